@@ -0,0 +1,139 @@
+/*
+ * ptrarray.c: Growable array of element pointers
+ *
+ * This file is part of OpenSC.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ptrarray.h"
+
+#define PTRARRAY_MIN_ALLOC	8
+
+int ptrarray_init(ptrarray_t *a)
+{
+	if (a == NULL)
+		return -1;
+	memset(a, 0, sizeof(*a));
+	return 0;
+}
+
+void ptrarray_destroy(ptrarray_t *a)
+{
+	if (a == NULL)
+		return;
+	free(a->items);
+	memset(a, 0, sizeof(*a));
+}
+
+int ptrarray_attributes_seeker(ptrarray_t *a, ptrarray_seeker seeker)
+{
+	if (a == NULL)
+		return -1;
+	a->seeker = seeker;
+	return 0;
+}
+
+int ptrarray_append(ptrarray_t *a, void *el)
+{
+	if (a == NULL)
+		return -1;
+
+	if (a->size == a->alloc) {
+		unsigned int alloc = a->alloc ? 2 * a->alloc : PTRARRAY_MIN_ALLOC;
+		void **items;
+
+		if (alloc < a->alloc)
+			return -1;
+		items = realloc(a->items, alloc * sizeof(*items));
+		if (items == NULL)
+			return -1;
+		a->items = items;
+		a->alloc = alloc;
+	}
+	a->items[a->size++] = el;
+	return 1;
+}
+
+unsigned int ptrarray_size(const ptrarray_t *a)
+{
+	return a ? a->size : 0;
+}
+
+void *ptrarray_get_at(const ptrarray_t *a, unsigned int pos)
+{
+	if (a == NULL || pos >= a->size)
+		return NULL;
+	return a->items[pos];
+}
+
+int ptrarray_locate(const ptrarray_t *a, const void *el)
+{
+	unsigned int i;
+
+	if (a == NULL)
+		return -1;
+	for (i = 0; i < a->size; i++) {
+		if (a->items[i] == el)
+			return (int)i;
+	}
+	return -1;
+}
+
+void *ptrarray_seek(const ptrarray_t *a, const void *indicator)
+{
+	unsigned int i;
+
+	if (a == NULL || a->seeker == NULL)
+		return NULL;
+	for (i = 0; i < a->size; i++) {
+		if (a->seeker(a->items[i], indicator))
+			return a->items[i];
+	}
+	return NULL;
+}
+
+int ptrarray_delete_at(ptrarray_t *a, unsigned int pos)
+{
+	if (a == NULL || pos >= a->size)
+		return -1;
+	memmove(&a->items[pos], &a->items[pos + 1],
+			(a->size - pos - 1) * sizeof(*a->items));
+	a->size--;
+	return 0;
+}
+
+int ptrarray_delete(ptrarray_t *a, const void *el)
+{
+	int pos = ptrarray_locate(a, el);
+
+	if (pos < 0)
+		return -1;
+	return ptrarray_delete_at(a, (unsigned int)pos);
+}
+
+void *ptrarray_pop(ptrarray_t *a)
+{
+	if (a == NULL || a->size == 0)
+		return NULL;
+	return a->items[--a->size];
+}
@@ -0,0 +1,86 @@
+/*
+ * ptrarray.h: Growable array of element pointers
+ *
+ * This file is part of OpenSC.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __PTRARRAY_H
+#define __PTRARRAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The array only stores references to the elements; the elements
+ * themselves are owned by the caller and keep their address for their
+ * whole lifetime.  In contrast to the simclist list_t, positional
+ * access is O(1) and a full scan touches a single contiguous block of
+ * memory.  The order of the elements is preserved on deletion.
+ */
+
+/**
+ * Returns nonzero if the element matches the indicator
+ * (same semantics as simclist's element_seeker).
+ */
+typedef int (*ptrarray_seeker)(const void *el, const void *indicator);
+
+typedef struct {
+	void **items;
+	unsigned int size;
+	unsigned int alloc;
+	ptrarray_seeker seeker;
+} ptrarray_t;
+
+/** Initialize an empty array. Returns 0 on success. */
+int ptrarray_init(ptrarray_t *a);
+
+/** Release the storage of the array (not the elements). */
+void ptrarray_destroy(ptrarray_t *a);
+
+/** Set the function used by ptrarray_seek(). */
+int ptrarray_attributes_seeker(ptrarray_t *a, ptrarray_seeker seeker);
+
+/** Append an element. Returns 1 on success, -1 on failure. */
+int ptrarray_append(ptrarray_t *a, void *el);
+
+/** Number of elements in the array. */
+unsigned int ptrarray_size(const ptrarray_t *a);
+
+/** Element at the given position, or NULL if out of range. */
+void *ptrarray_get_at(const ptrarray_t *a, unsigned int pos);
+
+/** Position of the element (compared by reference), or -1. */
+int ptrarray_locate(const ptrarray_t *a, const void *el);
+
+/** First element for which the seeker matches the indicator, or NULL. */
+void *ptrarray_seek(const ptrarray_t *a, const void *indicator);
+
+/** Remove the element (compared by reference). Returns 0 or -1. */
+int ptrarray_delete(ptrarray_t *a, const void *el);
+
+/** Remove the element at the given position. Returns 0 or -1. */
+int ptrarray_delete_at(ptrarray_t *a, unsigned int pos);
+
+/** Remove and return the last element, or NULL if the array is empty. */
+void *ptrarray_pop(ptrarray_t *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
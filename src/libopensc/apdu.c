@@ -354,10 +354,52 @@ sc_detect_apdu_cse(const sc_card_t *card, sc_apdu_t *apdu)
 }
 
 
-static int
+/** Accounts one reader transmission in the reader's statistics.
+ *  reader->stats_mutex is taken, as sc_ctx_get_stats() reads the
+ *  statistics without the card lock.
+ */
+static void
+sc_update_stats(struct sc_reader *reader, const struct sc_apdu *apdu,
+		unsigned long long elapsed, int rv)
+{
+	struct sc_apdu_stats *stats = &reader->stats;
+	unsigned int bucket = 0;
+
+	while (bucket < SC_STATS_LATENCY_BUCKETS - 1
+			&& elapsed >= ((unsigned long long)SC_STATS_LATENCY_BASE_US << bucket))
+		bucket++;
+
+	sc_mutex_lock(reader->ctx, reader->stats_mutex);
+	stats->apdus++;
+	stats->bytes_sent += sc_apdu_get_length(apdu, reader->active_protocol);
+	if (rv == SC_SUCCESS)
+		stats->bytes_received += apdu->resplen + 2;
+	else
+		stats->errors++;
+	if (apdu->ins == 0xA4)
+		stats->selects++;
+	stats->time_us += elapsed;
+	stats->ins[apdu->ins].count++;
+	stats->ins[apdu->ins].time_us += elapsed;
+	stats->latency[bucket]++;
+	sc_mutex_unlock(reader->ctx, reader->stats_mutex);
+}
+
+/** Increments one counter of the reader's statistics */
+static void
+sc_count_stat(struct sc_reader *reader, unsigned long long *counter)
+{
+	sc_mutex_lock(reader->ctx, reader->stats_mutex);
+	(*counter)++;
+	sc_mutex_unlock(reader->ctx, reader->stats_mutex);
+}
+
+
+int
 sc_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 {
 	struct sc_context *ctx  = card->ctx;
+	unsigned long long start;
 	int rv;
 
 	LOG_FUNC_CALLED(ctx);
@@ -376,13 +418,53 @@ sc_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 #endif
 
 	/* send APDU to the reader driver */
+	sc_card_shared_state_mark_changed(card);
+	start = sc_timestamp_us();
 	rv = card->reader->ops->transmit(card->reader, apdu);
+	sc_update_stats(card->reader, apdu, sc_timestamp_us() - start, rv);
+	card->cache.security_env_valid = 0;
 	LOG_TEST_RET(ctx, rv, "unable to transmit APDU");
 
 	LOG_FUNC_RETURN(ctx, rv);
 }
 
 
+/** Sends several APDUs with one call of the reader's transmit_sequence
+ *  operation. Returns the number of APDUs sent: all of them, or up to
+ *  the first one that did not return 0x9000.
+ */
+static int
+sc_sequence_transmit(struct sc_card *card, struct sc_apdu *apdus, size_t count)
+{
+	struct sc_context *ctx  = card->ctx;
+	unsigned long long elapsed;
+	size_t i, sent;
+	int rv;
+
+	LOG_FUNC_CALLED(ctx);
+	sc_log(ctx,
+	       "CLA:%X, INS:%X, P1:%X, P2:%X, %"SC_FORMAT_LEN_SIZE_T"u APDUs",
+	       apdus[0].cla, apdus[0].ins, apdus[0].p1, apdus[0].p2, count);
+
+	sc_card_shared_state_mark_changed(card);
+	elapsed = sc_timestamp_us();
+	rv = card->reader->ops->transmit_sequence(card->reader, apdus, count);
+	elapsed = sc_timestamp_us() - elapsed;
+	if (rv == 0 || rv > (int)count)
+		rv = SC_ERROR_INTERNAL;
+
+	/* the time of the APDUs is not known separately */
+	sent = rv > 0 ? (size_t)rv : 1;
+	for (i = 0; i < sent; i++)
+		sc_update_stats(card->reader, &apdus[i], elapsed / sent,
+				rv > 0 ? SC_SUCCESS : rv);
+	card->cache.security_env_valid = 0;
+	LOG_TEST_RET(ctx, rv, "unable to transmit APDUs");
+
+	LOG_FUNC_RETURN(ctx, rv);
+}
+
+
 static int
 sc_set_le_and_transmit(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 {
@@ -410,6 +492,7 @@ sc_set_le_and_transmit(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 #endif
 
 	/* re-transmit the APDU with new Le length */
+	sc_count_stat(card->reader, &card->reader->stats.retries);
 	rv = sc_single_transmit(card, apdu);
 	LOG_TEST_RET(ctx, rv, "cannot re-transmit APDU");
 
@@ -452,22 +535,28 @@ sc_get_response(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 	minlen = le;
 
 	do {
-		unsigned char resp[256];
+		unsigned char resp[256], *rbuf = resp;
 		size_t resp_len = le;
 
 		/* we have all the data the caller requested even if the card has more data */
 		if (buflen == 0)
 			break;
 
+		/* receive straight into the caller's buffer if the data fits */
+		if (buflen >= le)
+			rbuf = buf;
+		else
+			memset(resp, 0, sizeof(resp));
+
 		/* call GET RESPONSE to get more date from the card;
 		 * note: GET RESPONSE returns the left amount of data (== SW2) */
-		memset(resp, 0, sizeof(resp));
-		rv = card->ops->get_response(card, &resp_len, resp);
+		sc_count_stat(card->reader, &card->reader->stats.get_responses);
+		rv = card->ops->get_response(card, &resp_len, rbuf);
 		if (rv < 0)   {
 #ifdef ENABLE_SM
 			if (resp_len)   {
-				sc_log_hex(ctx, "SM response data", resp, resp_len);
-				sc_sm_update_apdu_response(card, resp, resp_len, rv, apdu);
+				sc_log_hex(ctx, "SM response data", rbuf, resp_len);
+				sc_sm_update_apdu_response(card, rbuf, resp_len, rv, apdu);
 			}
 #endif
 			LOG_TEST_RET(ctx, rv, "GET RESPONSE error");
@@ -478,7 +567,8 @@ sc_get_response(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 		if (buflen < le)
 			le = buflen;
 
-		memcpy(buf, resp, le);
+		if (rbuf != buf)
+			memcpy(buf, rbuf, le);
 		buf    += le;
 		buflen -= le;
 
@@ -500,23 +590,21 @@ sc_get_response(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 }
 
 
-/** Sends a single APDU to the card reader and calls GET RESPONSE to get the return data if necessary.
+/** Handles the status of a transmitted APDU that asks for more:
+ *  re-transmits with the right Le or calls GET RESPONSE.
  *  @param  card  sc_card_t object for the smartcard
- *  @param  apdu  APDU to be sent
+ *  @param  apdu  APDU that was sent
+ *  @param  olen  size of the response buffer before it was sent
  *  @return SC_SUCCESS on success and an error value otherwise
  */
 static int
-sc_transmit(sc_card_t *card, sc_apdu_t *apdu)
+sc_transmit_finish(sc_card_t *card, sc_apdu_t *apdu, size_t olen)
 {
 	struct sc_context *ctx  = card->ctx;
-	size_t       olen  = apdu->resplen;
 	int          r;
 
 	LOG_FUNC_CALLED(ctx);
 
-	r = sc_single_transmit(card, apdu);
-	LOG_TEST_RET(ctx, r, "transmit APDU failed");
-
 	/* ok, the APDU was successfully transmitted. Now we have two special cases:
 	 * 1. the card returned 0x6Cxx: in this case APDU will be re-transmitted with Le set to SW2
 	 * (possible only if response buffer size is larger than new Le = SW2)
@@ -540,6 +628,124 @@ sc_transmit(sc_card_t *card, sc_apdu_t *apdu)
 }
 
 
+/** Sends a single APDU to the card reader and calls GET RESPONSE to get the return data if necessary.
+ *  @param  card  sc_card_t object for the smartcard
+ *  @param  apdu  APDU to be sent
+ *  @return SC_SUCCESS on success and an error value otherwise
+ */
+static int
+sc_transmit(sc_card_t *card, sc_apdu_t *apdu)
+{
+	struct sc_context *ctx  = card->ctx;
+	size_t       olen  = apdu->resplen;
+	int          r;
+
+	LOG_FUNC_CALLED(ctx);
+
+	r = sc_single_transmit(card, apdu);
+	LOG_TEST_RET(ctx, r, "transmit APDU failed");
+
+	r = sc_transmit_finish(card, apdu, olen);
+	LOG_FUNC_RETURN(ctx, r);
+}
+
+
+/** Sends an APDU in chunks with Lc <= max_send_size bytes using command
+ *  chaining. If the reader can transmit a sequence of APDUs, the chunks
+ *  are handed to it together.
+ *  @param  card  sc_card_t object for the smartcard
+ *  @param  apdu  APDU to be sent
+ *  @return SC_SUCCESS on success and an error value otherwise
+ */
+static int
+sc_transmit_chain(sc_card_t *card, sc_apdu_t *apdu)
+{
+	size_t    max_send_size = sc_get_max_send_size(card);
+	size_t    count, i, last;
+	sc_apdu_t *chunks;
+	int       sequence = card->reader->ops->transmit_sequence != NULL;
+	int       r = SC_SUCCESS;
+
+#ifdef ENABLE_SM
+	if (card->sm_ctx.sm_mode == SM_MODE_TRANSMIT
+			&& (apdu->flags & SC_APDU_FLAGS_NO_SM) == 0)
+		sequence = 0;
+#endif
+	if (apdu->datalen == 0 || max_send_size == 0)
+		return SC_SUCCESS;
+
+	/* divide et impera: prepare all chunks first */
+	count  = (apdu->datalen + max_send_size - 1) / max_send_size;
+	chunks = calloc(count, sizeof(sc_apdu_t));
+	if (chunks == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	for (i = 0; i < count; i++) {
+		sc_apdu_t *tapdu = &chunks[i];
+		size_t    plen = max_send_size;
+
+		*tapdu = *apdu;
+		/* clear chaining flag */
+		tapdu->flags &= ~SC_APDU_FLAGS_CHAINING;
+		if (i < count - 1) {
+			/* adjust APDU case: in case of CASE 4 APDU
+			 * the intermediate APDU are of CASE 3 */
+			if ((tapdu->cse & SC_APDU_SHORT_MASK) == SC_APDU_CASE_4_SHORT)
+				tapdu->cse--;
+			/* XXX: the chunk size must be adjusted when
+			 *      secure messaging is used */
+			tapdu->cla    |= 0x10;
+			tapdu->le      = 0;
+			/* the intermediate APDU don't expect data */
+			tapdu->resplen = 0;
+			tapdu->resp    = NULL;
+		} else {
+			plen = apdu->datalen - i * max_send_size;
+		}
+		tapdu->data    = apdu->data + i * max_send_size;
+		tapdu->datalen = tapdu->lc = plen;
+
+		r = sc_check_apdu(card, tapdu);
+		if (r != SC_SUCCESS) {
+			sc_log(card->ctx, "inconsistent APDU while chaining");
+			goto out;
+		}
+	}
+
+	for (i = 0; i < count; i = last + 1) {
+		if (sequence) {
+			/* stops after a chunk that did not return 0x9000 */
+			r = sc_sequence_transmit(card, &chunks[i], count - i);
+			if (r < 0)
+				break;
+			last = i + r - 1;
+			r = sc_transmit_finish(card, &chunks[last],
+					last == count - 1 ? apdu->resplen : 0);
+		} else {
+			last = i;
+			r = sc_transmit(card, &chunks[last]);
+		}
+		if (r != SC_SUCCESS)
+			break;
+		if (last == count - 1) {
+			/* in case of the last APDU set the SW1
+			 * and SW2 bytes in the original APDU */
+			apdu->sw1 = chunks[last].sw1;
+			apdu->sw2 = chunks[last].sw2;
+			apdu->resplen = chunks[last].resplen;
+		} else {
+			/* otherwise check the status bytes */
+			r = sc_check_sw(card, chunks[last].sw1, chunks[last].sw2);
+			if (r != SC_SUCCESS)
+				break;
+		}
+	}
+
+out:
+	free(chunks);
+	return r;
+}
+
+
 int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
 {
 	int r = SC_SUCCESS;
@@ -564,65 +770,7 @@ int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
 	}
 
 	if ((apdu->flags & SC_APDU_FLAGS_CHAINING) != 0) {
-		/* divide et impera: transmit APDU in chunks with Lc <= max_send_size
-		 * bytes using command chaining */
-		size_t    len  = apdu->datalen;
-		const u8  *buf = apdu->data;
-		size_t    max_send_size = sc_get_max_send_size(card);
-
-		while (len != 0) {
-			size_t    plen;
-			sc_apdu_t tapdu;
-			int       last = 0;
-
-			tapdu = *apdu;
-			/* clear chaining flag */
-			tapdu.flags &= ~SC_APDU_FLAGS_CHAINING;
-			if (len > max_send_size) {
-				/* adjust APDU case: in case of CASE 4 APDU
-				 * the intermediate APDU are of CASE 3 */
-				if ((tapdu.cse & SC_APDU_SHORT_MASK) == SC_APDU_CASE_4_SHORT)
-					tapdu.cse--;
-				/* XXX: the chunk size must be adjusted when
-				 *      secure messaging is used */
-				plen          = max_send_size;
-				tapdu.cla    |= 0x10;
-				tapdu.le      = 0;
-				/* the intermediate APDU don't expect data */
-				tapdu.lc      = 0;
-				tapdu.resplen = 0;
-				tapdu.resp    = NULL;
-			} else {
-				plen = len;
-				last = 1;
-			}
-			tapdu.data    = buf;
-			tapdu.datalen = tapdu.lc = plen;
-
-			r = sc_check_apdu(card, &tapdu);
-			if (r != SC_SUCCESS) {
-				sc_log(card->ctx, "inconsistent APDU while chaining");
-				break;
-			}
-
-			r = sc_transmit(card, &tapdu);
-			if (r != SC_SUCCESS)
-				break;
-			if (last != 0) {
-				/* in case of the last APDU set the SW1
-				 * and SW2 bytes in the original APDU */
-				apdu->sw1 = tapdu.sw1;
-				apdu->sw2 = tapdu.sw2;
-				apdu->resplen = tapdu.resplen;
-			} else {
-				/* otherwise check the status bytes */
-				r = sc_check_sw(card, tapdu.sw1, tapdu.sw2);
-				if (r != SC_SUCCESS)
-					break;
-			}
-			len -= plen;
-			buf += plen;
-		}
+		r = sc_transmit_chain(card, apdu);
 	} else {
 		/* transmit single APDU */
 		r = sc_transmit(card, apdu);
@@ -630,6 +778,7 @@ int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
 
 	if (r == SC_ERROR_CARD_RESET || r == SC_ERROR_READER_REATTACHED) {
 		sc_invalidate_cache(card);
+		card->reset_count++;
 		/* give card driver a chance to react on resets */
 		if (card->ops->card_reader_lock_obtained)
 			card->ops->card_reader_lock_obtained(card, 1);
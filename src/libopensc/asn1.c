@@ -36,6 +36,10 @@
 static int asn1_decode(sc_context_t *ctx, struct sc_asn1_entry *asn1,
 		       const u8 *in, size_t len, const u8 **newp, size_t *len_left,
 		       int choice, int depth);
+
+/* Most of the ASN.1 debug messages are produced for every decoded entry;
+ * their arguments are only formatted if they are going to be logged. */
+#define ASN1_DEBUG_ENABLED(ctx)	((ctx) != NULL && (ctx)->debug >= SC_LOG_DEBUG_ASN1)
 static int asn1_encode(sc_context_t *ctx, const struct sc_asn1_entry *asn1,
 		       u8 **ptr, size_t *size, int depth);
 static int asn1_write_element(sc_context_t *ctx, unsigned int tag,
@@ -516,15 +520,97 @@ const u8 *sc_asn1_find_tag(sc_context_t *ctx, const u8 * buf,
 	return NULL;
 }
 
-const u8 *sc_asn1_skip_tag(sc_context_t *ctx, const u8 ** buf, size_t *buflen,
-			   unsigned int tag_in, size_t *taglen_out)
+void sc_asn1_cursor_init(struct sc_asn1_cursor *cur, const u8 *buf, size_t buflen)
 {
-	const u8 *p = *buf;
-	size_t len = *buflen, taglen;
-	unsigned int cla = 0, tag;
+	cur->p = buf;
+	cur->left = buf ? buflen : 0;
+}
+
+void sc_asn1_cursor_enter(struct sc_asn1_cursor *cur, const struct sc_asn1_tlv *tlv)
+{
+	sc_asn1_cursor_init(cur, tlv->value, tlv->len);
+}
+
+int sc_asn1_cursor_next(struct sc_asn1_cursor *cur, struct sc_asn1_tlv *tlv)
+{
+	const u8 *p = cur->p;
+	unsigned int cla = 0, tag, mask = 0xff00;
+	size_t len, hdrlen;
+	int r;
+
+	memset(tlv, 0, sizeof(*tlv));
+	if (cur->left == 0)
+		return 0;
+
+	r = sc_asn1_read_tag(&p, cur->left, &cla, &tag, &len);
+	if (r == SC_SUCCESS && p == NULL)
+		return 0;	/* padding */
+	if (p == NULL)
+		return SC_ERROR_INVALID_ASN1_OBJECT;
+
+	/* same representation as sc_asn1_find_tag() */
+	while ((tag & mask) != 0) {
+		cla <<= 8;
+		mask <<= 8;
+	}
+	hdrlen = p - cur->p;
+	tlv->tag = tag | cla;
+	tlv->raw = cur->p;
+	tlv->value = p;
+	if (r == SC_ERROR_ASN1_END_OF_CONTENTS) {
+		tlv->len = cur->left - hdrlen;
+		tlv->raw_len = cur->left;
+		return r;
+	}
+	tlv->len = len;
+	tlv->raw_len = hdrlen + len;
+
+	cur->p += tlv->raw_len;
+	cur->left -= tlv->raw_len;
+	return 1;
+}
+
+int sc_asn1_cursor_find(const struct sc_asn1_cursor *cur, unsigned int tag,
+			struct sc_asn1_tlv *tlv)
+{
+	struct sc_asn1_cursor c = *cur;
+	int r;
 
-	if (sc_asn1_read_tag((const u8 **) &p, len, &cla, &tag, &taglen) != SC_SUCCESS
-			|| p == NULL)
+	while ((r = sc_asn1_cursor_next(&c, tlv)) == 1) {
+		if (tlv->tag == tag)
+			return 1;
+	}
+	memset(tlv, 0, sizeof(*tlv));
+	return r < 0 ? r : 0;
+}
+
+/* Header of the next element in the buffer, as read by sc_asn1_read_tag() */
+struct asn1_tag_header {
+	const u8 *start;	/* where the header was read; NULL if not yet */
+	const u8 *value;	/* NULL if no valid element starts at 'start' */
+	unsigned int cla, tag;
+	size_t taglen;
+};
+
+static void asn1_read_tag_header(struct asn1_tag_header *hdr, const u8 *buf, size_t buflen)
+{
+	const u8 *p = buf;
+
+	hdr->start = buf;
+	hdr->cla = 0;
+	if (sc_asn1_read_tag(&p, buflen, &hdr->cla, &hdr->tag, &hdr->taglen) != SC_SUCCESS)
+		p = NULL;
+	hdr->value = p;
+}
+
+static const u8 *asn1_skip_tag_header(sc_context_t *ctx, const struct asn1_tag_header *hdr,
+		const u8 ** buf, size_t *buflen, unsigned int tag_in, size_t *taglen_out)
+{
+	const u8 *p = hdr->value;
+	size_t len = *buflen, taglen = hdr->taglen;
+	unsigned int cla = hdr->cla, tag = hdr->tag;
+
+	if (p == NULL)
 		return NULL;
 	switch (cla & 0xC0) {
 	case SC_ASN1_TAG_UNIVERSAL:
@@ -565,6 +651,15 @@ const u8 *sc_asn1_skip_tag(sc_context_t *ctx, const u8 ** buf, size_t *buflen,
 	return p;
 }
 
+const u8 *sc_asn1_skip_tag(sc_context_t *ctx, const u8 ** buf, size_t *buflen,
+			   unsigned int tag_in, size_t *taglen_out)
+{
+	struct asn1_tag_header hdr;
+
+	asn1_read_tag_header(&hdr, *buf, *buflen);
+	return asn1_skip_tag_header(ctx, &hdr, buf, buflen, tag_in, taglen_out);
+}
+
 const u8 *sc_asn1_verify_tag(sc_context_t *ctx, const u8 * buf, size_t buflen,
 			     unsigned int tag_in, size_t *taglen_out)
 {
@@ -1496,10 +1591,11 @@ static int asn1_decode_entry(sc_context_t *ctx,struct sc_asn1_entry *entry,
 
 	callback_func = parm;
 
-	sc_debug(ctx, SC_LOG_DEBUG_ASN1, "%*.*sdecoding '%s', raw data:%s%s\n",
-		depth, depth, "", entry->name,
-		sc_dump_hex(obj, objlen > 16  ? 16 : objlen),
-		objlen > 16 ? "..." : "");
+	if (ASN1_DEBUG_ENABLED(ctx))
+		sc_debug(ctx, SC_LOG_DEBUG_ASN1, "%*.*sdecoding '%s', raw data:%s%s\n",
+			depth, depth, "", entry->name,
+			sc_dump_hex(obj, objlen > 16  ? 16 : objlen),
+			objlen > 16 ? "..." : "");
 
 	switch (entry->type) {
 	case SC_ASN1_STRUCT:
@@ -1524,8 +1620,9 @@ static int asn1_decode_entry(sc_context_t *ctx,struct sc_asn1_entry *entry,
 	case SC_ASN1_ENUMERATED:
 		if (parm != NULL) {
 			r = sc_asn1_decode_integer(obj, objlen, (int *) entry->parm, 0);
-			sc_debug(ctx, SC_LOG_DEBUG_ASN1, "%*.*sdecoding '%s' returned %d\n", depth, depth, "",
-					entry->name, *((int *) entry->parm));
+			if (ASN1_DEBUG_ENABLED(ctx))
+				sc_debug(ctx, SC_LOG_DEBUG_ASN1, "%*.*sdecoding '%s' returned %d\n", depth, depth, "",
+						entry->name, *((int *) entry->parm));
 		}
 		break;
 	case SC_ASN1_BIT_STRING_NI:
@@ -1718,11 +1815,14 @@ static int asn1_decode(sc_context_t *ctx, struct sc_asn1_entry *asn1,
 	int r, idx = 0;
 	const u8 *p = in, *obj;
 	struct sc_asn1_entry *entry = asn1;
+	struct asn1_tag_header hdr;
 	size_t left = len, objlen;
+	int debug = ASN1_DEBUG_ENABLED(ctx);
 
-	sc_debug(ctx, SC_LOG_DEBUG_ASN1,
-		 "%*.*s""called, left=%"SC_FORMAT_LEN_SIZE_T"u, depth %d%s\n",
-		 depth, depth, "", left, depth, choice ? ", choice" : "");
+	if (debug)
+		sc_debug(ctx, SC_LOG_DEBUG_ASN1,
+			 "%*.*s""called, left=%"SC_FORMAT_LEN_SIZE_T"u, depth %d%s\n",
+			 depth, depth, "", left, depth, choice ? ", choice" : "");
 
 	if (!p)
 		return SC_ERROR_ASN1_OBJECT_NOT_FOUND;
@@ -1741,12 +1841,16 @@ static int asn1_decode(sc_context_t *ctx, struct sc_asn1_entry *asn1,
 	if (p[0] == 0 || p[0] == 0xFF || len == 0)
 		return SC_ERROR_ASN1_END_OF_CONTENTS;
 
+	/* The header of the next element is read once and then matched
+	 * against the entries until one of them consumes it */
+	hdr.start = NULL;
 	for (idx = 0; asn1[idx].name != NULL; idx++) {
 		entry = &asn1[idx];
 
-		sc_debug(ctx, SC_LOG_DEBUG_ASN1, "Looking for '%s', tag 0x%x%s%s\n",
-			entry->name, entry->tag, choice? ", CHOICE" : "",
-			(entry->flags & SC_ASN1_OPTIONAL)? ", OPTIONAL": "");
+		if (debug)
+			sc_debug(ctx, SC_LOG_DEBUG_ASN1, "Looking for '%s', tag 0x%x%s%s\n",
+				entry->name, entry->tag, choice? ", CHOICE" : "",
+				(entry->flags & SC_ASN1_OPTIONAL)? ", OPTIONAL": "");
 
 		/* Special case CHOICE has no tag */
 		if (entry->type == SC_ASN1_CHOICE) {
@@ -1758,9 +1862,12 @@ static int asn1_decode(sc_context_t *ctx, struct sc_asn1_entry *asn1,
 			goto decode_ok;
 		}
 
-		obj = sc_asn1_skip_tag(ctx, &p, &left, entry->tag, &objlen);
+		if (hdr.start != p)
+			asn1_read_tag_header(&hdr, p, left);
+		obj = asn1_skip_tag_header(ctx, &hdr, &p, &left, entry->tag, &objlen);
 		if (obj == NULL) {
-			sc_debug(ctx, SC_LOG_DEBUG_ASN1, "'%s' not present\n", entry->name);
+			if (debug)
+				sc_debug(ctx, SC_LOG_DEBUG_ASN1, "'%s' not present\n", entry->name);
 			if (choice)
 				continue;
 			if (entry->flags & SC_ASN1_OPTIONAL)
@@ -1794,6 +1901,8 @@ decode_ok:
 		*newp = p;
  	if (len_left != NULL)
 		*len_left = left;
+	if (!debug)
+		return choice ? idx : 0;
 	if (choice)
 		SC_FUNC_RETURN(ctx, SC_LOG_DEBUG_ASN1, idx);
 	SC_FUNC_RETURN(ctx, SC_LOG_DEBUG_ASN1, 0);
@@ -81,6 +81,39 @@ const u8 *sc_asn1_verify_tag(struct sc_context *ctx, const u8 * buf,
 const u8 *sc_asn1_skip_tag(struct sc_context *ctx, const u8 ** buf,
 			   size_t *buflen, unsigned int tag, size_t *taglen);
 
+/*
+ * Zero-copy walk over BER-TLV data such as card data objects. The values
+ * point into the parsed buffer, which must be kept while they are used.
+ * Tags are represented as for sc_asn1_find_tag(), i.e. the tag bytes as
+ * they appear in the data (0x5F50, 0x7F49, ...).
+ */
+struct sc_asn1_tlv {
+	unsigned int tag;
+	const u8 *value;	/* first byte of the value */
+	size_t len;		/* length of the value */
+	size_t raw_len;		/* length of the whole TLV starting at 'raw' */
+	const u8 *raw;		/* first byte of the tag */
+};
+
+struct sc_asn1_cursor {
+	const u8 *p;		/* next TLV */
+	size_t left;		/* bytes remaining in the buffer */
+};
+
+void sc_asn1_cursor_init(struct sc_asn1_cursor *cur, const u8 *buf, size_t buflen);
+/* Walk the contents of 'tlv' */
+void sc_asn1_cursor_enter(struct sc_asn1_cursor *cur, const struct sc_asn1_tlv *tlv);
+/*
+ * Read the next TLV and advance the cursor. Returns 1 if a TLV was read,
+ * 0 at the end of the data or at 0x00/0xFF padding. If the value extends
+ * beyond the buffer, returns SC_ERROR_ASN1_END_OF_CONTENTS with 'len'
+ * limited to the available data and does not advance the cursor.
+ */
+int sc_asn1_cursor_next(struct sc_asn1_cursor *cur, struct sc_asn1_tlv *tlv);
+/* Find 'tag' on the level of 'cur' without moving it. Returns 1 if found, 0 if not. */
+int sc_asn1_cursor_find(const struct sc_asn1_cursor *cur, unsigned int tag,
+			struct sc_asn1_tlv *tlv);
+
 /* DER encoding */
 
 /* Argument 'ptr' is set to the location of the next possible ASN.1 object.
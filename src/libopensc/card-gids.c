@@ -228,8 +228,8 @@ static int gids_get_DO(sc_card_t* card, int fileIdentifier, int dataObjectIdenti
 	sc_apdu_t apdu;
 	int r;
 	u8 data[4] = {0x5C, 0x02, (dataObjectIdentifier&0xFF00)>>8, (dataObjectIdentifier&0xFF)};
-	size_t datasize = 0;
-	const u8* p;
+	struct sc_asn1_cursor cur;
+	struct sc_asn1_tlv tlv;
 	u8 buffer[MAX_GIDS_FILE_SIZE];
 
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
@@ -251,16 +251,17 @@ static int gids_get_DO(sc_card_t* card, int fileIdentifier, int dataObjectIdenti
 	LOG_TEST_RET(card->ctx, r, "gids get data failed");
 	LOG_TEST_RET(card->ctx,  sc_check_sw(card, apdu.sw1, apdu.sw2), "invalid return");
 
-	p = sc_asn1_find_tag(card->ctx, buffer, sizeof(buffer), dataObjectIdentifier, &datasize);
-	if (!p) {
+	/* only look at what the card returned */
+	sc_asn1_cursor_init(&cur, buffer, apdu.resplen);
+	if (sc_asn1_cursor_find(&cur, dataObjectIdentifier, &tlv) != 1) {
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_FILE_NOT_FOUND);
 	}
 	if (response && responselen) {
-		if (datasize > *responselen) {
+		if (tlv.len > *responselen) {
 			LOG_FUNC_RETURN(card->ctx, SC_ERROR_BUFFER_TOO_SMALL);
 		}
-		memcpy(response, p, datasize);
-		*responselen = datasize;
+		memcpy(response, tlv.value, tlv.len);
+		*responselen = tlv.len;
 	}
 	return SC_SUCCESS;
 }
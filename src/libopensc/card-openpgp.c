@@ -971,7 +971,8 @@ pgp_set_blob(pgp_blob_t *blob, const u8 *data, size_t len)
 	blob->status = 0;
 
 	if (len > 0) {
-		void *tmp = calloc(len, 1);
+		/* no need to clear what is copied over right away */
+		void *tmp = data ? malloc(len) : calloc(len, 1);
 
 		if (tmp == NULL)
 			return SC_ERROR_OUT_OF_MEMORY;
@@ -1222,7 +1223,8 @@ pgp_read_blob(sc_card_t *card, pgp_blob_t *blob)
 static int
 pgp_enumerate_blob(sc_card_t *card, pgp_blob_t *blob)
 {
-	const u8	*in;
+	struct sc_asn1_cursor cur;
+	struct sc_asn1_tlv tlv;
 	int		r;
 	sc_file_t	*file = NULL;
 
@@ -1232,65 +1234,52 @@ pgp_enumerate_blob(sc_card_t *card, pgp_blob_t *blob)
 	if ((r = pgp_read_blob(card, blob)) < 0)
 		return r;
 
-	in = blob->data;
+	if (blob->len > 0 && blob->data == NULL)
+		return SC_ERROR_OBJECT_NOT_VALID;
 
-	while ((int) blob->len > (in - blob->data)) {
-		unsigned int	cla, tag, tmptag;
-		size_t		len;
-		const u8	*data = in;
+	sc_asn1_cursor_init(&cur, blob->data, blob->len);
+	while (cur.left > 0) {
 		pgp_blob_t	*new;
 
-		if (!in)
-			return SC_ERROR_OBJECT_NOT_VALID;
-
-		r = sc_asn1_read_tag(&data, blob->len - (in - blob->data),
-					&cla, &tag, &len);
-		if (r == SC_ERROR_INVALID_ASN1_OBJECT) {
-			sc_log(card->ctx, "Invalid ASN.1 object");
-			return SC_ERROR_OBJECT_NOT_VALID;
-		}
-		/* Check for unknown error, or empty data */
-		if (((r < 0) && (r != SC_ERROR_ASN1_END_OF_CONTENTS)) ||
-		    (data == NULL)) {
+		r = sc_asn1_cursor_next(&cur, &tlv);
+		if (r == 0) {
+			/* padding: keep the old behaviour of failing on it */
 			sc_log(card->ctx, "Unexpected end of contents");
 			return SC_ERROR_OBJECT_NOT_VALID;
 		}
-
-		/* undo ASN1's split of tag & class */
-		for (tmptag = tag; tmptag > 0x0FF; tmptag >>= 8) {
-			cla <<= 8;
-		}
-		tag |= cla;
-		/* Check for length mismatch */
-		if ((r == SC_ERROR_ASN1_END_OF_CONTENTS) ||
-		    (data + len > blob->data + blob->len)) {
+		if (r == SC_ERROR_ASN1_END_OF_CONTENTS) {
 			// Check if it is not known Yubikey 5 issue
-			if ((tag != blob->id) || (tag != 0xfa)) {
+			if ((tlv.tag != blob->id) || (tlv.tag != 0xfa)) {
 				sc_log(card->ctx, "Unexpected end of contents");
 				return SC_ERROR_OBJECT_NOT_VALID;
 			}
 		}
+		else if (r < 0) {
+			sc_log(card->ctx, "Invalid ASN.1 object");
+			return SC_ERROR_OBJECT_NOT_VALID;
+		}
 
 		/* Awful hack for composite DOs that have
 		 * a TLV with the DO's id encompassing the
 		 * entire blob. Example: Yubikey Neo */
-		if (tag == blob->id) {
-			in = data;
+		if (tlv.tag == blob->id) {
+			/* whatever follows the value is parsed as well */
+			sc_asn1_cursor_init(&cur, tlv.value,
+					blob->len - (tlv.value - blob->data));
 			continue;
 		}
 
 		/* create fake file system hierarchy by
 		 * using constructed DOs as DF */
 		file = sc_file_new();
-		if ((new = pgp_new_blob(card, blob, tag, file)) == NULL) {
+		if ((new = pgp_new_blob(card, blob, tlv.tag, file)) == NULL) {
 			sc_file_free(file);
 			return SC_ERROR_OUT_OF_MEMORY;
 		}
-		if (pgp_set_blob(new, data, len) != SC_SUCCESS) {
+		if (pgp_set_blob(new, tlv.value, tlv.len) != SC_SUCCESS) {
 			sc_file_free(file);
 			return SC_ERROR_OUT_OF_MEMORY;
 		}
-		in = data + len;
 	}
 
 	return SC_SUCCESS;
@@ -27,8 +27,10 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -122,6 +124,8 @@ enum {
  * Flags in the piv_obj_cache:
  * PIV_OBJ_CACHE_VALID means the data in the cache can be used.
  * It might have zero length indicating that the object was not found.
+ * PIV_OBJ_CACHE_INTERNAL_REF means internal_obj_data is part of obj_data
+ * and must not be freed.
  * PIV_OBJ_CACHE_NOT_PRESENT means do not even try to read the object.
  * These objects will only be present if the history object says
  * they are on the card, or the discovery or history object in not present.
@@ -131,6 +135,7 @@ enum {
  */
 
 #define PIV_OBJ_CACHE_VALID			1
+#define PIV_OBJ_CACHE_INTERNAL_REF	2	/* internal_obj_data points into obj_data */
 #define PIV_OBJ_CACHE_NOT_PRESENT	8
 
 typedef struct piv_obj_cache {
@@ -185,6 +190,9 @@ typedef struct piv_private_data {
 	int object_test_verify; /* Can test this object to set verification state of card */
 	int yubico_version; /* 3 byte version number of NEO or Yubikey4  as integer */
 	unsigned int ccc_flags;	    /* From  CCC indicate if CAC card */
+	int object_cache;	/* keep public objects in the cache directory */
+	int object_cache_dirty;	/* objects were read from the card since loading */
+	char *object_cache_file;
 } piv_private_data_t;
 
 #define PIV_DATA(card) ((piv_private_data_t*)card->drv_data)
@@ -959,6 +967,20 @@ err:
 }
 
 
+/*
+ * Objects kept in the persistent object cache. They can all be read
+ * without the PIN. The CHUID is stored with them to validate the cache.
+ */
+static int
+piv_object_cacheable(int enumtag)
+{
+	return enumtag == PIV_OBJ_CCC
+		|| enumtag == PIV_OBJ_DISCOVERY
+		|| enumtag == PIV_OBJ_HISTORY
+		|| (piv_objects[enumtag].flags & PIV_OBJECT_TYPE_CERT);
+}
+
+
 static int
 piv_get_cached_data(sc_card_t * card, int enumtag, u8 **buf, size_t *buf_len)
 {
@@ -1012,6 +1034,8 @@ piv_get_cached_data(sc_card_t * card, int enumtag, u8 **buf, size_t *buf_len)
 	sc_log(card->ctx, "get #%d",  enumtag);
 	rbuflen = 1;
 	r = piv_get_data(card, enumtag, &rbuf, &rbuflen);
+	if (r >= 0 || r == SC_ERROR_FILE_NOT_FOUND)
+		priv->object_cache_dirty |= piv_object_cacheable(enumtag);
 	if (r > 0) {
 		priv->obj_cache[enumtag].flags |= PIV_OBJ_CACHE_VALID;
 		priv->obj_cache[enumtag].obj_len = r;
@@ -1048,11 +1072,10 @@ static int
 piv_cache_internal_data(sc_card_t *card, int enumtag)
 {
 	piv_private_data_t * priv = PIV_DATA(card);
-	const u8* tag;
-	const u8* body;
-	size_t taglen;
-	size_t bodylen;
+	struct sc_asn1_cursor cur;
+	struct sc_asn1_tlv body, tlv;
 	int compressed = 0;
+	int r;
 
 	/* if already cached */
 	if (priv->obj_cache[enumtag].internal_obj_data && priv->obj_cache[enumtag].internal_obj_len) {
@@ -1064,28 +1087,25 @@ piv_cache_internal_data(sc_card_t *card, int enumtag)
 		LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
 	}
 
-	body = sc_asn1_find_tag(card->ctx,
-			priv->obj_cache[enumtag].obj_data,
-			priv->obj_cache[enumtag].obj_len,
-			0x53, &bodylen);
-
-	if (body == NULL || priv->obj_cache[enumtag].obj_data[0] != 0x53)
+	sc_asn1_cursor_init(&cur, priv->obj_cache[enumtag].obj_data,
+			priv->obj_cache[enumtag].obj_len);
+	if (sc_asn1_cursor_next(&cur, &body) != 1 || body.tag != 0x53)
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_OBJECT_NOT_VALID);
+	sc_asn1_cursor_enter(&cur, &body);
 
 	/* get the certificate out */
 	 if (piv_objects[enumtag].flags & PIV_OBJECT_TYPE_CERT) {
 
-		tag = sc_asn1_find_tag(card->ctx, body, bodylen, 0x71, &taglen);
+		r = sc_asn1_cursor_find(&cur, 0x71, &tlv);
 		/* 800-72-1 not clear if this is 80 or 01 Sent comment to NIST for 800-72-2 */
 		/* 800-73-3 says it is 01, keep dual test so old cards still work */
-		if (tag && taglen > 0 && (((*tag) & 0x80) || ((*tag) & 0x01)))
+		if (r == 1 && tlv.len > 0 && ((tlv.value[0] & 0x80) || (tlv.value[0] & 0x01)))
 			compressed = 1;
 
-		tag = sc_asn1_find_tag(card->ctx, body, bodylen, 0x70, &taglen);
-		if (tag == NULL)
+		if (sc_asn1_cursor_find(&cur, 0x70, &tlv) != 1)
 			LOG_FUNC_RETURN(card->ctx, SC_ERROR_OBJECT_NOT_VALID);
 
-		if (taglen == 0)
+		if (tlv.len == 0)
 			LOG_FUNC_RETURN(card->ctx, SC_ERROR_FILE_NOT_FOUND);
 
 		if(compressed) {
@@ -1093,7 +1113,7 @@ piv_cache_internal_data(sc_card_t *card, int enumtag)
 			size_t len;
 			u8* newBuf = NULL;
 
-			if(SC_SUCCESS != sc_decompress_alloc(&newBuf, &len, tag, taglen, COMPRESSION_AUTO))
+			if(SC_SUCCESS != sc_decompress_alloc(&newBuf, &len, tlv.value, tlv.len, COMPRESSION_AUTO))
 				LOG_FUNC_RETURN(card->ctx, SC_ERROR_OBJECT_NOT_VALID);
 
 			priv->obj_cache[enumtag].internal_obj_data = newBuf;
@@ -1104,29 +1124,25 @@ piv_cache_internal_data(sc_card_t *card, int enumtag)
 #endif
 		}
 		else {
-			if (!(priv->obj_cache[enumtag].internal_obj_data = malloc(taglen)))
-				LOG_FUNC_RETURN(card->ctx, SC_ERROR_OUT_OF_MEMORY);
-
-			memcpy(priv->obj_cache[enumtag].internal_obj_data, tag, taglen);
-			priv->obj_cache[enumtag].internal_obj_len = taglen;
+			/* refer to the certificate in obj_data */
+			priv->obj_cache[enumtag].internal_obj_data = (u8 *) tlv.value;
+			priv->obj_cache[enumtag].internal_obj_len = tlv.len;
+			priv->obj_cache[enumtag].flags |= PIV_OBJ_CACHE_INTERNAL_REF;
 		}
 
 	/* convert pub key to internal */
 /* TODO: -DEE need to fix ...  would only be used if we cache the pub key, but we don't today */
 	}
 	else if (piv_objects[enumtag].flags & PIV_OBJECT_TYPE_PUBKEY) {
-		tag = sc_asn1_find_tag(card->ctx, body, bodylen, *body, &taglen);
-		if (tag == NULL)
+		if (body.len == 0 || sc_asn1_cursor_find(&cur, body.value[0], &tlv) != 1)
 			LOG_FUNC_RETURN(card->ctx, SC_ERROR_OBJECT_NOT_VALID);
 
-		if (taglen == 0)
+		if (tlv.len == 0)
 			LOG_FUNC_RETURN(card->ctx, SC_ERROR_FILE_NOT_FOUND);
 
-		if (!(priv->obj_cache[enumtag].internal_obj_data = malloc(taglen)))
-			LOG_FUNC_RETURN(card->ctx, SC_ERROR_OUT_OF_MEMORY);
-
-		memcpy(priv->obj_cache[enumtag].internal_obj_data, tag, taglen);
-		priv->obj_cache[enumtag].internal_obj_len = taglen;
+		priv->obj_cache[enumtag].internal_obj_data = (u8 *) tlv.value;
+		priv->obj_cache[enumtag].internal_obj_len = tlv.len;
+		priv->obj_cache[enumtag].flags |= PIV_OBJ_CACHE_INTERNAL_REF;
 	}
 	else {
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_INTERNAL);
@@ -1355,17 +1371,18 @@ static int piv_write_binary(sc_card_t *card, unsigned int idx,
 
 		/* if  cached, remove old entry */
 		if (priv->obj_cache[enumtag].flags & PIV_OBJ_CACHE_VALID) {
+			if (priv->obj_cache[enumtag].internal_obj_data) {
+				if (!(priv->obj_cache[enumtag].flags & PIV_OBJ_CACHE_INTERNAL_REF))
+					free(priv->obj_cache[enumtag].internal_obj_data);
+				priv->obj_cache[enumtag].internal_obj_data = NULL;
+				priv->obj_cache[enumtag].internal_obj_len = 0;
+			}
 			priv->obj_cache[enumtag].flags = 0;
 			if (priv->obj_cache[enumtag].obj_data) {
 				free(priv->obj_cache[enumtag].obj_data);
 				priv->obj_cache[enumtag].obj_data = NULL;
 				priv->obj_cache[enumtag].obj_len = 0;
 			}
-			if (priv->obj_cache[enumtag].internal_obj_data) {
-				free(priv->obj_cache[enumtag].internal_obj_data);
-				priv->obj_cache[enumtag].internal_obj_data = NULL;
-				priv->obj_cache[enumtag].internal_obj_len = 0;
-			}
 		}
 
 		if (idx != 0)
@@ -1411,6 +1428,8 @@ static int piv_write_binary(sc_card_t *card, unsigned int idx,
 		priv->obj_cache[enumtag].flags |= PIV_OBJ_CACHE_VALID;
 		priv->obj_cache[enumtag].obj_data = priv->w_buf;
 		priv->obj_cache[enumtag].obj_len = priv->w_buf_len;
+		priv->object_cache_dirty |= piv_object_cacheable(enumtag)
+			|| enumtag == PIV_OBJ_CHUI;
 	} else {
 		if (priv->w_buf)
 			free(priv->w_buf);
@@ -2954,6 +2973,15 @@ piv_process_history(sc_card_t *card)
 			certlen = seqlen - (cert - seq);
 
 			enumtag = PIV_OBJ_RETIRED_X509_1 + *keyref - 0x82;
+
+			/* already loaded from the persistent object cache */
+			if (priv->obj_cache[enumtag].flags & PIV_OBJ_CACHE_VALID) {
+				sc_log(card->ctx, "Off card cert #%d already cached", enumtag);
+				bodylen -= (seqlen + seq - seqtag);
+				seq += seqlen;
+				continue;
+			}
+
 			/* now add the cert like another object */
 
 			if ((tmplen = sc_asn1_put_tag(0x70, NULL, certlen, NULL, 0, NULL)) <= 0 ||
@@ -3014,6 +3042,219 @@ err:
 }
 
 
+/*
+ * Persistent object cache
+ *
+ * With "object_cache" set in the piv card_driver block, the public objects
+ * are kept in the OpenSC cache directory, in a file named after the card's
+ * FASC-N or GUID. The file starts with a copy of the CHUID. When the CHUID
+ * read from the card is the same, the other objects are taken from the
+ * file and need not be read from the card.
+ *
+ * File format: "PIVC", version, then records of a 3 byte object tag,
+ * a 4 byte big endian length and the object. The CHUID is the first record.
+ * Length 0 records mark objects that are not on the card.
+ */
+#define PIV_CACHE_MAGIC		"PIVC"
+#define PIV_CACHE_VERSION	1
+
+static int
+piv_object_cache_read_record(FILE *f, u8 tag[3], u8 **data, size_t *len)
+{
+	u8 hdr[7];
+
+	*data = NULL;
+	if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+		return SC_ERROR_FILE_NOT_FOUND;
+	memcpy(tag, hdr, 3);
+	*len = ((size_t)hdr[3] << 24) | ((size_t)hdr[4] << 16) | ((size_t)hdr[5] << 8) | hdr[6];
+	if (*len > MAX_FILE_SIZE)
+		return SC_ERROR_INVALID_DATA;
+	if (*len == 0)
+		return SC_SUCCESS;
+	*data = malloc(*len);
+	if (*data == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	if (fread(*data, 1, *len, f) != *len) {
+		free(*data);
+		*data = NULL;
+		return SC_ERROR_INVALID_DATA;
+	}
+	return SC_SUCCESS;
+}
+
+static int
+piv_object_cache_write_record(FILE *f, const u8 tag[3], const u8 *data, size_t len)
+{
+	u8 hdr[7];
+
+	memcpy(hdr, tag, 3);
+	hdr[3] = (len >> 24) & 0xFF;
+	hdr[4] = (len >> 16) & 0xFF;
+	hdr[5] = (len >> 8) & 0xFF;
+	hdr[6] = len & 0xFF;
+	if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)
+			|| (len && fwrite(data, 1, len, f) != len))
+		return SC_ERROR_INTERNAL;
+	return SC_SUCCESS;
+}
+
+/* Reads the CHUID from the card and takes the other objects from the cache */
+static void
+piv_object_cache_load(sc_card_t *card)
+{
+	piv_private_data_t * priv = PIV_DATA(card);
+	sc_serial_number_t serial;
+	char filename[PATH_MAX], hex[2 * SC_MAX_SERIALNR + 1];
+	u8 *chuid = NULL, *data = NULL, tag[3], header[5];
+	size_t chuid_len = 0, len;
+	int i, r, loaded = 0;
+	FILE *f;
+
+	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
+
+	memset(&serial, 0, sizeof(serial));
+	r = piv_get_serial_nr_from_CHUI(card, &serial);
+	if (r < 0 || serial.len == 0)
+		return;
+	/* the CHUID is now in the memory cache */
+	if (piv_get_cached_data(card, PIV_OBJ_CHUI, &chuid, &chuid_len) <= 0)
+		return;
+
+	if (sc_get_cache_dir(card->ctx, filename, sizeof(filename)) != SC_SUCCESS
+			|| sc_bin_to_hex(serial.value, serial.len, hex, sizeof(hex), 0) != SC_SUCCESS)
+		return;
+	if (snprintf(filename + strlen(filename), sizeof(filename) - strlen(filename),
+				"/piv-%s", hex) >= (int)(sizeof(filename) - strlen(filename)))
+		return;
+	priv->object_cache_file = strdup(filename);
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+		return;
+	if (fread(header, 1, sizeof(header), f) != sizeof(header)
+			|| memcmp(header, PIV_CACHE_MAGIC, 4) != 0
+			|| header[4] != PIV_CACHE_VERSION)
+		goto out;
+
+	/* the card must still have the same CHUID */
+	r = piv_object_cache_read_record(f, tag, &data, &len);
+	if (r != SC_SUCCESS || memcmp(tag, piv_objects[PIV_OBJ_CHUI].tag_value, 3) != 0
+			|| len != chuid_len || memcmp(data, chuid, len) != 0) {
+		sc_log(card->ctx, "PIV object cache %s is outdated", filename);
+		goto out;
+	}
+	free(data);
+	data = NULL;
+
+	while (piv_object_cache_read_record(f, tag, &data, &len) == SC_SUCCESS) {
+		for (i = 0; i < PIV_OBJ_LAST_ENUM - 1; i++)
+			if (memcmp(piv_objects[i].tag_value, tag, 3) == 0)
+				break;
+		if (i == PIV_OBJ_LAST_ENUM - 1 || !piv_object_cacheable(i)
+				|| (priv->obj_cache[i].flags & PIV_OBJ_CACHE_VALID)) {
+			free(data);
+			data = NULL;
+			continue;
+		}
+		priv->obj_cache[i].flags |= PIV_OBJ_CACHE_VALID;
+		priv->obj_cache[i].obj_data = data;
+		priv->obj_cache[i].obj_len = len;
+		data = NULL;
+		loaded++;
+	}
+	sc_log(card->ctx, "Loaded %d objects from PIV object cache %s", loaded, filename);
+
+out:
+	free(data);
+	fclose(f);
+}
+
+/*
+ * Creates a temporary file next to the cache file. Each process gets its
+ * own, so that processes saving the cache at the same time do not write
+ * into the same file.
+ */
+static FILE *
+piv_object_cache_open_tmp(const char *filename, char *tmpname, size_t tmpname_len)
+{
+#ifdef _WIN32
+	if ((size_t)snprintf(tmpname, tmpname_len, "%s.%lu.tmp", filename,
+				(unsigned long)GetCurrentProcessId()) >= tmpname_len)
+		return NULL;
+	return fopen(tmpname, "wb");
+#else
+	FILE *f;
+	int fd;
+
+	if ((size_t)snprintf(tmpname, tmpname_len, "%s.XXXXXX", filename) >= tmpname_len)
+		return NULL;
+	fd = mkstemp(tmpname);
+	if (fd < 0)
+		return NULL;
+	f = fdopen(fd, "wb");
+	if (f == NULL) {
+		close(fd);
+		remove(tmpname);
+	}
+	return f;
+#endif
+}
+
+/* Writes the public objects and the CHUID to the cache file */
+static void
+piv_object_cache_save(sc_card_t *card)
+{
+	piv_private_data_t * priv = PIV_DATA(card);
+	char tmpname[PATH_MAX];
+	int i, r;
+	FILE *f;
+
+	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
+
+	if (!(priv->obj_cache[PIV_OBJ_CHUI].flags & PIV_OBJ_CACHE_VALID)
+			|| priv->obj_cache[PIV_OBJ_CHUI].obj_len == 0)
+		return;
+
+	f = piv_object_cache_open_tmp(priv->object_cache_file, tmpname, sizeof(tmpname));
+	if (f == NULL && errno == ENOENT) {
+		if (sc_make_cache_dir(card->ctx) < 0)
+			return;
+		f = piv_object_cache_open_tmp(priv->object_cache_file, tmpname, sizeof(tmpname));
+	}
+	if (f == NULL)
+		return;
+
+	r = fwrite(PIV_CACHE_MAGIC, 1, 4, f) == 4 ? SC_SUCCESS : SC_ERROR_INTERNAL;
+	if (r == SC_SUCCESS && fputc(PIV_CACHE_VERSION, f) == EOF)
+		r = SC_ERROR_INTERNAL;
+	if (r == SC_SUCCESS)
+		r = piv_object_cache_write_record(f, piv_objects[PIV_OBJ_CHUI].tag_value,
+				priv->obj_cache[PIV_OBJ_CHUI].obj_data,
+				priv->obj_cache[PIV_OBJ_CHUI].obj_len);
+	for (i = 0; r == SC_SUCCESS && i < PIV_OBJ_LAST_ENUM - 1; i++) {
+		if (!piv_object_cacheable(i) || !(priv->obj_cache[i].flags & PIV_OBJ_CACHE_VALID))
+			continue;
+		r = piv_object_cache_write_record(f, piv_objects[i].tag_value,
+				priv->obj_cache[i].obj_data, priv->obj_cache[i].obj_len);
+	}
+	if (fclose(f) != 0)
+		r = SC_ERROR_INTERNAL;
+
+	if (r == SC_SUCCESS) {
+#ifdef _WIN32
+		remove(priv->object_cache_file);
+#endif
+		if (rename(tmpname, priv->object_cache_file) != 0)
+			r = SC_ERROR_INTERNAL;
+	}
+	if (r != SC_SUCCESS) {
+		sc_log(card->ctx, "Could not write PIV object cache %s", priv->object_cache_file);
+		remove(tmpname);
+	}
+}
+
+
 static int
 piv_finish(sc_card_t *card)
 {
@@ -3027,6 +3268,9 @@ piv_finish(sc_card_t *card)
 			priv->context_specific = 0;
 			sc_unlock(card);
 		}
+		if (priv->object_cache_file && priv->object_cache_dirty)
+			piv_object_cache_save(card);
+		free(priv->object_cache_file);
 		if (priv->w_buf)
 			free(priv->w_buf);
 		if (priv->offCardCertURL)
@@ -3034,7 +3278,8 @@ piv_finish(sc_card_t *card)
 		for (i = 0; i < PIV_OBJ_LAST_ENUM - 1; i++) {
 			if (priv->obj_cache[i].obj_data)
 				free(priv->obj_cache[i].obj_data);
-			if (priv->obj_cache[i].internal_obj_data)
+			if (priv->obj_cache[i].internal_obj_data
+					&& !(priv->obj_cache[i].flags & PIV_OBJ_CACHE_INTERNAL_REF))
 				free(priv->obj_cache[i].internal_obj_data);
 		}
 		free(priv);
@@ -3327,6 +3572,7 @@ static int piv_match_card_continued(sc_card_t *card)
 static int piv_init(sc_card_t *card)
 {
 	int r = 0;
+	int i, j;
 	piv_private_data_t * priv = NULL;
 	sc_apdu_t apdu;
 	unsigned long flags;
@@ -3473,7 +3719,6 @@ static int piv_init(sc_card_t *card)
 	_sc_card_add_rsa_alg(card, 3072, flags, 0); /* optional */
 
 	if (!(priv->card_issues & CI_NO_EC)) {
-		int i;
 		flags = SC_ALGORITHM_ECDSA_RAW | SC_ALGORITHM_ECDH_CDH_RAW | SC_ALGORITHM_ECDSA_HASH_NONE;
 		ext_flags = SC_ALGORITHM_EXT_EC_NAMEDCURVE | SC_ALGORITHM_EXT_EC_UNCOMPRESES;
 
@@ -3489,6 +3734,21 @@ static int piv_init(sc_card_t *card)
 	/* May turn off SC_CARD_CAP_ISO7816_PIN_INFO later */
 	card->caps |=  SC_CARD_CAP_ISO7816_PIN_INFO;
 
+	for (i = 0; card->ctx->conf_blocks[i]; i++) {
+		scconf_block **found_blocks, *block;
+
+		found_blocks = scconf_find_blocks(card->ctx->conf, card->ctx->conf_blocks[i],
+				"card_driver", "piv");
+		if (!found_blocks)
+			continue;
+		for (j = 0, block = found_blocks[j]; block; j++, block = found_blocks[j])
+			priv->object_cache = scconf_get_bool(block, "object_cache", priv->object_cache);
+		free(found_blocks);
+	}
+	/* take the public objects from the cache directory if the CHUID is unchanged */
+	if (priv->object_cache)
+		piv_object_cache_load(card);
+
 	/*
 	 * 800-73-3 cards may have a history object and/or a discovery object
 	 * We want to process them now as this has information on what
@@ -176,6 +176,7 @@ static void sc_card_free(sc_card_t *card)
 		card->algorithm_count = 0;
 	}
 
+	sc_card_shared_state_detach(card);
 	sc_file_free(card->cache.current_ef);
 	sc_file_free(card->cache.current_df);
 
@@ -392,6 +393,8 @@ int sc_connect_card(sc_reader_t *reader, sc_card_t **card_out)
 		goto err;
 	}
 #endif
+	if (sc_card_shared_state_attach(card) != SC_SUCCESS)
+		sc_log(ctx, "continuing without shared card state");
 	*card_out = card;
 
 	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
@@ -419,6 +422,8 @@ int sc_disconnect_card(sc_card_t *card)
 			sc_log(ctx, "card driver finish() failed: %s", sc_strerror(r));
 	}
 
+	sc_reader_end_linger(card->reader, 1);
+
 	if (card->reader->ops->disconnect) {
 		int r = card->reader->ops->disconnect(card->reader);
 		if (r)
@@ -449,6 +454,7 @@ int sc_reset(sc_card_t *card, int do_cold_reset)
 
 	r = card->reader->ops->reset(card->reader, do_cold_reset);
 	sc_invalidate_cache(card);
+	card->reset_count++;
 
 	r2 = sc_mutex_unlock(card->ctx, card->mutex);
 	if (r2 != SC_SUCCESS) {
@@ -464,6 +470,8 @@ int sc_lock(sc_card_t *card)
 	int r = 0, r2 = 0;
 	int was_reset = 0;
 	int reader_lock_obtained  = 0;
+	int state_unchanged = 0;
+	int lingering = 0;
 
 	if (card == NULL)
 		return SC_ERROR_INVALID_ARGUMENTS;
@@ -474,10 +482,13 @@ int sc_lock(sc_card_t *card)
 	if (r != SC_SUCCESS)
 		return r;
 	if (card->lock_count == 0) {
-		if (card->reader->ops->lock != NULL) {
+		/* the transaction of the last sc_unlock() may still be ours */
+		lingering = sc_reader_take_linger(card->reader);
+		if (!lingering && card->reader->ops->lock != NULL) {
 			r = card->reader->ops->lock(card->reader);
 			while (r == SC_ERROR_CARD_RESET || r == SC_ERROR_READER_REATTACHED) {
 				sc_invalidate_cache(card);
+				card->reset_count++;
 				if (was_reset++ > 4) /* TODO retry a few times */
 					break;
 				r = card->reader->ops->lock(card->reader);
@@ -485,6 +496,15 @@ int sc_lock(sc_card_t *card)
 			if (r == 0)
 				reader_lock_obtained = 1;
 		}
+		if (reader_lock_obtained && card->shared_state)
+			state_unchanged = sc_card_shared_state_acquire(card, was_reset);
+		else if (reader_lock_obtained && card->ctx->transaction_linger
+				&& (card->flags & SC_CARD_FLAG_KEEP_ALIVE))
+			/* deferred from sc_unlock(), see there */
+			sc_invalidate_cache(card);
+		if (reader_lock_obtained && !state_unchanged)
+			/* another process may have set its own environment */
+			card->cache.security_env_valid = 0;
 		if (r == 0)
 			card->cache.valid = 1;
 	}
@@ -504,13 +524,17 @@ int sc_lock(sc_card_t *card)
 		r = r != SC_SUCCESS ? r : r2;
 	}
 
-	/* give card driver a chance to do something when reader lock first obtained */
-	if (r == 0 && reader_lock_obtained == 1  && card->ops->card_reader_lock_obtained) {
+	/* give card driver a chance to do something when reader lock first obtained,
+	 * unless no other process used the card since our last transaction */
+	if (r == 0 && reader_lock_obtained == 1 && !state_unchanged
+			&& card->ops->card_reader_lock_obtained) {
 		r = card->ops->card_reader_lock_obtained(card, was_reset);
 		/* return value of card->reader->ops->lock is overwritten here
 		   by card->ops->card_reader_lock_obtained */
 		if (r != 0) {
 			/* unlock reader and get the card to its original state in case of failure*/
+			if (card->shared_state)
+				sc_card_shared_state_release(card);
 			if (card->reader->ops->unlock != NULL)
 				r = card->reader->ops->unlock(card->reader);
 			card->lock_count--;
@@ -537,15 +561,24 @@ int sc_unlock(sc_card_t *card)
 		return SC_ERROR_INVALID_ARGUMENTS;
 	}
 	if (--card->lock_count == 0) {
-		if (card->flags & SC_CARD_FLAG_KEEP_ALIVE) {
+		if (card->shared_state) {
+			/* other processes tell us when they changed the card */
+			sc_card_shared_state_release(card);
+		} else if ((card->flags & SC_CARD_FLAG_KEEP_ALIVE) && !card->ctx->transaction_linger) {
 			/* Multiple processes accessing the card will most likely render
 			 * the card cache useless. To not have a bad cache, we explicitly
 			 * invalidate it. */
 			sc_invalidate_cache(card);
 		}
-		/* release reader lock */
-		if (card->reader->ops->unlock != NULL)
+		if (card->ctx->transaction_linger && card->reader->ops->unlock != NULL) {
+			/* keep the reader transaction for the next operation, so that
+			 * a burst of operations needs one transaction and one
+			 * card_reader_lock_obtained() call */
+			sc_reader_start_linger(card->reader, card->ctx->transaction_linger);
+		} else if (card->reader->ops->unlock != NULL) {
+			/* release reader lock */
 			r = card->reader->ops->unlock(card->reader);
+		}
 	}
 	r2 = sc_mutex_unlock(card->ctx, card->mutex);
 	if (r2 != SC_SUCCESS) {
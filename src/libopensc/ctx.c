@@ -74,20 +74,61 @@ int _sc_add_reader(sc_context_t *ctx, sc_reader_t *reader)
 		return SC_ERROR_INVALID_ARGUMENTS;
 	}
 	reader->ctx = ctx;
-	list_append(&ctx->readers, reader);
+	if (sc_mutex_create(ctx, &reader->linger_mutex) != SC_SUCCESS)
+		return SC_ERROR_OUT_OF_MEMORY;
+	if (sc_mutex_create(ctx, &reader->stats_mutex) != SC_SUCCESS) {
+		sc_mutex_destroy(ctx, reader->linger_mutex);
+		reader->linger_mutex = NULL;
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
+	if (ptrarray_append(&ctx->readers, reader) < 0) {
+		sc_mutex_destroy(ctx, reader->stats_mutex);
+		sc_mutex_destroy(ctx, reader->linger_mutex);
+		reader->stats_mutex = NULL;
+		reader->linger_mutex = NULL;
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
 	return SC_SUCCESS;
 }
 
+static void sc_add_stats(struct sc_apdu_stats *dst, const struct sc_apdu_stats *src)
+{
+	size_t i;
+
+	dst->apdus += src->apdus;
+	dst->errors += src->errors;
+	dst->bytes_sent += src->bytes_sent;
+	dst->bytes_received += src->bytes_received;
+	dst->get_responses += src->get_responses;
+	dst->selects += src->selects;
+	dst->retries += src->retries;
+	dst->time_us += src->time_us;
+	for (i = 0; i < SC_STATS_LATENCY_BUCKETS; i++)
+		dst->latency[i] += src->latency[i];
+	for (i = 0; i < 256; i++) {
+		dst->ins[i].count += src->ins[i].count;
+		dst->ins[i].time_us += src->ins[i].time_us;
+	}
+}
+
+/* The caller holds ctx->mutex, which guards the reader list and
+ * ctx->removed_readers_stats, see sc_ctx_get_stats() */
 int _sc_delete_reader(sc_context_t *ctx, sc_reader_t *reader)
 {
 	if (reader == NULL) {
 		return SC_ERROR_INVALID_ARGUMENTS;
 	}
+	/* keep the totals reported by sc_ctx_get_stats() stable */
+	sc_mutex_lock(ctx, reader->stats_mutex);
+	sc_add_stats(&ctx->removed_readers_stats, &reader->stats);
+	sc_mutex_unlock(ctx, reader->stats_mutex);
 	if (reader->ops->release)
 			reader->ops->release(reader);
 	free(reader->name);
 	free(reader->vendor);
-	list_delete(&ctx->readers, reader);
+	sc_mutex_destroy(ctx, reader->stats_mutex);
+	sc_mutex_destroy(ctx, reader->linger_mutex);
+	ptrarray_delete(&ctx->readers, reader);
 	free(reader);
 	return SC_SUCCESS;
 }
@@ -374,6 +415,9 @@ set_drivers(struct _sc_ctx_options *opts, const scconf_list *list)
 	}
 }
 
+/* upper limit of "transaction_linger" in milliseconds */
+#define SC_MAX_TRANSACTION_LINGER	10000
+
 static int
 load_parameters(sc_context_t *ctx, scconf_block *block, struct _sc_ctx_options *opts)
 {
@@ -381,6 +425,7 @@ load_parameters(sc_context_t *ctx, scconf_block *block, struct _sc_ctx_options *
 	const scconf_list *list;
 	const char *val;
 	int debug;
+	int linger;
 #ifdef _WIN32
 	char expanded_val[PATH_MAX];
 	DWORD expanded_len;
@@ -416,6 +461,17 @@ load_parameters(sc_context_t *ctx, scconf_block *block, struct _sc_ctx_options *
 				ctx->flags & SC_CTX_FLAG_ENABLE_DEFAULT_DRIVER))
 		ctx->flags |= SC_CTX_FLAG_ENABLE_DEFAULT_DRIVER;
 
+	if (scconf_get_bool (block, "shared_card_state",
+				ctx->flags & SC_CTX_FLAG_SHARED_CARD_STATE))
+		ctx->flags |= SC_CTX_FLAG_SHARED_CARD_STATE;
+
+	linger = scconf_get_int(block, "transaction_linger", ctx->transaction_linger);
+	if (linger < 0)
+		linger = 0;
+	else if (linger > SC_MAX_TRANSACTION_LINGER)
+		linger = SC_MAX_TRANSACTION_LINGER;
+	ctx->transaction_linger = linger;
+
 	list = scconf_find_list(block, "card_drivers");
 	set_drivers(opts, list);
 
@@ -762,22 +818,76 @@ int sc_ctx_detect_readers(sc_context_t *ctx)
 
 sc_reader_t *sc_ctx_get_reader(sc_context_t *ctx, unsigned int i)
 {
-	return list_get_at(&ctx->readers, i);
+	return ptrarray_get_at(&ctx->readers, i);
 }
 
 sc_reader_t *sc_ctx_get_reader_by_id(sc_context_t *ctx, unsigned int id)
 {
-	return list_get_at(&ctx->readers, id);
+	return ptrarray_get_at(&ctx->readers, id);
 }
 
 sc_reader_t *sc_ctx_get_reader_by_name(sc_context_t *ctx, const char * name)
 {
-	return list_seek(&ctx->readers, name);
+	return ptrarray_seek(&ctx->readers, name);
 }
 
 unsigned int sc_ctx_get_reader_count(sc_context_t *ctx)
 {
-	return list_size(&ctx->readers);
+	return ptrarray_size(&ctx->readers);
+}
+
+int sc_ctx_get_stats(sc_context_t *ctx, sc_reader_t *reader, sc_apdu_stats_t *stats)
+{
+	unsigned int i;
+
+	if (ctx == NULL || stats == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	/* ctx->mutex keeps the reader list stable, the stats mutex of each
+	 * reader keeps its counters consistent with a concurrent transmission */
+	sc_mutex_lock(ctx, ctx->mutex);
+	if (reader != NULL) {
+		sc_mutex_lock(ctx, reader->stats_mutex);
+		*stats = reader->stats;
+		sc_mutex_unlock(ctx, reader->stats_mutex);
+	} else {
+		*stats = ctx->removed_readers_stats;
+		for (i = 0; i < ptrarray_size(&ctx->readers); i++) {
+			sc_reader_t *r = ptrarray_get_at(&ctx->readers, i);
+			sc_mutex_lock(ctx, r->stats_mutex);
+			sc_add_stats(stats, &r->stats);
+			sc_mutex_unlock(ctx, r->stats_mutex);
+		}
+	}
+	sc_mutex_unlock(ctx, ctx->mutex);
+
+	return SC_SUCCESS;
+}
+
+int sc_ctx_reset_stats(sc_context_t *ctx, sc_reader_t *reader)
+{
+	unsigned int i;
+
+	if (ctx == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	sc_mutex_lock(ctx, ctx->mutex);
+	if (reader != NULL) {
+		sc_mutex_lock(ctx, reader->stats_mutex);
+		memset(&reader->stats, 0, sizeof(reader->stats));
+		sc_mutex_unlock(ctx, reader->stats_mutex);
+	} else {
+		memset(&ctx->removed_readers_stats, 0, sizeof(ctx->removed_readers_stats));
+		for (i = 0; i < ptrarray_size(&ctx->readers); i++) {
+			sc_reader_t *r = ptrarray_get_at(&ctx->readers, i);
+			sc_mutex_lock(ctx, r->stats_mutex);
+			memset(&r->stats, 0, sizeof(r->stats));
+			sc_mutex_unlock(ctx, r->stats_mutex);
+		}
+	}
+	sc_mutex_unlock(ctx, ctx->mutex);
+
+	return SC_SUCCESS;
 }
 
 int sc_establish_context(sc_context_t **ctx_out, const char *app_name)
@@ -877,12 +987,12 @@ int sc_context_create(sc_context_t **ctx_out, const sc_context_param_t *parm)
 	ctx->flags = parm->flags;
 	set_defaults(ctx, &opts);
 
-	if (0 != list_init(&ctx->readers)) {
+	if (0 != ptrarray_init(&ctx->readers)) {
 		del_drvs(&opts);
 		sc_release_context(ctx);
 		return SC_ERROR_OUT_OF_MEMORY;
 	}
-	list_attributes_seeker(&ctx->readers, reader_list_seeker);
+	ptrarray_attributes_seeker(&ctx->readers, reader_list_seeker);
 	/* set thread context and create mutex object (if specified) */
 	if (parm->thread_ctx != NULL)
 		ctx->thread_ctx = parm->thread_ctx;
@@ -950,11 +1060,15 @@ int sc_context_create(sc_context_t **ctx_out, const sc_context_param_t *parm)
 /* Used by minidriver to pass in provided handles to reader-pcsc */
 int sc_ctx_use_reader(sc_context_t *ctx, void *pcsc_context_handle, void *pcsc_card_handle)
 {
+	int r = SC_ERROR_NOT_SUPPORTED;
+
 	LOG_FUNC_CALLED(ctx);
+	sc_mutex_lock(ctx, ctx->mutex);
 	if (ctx->reader_driver->ops->use_reader != NULL)
-		return ctx->reader_driver->ops->use_reader(ctx, pcsc_context_handle, pcsc_card_handle);
+		r = ctx->reader_driver->ops->use_reader(ctx, pcsc_context_handle, pcsc_card_handle);
+	sc_mutex_unlock(ctx, ctx->mutex);
 
-	return SC_ERROR_NOT_SUPPORTED;
+	return r;
 }
 
 /* Following two are only implemented with internal PC/SC and don't consume a reader object */
@@ -970,7 +1084,12 @@ int sc_cancel(sc_context_t *ctx)
 
 int sc_wait_for_event(sc_context_t *ctx, unsigned int event_mask, sc_reader_t **event_reader, unsigned int *event, int timeout, void **reader_states)
 {
+	unsigned int i;
+
 	LOG_FUNC_CALLED(ctx);
+	/* do not block other processes while waiting */
+	for (i = 0; i < sc_ctx_get_reader_count(ctx); i++)
+		sc_reader_end_linger(sc_ctx_get_reader(ctx, i), 1);
 	if (ctx->reader_driver->ops->wait_for_event != NULL)
 		return ctx->reader_driver->ops->wait_for_event(ctx, event_mask, event_reader, event, timeout, reader_states);
 
@@ -985,10 +1104,12 @@ int sc_release_context(sc_context_t *ctx)
 		return SC_ERROR_INVALID_ARGUMENTS;
 	}
 	SC_FUNC_CALLED(ctx, SC_LOG_DEBUG_VERBOSE);
-	while (list_size(&ctx->readers)) {
-		sc_reader_t *rdr = (sc_reader_t *) list_get_at(&ctx->readers, 0);
+	sc_mutex_lock(ctx, ctx->mutex);
+	while (ptrarray_size(&ctx->readers)) {
+		sc_reader_t *rdr = (sc_reader_t *) ptrarray_get_at(&ctx->readers, 0);
 		_sc_delete_reader(ctx, rdr);
 	}
+	sc_mutex_unlock(ctx, ctx->mutex);
 
 	if (ctx->reader_driver->ops->finish != NULL)
 		ctx->reader_driver->ops->finish(ctx);
@@ -1021,7 +1142,7 @@ int sc_release_context(sc_context_t *ctx)
 		free(ctx->debug_filename);
 	if (ctx->app_name != NULL)
 		free(ctx->app_name);
-	list_destroy(&ctx->readers);
+	ptrarray_destroy(&ctx->readers);
 	sc_mem_clear(ctx, sizeof(*ctx));
 	free(ctx);
 	return SC_SUCCESS;
@@ -246,6 +246,11 @@ int sc_mutex_destroy(const sc_context_t *ctx, void *mutex);
  * @return unsigned long with the unique id or 0 if not supported
  */
 unsigned long sc_thread_id(const sc_context_t *ctx);
+/**
+ * Returns a monotonic time stamp, suitable for measuring intervals.
+ * @return time in microseconds or 0 if no monotonic clock is available
+ */
+unsigned long long sc_timestamp_us(void);
 
 /********************************************************************/
 /*             internal APDU handling functions                     */
@@ -272,6 +277,14 @@ int sc_apdu_get_octets(sc_context_t *ctx, const sc_apdu_t *apdu, u8 **buf,
  */
 int sc_apdu_set_resp(sc_context_t *ctx, sc_apdu_t *apdu, const u8 *buf,
 		size_t len);
+/**
+ * Sends one APDU to the reader driver, or through secure messaging,
+ * and records it in the reader statistics
+ * @param  card  sc_card_t object
+ * @param  apdu  the APDU to send
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_single_transmit(struct sc_card *card, struct sc_apdu *apdu);
 /**
  * Logs APDU
  * @param  ctx          sc_context_t object
@@ -282,6 +295,56 @@ int sc_apdu_set_resp(sc_context_t *ctx, sc_apdu_t *apdu, const u8 *buf,
 #define sc_apdu_log(ctx, data, len, is_outgoing) \
 	sc_debug_hex(ctx, SC_LOG_DEBUG_NORMAL, is_outgoing != 0 ? "Outgoing APDU" : "Incoming APDU", data, len)
 
+/********************************************************************/
+/*             card state shared between processes                  */
+/********************************************************************/
+
+struct sc_card_shared_state {
+	void *segment;			/* shared memory of the reader */
+	char name[64];			/* name of the shared memory object */
+	unsigned long long generation;	/* generation seen at the last sc_unlock() */
+	int changed;			/* APDUs were sent in this transaction */
+};
+
+/**
+ * Maps the shared state of the card's reader if "shared_card_state"
+ * is enabled. Without it, card->shared_state stays NULL.
+ */
+int sc_card_shared_state_attach(struct sc_card *card);
+void sc_card_shared_state_detach(struct sc_card *card);
+/**
+ * Called when the reader transaction was obtained. Invalidates the
+ * card cache if another process sent APDUs since the last transaction
+ * of this one.
+ * @return 1 if the card state is unchanged, 0 otherwise
+ */
+int sc_card_shared_state_acquire(struct sc_card *card, int was_reset);
+/**
+ * Called before the reader transaction is released. Publishes a new
+ * generation if this process sent APDUs.
+ */
+void sc_card_shared_state_release(struct sc_card *card);
+/**
+ * Called before an APDU is sent. Marks the shared state dirty until
+ * sc_card_shared_state_release(), so that a crash in between is noticed.
+ */
+void sc_card_shared_state_mark_changed(struct sc_card *card);
+
+/**
+ * Ends the reader transaction kept open by "transaction_linger".
+ * @param  force  end it even if the linger time is not over yet
+ */
+void sc_reader_end_linger(struct sc_reader *reader, int force);
+/**
+ * Keeps the reader transaction open for another @ms milliseconds.
+ */
+void sc_reader_start_linger(struct sc_reader *reader, unsigned int ms);
+/**
+ * Takes over a kept reader transaction, ending it if the time is over.
+ * @return 1 if the transaction is still held and can be used
+ */
+int sc_reader_take_linger(struct sc_reader *reader);
+
 extern struct sc_reader_driver *sc_get_pcsc_driver(void);
 extern struct sc_reader_driver *sc_get_ctapi_driver(void);
 extern struct sc_reader_driver *sc_get_openct_driver(void);
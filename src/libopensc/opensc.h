@@ -37,6 +37,7 @@ extern "C" {
 #endif
 
 #include "common/simclist.h"
+#include "common/ptrarray.h"
 #include "scconf/scconf.h"
 #include "libopensc/errors.h"
 #include "libopensc/types.h"
@@ -350,6 +351,11 @@ struct sc_card_cache {
         struct sc_file *current_ef;
         struct sc_file *current_df;
 
+	/* environment of the last signature, valid while no other APDU
+	 * was sent to the card, see sc_pkcs15_compute_signature_keep_env() */
+	struct sc_security_env security_env;
+	int security_env_valid;
+
 	int valid;
 };
 
@@ -383,6 +389,30 @@ struct sc_reader_driver {
 #define SC_READER_CAP_PACE_DESTROY_CHANNEL 0x00000010
 #define SC_READER_CAP_PACE_GENERIC         0x00000020
 
+/* APDU statistics: latency histogram bucket i counts transmissions that took
+ * less than (SC_STATS_LATENCY_BASE_US << i) microseconds; the last bucket
+ * counts everything slower than that */
+#define SC_STATS_LATENCY_BUCKETS	16
+#define SC_STATS_LATENCY_BASE_US	64
+
+struct sc_ins_stats {
+	unsigned long long count;
+	unsigned long long time_us;
+};
+
+typedef struct sc_apdu_stats {
+	unsigned long long apdus;		/* APDUs handed to the reader driver */
+	unsigned long long errors;		/* failed reader transmissions */
+	unsigned long long bytes_sent;		/* encoded command APDU bytes */
+	unsigned long long bytes_received;	/* response bytes including SW1/SW2 */
+	unsigned long long get_responses;	/* GET RESPONSE continuations */
+	unsigned long long selects;		/* SELECT commands */
+	unsigned long long retries;		/* re-transmissions after 6Cxx */
+	unsigned long long time_us;		/* total time spent in the reader driver */
+	unsigned long long latency[SC_STATS_LATENCY_BUCKETS];
+	struct sc_ins_stats ins[256];
+} sc_apdu_stats_t;
+
 /* reader send/receive length of short APDU */
 #define SC_READER_SHORT_APDU_MAX_SEND_SIZE 255
 #define SC_READER_SHORT_APDU_MAX_RECV_SIZE 256
@@ -410,6 +440,14 @@ typedef struct sc_reader {
 		int Fi, f, Di, N;
 		u8 FI, DI;
 	} atr_info;
+
+	struct sc_apdu_stats stats;
+	void *stats_mutex;	/* protects stats */
+
+	/* sc_timestamp_us() until which the reader transaction is kept open
+	 * after the last sc_unlock(), 0 if it is not kept (transaction_linger) */
+	unsigned long long linger_until;
+	void *linger_mutex;	/* protects linger_until */
 } sc_reader_t;
 
 /* This will be the new interface for handling PIN commands.
@@ -518,6 +556,11 @@ struct sc_reader_operations {
 	int (*reset)(struct sc_reader *, int);
 	/* Used to pass in PC/SC handles to minidriver */
 	int (*use_reader)(struct sc_context *ctx, void *pcsc_context_handle, void *pcsc_card_handle);
+	/* Optional: transmit several APDUs one after the other, e.g. the
+	 * chunks of a chained command. Stops after the first APDU but the
+	 * last that does not return 0x9000. Returns the number of APDUs
+	 * sent or an error. */
+	int (*transmit_sequence)(struct sc_reader *reader, sc_apdu_t *apdus, size_t count);
 };
 
 /*
@@ -606,6 +649,7 @@ typedef struct sc_card {
 	int max_pin_len;
 
 	struct sc_card_cache cache;
+	unsigned int reset_count;	/* incremented whenever a card reset is noticed */
 
 	struct sc_serial_number serialnr;
 	struct sc_version version;
@@ -615,6 +659,9 @@ typedef struct sc_card {
 	struct sm_context sm_ctx;
 #endif
 
+	/* card state shared with other processes, NULL if not enabled */
+	struct sc_card_shared_state *shared_state;
+
 	unsigned int magic;
 } sc_card_t;
 
@@ -866,6 +913,8 @@ typedef struct {
 #define SC_CTX_FLAG_ENABLE_DEFAULT_DRIVER	0x00000008
 #define SC_CTX_FLAG_DISABLE_POPUPS			0x00000010
 #define SC_CTX_FLAG_DISABLE_COLORS			0x00000020
+/** keep the card cache unless another process changed the card state */
+#define SC_CTX_FLAG_SHARED_CARD_STATE		0x00000040
 
 typedef struct ossl3ctx ossl3ctx_t;
 
@@ -880,7 +929,7 @@ typedef struct sc_context {
 	char *debug_filename;
 	char *preferred_language;
 
-	list_t readers;
+	ptrarray_t readers;
 
 	struct sc_reader_driver *reader_driver;
 	void *reader_drv_data;
@@ -891,6 +940,12 @@ typedef struct sc_context {
 	sc_thread_context_t	*thread_ctx;
 	void *mutex;
 
+	/* statistics of readers that have already been removed */
+	struct sc_apdu_stats removed_readers_stats;
+
+	/* milliseconds to keep the reader transaction after the last sc_unlock() */
+	unsigned int transaction_linger;
+
 #ifdef ENABLE_OPENSSL
 	ossl3ctx_t *ossl3ctx;
 #endif
@@ -1098,6 +1153,24 @@ int _sc_delete_reader(sc_context_t *ctx, sc_reader_t *reader);
  */
 int sc_ctx_log_to_file(sc_context_t *ctx, const char* filename);
 
+/**
+ * Retrieves the APDU statistics collected by sc_transmit_apdu()
+ * @param  ctx     OpenSC context
+ * @param  reader  reader to query or NULL for the sum over all readers,
+ *                 including the ones that have been removed
+ * @param  stats   structure receiving the statistics
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_ctx_get_stats(sc_context_t *ctx, sc_reader_t *reader, sc_apdu_stats_t *stats);
+
+/**
+ * Clears the APDU statistics
+ * @param  ctx     OpenSC context
+ * @param  reader  reader to reset or NULL to reset all readers
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_ctx_reset_stats(sc_context_t *ctx, sc_reader_t *reader);
+
 /**
  * Forces the use of a specified card driver
  * @param ctx OpenSC context
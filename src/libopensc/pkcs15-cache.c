@@ -221,3 +221,117 @@ int sc_pkcs15_cache_file(struct sc_pkcs15_card *p15card,
 	}
 	return 0;
 }
+
+/*
+ * For emulators that enumerate their files with sc_list_files(): keep the
+ * cached copies of the listed files consistent with the card. The list of
+ * 2-byte file identifiers is stored in the cache as if it was the content
+ * of the MF of the application. If the card returns the same list, all
+ * cached files are still good. Otherwise the cached copies of the files
+ * that were added or removed since are dropped, so they are read again,
+ * and the files present in both lists stay cached.
+ *
+ * A file rewritten in place, e.g. a key deleted and generated again under
+ * the same identifier on another host, keeps its identifier. So the size
+ * of every cached file in the list is compared with the size in the FCI,
+ * which costs a SELECT per cached file but no READ BINARY. A file of the
+ * same size with other contents is not noticed.
+ *
+ * Returns 1 if the list and the sizes did not change, 0 if they did or the
+ * list was not cached.
+ */
+/* Drops the cached copy of a file whose size on the card differs.
+ * Returns 1 if the copy was dropped */
+static int
+cache_drop_resized_file(struct sc_pkcs15_card *p15card, const struct sc_aid *aid,
+		const u8 *fid)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	char fname[PATH_MAX];
+	struct sc_file *file = NULL;
+	struct stat stbuf;
+	sc_path_t path;
+	int r, drop;
+
+	memset(&path, 0, sizeof(path));
+	sc_path_set(&path, SC_PATH_TYPE_FILE_ID, fid, 2, 0, -1);
+	path.aid = *aid;
+	if (generate_cache_filename(p15card, &path, fname, sizeof(fname)) != SC_SUCCESS
+			|| stat(fname, &stbuf) != 0)
+		return 0;
+
+	r = sc_select_file(p15card->card, &path, &file);
+	if (r == SC_ERROR_NOT_SUPPORTED)
+		drop = 0;
+	else if (r != SC_SUCCESS)
+		drop = 1;
+	else
+		/* not all cards tell the size */
+		drop = file->size != 0 && file->size != (size_t)stbuf.st_size;
+	sc_file_free(file);
+
+	if (!drop)
+		return 0;
+	sc_log(ctx, "Cached file %02X%02X changed on the card", fid[0], fid[1]);
+	unlink(fname);
+	return 1;
+}
+
+int sc_pkcs15_cache_validate_file_list(struct sc_pkcs15_card *p15card,
+		const struct sc_aid *aid, const u8 *list, size_t list_len)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	char fname[PATH_MAX];
+	sc_path_t path;
+	u8 *old = NULL;
+	size_t old_len = 0, i, j;
+	int r, unchanged = 1;
+
+	LOG_FUNC_CALLED(ctx);
+	if (aid == NULL || aid->len == 0 || (list == NULL && list_len > 0) || list_len % 2)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
+
+	memset(&path, 0, sizeof(path));
+	sc_path_set(&path, SC_PATH_TYPE_FILE_ID, (const u8 *) "\x3F\x00", 2, 0, -1);
+	path.aid = *aid;
+
+	r = sc_pkcs15_read_cached_file(p15card, &path, &old, &old_len);
+	if (r == SC_SUCCESS && old_len == list_len && memcmp(old, list, list_len) == 0) {
+		free(old);
+		for (i = 0; i < list_len; i += 2)
+			unchanged &= !cache_drop_resized_file(p15card, aid, list + i);
+		sc_log(ctx, "File list unchanged, using the cached files");
+		LOG_FUNC_RETURN(ctx, unchanged);
+	}
+	if (r != SC_SUCCESS || old_len % 2)
+		old_len = 0;
+
+	/* drop the files that are only in one of the lists */
+	for (i = 0; i < list_len + old_len; i += 2) {
+		const u8 *fid = i < list_len ? list + i : old + i - list_len;
+		const u8 *other = i < list_len ? old : list;
+		size_t other_len = i < list_len ? old_len : list_len;
+
+		for (j = 0; j < other_len; j += 2)
+			if (memcmp(other + j, fid, 2) == 0)
+				break;
+		if (j < other_len)
+			continue;
+		sc_path_set(&path, SC_PATH_TYPE_FILE_ID, fid, 2, 0, -1);
+		path.aid = *aid;
+		if (generate_cache_filename(p15card, &path, fname, sizeof(fname)) == SC_SUCCESS)
+			unlink(fname);
+	}
+
+	free(old);
+
+	/* the files in both lists may have been rewritten too */
+	for (i = 0; i < list_len; i += 2)
+		cache_drop_resized_file(p15card, aid, list + i);
+
+	sc_log(ctx, "File list changed, refreshing the cached files");
+	sc_path_set(&path, SC_PATH_TYPE_FILE_ID, (const u8 *) "\x3F\x00", 2, 0, -1);
+	path.aid = *aid;
+	sc_pkcs15_cache_file(p15card, &path, list, list_len);
+	LOG_FUNC_RETURN(ctx, 0);
+}
@@ -409,6 +409,104 @@ sc_pkcs15_read_certificate(struct sc_pkcs15_card *p15card, const struct sc_pkcs1
 }
 
 
+struct cert_read_order {
+	struct sc_pkcs15_object *obj;
+	size_t idx;
+};
+
+static int
+compare_cert_path(const void *a, const void *b)
+{
+	const struct sc_pkcs15_cert_info *ia = ((const struct cert_read_order *) a)->obj->data;
+	const struct sc_pkcs15_cert_info *ib = ((const struct cert_read_order *) b)->obj->data;
+	size_t len;
+	int r;
+
+	if (ia->path.aid.len != ib->path.aid.len)
+		return ia->path.aid.len < ib->path.aid.len ? -1 : 1;
+	r = memcmp(ia->path.aid.value, ib->path.aid.value, ia->path.aid.len);
+	if (r)
+		return r;
+	len = MIN(ia->path.len, ib->path.len);
+	r = memcmp(ia->path.value, ib->path.value, len);
+	if (r)
+		return r;
+	if (ia->path.len != ib->path.len)
+		return ia->path.len < ib->path.len ? -1 : 1;
+	return ia->path.index < ib->path.index ? -1 : ia->path.index > ib->path.index;
+}
+
+/*
+ * Read several certificates in one card transaction.
+ *
+ * The files are read in the order of their paths, so that certificates in
+ * the same DF follow each other and the select cache can skip most of the
+ * SELECTs. certs[i] receives the certificate of objs[i] or NULL, results[i]
+ * (if not NULL) the result of reading it. Once a private certificate is
+ * refused, the other private ones are not tried.
+ *
+ * Returns the number of certificates read.
+ */
+int
+sc_pkcs15_read_certificates(struct sc_pkcs15_card *p15card, struct sc_pkcs15_object **objs,
+		size_t count, struct sc_pkcs15_cert **certs, int *results)
+{
+	struct sc_context *ctx = NULL;
+	struct cert_read_order *order = NULL;
+	int private_rv = SC_SUCCESS, done = 0, r;
+	size_t i;
+
+	if (p15card == NULL || p15card->card == NULL || (count && (objs == NULL || certs == NULL)))
+		return SC_ERROR_INVALID_ARGUMENTS;
+	ctx = p15card->card->ctx;
+	LOG_FUNC_CALLED(ctx);
+
+	for (i = 0; i < count; i++) {
+		certs[i] = NULL;
+		if (results)
+			results[i] = SC_ERROR_OBJECT_NOT_FOUND;
+	}
+	if (count == 0)
+		LOG_FUNC_RETURN(ctx, 0);
+
+	order = malloc(count * sizeof(struct cert_read_order));
+	if (order == NULL)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	for (i = 0; i < count; i++) {
+		order[i].obj = objs[i];
+		order[i].idx = i;
+	}
+	qsort(order, count, sizeof(struct cert_read_order), compare_cert_path);
+
+	r = sc_lock(p15card->card);
+	if (r < 0) {
+		free(order);
+		LOG_TEST_RET(ctx, r, "sc_lock() failed");
+	}
+
+	for (i = 0; i < count; i++) {
+		struct sc_pkcs15_object *obj = order[i].obj;
+		int private_obj = obj->flags & SC_PKCS15_CO_FLAG_PRIVATE;
+
+		if (private_obj && private_rv < 0)
+			r = private_rv;
+		else
+			r = sc_pkcs15_read_certificate(p15card, obj->data, private_obj, &certs[order[i].idx]);
+		if (private_obj && (r == SC_ERROR_SECURITY_STATUS_NOT_SATISFIED
+				|| r == SC_ERROR_PIN_CODE_INCORRECT))
+			private_rv = r;
+		if (results)
+			results[order[i].idx] = r;
+		if (r == SC_SUCCESS)
+			done++;
+	}
+
+	sc_unlock(p15card->card);
+	free(order);
+	LOG_FUNC_RETURN(ctx, done);
+}
+
+
 static const struct sc_asn1_entry c_asn1_cred_ident[] = {
 	{ "idType",	SC_ASN1_INTEGER,      SC_ASN1_TAG_INTEGER, 0, NULL, NULL },
 	{ "idValue",	SC_ASN1_OCTET_STRING, SC_ASN1_TAG_OCTET_STRING, 0, NULL, NULL },
@@ -75,6 +75,36 @@ sc_pkcs15_read_data_object(struct sc_pkcs15_card *p15card,
 }
 
 
+/*
+ * Pass the value of a DATA object to the callback as it is read from the
+ * card, see sc_pkcs15_read_file_stream(). Unlike sc_pkcs15_read_data_object()
+ * the value is not kept in the object info.
+ */
+int
+sc_pkcs15_read_data_object_stream(struct sc_pkcs15_card *p15card,
+		const struct sc_pkcs15_data_info *info,
+		int private_obj,
+		sc_pkcs15_read_cb_t cb, void *cb_arg)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	int r;
+
+	LOG_FUNC_CALLED(ctx);
+	if (!info || !cb)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
+
+	if (info->data.value) {
+		r = info->data.len ? cb(cb_arg, info->data.value, info->data.len) : 0;
+		if (r == 0)
+			r = (int)info->data.len;
+		LOG_FUNC_RETURN(ctx, r);
+	}
+
+	r = sc_pkcs15_read_file_stream(p15card, &info->path, private_obj, cb, cb_arg);
+	LOG_FUNC_RETURN(ctx, r);
+}
+
+
 static const struct sc_asn1_entry c_asn1_data[] = {
 	{ "data", SC_ASN1_PKCS15_OBJECT, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, NULL, NULL },
 	{ NULL, 0, 0, 0, NULL, NULL }
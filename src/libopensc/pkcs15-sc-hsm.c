@@ -1500,6 +1500,11 @@ static int sc_pkcs15emu_sc_hsm_init (sc_pkcs15_card_t * p15card)
 		sc_pkcs15_card_clear(p15card);
 	LOG_TEST_RET(card->ctx, filelistlength, "Could not enumerate file and key identifier");
 
+	/* LIST FILES and the sizes of the cached files tell whether the
+	 * cached files are still current */
+	if (p15card->opts.use_file_cache)
+		sc_pkcs15_cache_validate_file_list(p15card, &sc_hsm_aid, filelist, filelistlength);
+
 	for (i = 0; i < filelistlength; i += 2) {
 		switch(filelist[i]) {
 		case KEY_PREFIX:
@@ -129,30 +129,52 @@ static int use_key(struct sc_pkcs15_card *p15card,
 		int (*card_command)(sc_card_t *card,
 			 const u8 * in, size_t inlen,
 			 u8 * out, size_t outlen),
-		const u8 * in, size_t inlen, u8 * out, size_t outlen)
+		const u8 * in, size_t inlen, u8 * out, size_t outlen,
+		int keep_se)
 {
+	sc_card_t *card = p15card->card;
+	sc_security_env_t requested;
 	int r = SC_SUCCESS;
 	int revalidated_cached_pin = 0;
+	int se_kept;
 	sc_path_t path;
-	LOG_TEST_RET(p15card->card->ctx, get_file_path(obj, &path), "Failed to get key file path.");
-
-	r = sc_lock(p15card->card);
-	LOG_TEST_RET(p15card->card->ctx, r, "sc_lock() failed");
-
-	do {
-		if (path.len != 0 || path.aid.len != 0) {
-			r = select_key_file(p15card, obj, senv);
-			if (r < 0) {
-				sc_log(p15card->card->ctx,
-						"Unable to select private key file");
+	LOG_TEST_RET(card->ctx, get_file_path(obj, &path), "Failed to get key file path.");
+
+	r = sc_lock(card);
+	LOG_TEST_RET(card->ctx, r, "sc_lock() failed");
+
+	/* A series of signatures with one key needs the key selected and
+	 * the environment set only once, as long as nothing else was sent
+	 * to the card in between. select_key_file() changes senv, so the
+	 * environment is compared as requested by the caller. */
+	requested = *senv;
+	se_kept = keep_se && card->cache.security_env_valid
+		&& !memcmp(&card->cache.security_env, &requested, sizeof(requested));
+
+	while (1) {
+		if (se_kept) {
+			sc_log(card->ctx, "Security environment still set");
+		} else {
+			r = SC_SUCCESS;
+			if (path.len != 0 || path.aid.len != 0) {
+				r = select_key_file(p15card, obj, senv);
+				if (r < 0) {
+					sc_log(card->ctx,
+							"Unable to select private key file");
+				}
 			}
+			if (r == SC_SUCCESS)
+				r = sc_set_security_env(card, senv, 0);
 		}
-		if (r == SC_SUCCESS)
-			r = sc_set_security_env(p15card->card, senv, 0);
 
 		if (r == SC_SUCCESS)
-			r = card_command(p15card->card, in, inlen, out, outlen);
+			r = card_command(card, in, inlen, out, outlen);
 
+		if (r < 0 && se_kept) {
+			/* the card may have lost it anyway, set it up again */
+			se_kept = 0;
+			continue;
+		}
 		if (revalidated_cached_pin)
 			/* only re-validate once */
 			break;
@@ -161,12 +183,19 @@ static int use_key(struct sc_pkcs15_card *p15card,
 			if (r < 0)
 				break;
 			revalidated_cached_pin = 1;
+			continue;
 		}
-	} while (revalidated_cached_pin);
+		break;
+	}
 
-	sc_unlock(p15card->card);
+	if (keep_se && r >= 0) {
+		card->cache.security_env = requested;
+		card->cache.security_env_valid = 1;
+	}
 
-	LOG_FUNC_RETURN(p15card->card->ctx, r);
+	sc_unlock(card);
+
+	LOG_FUNC_RETURN(card->ctx, r);
 }
 
 static int format_senv(struct sc_pkcs15_card *p15card,
@@ -303,7 +332,7 @@ int sc_pkcs15_decipher(struct sc_pkcs15_card *p15card,
 	senv.algorithm_flags = sec_flags;
 
 	r = use_key(p15card, obj, &senv, sc_decipher, in, inlen, out,
-			outlen);
+			outlen, 0);
 	LOG_TEST_RET(ctx, r, "use_key() failed");
 
 	/* Strip any padding */
@@ -381,7 +410,7 @@ int sc_pkcs15_derive(struct sc_pkcs15_card *p15card,
 	senv.algorithm_flags = sec_flags;
 
 	r = use_key(p15card, obj, &senv, sc_decipher, in, inlen, out,
-			*poutlen);
+			*poutlen, 0);
 	LOG_TEST_RET(ctx, r, "use_key() failed");
 
 	/* If card stores derived key on card, then no data is returned
@@ -470,7 +499,7 @@ int sc_pkcs15_unwrap(struct sc_pkcs15_card *p15card,
 	}
 
 	r = use_key(p15card, key, &senv, sc_unwrap, in, inlen, out,
-		    poutlen);
+		    poutlen, 0);
 	LOG_TEST_RET(ctx, r, "use_key() failed");
 
 	LOG_FUNC_RETURN(ctx, r);
@@ -569,7 +598,7 @@ int sc_pkcs15_wrap(struct sc_pkcs15_card *p15card,
 		LOG_TEST_RET(ctx, sec_env_add_param(&senv, &senv_param), "failed to add IV to security environment");
 	}
 
-	r = use_key(p15card, key, &senv, sc_wrap, NULL, 0, cryptogram, crgram_len ? *crgram_len : 0);
+	r = use_key(p15card, key, &senv, sc_wrap, NULL, 0, cryptogram, crgram_len ? *crgram_len : 0, 0);
 
 	if (r > -1 && crgram_len) {
 		if (*crgram_len < (size_t) r) {
@@ -590,10 +619,10 @@ int sc_pkcs15_wrap(struct sc_pkcs15_card *p15card,
 #define USAGE_ANY_DECIPHER      (SC_PKCS15_PRKEY_USAGE_DECRYPT|\
                                  SC_PKCS15_PRKEY_USAGE_UNWRAP)
 
-int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
+static int pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
 				const struct sc_pkcs15_object *obj,
 				unsigned long flags, const u8 *in, size_t inlen,
-				u8 *out, size_t outlen, void *pMechanism)
+				u8 *out, size_t outlen, void *pMechanism, int keep_env)
 {
 	sc_context_t *ctx = p15card->card->ctx;
 	int r;
@@ -767,7 +796,7 @@ int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
 
 
 	r = use_key(p15card, obj, &senv, sc_compute_signature, tmp, inlen,
-			out, outlen);
+			out, outlen, keep_env);
 	LOG_TEST_GOTO_ERR(ctx, r, "use_key() failed");
 
 	/* Some cards may return RSA signature as integer without leading zero bytes */
@@ -893,8 +922,8 @@ sc_pkcs15_decrypt_sym(struct sc_pkcs15_card *p15card,
 	sc_log(ctx, "called with flags 0x%lX", flags);
 
 	skey = (const struct sc_pkcs15_skey_info *)obj->data;
-	if (!(skey->usage & SC_PKCS15_PRKEY_USAGE_DECRYPT))
-		LOG_TEST_RET(ctx, SC_ERROR_NOT_ALLOWED, "This key cannot be used for encryption");
+	if (!(skey->usage & (SC_PKCS15_PRKEY_USAGE_DECRYPT|SC_PKCS15_PRKEY_USAGE_UNWRAP)))
+		LOG_TEST_RET(ctx, SC_ERROR_NOT_ALLOWED, "This key cannot be used for decryption");
 
 	r = format_senv(p15card, obj, &senv, &alg_info);
 	LOG_TEST_RET(ctx, r, "Could not initialize security environment");
@@ -957,3 +986,24 @@ sc_pkcs15_decrypt_sym(struct sc_pkcs15_card *p15card,
 
 	LOG_FUNC_RETURN(ctx, r);
 }
+
+int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
+				const struct sc_pkcs15_object *obj,
+				unsigned long flags, const u8 *in, size_t inlen,
+				u8 *out, size_t outlen, void *pMechanism)
+{
+	return pkcs15_compute_signature(p15card, obj, flags, in, inlen,
+			out, outlen, pMechanism, 0);
+}
+
+/* Like sc_pkcs15_compute_signature(), but a series of calls with the same
+ * key skips key selection and MSE as long as nothing else was sent to the
+ * card in between. */
+int sc_pkcs15_compute_signature_keep_env(struct sc_pkcs15_card *p15card,
+				const struct sc_pkcs15_object *obj,
+				unsigned long flags, const u8 *in, size_t inlen,
+				u8 *out, size_t outlen, void *pMechanism)
+{
+	return pkcs15_compute_signature(p15card, obj, flags, in, inlen,
+			out, outlen, pMechanism, 1);
+}
@@ -1377,14 +1377,171 @@ sc_pkcs15_unbind(struct sc_pkcs15_card *p15card)
 }
 
 
+/*
+ * Lookup tables over p15card->obj_list. Objects are only ever appended to
+ * the list, so every table keeps them in list order and searches return
+ * the same objects in the same order as a walk over the whole list.
+ */
+#define SC_PKCS15_OBJ_CLASS_COUNT	((SC_PKCS15_TYPE_CLASS_MASK >> 8) + 1)
+#define SC_PKCS15_OBJ_ID_BUCKETS	256
+
+struct sc_pkcs15_object_index {
+	struct sc_pkcs15_object *tail;
+	/* objects by (type >> 8) */
+	ptrarray_t classes[SC_PKCS15_OBJ_CLASS_COUNT];
+	/* objects by ID (auth ID for authentication objects),
+	 * built with the first search by ID */
+	int have_ids;
+	ptrarray_t ids[SC_PKCS15_OBJ_ID_BUCKETS];
+};
+
+
+static const struct sc_pkcs15_id *
+get_obj_id(const struct sc_pkcs15_object *obj)
+{
+	void *data = obj->data;
+
+	if (data == NULL)
+		return NULL;
+	switch (obj->type & SC_PKCS15_TYPE_CLASS_MASK) {
+	case SC_PKCS15_TYPE_CERT:
+		return &((struct sc_pkcs15_cert_info *) data)->id;
+	case SC_PKCS15_TYPE_PRKEY:
+		return &((struct sc_pkcs15_prkey_info *) data)->id;
+	case SC_PKCS15_TYPE_PUBKEY:
+		return &((struct sc_pkcs15_pubkey_info *) data)->id;
+	case SC_PKCS15_TYPE_SKEY:
+		return &((struct sc_pkcs15_skey_info *) data)->id;
+	case SC_PKCS15_TYPE_AUTH:
+		return &((struct sc_pkcs15_auth_info *) data)->auth_id;
+	case SC_PKCS15_TYPE_DATA_OBJECT:
+		return &((struct sc_pkcs15_data_info *) data)->id;
+	}
+	return NULL;
+}
+
+
+static unsigned int
+obj_id_hash(const struct sc_pkcs15_id *id)
+{
+	unsigned int hash = 2166136261U;
+	size_t ii;
+
+	for (ii = 0; ii < id->len && ii < sizeof(id->value); ii++)
+		hash = (hash ^ id->value[ii]) * 16777619U;
+	return hash % SC_PKCS15_OBJ_ID_BUCKETS;
+}
+
+
+static void
+obj_index_drop_ids(struct sc_pkcs15_object_index *index)
+{
+	unsigned int ii;
+
+	for (ii = 0; ii < SC_PKCS15_OBJ_ID_BUCKETS; ii++)
+		ptrarray_destroy(&index->ids[ii]);
+	index->have_ids = 0;
+}
+
+
+static void
+obj_index_free(struct sc_pkcs15_card *p15card)
+{
+	struct sc_pkcs15_object_index *index = p15card->obj_index;
+	unsigned int ii;
+
+	if (index == NULL)
+		return;
+	for (ii = 0; ii < SC_PKCS15_OBJ_CLASS_COUNT; ii++)
+		ptrarray_destroy(&index->classes[ii]);
+	obj_index_drop_ids(index);
+	free(index);
+	p15card->obj_index = NULL;
+}
+
+
+static int
+obj_index_add(struct sc_pkcs15_object_index *index, struct sc_pkcs15_object *obj)
+{
+	unsigned int class_idx = (obj->type & SC_PKCS15_TYPE_CLASS_MASK) >> 8;
+	const struct sc_pkcs15_id *id = get_obj_id(obj);
+
+	if (ptrarray_append(&index->classes[class_idx], obj) < 0)
+		return SC_ERROR_OUT_OF_MEMORY;
+	if (index->have_ids && id != NULL
+			&& ptrarray_append(&index->ids[obj_id_hash(id)], obj) < 0)
+		return SC_ERROR_OUT_OF_MEMORY;
+	index->tail = obj;
+	return SC_SUCCESS;
+}
+
+
+/* Returns the index of the card, creating it from obj_list if needed.
+ * Returns NULL if there is not enough memory; callers then use the list. */
+static struct sc_pkcs15_object_index *
+obj_index_get(struct sc_pkcs15_card *p15card)
+{
+	struct sc_pkcs15_object *obj;
+
+	if (p15card->obj_index != NULL)
+		return p15card->obj_index;
+
+	p15card->obj_index = calloc(1, sizeof(struct sc_pkcs15_object_index));
+	if (p15card->obj_index == NULL)
+		return NULL;
+	for (obj = p15card->obj_list; obj != NULL; obj = obj->next) {
+		if (obj_index_add(p15card->obj_index, obj) != SC_SUCCESS) {
+			obj_index_free(p15card);
+			return NULL;
+		}
+	}
+	return p15card->obj_index;
+}
+
+
+static int
+obj_index_build_ids(struct sc_pkcs15_card *p15card, struct sc_pkcs15_object_index *index)
+{
+	struct sc_pkcs15_object *obj;
+	const struct sc_pkcs15_id *id;
+
+	if (index->have_ids)
+		return SC_SUCCESS;
+	for (obj = p15card->obj_list; obj != NULL; obj = obj->next) {
+		id = get_obj_id(obj);
+		if (id == NULL)
+			continue;
+		if (ptrarray_append(&index->ids[obj_id_hash(id)], obj) < 0) {
+			obj_index_drop_ids(index);
+			return SC_ERROR_OUT_OF_MEMORY;
+		}
+	}
+	index->have_ids = 1;
+	return SC_SUCCESS;
+}
+
+
+void
+sc_pkcs15_reindex_objects(struct sc_pkcs15_card *p15card)
+{
+	if (p15card == NULL || p15card->obj_index == NULL)
+		return;
+	/* rebuilt with the next search by ID */
+	obj_index_drop_ids(p15card->obj_index);
+}
+
+
 static int
 __sc_pkcs15_search_objects(struct sc_pkcs15_card *p15card, unsigned int class_mask, unsigned int type,
+			const struct sc_pkcs15_id *id,
 			int (*func)(sc_pkcs15_object_t *, void *), void *func_arg,
 			sc_pkcs15_object_t **ret, size_t ret_size)
 {
 	struct sc_pkcs15_object *obj = NULL;
 	struct sc_pkcs15_df	*df = NULL;
-	unsigned int	df_mask = 0;
+	struct sc_pkcs15_object_index *index = NULL;
+	const ptrarray_t *candidates = NULL;
+	unsigned int	df_mask = 0, ii;
 	size_t		match_count = 0;
 	int r;
 
@@ -1433,8 +1590,24 @@ __sc_pkcs15_search_objects(struct sc_pkcs15_card *p15card, unsigned int class_ma
 			continue;
 	}
 
+	/* Only visit the objects with the wanted ID or of the wanted class,
+	 * if the lookup tables are available */
+	index = obj_index_get(p15card);
+	if (index != NULL) {
+		if (id != NULL && obj_index_build_ids(p15card, index) == SC_SUCCESS) {
+			candidates = &index->ids[obj_id_hash(id)];
+		} else if ((class_mask & (class_mask - 1)) == 0) {
+			for (ii = 1; ii < SC_PKCS15_OBJ_CLASS_COUNT; ii++)
+				if (class_mask == (1U << ii))
+					candidates = &index->classes[ii];
+		}
+	}
+
 	/* And now loop over all objects */
-	for (obj = p15card->obj_list; obj != NULL; obj = obj->next) {
+	ii = 0;
+	for (obj = candidates ? ptrarray_get_at(candidates, 0) : p15card->obj_list;
+			obj != NULL;
+			obj = candidates ? ptrarray_get_at(candidates, ++ii) : obj->next) {
 		/* Check object type */
 		if (!(class_mask & SC_PKCS15_TYPE_TO_CLASS(obj->type)))
 			continue;
@@ -1470,23 +1643,9 @@ sc_pkcs15_get_objects(struct sc_pkcs15_card *p15card, unsigned int type,
 static int
 compare_obj_id(struct sc_pkcs15_object *obj, const struct sc_pkcs15_id *id)
 {
-	void *data = obj->data;
+	const struct sc_pkcs15_id *obj_id = get_obj_id(obj);
 
-	switch (obj->type & SC_PKCS15_TYPE_CLASS_MASK) {
-	case SC_PKCS15_TYPE_CERT:
-		return sc_pkcs15_compare_id(&((struct sc_pkcs15_cert_info *) data)->id, id);
-	case SC_PKCS15_TYPE_PRKEY:
-		return sc_pkcs15_compare_id(&((struct sc_pkcs15_prkey_info *) data)->id, id);
-	case SC_PKCS15_TYPE_PUBKEY:
-		return sc_pkcs15_compare_id(&((struct sc_pkcs15_pubkey_info *) data)->id, id);
-	case SC_PKCS15_TYPE_SKEY:
-		return sc_pkcs15_compare_id(&((struct sc_pkcs15_skey_info *) data)->id, id);
-	case SC_PKCS15_TYPE_AUTH:
-		return sc_pkcs15_compare_id(&((struct sc_pkcs15_auth_info *) data)->auth_id, id);
-	case SC_PKCS15_TYPE_DATA_OBJECT:
-		return sc_pkcs15_compare_id(&((struct sc_pkcs15_data_info *) data)->id, id);
-	}
-	return 0;
+	return obj_id != NULL && sc_pkcs15_compare_id(obj_id, id);
 }
 
 
@@ -1633,7 +1792,7 @@ find_by_key(struct sc_pkcs15_card *p15card, unsigned int type, struct sc_pkcs15_
 {
 	int r;
 
-	r = sc_pkcs15_get_objects_cond(p15card, type, compare_obj_key, sk, out, 1);
+	r = __sc_pkcs15_search_objects(p15card, 0, type, sk->id, compare_obj_key, sk, out, 1);
 	if (r < 0)
 		return r;
 	if (r == 0)
@@ -1647,7 +1806,7 @@ sc_pkcs15_search_objects(struct sc_pkcs15_card *p15card, struct sc_pkcs15_search
 			struct sc_pkcs15_object **ret, size_t ret_size)
 {
 	return __sc_pkcs15_search_objects(p15card,
-			sk->class_mask, sk->type,
+			sk->class_mask, sk->type, sk->id,
 			compare_obj_key, sk,
 			ret, ret_size);
 }
@@ -1658,7 +1817,7 @@ sc_pkcs15_get_objects_cond(struct sc_pkcs15_card *p15card, unsigned int type,
 		int (* func)(struct sc_pkcs15_object *, void *),
 		void *func_arg, struct sc_pkcs15_object **ret, size_t ret_size)
 {
-	return __sc_pkcs15_search_objects(p15card, 0, type,
+	return __sc_pkcs15_search_objects(p15card, 0, type, NULL,
 			func, func_arg, ret, ret_size);
 }
 
@@ -1673,7 +1832,7 @@ int sc_pkcs15_find_object_by_id(struct sc_pkcs15_card *p15card,
 	memset(&sk, 0, sizeof(sk));
 	sk.id = id;
 
-	r = __sc_pkcs15_search_objects(p15card, 0, type, compare_obj_key, &sk, out, 1);
+	r = __sc_pkcs15_search_objects(p15card, 0, type, id, compare_obj_key, &sk, out, 1);
 	if (r < 0)
 		return r;
 	if (r == 0)
@@ -1844,7 +2003,7 @@ sc_pkcs15_find_data_object_by_app_oid(struct sc_pkcs15_card *p15card, const stru
 	memset(&sk, 0, sizeof(sk));
 	sk.app_oid = app_oid;
 
-	r = __sc_pkcs15_search_objects(p15card, 0, SC_PKCS15_TYPE_DATA_OBJECT,
+	r = __sc_pkcs15_search_objects(p15card, 0, SC_PKCS15_TYPE_DATA_OBJECT, NULL,
 				compare_obj_key, &sk,
 				out, 1);
 	if (r < 0)
@@ -1866,7 +2025,7 @@ sc_pkcs15_find_data_object_by_name(struct sc_pkcs15_card *p15card, const char *a
 	sk.app_label = app_label;
 	sk.label = label;
 
-	r = __sc_pkcs15_search_objects(p15card, 0, SC_PKCS15_TYPE_DATA_OBJECT,
+	r = __sc_pkcs15_search_objects(p15card, 0, SC_PKCS15_TYPE_DATA_OBJECT, NULL,
 				compare_obj_key, &sk,
 				out, 1);
 	if (r < 0)
@@ -1910,19 +2069,25 @@ sc_pkcs15_find_prkey_by_reference(struct sc_pkcs15_card *p15card, const struct s
 int
 sc_pkcs15_add_object(struct sc_pkcs15_card *p15card, struct sc_pkcs15_object *obj)
 {
+	struct sc_pkcs15_object_index *index;
 	struct sc_pkcs15_object *p = p15card->obj_list;
 
 	if (!obj)
 		return 0;
 	obj->next = obj->prev = NULL;
+	index = obj_index_get(p15card);
 	if (p15card->obj_list == NULL) {
 		p15card->obj_list = obj;
-		return 0;
+	} else {
+		if (index != NULL)
+			p = index->tail;
+		while (p->next != NULL)
+			p = p->next;
+		p->next = obj;
+		obj->prev = p;
 	}
-	while (p->next != NULL)
-		p = p->next;
-	p->next = obj;
-	obj->prev = p;
+	if (index != NULL && obj_index_add(index, obj) != SC_SUCCESS)
+		obj_index_free(p15card);
 
 	return 0;
 }
@@ -1931,9 +2096,21 @@ sc_pkcs15_add_object(struct sc_pkcs15_card *p15card, struct sc_pkcs15_object *ob
 void
 sc_pkcs15_remove_object(struct sc_pkcs15_card *p15card, struct sc_pkcs15_object *obj)
 {
+	struct sc_pkcs15_object_index *index = p15card->obj_index;
+	const struct sc_pkcs15_id *id;
+
 	if (!obj)
 		return;
-	else if (obj->prev == NULL)
+	if (index != NULL) {
+		if (index->tail == obj)
+			index->tail = obj->prev;
+		ptrarray_delete(&index->classes[(obj->type & SC_PKCS15_TYPE_CLASS_MASK) >> 8], obj);
+		id = get_obj_id(obj);
+		if (index->have_ids && id != NULL
+				&& ptrarray_delete(&index->ids[obj_id_hash(id)], obj) < 0)
+			obj_index_drop_ids(index);
+	}
+	if (obj->prev == NULL)
 		p15card->obj_list = obj->next;
 	else
 		obj->prev->next = obj->next;
@@ -1947,7 +2124,7 @@ sc_pkcs15_remove_objects(struct sc_pkcs15_card *p15card)
 {
 	struct sc_pkcs15_object *cur = NULL, *next = NULL;
 
-	if (!p15card || !p15card->obj_list)
+	if (!p15card)
 		return;
 	for (cur = p15card->obj_list; cur; cur = next)   {
 		next = cur->next;
@@ -1955,6 +2132,7 @@ sc_pkcs15_remove_objects(struct sc_pkcs15_card *p15card)
 	}
 
 	p15card->obj_list = NULL;
+	obj_index_free(p15card);
 }
 
 
@@ -2579,6 +2757,170 @@ fail:
 }
 
 
+/*
+ * Like sc_pkcs15_read_file(), but a transparent file is passed to the
+ * callback in chunks of at most one response APDU, so the file is never
+ * held in memory as a whole. Cached files and record based files are
+ * read with sc_pkcs15_read_file() and passed in one chunk.
+ * Returns the number of bytes read or an error, which can also be the
+ * non-zero return value of the callback.
+ */
+int
+sc_pkcs15_read_file_stream(struct sc_pkcs15_card *p15card, const struct sc_path *in_path,
+		int private_data, sc_pkcs15_read_cb_t cb, void *cb_arg)
+{
+	struct sc_context *ctx;
+	struct sc_file *file = NULL;
+	unsigned char *data = NULL;
+	size_t len = 0, offset = 0, done = 0, chunk = 0;
+	int r;
+
+	if (p15card == NULL || p15card->card == NULL || in_path == NULL || cb == NULL) {
+		return SC_ERROR_INVALID_ARGUMENTS;
+	}
+	ctx = p15card->card->ctx;
+
+	LOG_FUNC_CALLED(ctx);
+	sc_log(ctx, "path=%s, index=%u, count=%d", sc_print_path(in_path), in_path->index, in_path->count);
+
+	if (p15card->opts.use_file_cache
+	    && ((p15card->opts.use_file_cache & SC_PKCS15_OPTS_CACHE_ALL_FILES) || !private_data))
+		goto whole_file;
+
+	r = sc_lock(p15card->card);
+	LOG_TEST_RET(ctx, r, "sc_lock() failed");
+	r = sc_select_file(p15card->card, in_path, &file);
+	if (r)
+		goto out;
+	if (file->ef_structure != SC_FILE_EF_TRANSPARENT) {
+		sc_unlock(p15card->card);
+		sc_file_free(file);
+		goto whole_file;
+	}
+
+	if (in_path->count < 0) {
+		if (file->size)
+			len = (file->size > MAX_FILE_SIZE)? MAX_FILE_SIZE:file->size;
+		else
+			len = 1024;
+	}
+	else {
+		offset = in_path->index;
+		len = in_path->count;
+		/* Make sure we're within proper bounds */
+		if (offset >= file->size || offset + len > file->size) {
+			r = SC_ERROR_INVALID_ASN1_OBJECT;
+			goto out;
+		}
+	}
+
+	if (len == 0)
+		goto out;
+	chunk = sc_get_max_recv_size(p15card->card);
+	if (chunk == 0 || chunk > len)
+		chunk = len;
+	data = malloc(chunk);
+	if (data == NULL) {
+		r = SC_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	while (done < len) {
+		size_t todo = MIN(chunk, len - done);
+		int n;
+
+		n = sc_read_binary(p15card->card, (unsigned int)(offset + done), data, todo, 0);
+		if (n <= 0) {
+			r = n;
+			break;
+		}
+		done += n;
+		r = cb(cb_arg, data, n);
+		if (r)
+			break;
+		/* sc_read_binary may return less than requested */
+		if ((size_t)n < todo)
+			break;
+	}
+	if (r >= 0)
+		r = (int)done;
+
+out:
+	sc_unlock(p15card->card);
+	sc_file_free(file);
+	if (data) {
+		sc_mem_clear(data, chunk);
+		free(data);
+	}
+	LOG_FUNC_RETURN(ctx, r);
+
+whole_file:
+	r = sc_pkcs15_read_file(p15card, in_path, &data, &len, private_data);
+	LOG_TEST_RET(ctx, r, "Cannot read file");
+	if (len)
+		r = cb(cb_arg, data, len);
+	if (r == 0)
+		r = (int)len;
+	sc_mem_clear(data, len);
+	free(data);
+	LOG_FUNC_RETURN(ctx, r);
+}
+
+
+/*
+ * Number of bytes sc_pkcs15_read_file_stream() passes for the file, as far
+ * as it is known without reading the file. Returns SC_ERROR_NOT_SUPPORTED
+ * for cached and record based files and when the card does not tell the
+ * file size.
+ */
+int
+sc_pkcs15_get_file_len(struct sc_pkcs15_card *p15card, const struct sc_path *in_path,
+		int private_data, size_t *len)
+{
+	struct sc_context *ctx;
+	struct sc_file *file = NULL;
+	int r;
+
+	if (p15card == NULL || p15card->card == NULL || in_path == NULL || len == NULL) {
+		return SC_ERROR_INVALID_ARGUMENTS;
+	}
+	ctx = p15card->card->ctx;
+
+	LOG_FUNC_CALLED(ctx);
+	if (p15card->opts.use_file_cache
+	    && ((p15card->opts.use_file_cache & SC_PKCS15_OPTS_CACHE_ALL_FILES) || !private_data))
+		LOG_FUNC_RETURN(ctx, SC_ERROR_NOT_SUPPORTED);
+
+	r = sc_lock(p15card->card);
+	LOG_TEST_RET(ctx, r, "sc_lock() failed");
+	r = sc_select_file(p15card->card, in_path, &file);
+	if (r)
+		goto out;
+
+	if (file->ef_structure != SC_FILE_EF_TRANSPARENT) {
+		r = SC_ERROR_NOT_SUPPORTED;
+	}
+	else if (in_path->count >= 0) {
+		if ((size_t)in_path->index >= file->size
+				|| (size_t)in_path->index + in_path->count > file->size)
+			r = SC_ERROR_INVALID_ASN1_OBJECT;
+		else
+			*len = in_path->count;
+	}
+	else if (file->size == 0) {
+		r = SC_ERROR_NOT_SUPPORTED;
+	}
+	else {
+		*len = (file->size > MAX_FILE_SIZE)? MAX_FILE_SIZE:file->size;
+	}
+
+out:
+	sc_unlock(p15card->card);
+	sc_file_free(file);
+	LOG_FUNC_RETURN(ctx, r);
+}
+
+
 int
 sc_pkcs15_compare_id(const struct sc_pkcs15_id *id1, const struct sc_pkcs15_id *id2)
 {
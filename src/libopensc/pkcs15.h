@@ -168,6 +168,10 @@ struct sc_pkcs15_data {
 };
 typedef struct sc_pkcs15_data sc_pkcs15_data_t;
 
+/* Receives the data of sc_pkcs15_read_file_stream() chunk by chunk,
+ * a non-zero return value stops reading */
+typedef int (*sc_pkcs15_read_cb_t)(void *arg, const u8 *data, size_t len);
+
 #define sc_pkcs15_skey sc_pkcs15_data
 #define sc_pkcs15_skey_t sc_pkcs15_data_t
 
@@ -566,6 +570,8 @@ struct sc_pkcs15_operations   {
 			unsigned char *, size_t *);
 };
 
+struct sc_pkcs15_object_index;
+
 typedef struct sc_pkcs15_card {
 	sc_card_t *card;
 	unsigned int flags;
@@ -577,6 +583,8 @@ typedef struct sc_pkcs15_card {
 
 	struct sc_pkcs15_df *df_list;
 	struct sc_pkcs15_object *obj_list;
+	/* per class and per ID lookup tables over obj_list, used internally */
+	struct sc_pkcs15_object_index *obj_index;
 	sc_pkcs15_tokeninfo_t *tokeninfo;
 	sc_pkcs15_unusedspace_t *unusedspace_list;
 	int unusedspace_read;
@@ -684,6 +692,10 @@ int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
 				const struct sc_pkcs15_object *prkey_obj,
 				unsigned long alg_flags, const u8 *in,
 				size_t inlen, u8 *out, size_t outlen, void *pMechanism);
+int sc_pkcs15_compute_signature_keep_env(struct sc_pkcs15_card *p15card,
+				const struct sc_pkcs15_object *prkey_obj,
+				unsigned long alg_flags, const u8 *in,
+				size_t inlen, u8 *out, size_t outlen, void *pMechanism);
 
 int sc_pkcs15_encrypt_sym(struct sc_pkcs15_card *p15card,
 		const struct sc_pkcs15_object *obj,
@@ -740,6 +752,10 @@ int sc_pkcs15_read_data_object(struct sc_pkcs15_card *p15card,
 			       const struct sc_pkcs15_data_info *info,
 			       int private_obj,
 			       struct sc_pkcs15_data **data_object_out);
+int sc_pkcs15_read_data_object_stream(struct sc_pkcs15_card *p15card,
+			       const struct sc_pkcs15_data_info *info,
+			       int private_obj,
+			       sc_pkcs15_read_cb_t cb, void *cb_arg);
 int sc_pkcs15_find_data_object_by_id(struct sc_pkcs15_card *p15card,
 				     const struct sc_pkcs15_id *id,
 				     struct sc_pkcs15_object **out);
@@ -756,6 +772,9 @@ int sc_pkcs15_read_certificate(struct sc_pkcs15_card *card,
 			       const struct sc_pkcs15_cert_info *info,
 			       int private_obj,
 			       struct sc_pkcs15_cert **cert);
+int sc_pkcs15_read_certificates(struct sc_pkcs15_card *card,
+				struct sc_pkcs15_object **objs, size_t count,
+				struct sc_pkcs15_cert **certs, int *results);
 void sc_pkcs15_free_certificate(struct sc_pkcs15_cert *cert);
 int sc_pkcs15_find_cert_by_id(struct sc_pkcs15_card *card,
 			      const struct sc_pkcs15_id *id,
@@ -902,6 +921,9 @@ int sc_pkcs15_add_object(struct sc_pkcs15_card *p15card,
 			 struct sc_pkcs15_object *obj);
 void sc_pkcs15_remove_object(struct sc_pkcs15_card *p15card,
 			     struct sc_pkcs15_object *obj);
+/* To be called after changing the ID (or the auth ID of an authentication
+ * object) of objects that are already on the object list */
+void sc_pkcs15_reindex_objects(struct sc_pkcs15_card *p15card);
 int sc_pkcs15_add_df(struct sc_pkcs15_card *, unsigned int, const sc_path_t *);
 
 int sc_pkcs15_add_unusedspace(struct sc_pkcs15_card *p15card,
@@ -927,6 +949,11 @@ void sc_pkcs15_free_object(struct sc_pkcs15_object *obj);
 int sc_pkcs15_read_file(struct sc_pkcs15_card *p15card,
 			const struct sc_path *path,
 			u8 **buf, size_t *buflen, int private_data);
+int sc_pkcs15_read_file_stream(struct sc_pkcs15_card *p15card,
+			const struct sc_path *path, int private_data,
+			sc_pkcs15_read_cb_t cb, void *cb_arg);
+int sc_pkcs15_get_file_len(struct sc_pkcs15_card *p15card,
+			const struct sc_path *path, int private_data, size_t *len);
 
 /* Caching functions */
 int sc_pkcs15_read_cached_file(struct sc_pkcs15_card *p15card,
@@ -935,6 +962,9 @@ int sc_pkcs15_read_cached_file(struct sc_pkcs15_card *p15card,
 int sc_pkcs15_cache_file(struct sc_pkcs15_card *p15card,
 			 const struct sc_path *path,
 			 const u8 *buf, size_t bufsize);
+int sc_pkcs15_cache_validate_file_list(struct sc_pkcs15_card *p15card,
+			 const struct sc_aid *aid,
+			 const u8 *list, size_t list_len);
 
 /* PKCS #15 ID handling functions */
 int sc_pkcs15_compare_id(const struct sc_pkcs15_id *id1,
@@ -350,6 +350,70 @@ out:
 	return r;
 }
 
+static int pcsc_transmit_sequence(sc_reader_t *reader, sc_apdu_t *apdus, size_t count)
+{
+	size_t ssize, rsize, sbuflen = 0, rbuflen = 258, i;
+	u8 *sbuf = NULL, *rbuf = NULL;
+	int r = SC_SUCCESS;
+
+	/* one send and one receive buffer, big enough for all APDUs */
+	for (i = 0; i < count; i++) {
+		ssize = sc_apdu_get_length(&apdus[i], reader->active_protocol);
+		if (ssize == 0)
+			return SC_ERROR_INTERNAL;
+		if (ssize > sbuflen)
+			sbuflen = ssize;
+		if (apdus[i].resplen + 2 > rbuflen)
+			rbuflen = apdus[i].resplen + 2;
+	}
+	sbuf = malloc(sbuflen);
+	rbuf = malloc(rbuflen);
+	if (sbuf == NULL || rbuf == NULL) {
+		r = SC_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+	if (reader->name)
+		sc_log(reader->ctx, "reader '%s'", reader->name);
+
+	for (i = 0; i < count; ) {
+		sc_apdu_t *apdu = &apdus[i];
+
+		ssize = sc_apdu_get_length(apdu, reader->active_protocol);
+		r = sc_apdu2bytes(reader->ctx, apdu, reader->active_protocol, sbuf, ssize);
+		if (r != SC_SUCCESS)
+			break;
+		sc_apdu_log(reader->ctx, sbuf, ssize, 1);
+
+		rsize = rbuflen;
+		r = pcsc_internal_transmit(reader, sbuf, ssize,
+					rbuf, &rsize, apdu->control);
+		if (r < 0) {
+			sc_log(reader->ctx, "unable to transmit");
+			break;
+		}
+		sc_apdu_log(reader->ctx, rbuf, rsize, 0);
+		APDU_LOG(rbuf, (uint16_t)rsize);
+		r = sc_apdu_set_resp(reader->ctx, apdu, rbuf, rsize);
+		if (r != SC_SUCCESS)
+			break;
+		i++;
+		if (apdu->sw1 != 0x90 || apdu->sw2 != 0x00)
+			break;
+	}
+
+out:
+	if (sbuf != NULL) {
+		sc_mem_clear(sbuf, sbuflen);
+		free(sbuf);
+	}
+	if (rbuf != NULL) {
+		sc_mem_clear(rbuf, rbuflen);
+		free(rbuf);
+	}
+
+	return r < 0 ? r : (int)i;
+}
+
 /* Calls SCardGetStatusChange on the reader to set ATR and associated flags
  * (card present/changed) */
 static int refresh_attributes(sc_reader_t *reader)
@@ -2572,7 +2636,7 @@ int pcsc_use_reader(sc_context_t *ctx, void * pcsc_context_handle, void * pcsc_c
 	/* if we already have a reader, update it */
 	if (sc_ctx_get_reader_count(ctx) > 0) {
 		sc_log(ctx, "Reusing the reader");
-		sc_reader_t *reader = list_get_at(&ctx->readers, 0);
+		sc_reader_t *reader = ptrarray_get_at(&ctx->readers, 0);
 
 		if (reader) {
 			struct pcsc_private_data *priv = reader->drv_data;
@@ -2619,6 +2683,7 @@ struct sc_reader_driver * sc_get_pcsc_driver(void)
 	pcsc_ops.finish = pcsc_finish;
 	pcsc_ops.detect_readers = pcsc_detect_readers;
 	pcsc_ops.transmit = pcsc_transmit;
+	pcsc_ops.transmit_sequence = pcsc_transmit_sequence;
 	pcsc_ops.detect_card_presence = pcsc_detect_card_presence;
 	pcsc_ops.lock = pcsc_lock;
 	pcsc_ops.unlock = pcsc_unlock;
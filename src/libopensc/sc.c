@@ -49,6 +49,7 @@ static const char *sc_version = "(undef)";
 #else
 #include <sys/mman.h>
 #include <limits.h>
+#include <time.h>
 #include <unistd.h>
 #ifndef PAGESIZE
 #define PAGESIZE 0
@@ -334,6 +335,51 @@ int sc_valid_oid(const struct sc_object_id *oid)
 }
 
 
+/*
+ * The linger state of a reader is changed by sc_lock() and sc_unlock() under
+ * the card mutex, and by sc_detect_card_presence() and sc_wait_for_event()
+ * without it. reader->linger_mutex serializes all of them.
+ */
+void sc_reader_start_linger(sc_reader_t *reader, unsigned int ms)
+{
+	sc_mutex_lock(reader->ctx, reader->linger_mutex);
+	reader->linger_until = sc_timestamp_us() + ms * 1000ULL;
+	sc_mutex_unlock(reader->ctx, reader->linger_mutex);
+}
+
+int sc_reader_take_linger(sc_reader_t *reader)
+{
+	int lingering = 0;
+
+	sc_mutex_lock(reader->ctx, reader->linger_mutex);
+	if (reader->linger_until) {
+		lingering = sc_timestamp_us() < reader->linger_until;
+		reader->linger_until = 0;
+		if (!lingering) {
+			sc_log(reader->ctx, "Ending the kept reader transaction");
+			if (reader->ops->unlock != NULL)
+				reader->ops->unlock(reader);
+		}
+	}
+	sc_mutex_unlock(reader->ctx, reader->linger_mutex);
+	return lingering;
+}
+
+void sc_reader_end_linger(sc_reader_t *reader, int force)
+{
+	if (reader == NULL)
+		return;
+	sc_mutex_lock(reader->ctx, reader->linger_mutex);
+	if (reader->linger_until != 0
+			&& (force || sc_timestamp_us() >= reader->linger_until)) {
+		sc_log(reader->ctx, "Ending the kept reader transaction");
+		reader->linger_until = 0;
+		if (reader->ops->unlock != NULL)
+			reader->ops->unlock(reader);
+	}
+	sc_mutex_unlock(reader->ctx, reader->linger_mutex);
+}
+
 int sc_detect_card_presence(sc_reader_t *reader)
 {
 	int r;
@@ -341,6 +387,7 @@ int sc_detect_card_presence(sc_reader_t *reader)
 	if (reader->ops->detect_card_presence == NULL)
 		LOG_FUNC_RETURN(reader->ctx, SC_ERROR_NOT_SUPPORTED);
 
+	sc_reader_end_linger(reader, 0);
 	r = reader->ops->detect_card_presence(reader);
 
 	// Check that we get sane return value from backend
@@ -1145,6 +1192,24 @@ unsigned long sc_thread_id(const sc_context_t *ctx)
 		return ctx->thread_ctx->thread_id();
 }
 
+unsigned long long sc_timestamp_us(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+
+	if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&count))
+		return 0;
+	return (unsigned long long)(count.QuadPart / freq.QuadPart) * 1000000ULL
+		+ (unsigned long long)(count.QuadPart % freq.QuadPart) * 1000000ULL / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+	return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000;
+#endif
+}
+
 void sc_free(void *p)
 {
 	free(p);
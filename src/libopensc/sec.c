@@ -108,6 +108,8 @@ int sc_set_security_env(sc_card_t *card,
 	LOG_FUNC_CALLED(card->ctx);
 	if (card->ops->set_security_env == NULL)
 		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_NOT_SUPPORTED);
+	/* drivers without an APDU for this still replace the environment */
+	card->cache.security_env_valid = 0;
 	r = card->ops->set_security_env(card, env, se_num);
         SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, r);
 }
@@ -122,6 +124,7 @@ int sc_restore_security_env(sc_card_t *card, int se_num)
 	LOG_FUNC_CALLED(card->ctx);
 	if (card->ops->restore_security_env == NULL)
 		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_NOT_SUPPORTED);
+	card->cache.security_env_valid = 0;
 	r = card->ops->restore_security_env(card, se_num);
 	SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, r);
 }
@@ -0,0 +1,340 @@
+/*
+ * shared-state.c: Card state shared between processes using the same reader
+ *
+ * Every process that talks to a card keeps its own select cache. Without
+ * further information it has to assume that another process changed the
+ * card while it did not hold the reader transaction, and cards flagged
+ * "keep_alive" drop the cache on every sc_unlock() for that reason.
+ *
+ * With "shared_card_state" enabled, the processes keep a small shared
+ * memory segment per reader with a generation counter and the current
+ * path. A process that sent APDUs bumps the generation before it ends the
+ * transaction. The next process compares the generation with the one it
+ * saw last: if nobody else talked to the card, its cache and the applet
+ * selection are still valid. The segment is only accessed while holding
+ * the reader transaction, which serializes the processes.
+ *
+ * This only helps when every application using the card is an OpenSC
+ * process with this option enabled, others do not bump the generation.
+ * The segment is named after the user and the reader, and only a segment
+ * owned by the user and writable by nobody else is used: its contents
+ * decide whether the applet is selected again, so it must not be forged.
+ * Processes of other users therefore count as foreign applications.
+ *
+ * A process marks the segment dirty before it sends the first APDU of a
+ * transaction and clears the mark when it publishes the new generation.
+ * If it dies in between, the next process finds the mark and treats the
+ * card as changed.
+ *
+ * The attached processes are kept in the segment by their process ID. The
+ * last process detaching from a segment removes it, entries of processes
+ * that no longer exist are dropped on the way. It marks the segment dead
+ * first: a process that mapped it just before the removal sees the mark
+ * at its next transaction, treats the card as changed and maps the segment
+ * under the name again.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "internal.h"
+
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+
+#define SC_SHARED_STATE_MAGIC	0x4F534353	/* "OSCS" */
+#define SC_SHARED_STATE_USERS	32
+
+/* The layout of the shared segment */
+struct sc_shared_segment {
+	unsigned int magic;
+	unsigned int size;		/* sizeof(struct sc_shared_segment) */
+	unsigned long long generation;	/* bumped whenever a process sent APDUs */
+	int path_valid;
+	int dirty;			/* APDUs sent, generation not bumped yet */
+	struct sc_path current_path;	/* the card's current path after that */
+	unsigned int dead;		/* the segment was removed, map it again */
+	pid_t users[SC_SHARED_STATE_USERS];	/* attached processes */
+};
+
+/* FNV-1a, to derive the segment name from the reader name */
+static unsigned long long
+reader_name_hash(const char *name)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static void
+shared_segment_name(const char *reader_name, char *name, size_t len)
+{
+	snprintf(name, len, "/opensc-%lu-%016llx",
+			(unsigned long)geteuid(), reader_name_hash(reader_name));
+}
+
+/* Drops the entries of processes that no longer exist */
+static void
+shared_segment_prune(struct sc_shared_segment *segment)
+{
+	pid_t pid;
+	int i;
+
+	for (i = 0; i < SC_SHARED_STATE_USERS; i++) {
+		pid = segment->users[i];
+		if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH)
+			__sync_bool_compare_and_swap(&segment->users[i], pid, 0);
+	}
+}
+
+static int
+shared_segment_map(struct sc_context *ctx, const char *name, struct sc_shared_segment **out)
+{
+	struct sc_shared_segment *segment;
+	struct stat st;
+	pid_t pid = getpid();
+	int fd, i;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd < 0 && errno == EEXIST)
+		fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		sc_log(ctx, "Cannot open shared card state %s", name);
+		return SC_ERROR_INTERNAL;
+	}
+	/* whoever can write it decides whether we select the applet again */
+	if (fstat(fd, &st) != 0 || st.st_uid != geteuid()
+			|| (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+		close(fd);
+		sc_log(ctx, "Shared card state %s is not private to this user, not using it", name);
+		return SC_ERROR_SECURITY_STATUS_NOT_SATISFIED;
+	}
+	/* only grow it: a segment of another version may be in use */
+	if ((size_t)st.st_size < sizeof(struct sc_shared_segment)
+			&& ftruncate(fd, sizeof(struct sc_shared_segment)) != 0) {
+		close(fd);
+		sc_log(ctx, "Cannot size shared card state %s", name);
+		return SC_ERROR_INTERNAL;
+	}
+	segment = mmap(NULL, sizeof(struct sc_shared_segment),
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED) {
+		sc_log(ctx, "Cannot map shared card state %s", name);
+		return SC_ERROR_INTERNAL;
+	}
+
+	shared_segment_prune(segment);
+	for (i = 0; i < SC_SHARED_STATE_USERS; i++)
+		if (__sync_bool_compare_and_swap(&segment->users[i], 0, pid))
+			break;
+	/* not counted, the segment may be removed under us: then it is
+	 * marked dead and we map it again */
+	if (i == SC_SHARED_STATE_USERS)
+		sc_log(ctx, "Too many processes attached to %s", name);
+	*out = segment;
+	return SC_SUCCESS;
+}
+
+int
+sc_card_shared_state_attach(struct sc_card *card)
+{
+	struct sc_context *ctx = card->ctx;
+	struct sc_card_shared_state *state;
+	struct sc_shared_segment *segment;
+	int r;
+
+	if (!(ctx->flags & SC_CTX_FLAG_SHARED_CARD_STATE) || card->reader->name == NULL)
+		return SC_SUCCESS;
+	/* without reader transactions the processes are not serialized */
+	if (card->reader->ops->lock == NULL)
+		return SC_SUCCESS;
+
+	state = calloc(1, sizeof(struct sc_card_shared_state));
+	if (state == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	shared_segment_name(card->reader->name, state->name, sizeof(state->name));
+	r = shared_segment_map(ctx, state->name, &segment);
+	if (r != SC_SUCCESS) {
+		free(state);
+		return r;
+	}
+	state->segment = segment;
+	card->shared_state = state;
+	sc_log(ctx, "Sharing card state through %s", state->name);
+	return SC_SUCCESS;
+}
+
+void
+sc_card_shared_state_detach(struct sc_card *card)
+{
+	struct sc_card_shared_state *state = card->shared_state;
+	struct sc_shared_segment *segment;
+	pid_t pid = getpid();
+	int i;
+
+	if (state == NULL)
+		return;
+	segment = state->segment;
+	for (i = 0; i < SC_SHARED_STATE_USERS; i++)
+		if (__sync_bool_compare_and_swap(&segment->users[i], pid, 0))
+			break;
+	shared_segment_prune(segment);
+	for (i = 0; i < SC_SHARED_STATE_USERS; i++)
+		if (segment->users[i] != 0)
+			break;
+	/* only one of the last processes removes it */
+	if (i == SC_SHARED_STATE_USERS && __sync_bool_compare_and_swap(&segment->dead, 0, 1))
+		shm_unlink(state->name);
+	munmap(segment, sizeof(struct sc_shared_segment));
+	free(state);
+	card->shared_state = NULL;
+}
+
+int
+sc_card_shared_state_acquire(struct sc_card *card, int was_reset)
+{
+	struct sc_card_shared_state *state = card->shared_state;
+	struct sc_shared_segment *segment = state->segment;
+
+	state->changed = 0;
+	if (segment->dead) {
+		/* removed by the last other process, continue with the new one */
+		munmap(segment, sizeof(struct sc_shared_segment));
+		if (shared_segment_map(card->ctx, state->name, &segment) != SC_SUCCESS) {
+			free(state);
+			card->shared_state = NULL;
+			sc_invalidate_cache(card);
+			return 0;
+		}
+		state->segment = segment;
+		state->generation = 0;
+	}
+	if (segment->magic != SC_SHARED_STATE_MAGIC
+			|| segment->size != sizeof(struct sc_shared_segment)) {
+		/* new segment or one of a different OpenSC version */
+		segment->magic = SC_SHARED_STATE_MAGIC;
+		segment->size = sizeof(struct sc_shared_segment);
+		segment->generation = 1;
+		segment->path_valid = 0;
+		segment->dirty = 0;
+	}
+	else if (segment->dirty) {
+		/* a process died while it talked to the card */
+		segment->generation++;
+		segment->path_valid = 0;
+		segment->dirty = 0;
+	}
+	else if (!was_reset && segment->generation == state->generation) {
+		return 1;
+	}
+
+	sc_log(card->ctx, "Card state changed by another process (generation %llu, last seen %llu)",
+			segment->generation, state->generation);
+	sc_invalidate_cache(card);
+	/* written by another process, do not trust it blindly */
+	if (!was_reset && segment->path_valid
+			&& segment->current_path.len <= SC_MAX_PATH_SIZE
+			&& segment->current_path.aid.len <= SC_MAX_AID_SIZE)
+		card->cache.current_path = segment->current_path;
+	state->generation = segment->generation;
+	return 0;
+}
+
+void
+sc_card_shared_state_release(struct sc_card *card)
+{
+	struct sc_card_shared_state *state = card->shared_state;
+	struct sc_shared_segment *segment;
+
+	if (state == NULL || !state->changed)
+		return;
+	segment = state->segment;
+	segment->generation++;
+	segment->path_valid = card->cache.valid && card->cache.current_path.len > 0;
+	if (segment->path_valid)
+		segment->current_path = card->cache.current_path;
+	__sync_synchronize();
+	segment->dirty = 0;
+	state->generation = segment->generation;
+	state->changed = 0;
+}
+
+void
+sc_card_shared_state_mark_changed(struct sc_card *card)
+{
+	struct sc_card_shared_state *state = card->shared_state;
+	struct sc_shared_segment *segment;
+
+	if (state == NULL || state->changed)
+		return;
+	segment = state->segment;
+	segment->dirty = 1;
+	__sync_synchronize();
+	state->changed = 1;
+}
+
+#else
+
+int
+sc_card_shared_state_attach(struct sc_card *card)
+{
+	if (card->ctx->flags & SC_CTX_FLAG_SHARED_CARD_STATE)
+		sc_log(card->ctx, "Shared card state is not supported on this platform");
+	return SC_SUCCESS;
+}
+
+void
+sc_card_shared_state_detach(struct sc_card *card)
+{
+}
+
+int
+sc_card_shared_state_acquire(struct sc_card *card, int was_reset)
+{
+	return 0;
+}
+
+void
+sc_card_shared_state_release(struct sc_card *card)
+{
+}
+
+void
+sc_card_shared_state_mark_changed(struct sc_card *card)
+{
+}
+
+#endif
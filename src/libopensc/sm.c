@@ -139,8 +139,11 @@ sc_sm_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 	rv = card->sm_ctx.ops.get_sm_apdu(card, apdu, &sm_apdu);
 	if (rv == SC_ERROR_SM_NOT_APPLIED)   {
 		/* SM wrap of this APDU is ignored by card driver.
-		 * Send plain APDU to the reader driver */
-		rv = card->reader->ops->transmit(card->reader, apdu);
+		 * Send plain APDU, flagged as NO_SM so that it goes to the
+		 * reader driver and is counted like any other APDU */
+		apdu->flags |= SC_APDU_FLAGS_NO_SM;
+		rv = sc_single_transmit(card, apdu);
+		apdu->flags &= ~SC_APDU_FLAGS_NO_SM;
 		LOG_FUNC_RETURN(ctx, rv);
 	} else {
 		if (rv < 0)
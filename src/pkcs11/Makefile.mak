@@ -6,7 +6,7 @@ TARGET3			= pkcs11-spy.dll
 
 OBJECTS			= pkcs11-global.obj pkcs11-session.obj pkcs11-object.obj misc.obj slot.obj \
 				  mechanism.obj openssl.obj framework-pkcs15.obj framework-pkcs15init.obj \
-				  debug.obj pkcs11-display.obj versioninfo-pkcs11.res
+				  attr-cache.obj debug.obj pkcs11-display.obj versioninfo-pkcs11.res
 OBJECTS3		= pkcs11-spy.obj pkcs11-display.obj versioninfo-pkcs11-spy.res
 
 LIBS = $(TOPDIR)\src\libopensc\opensc_a.lib \
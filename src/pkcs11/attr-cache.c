@@ -0,0 +1,109 @@
+/*
+ * attr-cache.c: Cache of encoded attribute values of one object
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sc-pkcs11.h"
+
+struct sc_pkcs11_attr_cache_entry {
+	CK_ATTRIBUTE_TYPE	type;
+	unsigned char *		value;
+	CK_ULONG		len;
+};
+
+/* Copies a cached value like the get_attribute() operations do */
+static CK_RV
+attr_cache_copy(const struct sc_pkcs11_attr_cache_entry *entry, CK_ATTRIBUTE_PTR attr)
+{
+	if (attr->pValue == NULL_PTR) {
+		attr->ulValueLen = entry->len;
+		return CKR_OK;
+	}
+	if (attr->ulValueLen < entry->len) {
+		attr->ulValueLen = entry->len;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+	attr->ulValueLen = entry->len;
+	memcpy(attr->pValue, entry->value, entry->len);
+	return CKR_OK;
+}
+
+/*
+ * Returns the attribute from the cache, or gets it with get_attribute()
+ * and keeps it. The owner of the cache clears it whenever the data the
+ * values are encoded from changes or is freed. Values get_attribute()
+ * fails on are not cached.
+ */
+CK_RV
+sc_pkcs11_attr_cache_get(struct sc_pkcs11_attr_cache *cache,
+		struct sc_pkcs11_session *session, void *object, CK_ATTRIBUTE_PTR attr,
+		CK_RV (*get_attribute)(struct sc_pkcs11_session *, void *, CK_ATTRIBUTE_PTR))
+{
+	struct sc_pkcs11_attr_cache_entry *entry, *tmp;
+	CK_ATTRIBUTE value;
+	unsigned int i;
+	CK_RV rv;
+
+	for (i = 0; i < cache->count; i++)
+		if (cache->entries[i].type == attr->type)
+			return attr_cache_copy(&cache->entries[i], attr);
+
+	value.type = attr->type;
+	value.pValue = NULL_PTR;
+	value.ulValueLen = 0;
+	rv = get_attribute(session, object, &value);
+	if (rv != CKR_OK)
+		return rv;
+	/* cleared, as get_attribute() may succeed without writing the value */
+	if (value.ulValueLen == 0 || value.ulValueLen == (CK_ULONG) -1
+			|| (value.pValue = calloc(1, value.ulValueLen)) == NULL)
+		return get_attribute(session, object, attr);
+	rv = get_attribute(session, object, &value);
+	if (rv != CKR_OK) {
+		free(value.pValue);
+		return rv;
+	}
+
+	tmp = realloc(cache->entries, (cache->count + 1) * sizeof(*tmp));
+	if (tmp == NULL) {
+		free(value.pValue);
+		return get_attribute(session, object, attr);
+	}
+	cache->entries = tmp;
+	entry = &cache->entries[cache->count++];
+	entry->type = attr->type;
+	entry->value = value.pValue;
+	entry->len = value.ulValueLen;
+
+	return attr_cache_copy(entry, attr);
+}
+
+void
+sc_pkcs11_attr_cache_clear(struct sc_pkcs11_attr_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->count; i++)
+		free(cache->entries[i].value);
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->count = 0;
+}
@@ -45,6 +45,10 @@
 
 struct pkcs15_slot_data {
 	struct sc_pkcs15_object *auth_obj;
+	/* PIN status of auth_obj is cached until this sc_timestamp_us() or a
+	 * card reset */
+	unsigned long long pin_info_expires;
+	unsigned int pin_info_reset_count;
 };
 #define slot_data(p)		((struct pkcs15_slot_data *) (p))
 #define slot_data_auth(p)	(((p) && slot_data(p)) ? slot_data(p)->auth_obj : NULL)
@@ -80,6 +84,7 @@ struct pkcs15_any_object {
 	struct pkcs15_pubkey_object *	related_pubkey;
 	struct pkcs15_cert_object *	related_cert;
 	struct pkcs15_prkey_object *	related_privkey;
+	struct sc_pkcs11_attr_cache	attr_cache;
 };
 
 struct pkcs15_cert_object {
@@ -517,6 +522,7 @@ __pkcs15_release_object(struct pkcs15_any_object *obj)
 	if (--(obj->refcount) != 0)
 		return obj->refcount;
 
+	sc_pkcs11_attr_cache_clear(&obj->attr_cache);
 	sc_mem_clear(obj, obj->size);
 	free(obj);
 
@@ -544,6 +550,55 @@ __pkcs15_delete_object(struct pkcs15_fw_data *fw_data, struct pkcs15_any_object
 }
 #endif
 
+/*
+ * Refresh the PIN status of the slot's authentication object, unless
+ * it was read from the card recently enough.
+ */
+static int
+pkcs15_get_pin_info(struct sc_pkcs11_slot *slot, struct sc_pkcs15_card *p15card,
+		struct sc_pkcs15_object *pin_obj)
+{
+	struct pkcs15_slot_data *data = slot_data(slot->fw_data);
+	unsigned long long now;
+	int r;
+
+	if (!data || data->auth_obj != pin_obj || sc_pkcs11_conf.pin_status_ttl == 0)
+		return sc_pkcs15_get_pin_info(p15card, pin_obj);
+
+	now = sc_timestamp_us();
+	if (now != 0 && now < data->pin_info_expires
+			&& data->pin_info_reset_count == p15card->card->reset_count) {
+		sc_log(context, "Using cached PIN status");
+		return SC_SUCCESS;
+	}
+
+	r = sc_pkcs15_get_pin_info(p15card, pin_obj);
+	if (r == SC_SUCCESS && now != 0) {
+		data->pin_info_expires = now + sc_pkcs11_conf.pin_status_ttl * 1000000ULL;
+		data->pin_info_reset_count = p15card->card->reset_count;
+	} else {
+		data->pin_info_expires = 0;
+	}
+	return r;
+}
+
+/*
+ * Forget the cached PIN status of all slots of the card, e.g. after
+ * the PIN was verified, changed or the card was logged out.
+ */
+static void
+pkcs15_invalidate_pin_info(struct sc_pkcs11_card *p11card)
+{
+	unsigned int i;
+
+	for (i = 0; i < ptrarray_size(&virtual_slots); i++) {
+		struct sc_pkcs11_slot *slot = (struct sc_pkcs11_slot *) ptrarray_get_at(&virtual_slots, i);
+
+		if (slot && slot->p11card == p11card && slot->fw_data)
+			slot_data(slot->fw_data)->pin_info_expires = 0;
+	}
+}
+
 CK_RV C_GetTokenInfo(CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo)
 {
 	struct sc_pkcs11_slot *slot;
@@ -598,7 +653,7 @@ CK_RV C_GetTokenInfo(CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo)
 			goto out;
 		}
 
-		sc_pkcs15_get_pin_info(p15card, auth);
+		pkcs15_get_pin_info(slot, p15card, auth);
 
 		if (pin_info->tries_left >= 0) {
 			if (pin_info->tries_left == 1 || pin_info->max_tries == 1)
@@ -675,12 +730,13 @@ pkcs15_cert_extract_label(struct pkcs15_cert_object *cert)
 	}
 }
 
+/* Create the object of a certificate that was already read (or is private,
+ * then p15_cert is NULL). Takes ownership of p15_cert. */
 static int
-__pkcs15_create_cert_object(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_object *cert,
-		struct pkcs15_any_object **cert_object)
+pkcs15_create_cert_object_from_data(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_object *cert,
+		struct sc_pkcs15_cert *p15_cert, struct pkcs15_any_object **cert_object)
 {
 	struct sc_pkcs15_cert_info *p15_info = NULL;
-	struct sc_pkcs15_cert *p15_cert = NULL;
 	struct pkcs15_any_object *any_object = NULL;
 	struct pkcs15_cert_object *object = NULL;
 	struct pkcs15_pubkey_object *obj2 = NULL;
@@ -689,15 +745,6 @@ __pkcs15_create_cert_object(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_obj
 
 	p15_info = (struct sc_pkcs15_cert_info *) cert->data;
 
-	if (cert->flags & SC_PKCS15_CO_FLAG_PRIVATE)  {	/* is the cert private? */
-		p15_cert = NULL;			/* will read cert when needed */
-	}
-	else    {
-		rv = sc_pkcs15_read_certificate(fw_data->p15_card, p15_info, 0, &p15_cert);
-		if (rv < 0)
-			return rv;
-	}
-
 	/* Certificate object */
 	rv = __pkcs15_create_object(fw_data, &any_object,
 			cert, &pkcs15_cert_ops, sizeof(struct pkcs15_cert_object));
@@ -722,8 +769,10 @@ __pkcs15_create_cert_object(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_obj
 
 	if (p15_cert) {
 		 /* make a copy of public key from the cert */
-		if (!obj2->pub_data)
+		if (!obj2->pub_data) {
 			rv = sc_pkcs15_pubkey_from_cert(context, &p15_cert->data, &obj2->pub_data);
+			sc_pkcs11_attr_cache_clear(&obj2->base.attr_cache);
+		}
 		if (rv < 0)
 			return rv;
 	}
@@ -740,6 +789,23 @@ __pkcs15_create_cert_object(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_obj
 	return 0;
 }
 
+static int
+__pkcs15_create_cert_object(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_object *cert,
+		struct pkcs15_any_object **cert_object)
+{
+	struct sc_pkcs15_cert *p15_cert = NULL;
+	int rv;
+
+	if (!(cert->flags & SC_PKCS15_CO_FLAG_PRIVATE))  {
+		rv = sc_pkcs15_read_certificate(fw_data->p15_card,
+				(struct sc_pkcs15_cert_info *) cert->data, 0, &p15_cert);
+		if (rv < 0)
+			return rv;
+	}
+	/* private certificates are read when needed */
+	return pkcs15_create_cert_object_from_data(fw_data, cert, p15_cert, cert_object);
+}
+
 
 static int
 __pkcs15_create_pubkey_object(struct pkcs15_fw_data *fw_data,
@@ -911,6 +977,49 @@ pkcs15_create_pkcs11_objects(struct pkcs15_fw_data *fw_data, int p15_type, const
 }
 
 
+/* Like pkcs15_create_pkcs11_objects() for the certificates, but all public
+ * certificates are read up front in a single card transaction */
+static int
+pkcs15_create_cert_objects(struct pkcs15_fw_data *fw_data)
+{
+	struct sc_pkcs15_object *p15_object[MAX_OBJECTS];
+	struct sc_pkcs15_object *to_read[MAX_OBJECTS];
+	struct sc_pkcs15_cert *certs[MAX_OBJECTS];
+	struct sc_pkcs15_cert *p15_cert;
+	int results[MAX_OBJECTS];
+	int i, n, count, rv;
+
+	rv = count = sc_pkcs15_get_objects(fw_data->p15_card, SC_PKCS15_TYPE_CERT_X509, p15_object, MAX_OBJECTS);
+	if (rv < 0)
+		return rv;
+	sc_log(context, "Found %d certificate%s", count, (count == 1)? "" : "s");
+
+	for (i = 0, n = 0; i < count; i++)
+		if (!(p15_object[i]->flags & SC_PKCS15_CO_FLAG_PRIVATE))
+			to_read[n++] = p15_object[i];
+	rv = sc_pkcs15_read_certificates(fw_data->p15_card, to_read, n, certs, results);
+	if (rv < 0)
+		return rv;
+
+	/* as before, stop at the first certificate that fails */
+	for (i = 0, n = 0, rv = 0; i < count; i++) {
+		p15_cert = NULL;
+		if (!(p15_object[i]->flags & SC_PKCS15_CO_FLAG_PRIVATE)) {
+			p15_cert = certs[n];
+			if (rv >= 0)
+				rv = results[n];
+			n++;
+		}
+		if (rv >= 0)
+			rv = pkcs15_create_cert_object_from_data(fw_data, p15_object[i], p15_cert, NULL);
+		else if (p15_cert)
+			sc_pkcs15_free_certificate(p15_cert);
+	}
+
+	return count;
+}
+
+
 static void
 __pkcs15_prkey_bind_related(struct pkcs15_fw_data *fw_data, struct pkcs15_prkey_object *pk)
 {
@@ -1022,12 +1131,19 @@ pkcs15_bind_related_objects(struct pkcs15_fw_data *fw_data)
 
 
 /* We deferred reading of the cert until needed, as it may be
- * a private object, so we must wait till login to read  */
+ * a private object, so we must wait till login to read.
+ * The other unread certificates of the same kind will be needed as well,
+ * read them in the same card transaction. */
 static int
 check_cert_data_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *cert)
 {
+	struct pkcs15_cert_object *pending[MAX_OBJECTS];
+	struct sc_pkcs15_object *p15_objects[MAX_OBJECTS];
+	struct sc_pkcs15_cert *certs[MAX_OBJECTS];
+	int results[MAX_OBJECTS];
 	struct pkcs15_pubkey_object *obj2;
-	int rv;
+	unsigned int i, count = 0;
+	int rv, read;
 	int private_obj;
 
 	if (!cert)
@@ -1036,22 +1152,48 @@ check_cert_data_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *
 	if (cert->cert_data)
 		return 0;
 	private_obj = cert->cert_flags & SC_PKCS15_CO_FLAG_PRIVATE;
-	rv = sc_pkcs15_read_certificate(fw_data->p15_card, cert->cert_info, private_obj, &cert->cert_data);
-	if (rv < 0)
-		return rv;
 
-	obj2 = cert->cert_pubkey;
-	/* make a copy of public key from the cert data */
-	if (!obj2->pub_data)
-		rv = sc_pkcs15_pubkey_from_cert(context, &cert->cert_data->data, &obj2->pub_data);
+	pending[count++] = cert;
+	for (i = 0; i < fw_data->num_objects; i++) {
+		struct pkcs15_cert_object *other = (struct pkcs15_cert_object *) fw_data->objects[i];
 
-	/* Find missing labels for certificate */
-	pkcs15_cert_extract_label(cert);
+		if (!is_cert(fw_data->objects[i]) || other == cert || other->cert_data
+				|| other->cert_p15obj == NULL
+				|| (other->cert_flags & SC_PKCS15_CO_FLAG_PRIVATE) != private_obj)
+			continue;
+		pending[count++] = other;
+	}
+	for (i = 0; i < count; i++)
+		p15_objects[i] = pending[i]->cert_p15obj;
 
-	/* now that we have the cert and pub key, lets see if we can bind anything else */
-	pkcs15_bind_related_objects(fw_data);
+	read = sc_pkcs15_read_certificates(fw_data->p15_card, p15_objects, count, certs, results);
+	if (read < 0)
+		return read;
 
-	return rv;
+	for (i = 0; i < count; i++) {
+		if (certs[i] == NULL)
+			continue;
+		pending[i]->cert_data = certs[i];
+
+		obj2 = pending[i]->cert_pubkey;
+		/* make a copy of public key from the cert data */
+		rv = 0;
+		if (!obj2->pub_data) {
+			rv = sc_pkcs15_pubkey_from_cert(context, &certs[i]->data, &obj2->pub_data);
+			sc_pkcs11_attr_cache_clear(&obj2->base.attr_cache);
+		}
+		if (i == 0)
+			results[0] = rv;
+
+		/* Find missing labels for certificate */
+		pkcs15_cert_extract_label(pending[i]);
+	}
+
+	/* now that we have the certs and pub keys, lets see if we can bind anything else */
+	if (read > 0)
+		pkcs15_bind_related_objects(fw_data);
+
+	return results[0];
 }
 
 
@@ -1069,13 +1211,13 @@ pkcs15_add_object(struct sc_pkcs11_slot *slot, struct pkcs15_any_object *obj,
 	if (obj->base.flags & (SC_PKCS11_OBJECT_HIDDEN | SC_PKCS11_OBJECT_RECURS))
 		return;
 
-	if (list_contains(&slot->objects, obj))
+	if (ptrarray_locate(&slot->objects, obj) >= 0)
 		return;
 
 	if (pHandle != NULL)
 		*pHandle = handle;
 
-	list_append(&slot->objects, obj);
+	ptrarray_append(&slot->objects, obj);
 	sc_log(context, "Slot:%lX Setting object handle of 0x%lx to 0x%lx",
 		   slot->id, obj->base.handle, handle);
 	obj->base.handle = handle;
@@ -1314,8 +1456,7 @@ _pkcs15_create_typed_objects(struct pkcs15_fw_data *fw_data)
 	if (rv < 0)
 		return rv;
 
-	rv = pkcs15_create_pkcs11_objects(fw_data, SC_PKCS15_TYPE_CERT_X509, "certificate",
-			__pkcs15_create_cert_object);
+	rv = pkcs15_create_cert_objects(fw_data);
 	if (rv < 0)
 		return rv;
 
@@ -1388,7 +1529,7 @@ int slot_get_logged_in_state(struct sc_pkcs11_slot *slot)
 	pin_info = (struct sc_pkcs15_auth_info *)pin_obj->data;
 	if (!pin_info)
 		goto out;
-	sc_pkcs15_get_pin_info(p15card, pin_obj);
+	pkcs15_get_pin_info(slot, p15card, pin_obj);
 	logged_in = pin_info->logged_in;
 out:
 	return logged_in;
@@ -1710,6 +1851,7 @@ pkcs15_login(struct sc_pkcs11_slot *slot, CK_USER_TYPE userType,
 	if (slot->p11card == NULL)
 		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, "C_Login");
 	p11card = slot->p11card;
+	pkcs15_invalidate_pin_info(p11card);
 
 	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[slot->fw_data_idx];
 	if (!fw_data)
@@ -1879,6 +2021,7 @@ pkcs15_logout(struct sc_pkcs11_slot *slot)
 
 	if (!p11card)
 		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, "C_Logout");
+	pkcs15_invalidate_pin_info(p11card);
 	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[slot->fw_data_idx];
 	if (!fw_data)
 		return sc_to_cryptoki_error(SC_ERROR_INTERNAL, "C_Logout");
@@ -1926,6 +2069,7 @@ pkcs15_change_pin(struct sc_pkcs11_slot *slot,
 
 	if (!p11card)
 		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, "C_SetPin");
+	pkcs15_invalidate_pin_info(p11card);
 	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[slot->fw_data_idx];
 	if (!fw_data)
 		return sc_to_cryptoki_error(SC_ERROR_INTERNAL, "C_SetPin");
@@ -2124,6 +2268,7 @@ pkcs15_init_pin(struct sc_pkcs11_slot *slot, CK_CHAR_PTR pPin, CK_ULONG ulPinLen
 
 	if (!p11card)
 		return CKR_TOKEN_NOT_RECOGNIZED;
+	pkcs15_invalidate_pin_info(p11card);
 	rc = sc_card_ctl(p11card->card, SC_CARDCTL_PKCS11_INIT_PIN, &p11args);
 	if (rc != SC_ERROR_NOT_SUPPORTED) {
 		if (rc == SC_SUCCESS)
@@ -2448,6 +2593,7 @@ pkcs15_create_secret_key(struct sc_pkcs11_slot *slot, struct sc_profile *profile
 
 	switch (key_type) {
 		case CKK_GENERIC_SECRET:
+		case CKK_CHACHA20:
 			args.algorithm = SC_ALGORITHM_UNDEFINED;
 			break;
 		case CKK_AES:
@@ -3403,7 +3549,7 @@ pkcs15_skey_destroy(struct sc_pkcs11_session *session, void *object)
 
 	/* Oppose to pkcs15_add_object */
 	--any_obj->refcount; /* correct refcount */
-	list_delete(&session->slot->objects, any_obj);
+	ptrarray_delete(&session->slot->objects, any_obj);
 	/* Delete object in pkcs15 */
 	rv = __pkcs15_delete_object(fw_data, any_obj);
 
@@ -3463,7 +3609,7 @@ pkcs15_any_destroy(struct sc_pkcs11_session *session, void *object)
 		struct pkcs15_pubkey_object *pubkey = any_obj->related_pubkey;
 
 		/* Check if key is not removed in between */
-		if (list_locate(&session->slot->objects, ao_pubkey) > 0) {
+		if (ptrarray_locate(&session->slot->objects, ao_pubkey) >= 0) {
 			sc_log(context, "Found related pubkey %p", any_obj->related_pubkey);
 
 			/* Delete reference to related certificate of the public key PKCS#11 object */
@@ -3473,12 +3619,13 @@ pkcs15_any_destroy(struct sc_pkcs11_session *session, void *object)
 				/* Unlink related public key FW object if it has no corresponding PKCS#15 object
 				 * and was created from certificate. */
 				--ao_pubkey->refcount;
-				list_delete(&session->slot->objects, ao_pubkey);
+				ptrarray_delete(&session->slot->objects, ao_pubkey);
 				/* Delete public key object in pkcs15 */
 				if (pubkey->pub_data)   {
 					sc_log(context, "Found pub_data %p", pubkey->pub_data);
 					sc_pkcs15_free_pubkey(pubkey->pub_data);
 					pubkey->pub_data = NULL;
+					sc_pkcs11_attr_cache_clear(&ao_pubkey->attr_cache);
 				}
 				__pkcs15_delete_object(fw_data, ao_pubkey);
 			}
@@ -3491,7 +3638,7 @@ pkcs15_any_destroy(struct sc_pkcs11_session *session, void *object)
 	if (rv >= 0) {
 		/* Oppose to pkcs15_add_object */
 		--any_obj->refcount; /* correct refcount */
-		list_delete(&session->slot->objects, any_obj);
+		ptrarray_delete(&session->slot->objects, any_obj);
 		/* Delete object in pkcs15 */
 		rv = __pkcs15_delete_object(fw_data, any_obj);
 	}
@@ -3863,10 +4010,36 @@ static CK_RV pkcs15_prkey_set_attribute(struct sc_pkcs11_session *session,
                                CK_ATTRIBUTE_PTR attr)
 {
 	struct pkcs15_prkey_object *prkey = (struct pkcs15_prkey_object*) object;
+
 	return pkcs15_set_attrib(session, prkey->base.p15_object, attr);
 }
 
 
+/*
+ * Public key material (modulus, EC point, SPKI, ...) is DER encoded from
+ * the PKCS#15 structures and may need certificates to be read from the
+ * card first. Materialize such values once per object and answer later
+ * requests from the cache. The cache is cleared whenever pub_data is
+ * replaced or freed. Private keys are not cached, as their public values
+ * depend on a public key or certificate that may only be found later.
+ */
+static int
+pkcs15_attr_is_cacheable(CK_ATTRIBUTE_TYPE type)
+{
+	switch (type) {
+	case CKA_VALUE:
+	case CKA_SPKI:
+	case CKA_MODULUS:
+	case CKA_MODULUS_BITS:
+	case CKA_PUBLIC_EXPONENT:
+	case CKA_EC_PARAMS:
+	case CKA_EC_POINT:
+		return 1;
+	}
+	return 0;
+}
+
+
 static CK_RV
 pkcs15_prkey_get_attribute(struct sc_pkcs11_session *session,
 		void *object, CK_ATTRIBUTE_PTR attr)
@@ -4136,6 +4309,9 @@ pkcs15_prkey_sign(struct sc_pkcs11_session *session, void *obj,
 	struct pkcs15_prkey_object *prkey = (struct pkcs15_prkey_object *) obj;
 	struct sc_pkcs11_card *p11card = session->slot->p11card;
 	struct pkcs15_fw_data *fw_data = NULL;
+	struct sc_pkcs11_operation *message_op;
+	int (*compute_signature)(struct sc_pkcs15_card *, const struct sc_pkcs15_object *,
+			unsigned long, const u8 *, size_t, u8 *, size_t, void *);
 	CK_RV rv;
 	int flags = 0, prkey_has_path = 0, rc;
 	unsigned sign_flags = SC_PKCS15_PRKEY_USAGE_SIGN | SC_PKCS15_PRKEY_USAGE_SIGNRECOVER
@@ -4290,10 +4466,15 @@ pkcs15_prkey_sign(struct sc_pkcs11_session *session, void *obj,
 	if (rc < 0)
 		return sc_to_cryptoki_error(rc, "C_Sign");
 
+	/* the messages of one C_MessageSignInit() share the security environment */
+	message_op = session->operation[SC_PKCS11_OPERATION_MESSAGE_SIGN];
+	compute_signature = (message_op && pMechanism == &message_op->mechanism)
+		? sc_pkcs15_compute_signature_keep_env : sc_pkcs15_compute_signature;
+
 	sc_log(context,
 	       "Selected flags %X. Now computing signature for %lu bytes. %lu bytes reserved.",
 	       flags, ulDataLen, *pulDataLen);
-	rc = sc_pkcs15_compute_signature(fw_data->p15_card, prkey->prv_p15obj, flags,
+	rc = compute_signature(fw_data->p15_card, prkey->prv_p15obj, flags,
 			pData, ulDataLen, pSignature, *pulDataLen, pMechanism);
 	if (rc < 0 && !sc_pkcs11_conf.lock_login && !prkey_has_path) {
 		/* If private key PKCS#15 object do not have 'path' attribute,
@@ -4303,7 +4484,7 @@ pkcs15_prkey_sign(struct sc_pkcs11_session *session, void *obj,
 		 * In this particular case try to 'reselect' application DF.
 		 */
 		if (reselect_app_df(fw_data->p15_card) == SC_SUCCESS)
-			rc = sc_pkcs15_compute_signature(fw_data->p15_card, prkey->prv_p15obj, flags,
+			rc = compute_signature(fw_data->p15_card, prkey->prv_p15obj, flags,
 					pData, ulDataLen, pSignature, *pulDataLen, pMechanism);
 	}
 
@@ -4320,6 +4501,67 @@ pkcs15_prkey_sign(struct sc_pkcs11_session *session, void *obj,
 }
 
 
+/*
+ * A secret key session object that is only held in memory has no file on
+ * the card to unwrap into. The wrapped key is decrypted with the card instead
+ * and the value is kept in the object, so the module can use the key without
+ * the card afterwards, e.g. for C_EncryptMessage().
+ */
+static int
+pkcs15_skey_in_memory(const struct sc_pkcs15_object *obj)
+{
+	const struct sc_pkcs15_skey_info *skey_info = (const struct sc_pkcs15_skey_info *) obj->data;
+
+	return obj->session_object && skey_info != NULL
+		&& (obj->type & SC_PKCS15_TYPE_CLASS_MASK) == SC_PKCS15_TYPE_SKEY
+		&& skey_info->path.len == 0 && skey_info->path.aid.len == 0;
+}
+
+static CK_RV
+pkcs15_skey_set_unwrapped_value(struct sc_pkcs15_object *obj, const u8 *value, size_t len)
+{
+	struct sc_pkcs15_skey_info *skey_info = (struct sc_pkcs15_skey_info *) obj->data;
+	u8 *copy;
+
+	if (len == 0 || (skey_info->value_len != 0 && skey_info->value_len != len * 8))
+		return CKR_WRAPPED_KEY_INVALID;
+	copy = malloc(len);
+	if (copy == NULL)
+		return CKR_HOST_MEMORY;
+	memcpy(copy, value, len);
+	if (skey_info->data.value) {
+		sc_mem_clear(skey_info->data.value, skey_info->data.len);
+		free(skey_info->data.value);
+	}
+	skey_info->data.value = copy;
+	skey_info->data.len = len;
+	skey_info->value_len = len * 8;
+	return CKR_OK;
+}
+
+/* Init, decrypt and finalize in one go, as sc_pkcs11_decrypt() does */
+static int
+pkcs15_skey_decrypt_value(struct sc_pkcs15_card *p15card, struct sc_pkcs15_object *obj,
+		unsigned long flags, const u8 *in, size_t inlen, u8 *out, size_t *outlen,
+		const u8 *param, size_t paramlen)
+{
+	size_t len = *outlen, last_len;
+	int rv;
+
+	rv = sc_pkcs15_decrypt_sym(p15card, obj, flags, NULL, 0, NULL, NULL, param, paramlen);
+	if (rv < 0)
+		return rv;
+	rv = sc_pkcs15_decrypt_sym(p15card, obj, flags, in, inlen, out, &len, param, paramlen);
+	if (rv < 0)
+		return rv;
+	last_len = *outlen - len;
+	rv = sc_pkcs15_decrypt_sym(p15card, obj, flags, NULL, 0, out + len, &last_len, param, paramlen);
+	if (rv < 0)
+		return rv;
+	*outlen = len + last_len;
+	return SC_SUCCESS;
+}
+
 static CK_RV
 pkcs15_prkey_unwrap(struct sc_pkcs11_session *session, void *obj,
 			CK_MECHANISM_PTR pMechanism, CK_BYTE_PTR pWrappedKey,
@@ -4373,6 +4615,20 @@ pkcs15_prkey_unwrap(struct sc_pkcs11_session *session, void *obj,
 	if (rv < 0)
 		return sc_to_cryptoki_error(rv, "C_UnwrapKey");
 
+	if (pkcs15_skey_in_memory(targetKeyObj->p15_object)) {
+		u8 value[512]; /* FIXME: Will not work for keys above 4096 bits */
+		CK_RV ckrv;
+
+		rv = sc_pkcs15_decipher(fw_data->p15_card, prkey->prv_p15obj, flags,
+			pWrappedKey, ulWrappedKeyLen, value, sizeof(value), pMechanism);
+		sc_unlock(p11card->card);
+		if (rv < 0)
+			return sc_to_cryptoki_error(rv, "C_UnwrapKey");
+		ckrv = pkcs15_skey_set_unwrapped_value(targetKeyObj->p15_object, value, rv);
+		sc_mem_clear(value, sizeof(value));
+		return ckrv;
+	}
+
 	/* Call the card to do the unwrap operation */
 	rv = sc_pkcs15_unwrap(fw_data->p15_card, prkey->prv_p15obj, targetKeyObj->p15_object, flags,
 		pWrappedKey, ulWrappedKeyLen, NULL, 0);
@@ -4756,12 +5012,14 @@ pkcs15_pubkey_set_attribute(struct sc_pkcs11_session *session,
 		void *object, CK_ATTRIBUTE_PTR attr)
 {
 	struct pkcs15_pubkey_object *pubkey = (struct pkcs15_pubkey_object*) object;
+
+	sc_pkcs11_attr_cache_clear(&pubkey->base.attr_cache);
 	return pkcs15_set_attrib(session, pubkey->base.p15_object, attr);
 }
 
 
 static CK_RV
-pkcs15_pubkey_get_attribute(struct sc_pkcs11_session *session, void *object, CK_ATTRIBUTE_PTR attr)
+__pkcs15_pubkey_get_attribute(struct sc_pkcs11_session *session, void *object, CK_ATTRIBUTE_PTR attr)
 {
 	struct sc_pkcs11_card *p11card = NULL;
 	struct pkcs15_pubkey_object *pubkey = (struct pkcs15_pubkey_object*) object;
@@ -4979,6 +5237,17 @@ pkcs15_pubkey_get_attribute(struct sc_pkcs11_session *session, void *object, CK_
 	return CKR_OK;
 }
 
+static CK_RV
+pkcs15_pubkey_get_attribute(struct sc_pkcs11_session *session, void *object, CK_ATTRIBUTE_PTR attr)
+{
+	struct pkcs15_pubkey_object *pubkey = (struct pkcs15_pubkey_object*) object;
+
+	if (pkcs15_attr_is_cacheable(attr->type))
+		return sc_pkcs11_attr_cache_get(&pubkey->base.attr_cache, session, object,
+				attr, __pkcs15_pubkey_get_attribute);
+	return __pkcs15_pubkey_get_attribute(session, object, attr);
+}
+
 struct sc_pkcs11_object_ops pkcs15_pubkey_ops = {
 	pkcs15_pubkey_release,
 	pkcs15_pubkey_set_attribute,
@@ -5015,27 +5284,48 @@ pkcs15_dobj_set_attribute(struct sc_pkcs11_session *session,
 }
 
 
+struct dobj_value_reader {
+	CK_ATTRIBUTE_PTR attr;
+	CK_ULONG len;
+	int too_small;
+};
+
+/* Copy a chunk of the DATA object value to the attribute. Without a
+ * buffer the value is only counted. Once the buffer is too small the
+ * rest of the value is not needed, so reading stops */
+static int
+dobj_value_chunk(void *arg, const u8 *data, size_t len)
+{
+	struct dobj_value_reader *reader = (struct dobj_value_reader *) arg;
+
+	if (reader->attr->pValue != NULL_PTR) {
+		if (len > reader->attr->ulValueLen - reader->len) {
+			reader->too_small = 1;
+			return SC_ERROR_BUFFER_TOO_SMALL;
+		}
+		memcpy((u8 *) reader->attr->pValue + reader->len, data, len);
+	}
+	reader->len += len;
+	return 0;
+}
+
 static CK_RV
 pkcs15_dobj_get_value(struct sc_pkcs11_session *session,
 		struct pkcs15_data_object *dobj,
-		struct sc_pkcs15_data **out_data)
+		CK_ATTRIBUTE_PTR attr)
 {
 	struct sc_pkcs11_card *p11card = session->slot->p11card;
 	struct pkcs15_fw_data *fw_data = NULL;
+	struct dobj_value_reader reader = { attr, 0, 0 };
+	struct sc_pkcs15_data_info *info = dobj->info;
+	struct sc_pkcs15_data *data = NULL;
 	struct sc_card *card;
+	size_t len;
 	int rv;
-	int private_obj;
 
 	if (!p11card)
 		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, "C_GetAttributeValue");
 	card = session->slot->p11card->card;
-	if (!out_data)
-		return SC_ERROR_INVALID_ARGUMENTS;
-	if (dobj->info->data.len == 0)
-	/* CKA_VALUE is empty we may need to read it */
-	{
-		*out_data = NULL;
-	}
 
 	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[session->slot->fw_data_idx];
 	if (!fw_data)
@@ -5047,25 +5337,49 @@ pkcs15_dobj_get_value(struct sc_pkcs11_session *session,
 	if (rv < 0)
 		return sc_to_cryptoki_error(rv, "C_GetAttributeValue");
 
-	private_obj = dobj->data_flags;
-	rv = sc_pkcs15_read_data_object(fw_data->p15_card, dobj->info, private_obj, out_data);
+	/* Asking for the length only must not read the whole object: take it
+	 * from the file size, or read the value once and keep it */
+	if (attr->pValue == NULL_PTR && !info->data.value) {
+		rv = sc_pkcs15_get_file_len(fw_data->p15_card, &info->path,
+				dobj->data_flags, &len);
+		if (rv == SC_SUCCESS) {
+			sc_unlock(card);
+			attr->ulValueLen = len;
+			return CKR_OK;
+		}
+		if (rv == SC_ERROR_NOT_SUPPORTED)
+			rv = sc_pkcs15_read_data_object(fw_data->p15_card, info,
+					dobj->data_flags, &data);
+		sc_pkcs15_free_data_object(data);
+		if (rv < 0) {
+			sc_unlock(card);
+			return sc_to_cryptoki_error(rv, "C_GetAttributeValue");
+		}
+	}
+
+	/* The value goes straight to the application buffer */
+	rv = sc_pkcs15_read_data_object_stream(fw_data->p15_card, info,
+			dobj->data_flags, dobj_value_chunk, &reader);
 
 	sc_unlock(card);
+	if (reader.too_small) {
+		attr->ulValueLen = CK_UNAVAILABLE_INFORMATION;
+		return CKR_BUFFER_TOO_SMALL;
+	}
 	if (rv < 0)
 		return sc_to_cryptoki_error(rv, "C_GetAttributeValue");
 
-	return rv;
-}
-
-
-static CK_RV
-data_value_to_attr(CK_ATTRIBUTE_PTR attr, struct sc_pkcs15_data *data)
-{
-	if (!attr || !data)
-		return CKR_ATTRIBUTE_VALUE_INVALID;
+	/* Keep the value read into the application buffer, as
+	 * sc_pkcs15_read_data_object() does */
+	if (!info->data.value && attr->pValue != NULL_PTR && reader.len > 0) {
+		info->data.value = malloc(reader.len);
+		if (info->data.value) {
+			memcpy(info->data.value, attr->pValue, reader.len);
+			info->data.len = reader.len;
+		}
+	}
 
-	check_attribute_buffer(attr, data->data_len);
-	memcpy(attr->pValue, data->data, data->data_len);
+	attr->ulValueLen = reader.len;
 	return CKR_OK;
 }
 
@@ -5074,7 +5388,6 @@ static CK_RV
 pkcs15_dobj_get_attribute(struct sc_pkcs11_session *session, void *object, CK_ATTRIBUTE_PTR attr)
 {
 	struct pkcs15_data_object *dobj = (struct pkcs15_data_object*) object;
-	struct sc_pkcs15_data *data = NULL;
 	CK_RV rv;
 	size_t len;
 	int r;
@@ -5137,21 +5450,7 @@ pkcs15_dobj_get_attribute(struct sc_pkcs11_session *session, void *object, CK_AT
 		free(buf);
 		break;
 	case CKA_VALUE:
-		/* if CKA_VALUE is empty, sets data to NULL */
-		rv = pkcs15_dobj_get_value(session, dobj, &data);
-		if (rv == CKR_OK) {
-			if (data) {
-				rv = data_value_to_attr(attr, data);
-			}
-			else {
-				attr->ulValueLen = 0;
-				attr->pValue = NULL_PTR;
-			}
-		}
-		if (data) {
-			free(data->data);
-			free(data);
-		}
+		rv = pkcs15_dobj_get_value(session, dobj, attr);
 		if (rv != CKR_OK)
 			return rv;
 		break;
@@ -5448,6 +5747,31 @@ pkcs15_skey_unwrap(struct sc_pkcs11_session *session, void *obj,
 	if (rv < 0)
 		return sc_to_cryptoki_error(rv, "C_UnwrapKey");
 
+	if (pkcs15_skey_in_memory(targetKeyObj->prv_p15obj)) {
+		u8 *value;
+		size_t len = ulWrappedKeyLen;
+		CK_RV ckrv;
+
+		value = malloc(len);
+		if (value == NULL) {
+			sc_unlock(p11card->card);
+			return CKR_HOST_MEMORY;
+		}
+		rv = pkcs15_skey_decrypt_value(fw_data->p15_card, skey->prv_p15obj, flags,
+			pWrappedKey, ulWrappedKeyLen, value, &len,
+			pMechanism->pParameter, pMechanism->ulParameterLen);
+		sc_unlock(p11card->card);
+		if (rv < 0) {
+			sc_mem_clear(value, ulWrappedKeyLen);
+			free(value);
+			return sc_to_cryptoki_error(rv, "C_UnwrapKey");
+		}
+		ckrv = pkcs15_skey_set_unwrapped_value(targetKeyObj->prv_p15obj, value, len);
+		sc_mem_clear(value, ulWrappedKeyLen);
+		free(value);
+		return ckrv;
+	}
+
 	/* Call the card to do the unwrap operation */
 	rv = sc_pkcs15_unwrap(fw_data->p15_card, skey->prv_p15obj, targetKeyObj->prv_p15obj, flags,
 		pWrappedKey, ulWrappedKeyLen, pMechanism->pParameter, pMechanism->ulParameterLen);
@@ -41,6 +41,9 @@ struct operation_data {
 	sc_pkcs11_operation_t *md;
 	CK_BYTE			*buffer;
 	CK_ULONG		buffer_len;
+	/* message-based signing */
+	int			in_message;
+	int			needs_restart;
 };
 
 static struct operation_data *
@@ -362,12 +365,12 @@ sc_pkcs11_md_final(struct sc_pkcs11_session *session,
 }
 
 /*
- * Initialize a signing context. When we get here, we know
- * the key object is capable of signing _something_
+ * Initialize a signing context of the given operation type. When
+ * we get here, we know the key object is capable of signing _something_
  */
-CK_RV
-sc_pkcs11_sign_init(struct sc_pkcs11_session *session, CK_MECHANISM_PTR pMechanism,
-		    struct sc_pkcs11_object *key, CK_KEY_TYPE key_type)
+static CK_RV
+sign_init_operation(struct sc_pkcs11_session *session, int op_type,
+		CK_MECHANISM_PTR pMechanism, struct sc_pkcs11_object *key, CK_KEY_TYPE key_type)
 {
 	struct sc_pkcs11_card *p11card;
 	sc_pkcs11_operation_t *operation;
@@ -394,7 +397,7 @@ sc_pkcs11_sign_init(struct sc_pkcs11_session *session, CK_MECHANISM_PTR pMechani
 	    pMechanism->ulParameterLen > sizeof(operation->mechanism_params))
 		LOG_FUNC_RETURN(context, CKR_ARGUMENTS_BAD);
 
-	rv = session_start_operation(session, SC_PKCS11_OPERATION_SIGN, mt, &operation);
+	rv = session_start_operation(session, op_type, mt, &operation);
 	if (rv != CKR_OK)
 		LOG_FUNC_RETURN(context, (int) rv);
 
@@ -406,11 +409,18 @@ sc_pkcs11_sign_init(struct sc_pkcs11_session *session, CK_MECHANISM_PTR pMechani
 	}
 	rv = mt->sign_init(operation, key);
 	if (rv != CKR_OK)
-		session_stop_operation(session, SC_PKCS11_OPERATION_SIGN);
+		session_stop_operation(session, op_type);
 
 	LOG_FUNC_RETURN(context, (int) rv);
 }
 
+CK_RV
+sc_pkcs11_sign_init(struct sc_pkcs11_session *session, CK_MECHANISM_PTR pMechanism,
+		    struct sc_pkcs11_object *key, CK_KEY_TYPE key_type)
+{
+	return sign_init_operation(session, SC_PKCS11_OPERATION_SIGN, pMechanism, key, key_type);
+}
+
 CK_RV
 sc_pkcs11_sign_update(struct sc_pkcs11_session *session,
 		      CK_BYTE_PTR pData, CK_ULONG ulDataLen)
@@ -653,6 +663,318 @@ sc_pkcs11_signature_size(sc_pkcs11_operation_t *operation, CK_ULONG_PTR pLength)
 	LOG_FUNC_RETURN(context, (int) rv);
 }
 
+/*
+ * Message-based signing (PKCS#11 3.0). The mechanism, the key and the
+ * mechanism parameters are checked once by sc_pkcs11_message_sign_init().
+ * The operation then stays active until sc_pkcs11_message_sign_final() and
+ * each message only restarts the hash operation, if there is one. The card
+ * keeps the security environment of the first message for the following
+ * ones while no other command was sent to it in between.
+ */
+CK_RV
+sc_pkcs11_message_sign_init(struct sc_pkcs11_session *session, CK_MECHANISM_PTR pMechanism,
+		struct sc_pkcs11_object *key, CK_KEY_TYPE key_type)
+{
+	return sign_init_operation(session, SC_PKCS11_OPERATION_MESSAGE_SIGN,
+			pMechanism, key, key_type);
+}
+
+/* Forget the previous message, if any */
+static CK_RV
+signature_restart(sc_pkcs11_operation_t *operation)
+{
+	struct operation_data *data = (struct operation_data *)operation->priv_data;
+	CK_RV rv;
+
+	if (!data->needs_restart)
+		return CKR_OK;
+
+	sc_mem_secure_clear_free(data->buffer, data->buffer_len);
+	data->buffer = NULL;
+	data->buffer_len = 0;
+	if (data->info) {
+		sc_pkcs11_release_operation(&data->md);
+		data->md = sc_pkcs11_new_operation(operation->session, data->info->hash_type);
+		if (data->md == NULL)
+			return CKR_HOST_MEMORY;
+		rv = data->info->hash_type->md_init(data->md);
+		if (rv != CKR_OK) {
+			sc_pkcs11_release_operation(&data->md);
+			return rv;
+		}
+	}
+	data->needs_restart = 0;
+	return CKR_OK;
+}
+
+static void
+signature_message_done(sc_pkcs11_operation_t *operation)
+{
+	struct operation_data *data = (struct operation_data *)operation->priv_data;
+
+	data->in_message = 0;
+	data->needs_restart = 1;
+}
+
+static CK_RV
+get_message_sign_operation(struct sc_pkcs11_session *session, int in_message,
+		sc_pkcs11_operation_t **op)
+{
+	CK_RV rv;
+
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_MESSAGE_SIGN, op);
+	if (rv != CKR_OK)
+		return rv;
+	if (((struct operation_data *)(*op)->priv_data)->in_message != in_message)
+		return in_message ? CKR_OPERATION_NOT_INITIALIZED : CKR_OPERATION_ACTIVE;
+	return CKR_OK;
+}
+
+CK_RV
+sc_pkcs11_message_sign_begin(struct sc_pkcs11_session *session)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	LOG_FUNC_CALLED(context);
+	rv = get_message_sign_operation(session, 0, &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	rv = signature_restart(op);
+	if (rv == CKR_OK)
+		((struct operation_data *)op->priv_data)->in_message = 1;
+
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+CK_RV
+sc_pkcs11_message_sign_update(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pData, CK_ULONG ulDataLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	LOG_FUNC_CALLED(context);
+	rv = get_message_sign_operation(session, 1, &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	rv = op->type->sign_update(op, pData, ulDataLen);
+	if (rv != CKR_OK)
+		signature_message_done(op);
+
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+/*
+ * Sign the current message. As with sc_pkcs11_sign_final(), asking for
+ * the length or passing a too small buffer leaves the message open.
+ */
+CK_RV
+sc_pkcs11_message_sign_end(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	LOG_FUNC_CALLED(context);
+	rv = get_message_sign_operation(session, 1, &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	rv = op->type->sign_final(op, pSignature, pulSignatureLen);
+	if (rv != CKR_BUFFER_TOO_SMALL && pSignature != NULL)
+		signature_message_done(op);
+
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+/* Sign a complete message */
+CK_RV
+sc_pkcs11_message_sign(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	CK_RV rv;
+
+	rv = sc_pkcs11_message_sign_begin(session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_sign_update(session, pData, ulDataLen);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_sign_end(session, pSignature, pulSignatureLen);
+	return rv;
+}
+
+CK_RV
+sc_pkcs11_message_sign_size(struct sc_pkcs11_session *session, CK_ULONG_PTR pLength)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_MESSAGE_SIGN, &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	rv = op->type->sign_size(op, pLength);
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+CK_RV
+sc_pkcs11_message_sign_final(struct sc_pkcs11_session *session)
+{
+	CK_RV rv;
+
+	LOG_FUNC_CALLED(context);
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_MESSAGE_SIGN, NULL);
+	if (rv == CKR_OK)
+		session_stop_operation(session, SC_PKCS11_OPERATION_MESSAGE_SIGN);
+
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+/*
+ * Message-based encryption and decryption (PKCS#11 3.0). Only software
+ * mechanisms implement these (see openssl.c): they take the key once in
+ * message_init and then handle every message in memory.
+ */
+static int
+message_crypt_op_type(CK_FLAGS flags)
+{
+	return flags == CKF_MESSAGE_ENCRYPT ? SC_PKCS11_OPERATION_MESSAGE_ENCRYPT
+		: SC_PKCS11_OPERATION_MESSAGE_DECRYPT;
+}
+
+CK_RV
+sc_pkcs11_message_crypt_init(struct sc_pkcs11_session *session, CK_FLAGS flags,
+		CK_MECHANISM_PTR pMechanism, struct sc_pkcs11_object *key, CK_KEY_TYPE key_type)
+{
+	struct sc_pkcs11_card *p11card;
+	sc_pkcs11_operation_t *operation;
+	sc_pkcs11_mechanism_type_t *mt;
+	int op_type = message_crypt_op_type(flags);
+	CK_RV rv;
+
+	LOG_FUNC_CALLED(context);
+	if (!session || !session->slot || !(p11card = session->slot->p11card))
+		LOG_FUNC_RETURN(context, CKR_ARGUMENTS_BAD);
+
+	sc_log(context, "mechanism 0x%lX, key-type 0x%lX",
+	       pMechanism->mechanism, key_type);
+	mt = sc_pkcs11_find_mechanism(p11card, pMechanism->mechanism, flags);
+	if (mt == NULL || mt->message_init == NULL)
+		LOG_FUNC_RETURN(context, CKR_MECHANISM_INVALID);
+
+	rv = _validate_key_type(mt, key_type);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	if (pMechanism->pParameter &&
+	    pMechanism->ulParameterLen > sizeof(operation->mechanism_params))
+		LOG_FUNC_RETURN(context, CKR_ARGUMENTS_BAD);
+
+	rv = session_start_operation(session, op_type, mt, &operation);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	memcpy(&operation->mechanism, pMechanism, sizeof(CK_MECHANISM));
+	if (pMechanism->pParameter) {
+		memcpy(&operation->mechanism_params, pMechanism->pParameter,
+		       pMechanism->ulParameterLen);
+		operation->mechanism.pParameter = &operation->mechanism_params;
+	}
+	rv = mt->message_init(operation, key, flags);
+	if (rv != CKR_OK)
+		session_stop_operation(session, op_type);
+
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+CK_RV
+sc_pkcs11_message_crypt_begin(struct sc_pkcs11_session *session, CK_FLAGS flags,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, message_crypt_op_type(flags), &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	rv = op->type->message_begin(op, pParameter, ulParameterLen,
+			pAssociatedData, ulAssociatedDataLen);
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+/*
+ * Process a part of the current message; CKF_END_OF_MESSAGE in msg_flags
+ * completes it. A NULL pOut only asks for the output length.
+ */
+CK_RV
+sc_pkcs11_message_crypt_next(struct sc_pkcs11_session *session, CK_FLAGS flags,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen, CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen,
+		CK_FLAGS msg_flags)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, message_crypt_op_type(flags), &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	rv = op->type->message_next(op, pParameter, ulParameterLen,
+			pIn, ulInLen, pOut, pulOutLen, msg_flags);
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+/* Encrypt or decrypt a complete message */
+CK_RV
+sc_pkcs11_message_crypt(struct sc_pkcs11_session *session, CK_FLAGS flags,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen, CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_ULONG length;
+	CK_RV rv;
+
+	rv = session_get_operation(session, message_crypt_op_type(flags), &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	/* Asking for the length must not start a message */
+	rv = op->type->message_next(op, pParameter, ulParameterLen,
+			pIn, ulInLen, NULL, &length, CKF_END_OF_MESSAGE);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+	if (pOut == NULL || length > *pulOutLen) {
+		*pulOutLen = length;
+		LOG_FUNC_RETURN(context, pOut ? CKR_BUFFER_TOO_SMALL : CKR_OK);
+	}
+
+	rv = op->type->message_begin(op, pParameter, ulParameterLen,
+			pAssociatedData, ulAssociatedDataLen);
+	if (rv == CKR_OK)
+		rv = op->type->message_next(op, pParameter, ulParameterLen,
+				pIn, ulInLen, pOut, pulOutLen, CKF_END_OF_MESSAGE);
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
+CK_RV
+sc_pkcs11_message_crypt_final(struct sc_pkcs11_session *session, CK_FLAGS flags)
+{
+	int op_type = message_crypt_op_type(flags);
+	CK_RV rv;
+
+	rv = session_get_operation(session, op_type, NULL);
+	if (rv == CKR_OK)
+		session_stop_operation(session, op_type);
+
+	LOG_FUNC_RETURN(context, (int) rv);
+}
+
 static void
 sc_pkcs11_operation_release(sc_pkcs11_operation_t *operation)
 {
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "sc-pkcs11.h"
 
@@ -448,11 +449,28 @@ CK_RV attr_find_var(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_ULONG type,
 	return attr_extract(pTemplate, ptr, sizep);
 }
 
+/* Session and object handles are made from the address of the element,
+ * so look for the address first. Fall back to the seeker if the handle
+ * does not hold the whole pointer (Win64). */
+void *find_by_handle(ptrarray_t *array, CK_ULONG handle)
+{
+	int pos = ptrarray_locate(array, (void *)(uintptr_t)handle);
+
+	if (pos >= 0) {
+		void *el = ptrarray_get_at(array, (unsigned int)pos);
+
+		if (array->seeker && array->seeker(el, &handle))
+			return el;
+	}
+	return ptrarray_seek(array, &handle);
+}
+
 void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 {
 	scconf_block *conf_block = NULL;
 	char *unblock_style = NULL;
 	char *create_slots_for_pins = NULL, *op, *tmp;
+	int detect_threads, pin_status_ttl;
 
 	/* Set defaults */
 	conf->max_virtual_slots = 16;
@@ -467,6 +485,8 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 	conf->pin_unblock_style = SC_PKCS11_PIN_UNBLOCK_NOT_ALLOWED;
 	conf->create_puk_slot = 0;
 	conf->create_slots_flags = SC_PKCS11_SLOT_CREATE_ALL;
+	conf->detect_threads = 1;
+	conf->pin_status_ttl = 5;
 
 	conf_block = sc_get_conf_block(ctx, "pkcs11", NULL, 1);
 	if (!conf_block)
@@ -480,6 +500,14 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 		conf->lock_login = 1;
 	conf->lock_login = scconf_get_bool(conf_block, "lock_login", conf->lock_login);
 	conf->init_sloppy = scconf_get_bool(conf_block, "init_sloppy", conf->init_sloppy);
+	detect_threads = scconf_get_int(conf_block, "detect_threads", conf->detect_threads);
+	if (detect_threads < 1)
+		detect_threads = 1;
+	if (detect_threads > SC_PKCS11_MAX_DETECT_THREADS)
+		detect_threads = SC_PKCS11_MAX_DETECT_THREADS;
+	conf->detect_threads = detect_threads;
+	pin_status_ttl = scconf_get_int(conf_block, "pin_status_ttl", conf->pin_status_ttl);
+	conf->pin_status_ttl = pin_status_ttl < 0 ? 0 : pin_status_ttl;
 
 	unblock_style = (char *)scconf_get_str(conf_block, "user_pin_unblock_style", NULL);
 	if (unblock_style && !strcmp(unblock_style, "set_pin_in_unlogged_session"))
@@ -508,8 +536,9 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 
 	sc_log(ctx, "PKCS#11 options: max_virtual_slots=%d slots_per_card=%d "
 		 "lock_login=%d atomic=%d pin_unblock_style=%d "
-		 "create_slots_flags=0x%X",
+		 "create_slots_flags=0x%X detect_threads=%u pin_status_ttl=%u",
 		 conf->max_virtual_slots, conf->slots_per_card,
 		 conf->lock_login, conf->atomic, conf->pin_unblock_style,
-		 conf->create_slots_flags);
+		 conf->create_slots_flags, conf->detect_threads,
+		 conf->pin_status_ttl);
 }
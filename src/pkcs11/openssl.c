@@ -54,6 +54,14 @@ static CK_RV	sc_pkcs11_openssl_md_update(sc_pkcs11_operation_t *,
 static CK_RV	sc_pkcs11_openssl_md_final(sc_pkcs11_operation_t *,
 					CK_BYTE_PTR, CK_ULONG_PTR);
 static void	sc_pkcs11_openssl_md_release(sc_pkcs11_operation_t *);
+static CK_RV	sc_pkcs11_openssl_aead_init(sc_pkcs11_operation_t *,
+					struct sc_pkcs11_object *, CK_FLAGS);
+static CK_RV	sc_pkcs11_openssl_aead_begin(sc_pkcs11_operation_t *,
+					CK_VOID_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG);
+static CK_RV	sc_pkcs11_openssl_aead_next(sc_pkcs11_operation_t *,
+					CK_VOID_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG,
+					CK_BYTE_PTR, CK_ULONG_PTR, CK_FLAGS);
+static void	sc_pkcs11_openssl_aead_release(sc_pkcs11_operation_t *);
 
 static sc_pkcs11_mechanism_type_t openssl_sha1_mech = {
 	CKM_SHA_1,
@@ -71,6 +79,7 @@ static sc_pkcs11_mechanism_type_t openssl_sha1_mech = {
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
+	NULL, NULL, NULL,	/* message_* */
 	NULL,			/* mech_data */
 	NULL,			/* free_mech_data */
 	NULL,			/* copy_mech_data */
@@ -92,6 +101,7 @@ static sc_pkcs11_mechanism_type_t openssl_sha224_mech = {
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
+	NULL, NULL, NULL,	/* message_* */
 	NULL,			/* mech_data */
 	NULL,			/* free_mech_data */
 	NULL,			/* copy_mech_data */
@@ -113,6 +123,7 @@ static sc_pkcs11_mechanism_type_t openssl_sha256_mech = {
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
+	NULL, NULL, NULL,	/* message_* */
 	NULL,			/* mech_data */
 	NULL,			/* free_mech_data */
 	NULL,			/* copy_mech_data */
@@ -134,6 +145,7 @@ static sc_pkcs11_mechanism_type_t openssl_sha384_mech = {
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
+	NULL, NULL, NULL,	/* message_* */
 	NULL,			/* mech_data */
 	NULL,			/* free_mech_data */
 	NULL,			/* copy_mech_data */
@@ -155,6 +167,7 @@ static sc_pkcs11_mechanism_type_t openssl_sha512_mech = {
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
+	NULL, NULL, NULL,	/* message_* */
 	NULL,			/* mech_data */
 	NULL,			/* free_mech_data */
 	NULL,			/* copy_mech_data */
@@ -176,6 +189,7 @@ static sc_pkcs11_mechanism_type_t openssl_gostr3411_mech = {
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
+	NULL, NULL, NULL,	/* message_* */
 	NULL,			/* mech_data */
 	NULL,			/* free_mech_data */
 	NULL,			/* copy_mech_data */
@@ -197,6 +211,7 @@ static sc_pkcs11_mechanism_type_t openssl_md5_mech = {
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
+	NULL, NULL, NULL,	/* message_* */
 	NULL,			/* mech_data */
 	NULL,			/* free_mech_data */
 	NULL,			/* copy_mech_data */
@@ -218,11 +233,58 @@ static sc_pkcs11_mechanism_type_t openssl_ripemd160_mech = {
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
+	NULL, NULL, NULL,	/* message_* */
 	NULL,			/* mech_data */
 	NULL,			/* free_mech_data */
 	NULL,			/* copy_mech_data */
 };
 
+static sc_pkcs11_mechanism_type_t openssl_aes_gcm_mech = {
+	CKM_AES_GCM,
+	{ 16, 32, CKF_MESSAGE_ENCRYPT | CKF_MESSAGE_DECRYPT },
+	{ CKK_AES, -1 },
+	sizeof(struct sc_pkcs11_operation),
+	sc_pkcs11_openssl_aead_release,
+	NULL, NULL, NULL,	/* md_* */
+	NULL, NULL, NULL, NULL,	/* sign_* */
+	NULL, NULL, NULL,	/* verif_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
+	NULL, NULL, NULL, NULL, /* encrypt */
+	NULL,			/* derive */
+	NULL,			/* wrap */
+	NULL,			/* unwrap */
+	sc_pkcs11_openssl_aead_init,
+	sc_pkcs11_openssl_aead_begin,
+	sc_pkcs11_openssl_aead_next,
+	NULL,			/* mech_data */
+	NULL,			/* free_mech_data */
+	NULL,			/* copy_mech_data */
+};
+
+#if !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+static sc_pkcs11_mechanism_type_t openssl_chacha20_poly1305_mech = {
+	CKM_CHACHA20_POLY1305,
+	{ 32, 32, CKF_MESSAGE_ENCRYPT | CKF_MESSAGE_DECRYPT },
+	{ CKK_CHACHA20, -1 },
+	sizeof(struct sc_pkcs11_operation),
+	sc_pkcs11_openssl_aead_release,
+	NULL, NULL, NULL,	/* md_* */
+	NULL, NULL, NULL, NULL,	/* sign_* */
+	NULL, NULL, NULL,	/* verif_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
+	NULL, NULL, NULL, NULL, /* encrypt */
+	NULL,			/* derive */
+	NULL,			/* wrap */
+	NULL,			/* unwrap */
+	sc_pkcs11_openssl_aead_init,
+	sc_pkcs11_openssl_aead_begin,
+	sc_pkcs11_openssl_aead_next,
+	NULL,			/* mech_data */
+	NULL,			/* free_mech_data */
+	NULL,			/* copy_mech_data */
+};
+#endif
+
 static void * dup_mem(void *in, size_t in_len)
 {
 	void *out = malloc(in_len);
@@ -360,6 +422,15 @@ sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *p11card)
 	sc_pkcs11_register_mechanism(p11card, mt, NULL);
 	sc_pkcs11_free_mechanism(&mt);
 
+	mt = dup_mem(&openssl_aes_gcm_mech, sizeof openssl_aes_gcm_mech);
+	sc_pkcs11_register_mechanism(p11card, mt, NULL);
+	sc_pkcs11_free_mechanism(&mt);
+#if !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+	mt = dup_mem(&openssl_chacha20_poly1305_mech, sizeof openssl_chacha20_poly1305_mech);
+	sc_pkcs11_register_mechanism(p11card, mt, NULL);
+	sc_pkcs11_free_mechanism(&mt);
+#endif
+
 }
 
 
@@ -428,6 +499,275 @@ static void sc_pkcs11_openssl_md_release(sc_pkcs11_operation_t *op)
 	}
 }
 
+/*
+ * Software AEAD for message-based encryption (CKM_AES_GCM and
+ * CKM_CHACHA20_POLY1305). It needs a secret key whose value the module
+ * holds: a session key created with C_CreateObject, or one unwrapped with
+ * C_UnwrapKey into a session object kept in memory. Keys stored on the
+ * token never reveal their value and cannot be used; no card driver
+ * offers AEAD.
+ * The key schedule is set up once at C_MessageEncryptInit or
+ * C_MessageDecryptInit. After that, each message only loads a new IV and
+ * the token is never involved.
+ */
+struct openssl_aead_data {
+	EVP_CIPHER_CTX	*ctx;
+	int		encrypt;
+	int		in_message;
+	size_t		iv_len;
+};
+
+#define AEAD_DATA(op) \
+	(op ? (struct openssl_aead_data *) (op)->priv_data : NULL)
+
+/* IV and tag of one message */
+struct aead_params {
+	unsigned char	*iv;
+	size_t		iv_len;
+	size_t		iv_fixed_len;
+	CK_GENERATOR_FUNCTION iv_generator;
+	unsigned char	*tag;
+	size_t		tag_len;
+};
+
+static CK_RV aead_get_params(sc_pkcs11_operation_t *op,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen, struct aead_params *params)
+{
+	memset(params, 0, sizeof(*params));
+	if (pParameter == NULL)
+		return CKR_MECHANISM_PARAM_INVALID;
+
+	switch (op->type->mech) {
+	case CKM_AES_GCM: {
+		CK_GCM_MESSAGE_PARAMS *gcm = (CK_GCM_MESSAGE_PARAMS *) pParameter;
+
+		if (ulParameterLen != sizeof(CK_GCM_MESSAGE_PARAMS)
+				|| gcm->pIv == NULL || gcm->ulIvLen == 0 || gcm->ulIvLen > 256
+				|| gcm->ulIvFixedBits % 8 != 0 || gcm->ulIvFixedBits / 8 > gcm->ulIvLen
+				|| gcm->pTag == NULL || gcm->ulTagBits % 8 != 0
+				|| gcm->ulTagBits < 32 || gcm->ulTagBits > 128)
+			return CKR_MECHANISM_PARAM_INVALID;
+		params->iv = gcm->pIv;
+		params->iv_len = gcm->ulIvLen;
+		params->iv_fixed_len = gcm->ulIvFixedBits / 8;
+		params->iv_generator = gcm->ivGenerator;
+		params->tag = gcm->pTag;
+		params->tag_len = gcm->ulTagBits / 8;
+		break;
+	}
+	case CKM_CHACHA20_POLY1305: {
+		CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS *chacha =
+			(CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS *) pParameter;
+
+		/* OpenSSL implements the 96-bit nonce variant only */
+		if (ulParameterLen != sizeof(CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS)
+				|| chacha->pNonce == NULL || chacha->ulNonceLen != 12
+				|| chacha->pTag == NULL)
+			return CKR_MECHANISM_PARAM_INVALID;
+		params->iv = chacha->pNonce;
+		params->iv_len = chacha->ulNonceLen;
+		params->iv_generator = CKG_NO_GENERATE;
+		params->tag = chacha->pTag;
+		params->tag_len = 16;
+		break;
+	}
+	default:
+		return CKR_MECHANISM_INVALID;
+	}
+	return CKR_OK;
+}
+
+static CK_RV aead_update(EVP_CIPHER_CTX *ctx, unsigned char *out,
+		const unsigned char *in, CK_ULONG in_len)
+{
+	while (in_len > 0) {
+		int chunk = in_len > (1UL << 30) ? (1 << 30) : (int) in_len;
+		int out_len;
+
+		if (!EVP_CipherUpdate(ctx, out, &out_len, in, chunk))
+			return CKR_GENERAL_ERROR;
+		in += chunk;
+		in_len -= chunk;
+		if (out)
+			out += out_len;
+	}
+	return CKR_OK;
+}
+
+static CK_RV sc_pkcs11_openssl_aead_init(sc_pkcs11_operation_t *op,
+		struct sc_pkcs11_object *key, CK_FLAGS flags)
+{
+	CK_ATTRIBUTE value = { CKA_VALUE, NULL, 0 };
+	struct openssl_aead_data *data = NULL;
+	EVP_CIPHER *cipher = NULL;
+	const char *name = NULL;
+	CK_RV rv;
+
+	if (!op || !key || !key->ops || !key->ops->get_attribute)
+		return CKR_ARGUMENTS_BAD;
+
+	/* Keys that exist only on the token cannot be used here */
+	rv = key->ops->get_attribute(op->session, key, &value);
+	if (rv != CKR_OK || value.ulValueLen == 0 || value.ulValueLen == CK_UNAVAILABLE_INFORMATION) {
+		sc_log(context, "AEAD needs a key value held by the module, the key is on the token");
+		return CKR_KEY_FUNCTION_NOT_PERMITTED;
+	}
+
+	switch (op->type->mech) {
+	case CKM_AES_GCM:
+		if (value.ulValueLen == 16)
+			name = "AES-128-GCM";
+		else if (value.ulValueLen == 24)
+			name = "AES-192-GCM";
+		else if (value.ulValueLen == 32)
+			name = "AES-256-GCM";
+		break;
+	case CKM_CHACHA20_POLY1305:
+		if (value.ulValueLen == 32)
+			name = "ChaCha20-Poly1305";
+		break;
+	}
+	if (name == NULL)
+		return CKR_KEY_SIZE_RANGE;
+
+	value.pValue = sc_mem_secure_alloc(value.ulValueLen);
+	if (value.pValue == NULL)
+		return CKR_HOST_MEMORY;
+	rv = key->ops->get_attribute(op->session, key, &value);
+	if (rv != CKR_OK)
+		goto out;
+
+	cipher = sc_evp_cipher(context, name);
+	if (cipher == NULL) {
+		rv = CKR_MECHANISM_INVALID;
+		goto out;
+	}
+	data = calloc(1, sizeof(struct openssl_aead_data));
+	if (data == NULL || (data->ctx = EVP_CIPHER_CTX_new()) == NULL) {
+		rv = CKR_HOST_MEMORY;
+		goto out;
+	}
+	data->encrypt = flags == CKF_MESSAGE_ENCRYPT;
+	if (!EVP_CipherInit_ex(data->ctx, cipher, NULL, value.pValue, NULL, data->encrypt)) {
+		rv = CKR_GENERAL_ERROR;
+		goto out;
+	}
+	data->iv_len = EVP_CIPHER_CTX_iv_length(data->ctx);
+	op->priv_data = data;
+	data = NULL;
+
+out:
+	if (data) {
+		EVP_CIPHER_CTX_free(data->ctx);
+		free(data);
+	}
+	sc_evp_cipher_free(cipher);
+	sc_mem_secure_clear_free(value.pValue, value.ulValueLen);
+	return rv;
+}
+
+static CK_RV sc_pkcs11_openssl_aead_begin(sc_pkcs11_operation_t *op,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen)
+{
+	struct openssl_aead_data *data = AEAD_DATA(op);
+	struct aead_params params;
+	CK_RV rv;
+
+	if (!data || (ulAssociatedDataLen > 0 && pAssociatedData == NULL))
+		return CKR_ARGUMENTS_BAD;
+	if (data->in_message)
+		return CKR_OPERATION_ACTIVE;
+
+	rv = aead_get_params(op, pParameter, ulParameterLen, &params);
+	if (rv != CKR_OK)
+		return rv;
+
+	/* A generated IV is returned in the caller's parameters */
+	if (data->encrypt && params.iv_generator != CKG_NO_GENERATE) {
+		if (params.iv_generator != CKG_GENERATE && params.iv_generator != CKG_GENERATE_RANDOM)
+			return CKR_MECHANISM_PARAM_INVALID;
+		if (RAND_bytes(params.iv + params.iv_fixed_len,
+				(int) (params.iv_len - params.iv_fixed_len)) != 1)
+			return CKR_FUNCTION_FAILED;
+	}
+
+	if (params.iv_len != data->iv_len) {
+		if (!EVP_CIPHER_CTX_ctrl(data->ctx, EVP_CTRL_AEAD_SET_IVLEN, (int) params.iv_len, NULL))
+			return CKR_MECHANISM_PARAM_INVALID;
+		data->iv_len = params.iv_len;
+	}
+	if (!EVP_CipherInit_ex(data->ctx, NULL, NULL, NULL, params.iv, -1))
+		return CKR_GENERAL_ERROR;
+	rv = aead_update(data->ctx, NULL, pAssociatedData, ulAssociatedDataLen);
+	if (rv != CKR_OK)
+		return rv;
+
+	data->in_message = 1;
+	return CKR_OK;
+}
+
+static CK_RV sc_pkcs11_openssl_aead_next(sc_pkcs11_operation_t *op,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen, CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen,
+		CK_FLAGS flags)
+{
+	struct openssl_aead_data *data = AEAD_DATA(op);
+	struct aead_params params;
+	int len;
+	CK_RV rv = CKR_OK;
+
+	if (!data || !pulOutLen || (ulInLen > 0 && pIn == NULL))
+		return CKR_ARGUMENTS_BAD;
+
+	/* Both are stream ciphers: the output is as long as the input */
+	if (pOut == NULL || *pulOutLen < ulInLen) {
+		*pulOutLen = ulInLen;
+		return pOut ? CKR_BUFFER_TOO_SMALL : CKR_OK;
+	}
+	if (!data->in_message)
+		return CKR_OPERATION_NOT_INITIALIZED;
+
+	if (flags & CKF_END_OF_MESSAGE) {
+		rv = aead_get_params(op, pParameter, ulParameterLen, &params);
+		if (rv == CKR_OK && !data->encrypt
+				&& !EVP_CIPHER_CTX_ctrl(data->ctx, EVP_CTRL_AEAD_SET_TAG,
+					(int) params.tag_len, params.tag))
+			rv = CKR_GENERAL_ERROR;
+	}
+	if (rv == CKR_OK)
+		rv = aead_update(data->ctx, pOut, pIn, ulInLen);
+	if (rv == CKR_OK && (flags & CKF_END_OF_MESSAGE)) {
+		if (!EVP_CipherFinal_ex(data->ctx, pOut + ulInLen, &len)) {
+			/* Do not hand out plaintext that failed authentication */
+			if (!data->encrypt)
+				OPENSSL_cleanse(pOut, ulInLen);
+			rv = data->encrypt ? CKR_GENERAL_ERROR : CKR_AEAD_DECRYPT_FAILED;
+		} else if (data->encrypt
+				&& !EVP_CIPHER_CTX_ctrl(data->ctx, EVP_CTRL_AEAD_GET_TAG,
+					(int) params.tag_len, params.tag)) {
+			rv = CKR_GENERAL_ERROR;
+		}
+	}
+
+	if (rv != CKR_OK || (flags & CKF_END_OF_MESSAGE))
+		data->in_message = 0;
+	if (rv == CKR_OK)
+		*pulOutLen = ulInLen;
+	return rv;
+}
+
+static void sc_pkcs11_openssl_aead_release(sc_pkcs11_operation_t *op)
+{
+	struct openssl_aead_data *data = AEAD_DATA(op);
+
+	if (data) {
+		EVP_CIPHER_CTX_free(data->ctx);
+		free(data);
+		op->priv_data = NULL;
+	}
+}
+
 #if !defined(OPENSSL_NO_EC)
 
 static void reverse(unsigned char *buf, size_t len)
@@ -304,7 +304,8 @@ static enum_specs ck_key_s[] = {
   { CKK_TWOFISH       , "CKK_TWOFISH        " },
   { CKK_GOSTR3410     , "CKK_GOSTR3410      " },
   { CKK_GOSTR3411     , "CKK_GOSTR3411      " },
-  { CKK_GOST28147     , "CKK_GOST28147      " }
+  { CKK_GOST28147     , "CKK_GOST28147      " },
+  { CKK_CHACHA20      , "CKK_CHACHA20       " }
 };
 
 static enum_specs ck_mec_s[] = {
@@ -501,6 +502,7 @@ static enum_specs ck_mec_s[] = {
   { CKM_ECDH1_COFACTOR_DERIVE    , "CKM_ECDH1_COFACTOR_DERIVE    " },
   { CKM_ECMQV_DERIVE             , "CKM_ECMQV_DERIVE             " },
   { CKM_EDDSA                    , "CKM_EDDSA                    " },
+  { CKM_CHACHA20_POLY1305        , "CKM_CHACHA20_POLY1305        " },
   { CKM_XEDDSA                   , "CKM_XEDDSA                    " },
   { CKM_JUNIPER_KEY_GEN          , "CKM_JUNIPER_KEY_GEN          " },
   { CKM_JUNIPER_ECB128           , "CKM_JUNIPER_ECB128           " },
@@ -577,6 +579,7 @@ static enum_specs ck_err_s[] = {
   { CKR_DEVICE_ERROR,                     "CKR_DEVICE_ERROR" },
   { CKR_DEVICE_MEMORY,                    "CKR_DEVICE_MEMORY" },
   { CKR_DEVICE_REMOVED,                   "CKR_DEVICE_REMOVED" },
+  { CKR_AEAD_DECRYPT_FAILED,              "CKR_AEAD_DECRYPT_FAILED" },
   { CKR_ENCRYPTED_DATA_INVALID,           "CKR_ENCRYPTED_DATA_INVALID" },
   { CKR_ENCRYPTED_DATA_LEN_RANGE,         "CKR_ENCRYPTED_DATA_LEN_RANGE" },
   { CKR_FUNCTION_CANCELED,                "CKR_FUNCTION_CANCELED" },
@@ -994,7 +997,8 @@ void
 print_mech_info(FILE *f, CK_MECHANISM_TYPE type, CK_MECHANISM_INFO_PTR minfo)
 {
 	const char *name = lookup_enum(MEC_T, type);
-	CK_ULONG known_flags = CKF_HW | CKF_ENCRYPT | CKF_DECRYPT | CKF_DIGEST |
+	CK_ULONG known_flags = CKF_HW | CKF_MESSAGE_ENCRYPT | CKF_MESSAGE_DECRYPT |
+			CKF_ENCRYPT | CKF_DECRYPT | CKF_DIGEST |
 			CKF_SIGN | CKF_SIGN_RECOVER | CKF_VERIFY | CKF_VERIFY_RECOVER |
 			CKF_GENERATE | CKF_GENERATE_KEY_PAIR | CKF_WRAP | CKF_UNWRAP |
 			CKF_DERIVE | CKF_EC_F_P | CKF_EC_F_2M |CKF_EC_ECPARAMETERS |
@@ -1008,8 +1012,10 @@ print_mech_info(FILE *f, CK_MECHANISM_TYPE type, CK_MECHANISM_INFO_PTR minfo)
 	fprintf(f, "min:%lu max:%lu flags:0x%lX ",
 			(unsigned long) minfo->ulMinKeySize,
 			(unsigned long) minfo->ulMaxKeySize, minfo->flags);
-	fprintf(f, "( %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s)\n",
+	fprintf(f, "( %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s)\n",
 			(minfo->flags & CKF_HW)                ? "Hardware " : "",
+			(minfo->flags & CKF_MESSAGE_ENCRYPT)   ? "MsgEncrypt " : "",
+			(minfo->flags & CKF_MESSAGE_DECRYPT)   ? "MsgDecrypt " : "",
 			(minfo->flags & CKF_ENCRYPT)           ? "Encrypt "  : "",
 			(minfo->flags & CKF_DECRYPT)           ? "Decrypt "  : "",
 			(minfo->flags & CKF_DIGEST)            ? "Digest "   : "",
@@ -36,6 +36,9 @@
 
 #include "sc-pkcs11.h"
 #include "ui/notify.h"
+#ifdef USE_PKCS15_INIT
+#include "pkcs15init/pkcs15-init.h"
+#endif
 
 #ifdef ENABLE_OPENSSL
 #include <openssl/crypto.h>
@@ -51,14 +54,15 @@
 
 sc_context_t *context = NULL;
 struct sc_pkcs11_config sc_pkcs11_conf;
-list_t sessions;
-list_t virtual_slots;
+ptrarray_t sessions;
+ptrarray_t virtual_slots;
 #if !defined(_WIN32)
 pid_t initialized_pid = (pid_t)-1;
 #endif
 static int in_finalize = 0;
 extern CK_FUNCTION_LIST pkcs11_function_list;
 extern CK_FUNCTION_LIST_3_0 pkcs11_function_list_3_0;
+extern CK_OPENSC_FUNCTION_LIST pkcs11_function_list_opensc;
 int nesting = 0;
 
 #ifdef PKCS11_THREAD_LOCKING
@@ -216,7 +220,7 @@ static sc_thread_context_t sc_thread_ctx = {
 	sc_unlock_mutex, sc_destroy_mutex, NULL
 };
 
-/* simclist helpers to locate interesting objects by ID */
+/* helpers to locate interesting objects by ID */
 static int session_list_seeker(const void *el, const void *key) {
 	const struct sc_pkcs11_session *session = (struct sc_pkcs11_session *)el;
 	if ((el == NULL) || (key == NULL))
@@ -349,18 +353,18 @@ CK_RV C_Initialize(CK_VOID_PTR pInitArgs)
 	load_pkcs11_parameters(&sc_pkcs11_conf, context);
 
 	/* List of sessions */
-	if (0 != list_init(&sessions)) {
+	if (0 != ptrarray_init(&sessions)) {
 		rv = CKR_HOST_MEMORY;
 		goto out;
 	}
-	list_attributes_seeker(&sessions, session_list_seeker);
+	ptrarray_attributes_seeker(&sessions, session_list_seeker);
 
 	/* List of slots */
-	if (0 != list_init(&virtual_slots)) {
+	if (0 != ptrarray_init(&virtual_slots)) {
 		rv = CKR_HOST_MEMORY;
 		goto out;
 	}
-	list_attributes_seeker(&virtual_slots, slot_list_seeker);
+	ptrarray_attributes_seeker(&virtual_slots, slot_list_seeker);
 
 	card_detect_all();
 
@@ -414,16 +418,20 @@ CK_RV C_Finalize(CK_VOID_PTR pReserved)
 	for (i=0; i < (int)sc_ctx_get_reader_count(context); i++)
 		card_removed(sc_ctx_get_reader(context, i));
 
-	while ((p = list_fetch(&sessions)))
+	while ((p = ptrarray_pop(&sessions)))
 		free(p);
-	list_destroy(&sessions);
+	ptrarray_destroy(&sessions);
 
-	while ((slot = list_fetch(&virtual_slots))) {
-		list_destroy(&slot->objects);
+	while ((slot = ptrarray_pop(&virtual_slots))) {
+		ptrarray_destroy(&slot->objects);
 		list_destroy(&slot->logins);
 		free(slot);
 	}
-	list_destroy(&virtual_slots);
+	ptrarray_destroy(&virtual_slots);
+
+#ifdef USE_PKCS15_INIT
+	sc_pkcs15init_cleanup();
+#endif
 
 	sc_release_context(context);
 	context = NULL;
@@ -516,14 +524,14 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 
 	card_detect_all();
 
-	if (list_empty(&virtual_slots)) {
+	if (ptrarray_size(&virtual_slots) == 0) {
 		sc_log(context, "returned 0 slots\n");
 		*pulCount = 0;
 		rv = CKR_OK;
 		goto out;
 	}
 
-	found = calloc(list_size(&virtual_slots), sizeof(CK_SLOT_ID));
+	found = calloc(ptrarray_size(&virtual_slots), sizeof(CK_SLOT_ID));
 
 	if (found == NULL) {
 		rv = CKR_HOST_MEMORY;
@@ -532,8 +540,8 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 
 	prev_reader = NULL;
 	numMatches = 0;
-	for (i=0; i<list_size(&virtual_slots); i++) {
-		slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+	for (i=0; i<ptrarray_size(&virtual_slots); i++) {
+		slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, i);
 		/* the list of available slots contains:
 		 * - without token(s), at least one empty slot per reader;
 		 * - any slot with token;
@@ -742,8 +750,8 @@ CK_RV C_InitToken(CK_SLOT_ID slotID,
 	}
 
 	/* Make sure there's no open session for this token */
-	for (i=0; i<list_size(&sessions); i++) {
-		session = (struct sc_pkcs11_session*)list_get_at(&sessions, i);
+	for (i=0; i<ptrarray_size(&sessions); i++) {
+		session = (struct sc_pkcs11_session*)ptrarray_get_at(&sessions, i);
 		if (session->slot == slot) {
 			rv = CKR_SESSION_EXISTS;
 			goto out;
@@ -834,11 +842,12 @@ out:
 /*
  * Interfaces
  */
-#define NUM_INTERFACES 2
+#define NUM_INTERFACES 3
 #define DEFAULT_INTERFACE 0
 CK_INTERFACE interfaces[NUM_INTERFACES] = {
 	{"PKCS 11", (void *)&pkcs11_function_list_3_0, 0},
-	{"PKCS 11", (void *)&pkcs11_function_list, 0}
+	{"PKCS 11", (void *)&pkcs11_function_list, 0},
+	{OPENSC_INTERFACE_NAME, (void *)&pkcs11_function_list_opensc, 0}
 };
 
 CK_RV C_GetInterfaceList(CK_INTERFACE_PTR pInterfacesList,  /* returned interfaces */
@@ -919,6 +928,91 @@ CK_RV C_GetInterface(CK_UTF8CHAR_PTR pInterfaceName, /* name of the interface */
 	return CKR_ARGUMENTS_BAD;
 }
 
+/*
+ * OpenSC vendor functions
+ */
+
+/* Resolves the reader behind a slot, or NULL for CK_OPENSC_ALL_SLOTS */
+static CK_RV
+get_stats_reader(CK_SLOT_ID slotID, sc_reader_t **reader)
+{
+	struct sc_pkcs11_slot *slot = NULL;
+	CK_RV rv;
+
+	*reader = NULL;
+	if (slotID == CK_OPENSC_ALL_SLOTS)
+		return CKR_OK;
+
+	rv = slot_get_slot(slotID, &slot);
+	if (rv != CKR_OK)
+		return rv;
+	if (slot->reader == NULL)
+		return CKR_SLOT_ID_INVALID;
+	*reader = slot->reader;
+	return CKR_OK;
+}
+
+static CK_RV
+C_OpenSC_GetStats(CK_SLOT_ID slotID, CK_OPENSC_APDU_STATS_PTR pStats)
+{
+	sc_reader_t *reader = NULL;
+	sc_apdu_stats_t stats;
+	size_t i;
+	CK_RV rv;
+
+	if (pStats == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	sc_log(context, "C_OpenSC_GetStats(0x%lx)", slotID);
+	rv = get_stats_reader(slotID, &reader);
+	if (rv == CKR_OK)
+		rv = sc_to_cryptoki_error(sc_ctx_get_stats(context, reader, &stats), NULL);
+	if (rv == CKR_OK) {
+		pStats->apdus = stats.apdus;
+		pStats->errors = stats.errors;
+		pStats->bytes_sent = stats.bytes_sent;
+		pStats->bytes_received = stats.bytes_received;
+		pStats->get_responses = stats.get_responses;
+		pStats->selects = stats.selects;
+		pStats->retries = stats.retries;
+		pStats->time_us = stats.time_us;
+		for (i = 0; i < CK_OPENSC_STATS_LATENCY_BUCKETS && i < SC_STATS_LATENCY_BUCKETS; i++)
+			pStats->latency[i] = stats.latency[i];
+		for (i = 0; i < 256; i++) {
+			pStats->ins[i].count = stats.ins[i].count;
+			pStats->ins[i].time_us = stats.ins[i].time_us;
+		}
+	}
+
+	SC_LOG_RV("C_OpenSC_GetStats() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
+static CK_RV
+C_OpenSC_ResetStats(CK_SLOT_ID slotID)
+{
+	sc_reader_t *reader = NULL;
+	CK_RV rv;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	sc_log(context, "C_OpenSC_ResetStats(0x%lx)", slotID);
+	rv = get_stats_reader(slotID, &reader);
+	if (rv == CKR_OK)
+		rv = sc_to_cryptoki_error(sc_ctx_reset_stats(context, reader), NULL);
+
+	SC_LOG_RV("C_OpenSC_ResetStats() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
 /*
  * Locking functions
  */
@@ -1201,3 +1295,12 @@ CK_FUNCTION_LIST_3_0 pkcs11_function_list_3_0 = {
 	C_VerifyMessageNext,
 	C_MessageVerifyFinal
 };
+
+/* Returned from getInterface("Vendor OpenSC") */
+CK_OPENSC_FUNCTION_LIST pkcs11_function_list_opensc = {
+	{ 1, 1 },
+	C_OpenSC_GetStats,
+	C_OpenSC_ResetStats,
+	C_OpenSC_GetAttributeValues,
+	C_OpenSC_FindObjectsWithAttributes
+};
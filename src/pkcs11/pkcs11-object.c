@@ -55,6 +55,9 @@ static sc_pkcs11_mechanism_type_t find_mechanism = {
 	NULL,		/* encrypt */
 	NULL,		/* ecnrypt_update */
 	NULL,		/* encrypt_final */
+	NULL,		/* message_init */
+	NULL,		/* message_begin */
+	NULL,		/* message_next */
 	NULL,		/* mech_data */
 	NULL,		/* free_mech_data */
 	NULL,		/* copy_mech_data */
@@ -83,7 +86,7 @@ get_object_from_session(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject,
 	if (rv != CKR_OK)
 		return rv;
 
-	*object = list_seek(&sess->slot->objects, &hObject);
+	*object = find_by_handle(&sess->slot->objects, hObject);
 	if (!*object)
 		return CKR_OBJECT_HANDLE_INVALID;
 	*session = sess;
@@ -117,7 +120,7 @@ CK_RV sc_create_object_int(CK_SESSION_HANDLE hSession,	/* the session's handle *
 
 	dump_template(SC_LOG_DEBUG_NORMAL, "C_CreateObject()", pTemplate, ulCount);
 
-	session = list_seek(&sessions, &hSession);
+	session = find_by_handle(&sessions, hSession);
 	if (!session) {
 		rv = CKR_SESSION_HANDLE_INVALID;
 		goto out;
@@ -224,11 +227,11 @@ C_GetObjectSize(CK_SESSION_HANDLE hSession,	/* the session's handle */
 }
 
 
-CK_RV
-C_GetAttributeValue(CK_SESSION_HANDLE hSession,	/* the session's handle */
-		CK_OBJECT_HANDLE hObject,	/* the object's handle */
-		CK_ATTRIBUTE_PTR pTemplate,	/* specifies attributes, gets values */
-		CK_ULONG ulCount)		/* attributes in template */
+/* Fill in the attributes of one object and return the result code
+ * C_GetAttributeValue() has to return for them */
+static CK_RV
+get_attribute_values(struct sc_pkcs11_session *session, struct sc_pkcs11_object *object,
+		CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount)
 {
 	static CK_RV precedence[] = {
 		CKR_OK,
@@ -239,27 +242,13 @@ C_GetAttributeValue(CK_SESSION_HANDLE hSession,	/* the session's handle */
 	};
 	char object_name[64];
 	CK_RV j;
-	CK_RV rv;
-	struct sc_pkcs11_session *session;
-	struct sc_pkcs11_object *object;
+	CK_RV rv = CKR_OK;
 	CK_RV res;
 	CK_RV res_type;
-	unsigned int i;
-	const char *name;
-
-	if (pTemplate == NULL_PTR || ulCount == 0)
-		return CKR_ARGUMENTS_BAD;
-
-	rv = sc_pkcs11_lock();
-	if (rv != CKR_OK)
-		return rv;
-
-	rv = get_object_from_session(hSession, hObject, &session, &object);
-	if (rv != CKR_OK)
-		goto out;
+	CK_ULONG i;
 
 	/* Debug printf */
-	snprintf(object_name, sizeof(object_name), "Object %lu", (unsigned long)hObject);
+	snprintf(object_name, sizeof(object_name), "Object %lu", (unsigned long)object->handle);
 
 	res_type = 0;
 	for (i = 0; i < ulCount; i++) {
@@ -267,8 +256,6 @@ C_GetAttributeValue(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		if (res != CKR_OK)
 			pTemplate[i].ulValueLen = (CK_ULONG) - 1;
 
-		dump_template(SC_LOG_DEBUG_NORMAL, object_name, &pTemplate[i], 1);
-
 		/* the pkcs11 spec has complicated rules on
 		 * what errors take precedence:
 		 *      CKR_ATTRIBUTE_SENSITIVE
@@ -287,8 +274,32 @@ C_GetAttributeValue(CK_SESSION_HANDLE hSession,	/* the session's handle */
 			rv = res;
 		}
 	}
+	dump_template(SC_LOG_DEBUG_NORMAL, object_name, pTemplate, ulCount);
+	return rv;
+}
+
+CK_RV
+C_GetAttributeValue(CK_SESSION_HANDLE hSession,	/* the session's handle */
+		CK_OBJECT_HANDLE hObject,	/* the object's handle */
+		CK_ATTRIBUTE_PTR pTemplate,	/* specifies attributes, gets values */
+		CK_ULONG ulCount)		/* attributes in template */
+{
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+	struct sc_pkcs11_object *object;
+	const char *name;
+
+	if (pTemplate == NULL_PTR || ulCount == 0)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_object_from_session(hSession, hObject, &session, &object);
+	if (rv == CKR_OK)
+		rv = get_attribute_values(session, object, pTemplate, ulCount);
 
-out:
 	name = lookup_enum (RV_T, rv );
 	if (name)
 		sc_log(context, "C_GetAttributeValue(hSession=0x%lx, hObject=0x%lx) = %s",
@@ -347,16 +358,63 @@ out:
 }
 
 
+/* Private objects are hidden until the user logs in */
+static int
+hide_private_objects(struct sc_pkcs11_slot *slot)
+{
+	return slot->login_user == -1 && (slot->token_info.flags & CKF_LOGIN_REQUIRED);
+}
+
+/* Whether the object is visible and matches every attribute of the template */
+static int
+object_matches(struct sc_pkcs11_session *session, struct sc_pkcs11_object *object,
+		CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, int hide_private)
+{
+	struct sc_pkcs11_slot *slot = session->slot;
+	CK_BBOOL is_private = TRUE;
+	CK_ATTRIBUTE private_attribute = { CKA_PRIVATE, &is_private, sizeof(is_private) };
+	CK_ULONG j;
+
+	sc_log(context, "Object with handle 0x%lx", object->handle);
+
+	/* User not logged in and private object? */
+	if (hide_private) {
+		if (object->ops->get_attribute(session, object, &private_attribute) != CKR_OK)
+			return 0;
+		if (is_private) {
+			sc_log(context,
+			       "Object %lu/%lu: Private object and not logged in.",
+			       slot->id, object->handle);
+			return 0;
+		}
+	}
+
+	/* Try to match every attribute */
+	for (j = 0; j < ulCount; j++) {
+		if (object->ops->cmp_attribute(session, object, &pTemplate[j]) == 0) {
+			sc_log(context,
+			       "Object %lu/%lu: Attribute 0x%lx does NOT match.",
+			       slot->id, object->handle, pTemplate[j].type);
+			return 0;
+		}
+
+		if (context->debug >= 4) {
+			sc_log(context,
+			       "Object %lu/%lu: Attribute 0x%lx matches.",
+			       slot->id, object->handle, pTemplate[j].type);
+		}
+	}
+	return 1;
+}
+
 CK_RV
 C_FindObjectsInit(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		CK_ATTRIBUTE_PTR pTemplate,	/* attribute values to match */
 		CK_ULONG ulCount)		/* attributes in search template */
 {
 	CK_RV rv;
-	CK_BBOOL is_private = TRUE;
-	CK_ATTRIBUTE private_attribute = { CKA_PRIVATE, &is_private, sizeof(is_private) };
-	int match, hide_private;
-	unsigned int i, j;
+	int hide_private;
+	unsigned int i;
 	struct sc_pkcs11_session *session;
 	struct sc_pkcs11_object *object;
 	struct sc_pkcs11_find_operation *operation;
@@ -390,47 +448,13 @@ C_FindObjectsInit(CK_SESSION_HANDLE hSession,	/* the session's handle */
 	slot = session->slot;
 
 	/* Check whether we should hide private objects */
-	hide_private = 0;
-	if ((slot->login_user == -1) && (slot->token_info.flags & CKF_LOGIN_REQUIRED))
-		hide_private = 1;
+	hide_private = hide_private_objects(slot);
 
 	/* For each object in token do */
-	for (i=0; i<list_size(&slot->objects); i++) {
-		object = (struct sc_pkcs11_object *)list_get_at(&slot->objects, i);
-		sc_log(context, "Object with handle 0x%lx", object->handle);
-
-		/* User not logged in and private object? */
-		if (hide_private) {
-			if (object->ops->get_attribute(session, object, &private_attribute) != CKR_OK)
-			        continue;
-			if (is_private) {
-				sc_log(context,
-				       "Object %lu/%lu: Private object and not logged in.",
-				       slot->id, object->handle);
-				continue;
-			}
-		}
-
-		/* Try to match every attribute */
-		match = 1;
-		for (j = 0; j < ulCount; j++) {
-			rv = object->ops->cmp_attribute(session, object, &pTemplate[j]);
-			if (rv == 0) {
-				sc_log(context,
-				       "Object %lu/%lu: Attribute 0x%lx does NOT match.",
-				       slot->id, object->handle, pTemplate[j].type);
-				match = 0;
-				break;
-			}
-
-			if (context->debug >= 4) {
-				sc_log(context,
-				       "Object %lu/%lu: Attribute 0x%lx matches.",
-				       slot->id, object->handle, pTemplate[j].type);
-			}
-		}
+	for (i=0; i<ptrarray_size(&slot->objects); i++) {
+		object = (struct sc_pkcs11_object *)ptrarray_get_at(&slot->objects, i);
 
-		if (match) {
+		if (object_matches(session, object, pTemplate, ulCount, hide_private)) {
 			sc_log(context, "Object %lu/%lu matches\n", slot->id,
 			       object->handle);
 			/* Realloc handles - remove restriction on only 32 matching objects -dee */
@@ -522,6 +546,133 @@ out:	sc_pkcs11_unlock();
 	return rv;
 }
 
+/*
+ * OpenSC vendor extensions: attributes of many objects in one call.
+ * pTemplates holds ulCount attributes for every object, one template
+ * after the other, and pResults receives what C_GetAttributeValue()
+ * would have returned for each of them.
+ */
+static CK_RV
+get_object_attribute_values(struct sc_pkcs11_session *session, struct sc_pkcs11_object *object,
+		CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount)
+{
+	CK_ULONG j;
+
+	if (object == NULL) {
+		for (j = 0; j < ulCount; j++)
+			pTemplate[j].ulValueLen = (CK_ULONG) -1;
+		return CKR_OBJECT_HANDLE_INVALID;
+	}
+	if (object->ops->get_attribute == NULL)
+		return CKR_ATTRIBUTE_TYPE_INVALID;
+	return get_attribute_values(session, object, pTemplate, ulCount);
+}
+
+CK_RV
+C_OpenSC_GetAttributeValues(CK_SESSION_HANDLE hSession,	/* the session's handle */
+		CK_OBJECT_HANDLE_PTR phObjects,	/* the objects' handles */
+		CK_ULONG ulObjectCount,		/* number of objects */
+		CK_ATTRIBUTE_PTR pTemplates,	/* ulCount attributes per object */
+		CK_ULONG ulCount,		/* attributes in each template */
+		CK_RV *pResults)		/* gets the result for each object */
+{
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+	struct sc_pkcs11_object *object;
+	CK_ULONG i;
+
+	if (phObjects == NULL_PTR || ulObjectCount == 0
+			|| pTemplates == NULL_PTR || ulCount == 0 || pResults == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	for (i = 0; rv == CKR_OK && i < ulObjectCount; i++) {
+		object = (struct sc_pkcs11_object *)find_by_handle(&session->slot->objects, phObjects[i]);
+		pResults[i] = get_object_attribute_values(session, object,
+				pTemplates + i * ulCount, ulCount);
+	}
+
+	SC_LOG_RV("C_OpenSC_GetAttributeValues() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
+CK_RV
+C_OpenSC_FindObjectsWithAttributes(CK_SESSION_HANDLE hSession,	/* the session's handle */
+		CK_ATTRIBUTE_PTR pFindTemplate,	/* attribute values to match */
+		CK_ULONG ulFindCount,		/* attributes in search template */
+		CK_OBJECT_HANDLE_PTR phObjects,	/* gets the matching handles */
+		CK_ULONG_PTR pulObjectCount,	/* in: size of phObjects, out: matches */
+		CK_ATTRIBUTE_PTR pTemplates,	/* ulCount attributes per object */
+		CK_ULONG ulCount,		/* attributes in each template */
+		CK_RV *pResults)		/* gets the result for each object */
+{
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+	struct sc_pkcs11_slot *slot;
+	struct sc_pkcs11_object *object, **objects = NULL;
+	CK_ULONG max_objects, found = 0, j;
+	int hide_private;
+	unsigned int i;
+
+	if ((pFindTemplate == NULL_PTR && ulFindCount > 0) || pulObjectCount == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+	/* without handles only the number of matches is returned */
+	if (phObjects != NULL_PTR && ulCount > 0 && (pTemplates == NULL_PTR || pResults == NULL_PTR))
+		return CKR_ARGUMENTS_BAD;
+	max_objects = phObjects != NULL_PTR ? *pulObjectCount : 0;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv != CKR_OK)
+		goto out;
+
+	/* the matches, so that their attributes are read without another
+	 * lookup by handle */
+	if (max_objects > 0 && ulCount > 0) {
+		objects = calloc(max_objects, sizeof(*objects));
+		if (objects == NULL) {
+			rv = CKR_HOST_MEMORY;
+			goto out;
+		}
+	}
+
+	slot = session->slot;
+	hide_private = hide_private_objects(slot);
+	for (i = 0; i < ptrarray_size(&slot->objects); i++) {
+		object = (struct sc_pkcs11_object *)ptrarray_get_at(&slot->objects, i);
+		if (!object_matches(session, object, pFindTemplate, ulFindCount, hide_private))
+			continue;
+		if (found < max_objects) {
+			phObjects[found] = object->handle;
+			if (objects)
+				objects[found] = object;
+		}
+		found++;
+	}
+
+	if (phObjects != NULL_PTR && found > max_objects)
+		rv = CKR_BUFFER_TOO_SMALL;
+	else if (objects != NULL)
+		for (j = 0; j < found; j++)
+			pResults[j] = get_object_attribute_values(session, objects[j],
+					pTemplates + j * ulCount, ulCount);
+	*pulObjectCount = found;
+
+out:
+	free(objects);
+	SC_LOG_RV("C_OpenSC_FindObjectsWithAttributes() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
 /*
  * Below here all functions are wrappers to pass all object attribute and method
  * handling to appropriate object layer.
@@ -648,15 +799,44 @@ C_DigestFinal(CK_SESSION_HANDLE hSession,	/* the session's handle */
 }
 
 
+/* Look up a key for C_SignInit() and C_MessageSignInit() */
+static CK_RV
+get_signature_key(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey,
+		struct sc_pkcs11_session **session, struct sc_pkcs11_object **object,
+		CK_KEY_TYPE *key_type)
+{
+	CK_BBOOL can_sign;
+	CK_ATTRIBUTE sign_attribute = { CKA_SIGN, &can_sign, sizeof(can_sign) };
+	CK_ATTRIBUTE key_type_attr = { CKA_KEY_TYPE, key_type, sizeof(*key_type) };
+	CK_RV rv;
+
+	rv = get_object_from_session(hSession, hKey, session, object);
+	if (rv != CKR_OK) {
+		if (rv == CKR_OBJECT_HANDLE_INVALID)
+			rv = CKR_KEY_HANDLE_INVALID;
+		return rv;
+	}
+
+	if ((*object)->ops->sign == NULL_PTR)
+		return CKR_KEY_TYPE_INCONSISTENT;
+
+	rv = (*object)->ops->get_attribute(*session, *object, &sign_attribute);
+	if (rv != CKR_OK || !can_sign)
+		return CKR_KEY_TYPE_INCONSISTENT;
+	rv = (*object)->ops->get_attribute(*session, *object, &key_type_attr);
+	if (rv != CKR_OK)
+		return CKR_KEY_TYPE_INCONSISTENT;
+
+	return CKR_OK;
+}
+
+
 CK_RV
 C_SignInit(CK_SESSION_HANDLE hSession,		/* the session's handle */
 		CK_MECHANISM_PTR pMechanism,	/* the signature mechanism */
 		CK_OBJECT_HANDLE hKey)		/* handle of the signature key */
 {
-	CK_BBOOL can_sign;
 	CK_KEY_TYPE key_type;
-	CK_ATTRIBUTE sign_attribute = { CKA_SIGN, &can_sign, sizeof(can_sign) };
-	CK_ATTRIBUTE key_type_attr = { CKA_KEY_TYPE, &key_type, sizeof(key_type) };
 	struct sc_pkcs11_session *session;
 	struct sc_pkcs11_object *object;
 	CK_RV rv;
@@ -668,32 +848,10 @@ C_SignInit(CK_SESSION_HANDLE hSession,		/* the session's handle */
 	if (rv != CKR_OK)
 		return rv;
 
-	rv = get_object_from_session(hSession, hKey, &session, &object);
-	if (rv != CKR_OK) {
-		if (rv == CKR_OBJECT_HANDLE_INVALID)
-			rv = CKR_KEY_HANDLE_INVALID;
-		goto out;
-	}
-
-	if (object->ops->sign == NULL_PTR) {
-		rv = CKR_KEY_TYPE_INCONSISTENT;
-		goto out;
-	}
-
-	rv = object->ops->get_attribute(session, object, &sign_attribute);
-	if (rv != CKR_OK || !can_sign) {
-		rv = CKR_KEY_TYPE_INCONSISTENT;
-		goto out;
-	}
-	rv = object->ops->get_attribute(session, object, &key_type_attr);
-	if (rv != CKR_OK) {
-		rv = CKR_KEY_TYPE_INCONSISTENT;
-		goto out;
-	}
-
-	rv = sc_pkcs11_sign_init(session, pMechanism, object, key_type);
+	rv = get_signature_key(hSession, hKey, &session, &object, &key_type);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_sign_init(session, pMechanism, object, key_type);
 
-out:
 	SC_LOG_RV("C_SignInit() = %s", rv);
 	sc_pkcs11_unlock();
 	return rv;
@@ -1609,11 +1767,55 @@ CK_RV C_VerifyRecover(CK_SESSION_HANDLE hSession,	/* the session's handle */
 }
 
 /* PKCS #11 3.0 only */
+/* Look up the key for C_MessageEncryptInit() and C_MessageDecryptInit() */
+static CK_RV
+message_crypt_init(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hKey, CK_FLAGS flags)
+{
+	CK_BBOOL can_do;
+	CK_KEY_TYPE key_type;
+	CK_ATTRIBUTE usage_attribute = { flags == CKF_MESSAGE_ENCRYPT ? CKA_ENCRYPT : CKA_DECRYPT,
+					 &can_do, sizeof(can_do) };
+	CK_ATTRIBUTE key_type_attr = { CKA_KEY_TYPE, &key_type, sizeof(key_type) };
+	struct sc_pkcs11_session *session;
+	struct sc_pkcs11_object *object;
+	CK_RV rv;
+
+	rv = get_object_from_session(hSession, hKey, &session, &object);
+	if (rv != CKR_OK) {
+		if (rv == CKR_OBJECT_HANDLE_INVALID)
+			rv = CKR_KEY_HANDLE_INVALID;
+		return rv;
+	}
+
+	rv = object->ops->get_attribute(session, object, &usage_attribute);
+	if (rv != CKR_OK || !can_do)
+		return CKR_KEY_TYPE_INCONSISTENT;
+	rv = object->ops->get_attribute(session, object, &key_type_attr);
+	if (rv != CKR_OK)
+		return CKR_KEY_TYPE_INCONSISTENT;
+
+	return sc_pkcs11_message_crypt_init(session, flags, pMechanism, object, key_type);
+}
+
 CK_RV C_MessageEncryptInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
 			   CK_MECHANISM_PTR pMechanism,  /* the encryption mechanism */
 			   CK_OBJECT_HANDLE hKey)         /* handle of encryption key */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_RV rv;
+
+	if (pMechanism == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = message_crypt_init(hSession, pMechanism, hKey, CKF_MESSAGE_ENCRYPT);
+
+	SC_LOG_RV("C_MessageEncryptInit() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_EncryptMessage(CK_SESSION_HANDLE hSession,   /* the session's handle */
@@ -1621,12 +1823,30 @@ CK_RV C_EncryptMessage(CK_SESSION_HANDLE hSession,   /* the session's handle */
 		       CK_ULONG ulParameterLen,      /* length of message specific parameter */
 		       CK_BYTE_PTR pAssociatedData,  /* AEAD Associated data */
 		       CK_ULONG ulAssociatedDataLen, /* AEAD Associated data length */
-		       CK_BYTE_PTR pPlaintext,       /* plain text  */
+		       CK_BYTE_PTR pPlaintext,       /* plain text */
 		       CK_ULONG ulPlaintextLen,      /* plain text length */
 		       CK_BYTE_PTR pCiphertext,      /* gets cipher text */
 		       CK_ULONG_PTR pulCiphertextLen) /* gets cipher text length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	if (pulCiphertextLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_crypt(session, CKF_MESSAGE_ENCRYPT, pParameter, ulParameterLen,
+				pAssociatedData, ulAssociatedDataLen,
+				pPlaintext, ulPlaintextLen, pCiphertext, pulCiphertextLen);
+
+	SC_LOG_RV("C_EncryptMessage() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_EncryptMessageBegin(CK_SESSION_HANDLE hSession,   /* the session's handle */
@@ -1635,7 +1855,21 @@ CK_RV C_EncryptMessageBegin(CK_SESSION_HANDLE hSession,   /* the session's handl
 			    CK_BYTE_PTR pAssociatedData,  /* AEAD Associated data */
 			    CK_ULONG ulAssociatedDataLen)  /* AEAD Associated data length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_crypt_begin(session, CKF_MESSAGE_ENCRYPT, pParameter, ulParameterLen,
+				pAssociatedData, ulAssociatedDataLen);
+
+	SC_LOG_RV("C_EncryptMessageBegin() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_EncryptMessageNext(CK_SESSION_HANDLE hSession,        /* the session's handle */
@@ -1647,65 +1881,188 @@ CK_RV C_EncryptMessageNext(CK_SESSION_HANDLE hSession,        /* the session's h
 			   CK_ULONG_PTR pulCiphertextPartLen, /* gets cipher text length */
 			   CK_FLAGS flags)                     /* multi mode flag */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	if (pulCiphertextPartLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_crypt_next(session, CKF_MESSAGE_ENCRYPT, pParameter, ulParameterLen,
+				pPlaintextPart, ulPlaintextPartLen, pCiphertextPart, pulCiphertextPartLen, flags);
+
+	SC_LOG_RV("C_EncryptMessageNext() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_MessageEncryptFinal(CK_SESSION_HANDLE hSession)        /* the session's handle */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_crypt_final(session, CKF_MESSAGE_ENCRYPT);
+
+	SC_LOG_RV("C_MessageEncryptFinal() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_MessageDecryptInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
 			   CK_MECHANISM_PTR pMechanism,  /* the decryption mechanism */
 			   CK_OBJECT_HANDLE hKey)         /* handle of decryption key */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_RV rv;
+
+	if (pMechanism == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = message_crypt_init(hSession, pMechanism, hKey, CKF_MESSAGE_DECRYPT);
+
+	SC_LOG_RV("C_MessageDecryptInit() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
-CK_RV C_DecryptMessage(CK_SESSION_HANDLE hSession,    /* the session's handle */
+CK_RV C_DecryptMessage(CK_SESSION_HANDLE hSession,   /* the session's handle */
 		       CK_VOID_PTR pParameter,       /* message specific parameter */
 		       CK_ULONG ulParameterLen,      /* length of message specific parameter */
 		       CK_BYTE_PTR pAssociatedData,  /* AEAD Associated data */
 		       CK_ULONG ulAssociatedDataLen, /* AEAD Associated data length */
-		       CK_BYTE_PTR pCiphertext,      /* cipher text */
-		       CK_ULONG ulCiphertextLen,     /* cipher text length */
-		       CK_BYTE_PTR pPlaintext,       /* gets plain text */
-		       CK_ULONG_PTR pulPlaintextLen)  /* gets plain text length */
+		       CK_BYTE_PTR pCiphertext,       /* cipher text */
+		       CK_ULONG ulCiphertextLen,      /* cipher text length */
+		       CK_BYTE_PTR pPlaintext,      /* gets plain text */
+		       CK_ULONG_PTR pulPlaintextLen) /* gets plain text length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	if (pulPlaintextLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_crypt(session, CKF_MESSAGE_DECRYPT, pParameter, ulParameterLen,
+				pAssociatedData, ulAssociatedDataLen,
+				pCiphertext, ulCiphertextLen, pPlaintext, pulPlaintextLen);
+
+	SC_LOG_RV("C_DecryptMessage() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
-CK_RV C_DecryptMessageBegin(CK_SESSION_HANDLE hSession,    /* the session's handle */
+CK_RV C_DecryptMessageBegin(CK_SESSION_HANDLE hSession,   /* the session's handle */
 			    CK_VOID_PTR pParameter,       /* message specific parameter */
 			    CK_ULONG ulParameterLen,      /* length of message specific parameter */
 			    CK_BYTE_PTR pAssociatedData,  /* AEAD Associated data */
 			    CK_ULONG ulAssociatedDataLen)  /* AEAD Associated data length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_crypt_begin(session, CKF_MESSAGE_DECRYPT, pParameter, ulParameterLen,
+				pAssociatedData, ulAssociatedDataLen);
+
+	SC_LOG_RV("C_DecryptMessageBegin() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
-CK_RV C_DecryptMessageNext(CK_SESSION_HANDLE hSession,    /* the session's handle */
+CK_RV C_DecryptMessageNext(CK_SESSION_HANDLE hSession,        /* the session's handle */
 			   CK_VOID_PTR pParameter,            /* message specific parameter */
 			   CK_ULONG ulParameterLen,           /* length of message specific parameter */
-			   CK_BYTE_PTR pCiphertextPart,       /* cipher text */
-			   CK_ULONG ulCiphertextPartLen,      /* cipher text length */
-			   CK_BYTE_PTR pPlaintextPart,        /* gets plain text */
-			   CK_ULONG_PTR pulPlaintextPartLen,  /* gets plain text length */
+			   CK_BYTE_PTR pCiphertextPart,        /* cipher text */
+			   CK_ULONG ulCiphertextPartLen,       /* cipher text length */
+			   CK_BYTE_PTR pPlaintextPart,       /* gets plain text */
+			   CK_ULONG_PTR pulPlaintextPartLen, /* gets plain text length */
 			   CK_FLAGS flags)                     /* multi mode flag */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	if (pulPlaintextPartLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_crypt_next(session, CKF_MESSAGE_DECRYPT, pParameter, ulParameterLen,
+				pCiphertextPart, ulCiphertextPartLen, pPlaintextPart, pulPlaintextPartLen, flags);
+
+	SC_LOG_RV("C_DecryptMessageNext() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
-CK_RV C_MessageDecryptFinal(CK_SESSION_HANDLE hSession)    /* the session's handle */
+CK_RV C_MessageDecryptFinal(CK_SESSION_HANDLE hSession)        /* the session's handle */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_crypt_final(session, CKF_MESSAGE_DECRYPT);
+
+	SC_LOG_RV("C_MessageDecryptFinal() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_MessageSignInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
 			CK_MECHANISM_PTR pMechanism,  /* the signing mechanism */
 			CK_OBJECT_HANDLE hKey)         /* handle of signing key */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_KEY_TYPE key_type;
+	struct sc_pkcs11_session *session;
+	struct sc_pkcs11_object *object;
+	CK_RV rv;
+
+	if (pMechanism == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_signature_key(hSession, hKey, &session, &object, &key_type);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_sign_init(session, pMechanism, object, key_type);
+
+	SC_LOG_RV("C_MessageSignInit() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_SignMessage(CK_SESSION_HANDLE hSession,    /* the session's handle */
@@ -1716,14 +2073,64 @@ CK_RV C_SignMessage(CK_SESSION_HANDLE hSession,    /* the session's handle */
 		    CK_BYTE_PTR pSignature,       /* gets signature */
 		    CK_ULONG_PTR pulSignatureLen)  /* gets signature length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_ULONG length;
+	CK_RV rv;
+
+	/* None of the signature mechanisms take per-message parameters */
+	if (pParameter != NULL_PTR || pulSignatureLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv != CKR_OK)
+		goto out;
+
+	/* As in C_Sign(), asking for the length must not consume the data */
+	if ((rv = sc_pkcs11_message_sign_size(session, &length)) != CKR_OK)
+		goto out;
+
+	if (pSignature == NULL || length > *pulSignatureLen) {
+		*pulSignatureLen = length;
+		rv = pSignature ? CKR_BUFFER_TOO_SMALL : CKR_OK;
+		goto out;
+	}
+
+	rv = restore_login_state(session->slot);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_sign(session, pData, ulDataLen, pSignature, pulSignatureLen);
+	rv = reset_login_state(session->slot, rv);
+
+out:
+	SC_LOG_RV("C_SignMessage() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_SignMessageBegin(CK_SESSION_HANDLE hSession,    /* the session's handle */
 			 CK_VOID_PTR pParameter,       /* message specific parameter */
 			 CK_ULONG ulParameterLen)      /* length of message specific parameter */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	if (pParameter != NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_sign_begin(session);
+
+	SC_LOG_RV("C_SignMessageBegin() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_SignMessageNext(CK_SESSION_HANDLE hSession,    /* the session's handle */
@@ -1734,12 +2141,66 @@ CK_RV C_SignMessageNext(CK_SESSION_HANDLE hSession,    /* the session's handle *
 			CK_BYTE_PTR pSignature,       /* gets signature */
 			CK_ULONG_PTR pulSignatureLen)  /* gets signature length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_ULONG length;
+	CK_RV rv;
+
+	if (pParameter != NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv != CKR_OK)
+		goto out;
+
+	/* Without pulSignatureLen this is not the last part of the message */
+	if (pulSignatureLen == NULL_PTR) {
+		rv = sc_pkcs11_message_sign_update(session, pData, ulDataLen);
+		goto out;
+	}
+
+	if ((rv = sc_pkcs11_message_sign_size(session, &length)) != CKR_OK)
+		goto out;
+
+	if (pSignature == NULL || length > *pulSignatureLen) {
+		*pulSignatureLen = length;
+		rv = pSignature ? CKR_BUFFER_TOO_SMALL : CKR_OK;
+		goto out;
+	}
+
+	rv = sc_pkcs11_message_sign_update(session, pData, ulDataLen);
+	if (rv == CKR_OK) {
+		rv = restore_login_state(session->slot);
+		if (rv == CKR_OK)
+			rv = sc_pkcs11_message_sign_end(session, pSignature, pulSignatureLen);
+		rv = reset_login_state(session->slot, rv);
+	}
+
+out:
+	SC_LOG_RV("C_SignMessageNext() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_MessageSignFinal(CK_SESSION_HANDLE hSession)    /* the session's handle */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	struct sc_pkcs11_session *session;
+	CK_RV rv;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_message_sign_final(session);
+
+	SC_LOG_RV("C_MessageSignFinal() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_MessageVerifyInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
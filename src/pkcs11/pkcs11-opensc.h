@@ -25,5 +25,59 @@
  * to set userConsent=1 for other objects than private keys via PKCS#11. */
 #define CKA_OPENSC_ALWAYS_AUTH_ANY_OBJECT (CKA_VENDOR_DEFINED | SC_VENDOR_DEFINED | 3UL)
 
+/*
+ * OpenSC specific functions, available through
+ * C_GetInterface("Vendor OpenSC", ...).
+ */
+#define OPENSC_INTERFACE_NAME		"Vendor OpenSC"
+
+/* Pass as slotID to aggregate over all readers */
+#define CK_OPENSC_ALL_SLOTS		((CK_SLOT_ID)~0UL)
+
+#define CK_OPENSC_STATS_LATENCY_BUCKETS	16
+
+typedef struct CK_OPENSC_APDU_STATS {
+	unsigned long long apdus;
+	unsigned long long errors;
+	unsigned long long bytes_sent;
+	unsigned long long bytes_received;
+	unsigned long long get_responses;
+	unsigned long long selects;
+	unsigned long long retries;
+	unsigned long long time_us;
+	/* bucket i counts APDUs faster than (64 << i) microseconds,
+	 * the last bucket counts all slower ones */
+	unsigned long long latency[CK_OPENSC_STATS_LATENCY_BUCKETS];
+	struct {
+		unsigned long long count;
+		unsigned long long time_us;
+	} ins[256];
+} CK_OPENSC_APDU_STATS;
+
+typedef CK_OPENSC_APDU_STATS * CK_OPENSC_APDU_STATS_PTR;
+
+typedef struct CK_OPENSC_FUNCTION_LIST {
+	CK_VERSION version;
+	CK_RV (*C_OpenSC_GetStats)(CK_SLOT_ID slotID, CK_OPENSC_APDU_STATS_PTR pStats);
+	CK_RV (*C_OpenSC_ResetStats)(CK_SLOT_ID slotID);
+	/* Since 1.1: C_GetAttributeValue() for ulObjectCount objects at once.
+	 * pTemplates holds ulCount attributes per object, pResults gets the
+	 * return value of each object */
+	CK_RV (*C_OpenSC_GetAttributeValues)(CK_SESSION_HANDLE hSession,
+			CK_OBJECT_HANDLE_PTR phObjects, CK_ULONG ulObjectCount,
+			CK_ATTRIBUTE_PTR pTemplates, CK_ULONG ulCount, CK_RV *pResults);
+	/* Since 1.1: find the objects matching pFindTemplate and get their
+	 * attributes like C_OpenSC_GetAttributeValues(). *pulObjectCount is the
+	 * size of phObjects on input and the number of matches on output; with
+	 * phObjects NULL only the matches are counted. Does not touch the
+	 * session's C_FindObjects() operation */
+	CK_RV (*C_OpenSC_FindObjectsWithAttributes)(CK_SESSION_HANDLE hSession,
+			CK_ATTRIBUTE_PTR pFindTemplate, CK_ULONG ulFindCount,
+			CK_OBJECT_HANDLE_PTR phObjects, CK_ULONG_PTR pulObjectCount,
+			CK_ATTRIBUTE_PTR pTemplates, CK_ULONG ulCount, CK_RV *pResults);
+} CK_OPENSC_FUNCTION_LIST;
+
+typedef CK_OPENSC_FUNCTION_LIST * CK_OPENSC_FUNCTION_LIST_PTR;
+
 
 #endif
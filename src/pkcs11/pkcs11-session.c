@@ -29,7 +29,7 @@
 
 CK_RV get_session(CK_SESSION_HANDLE hSession, struct sc_pkcs11_session **session)
 {
-	*session = list_seek(&sessions, &hSession);
+	*session = find_by_handle(&sessions, hSession);
 	if (!*session)
 		return CKR_SESSION_HANDLE_INVALID;
 	return CKR_OK;
@@ -75,7 +75,7 @@ CK_RV C_OpenSession(CK_SLOT_ID slotID,	/* the slot's ID */
 
 	/* make session handle from pointer and check its uniqueness */
 	session->handle = (CK_SESSION_HANDLE)(uintptr_t)session;
-	if (list_seek(&sessions, &session->handle) != NULL) {
+	if (find_by_handle(&sessions, session->handle) != NULL) {
 		sc_log(context, "C_OpenSession handle 0x%lx already exists", session->handle);
 
 		free(session);
@@ -88,8 +88,12 @@ CK_RV C_OpenSession(CK_SLOT_ID slotID,	/* the slot's ID */
 	session->notify_callback = Notify;
 	session->notify_data = pApplication;
 	session->flags = flags;
+	if (ptrarray_append(&sessions, session) < 0) {
+		free(session);
+		rv = CKR_HOST_MEMORY;
+		goto out;
+	}
 	slot->nsessions++;
-	list_append(&sessions, session);
 	*phSession = session->handle;
 	sc_log(context, "C_OpenSession handle: 0x%lx", session->handle);
 
@@ -108,7 +112,7 @@ static CK_RV sc_pkcs11_close_session(CK_SESSION_HANDLE hSession)
 
 	sc_log(context, "real C_CloseSession(0x%lx)", hSession);
 
-	session = list_seek(&sessions, &hSession);
+	session = find_by_handle(&sessions, hSession);
 	if (!session)
 		return CKR_SESSION_HANDLE_INVALID;
 
@@ -129,7 +133,7 @@ static CK_RV sc_pkcs11_close_session(CK_SESSION_HANDLE hSession)
 	for (size_t i = 0; i < SC_PKCS11_OPERATION_MAX; i++)
 		sc_pkcs11_release_operation(&session->operation[i]);
 
-	if (list_delete(&sessions, session) != 0)
+	if (ptrarray_delete(&sessions, session) != 0)
 		sc_log(context, "Could not delete session from list!");
 	free(session);
 	return CKR_OK;
@@ -142,9 +146,10 @@ CK_RV sc_pkcs11_close_all_sessions(CK_SLOT_ID slotID)
 	CK_RV rv = CKR_OK, error;
 	struct sc_pkcs11_session *session;
 	unsigned int i;
-	sc_log(context, "real C_CloseAllSessions(0x%lx) %d", slotID, list_size(&sessions));
-	for (i = 0; i < list_size(&sessions); i++) {
-		session = list_get_at(&sessions, i);
+	sc_log(context, "real C_CloseAllSessions(0x%lx) %d", slotID, ptrarray_size(&sessions));
+	/* walk backwards, closing a session removes it from the array */
+	for (i = ptrarray_size(&sessions); i-- > 0; ) {
+		session = ptrarray_get_at(&sessions, i);
 		if (session->slot->id == slotID)
 			if ((error = sc_pkcs11_close_session(session->handle)) != CKR_OK)
 				rv = error;
@@ -263,7 +268,7 @@ CK_RV C_GetSessionInfo(CK_SESSION_HANDLE hSession,	/* the session's handle */
 
 	sc_log(context, "C_GetSessionInfo(hSession:0x%lx)", hSession);
 
-	session = list_seek(&sessions, &hSession);
+	session = find_by_handle(&sessions, hSession);
 	if (!session) {
 		rv = CKR_SESSION_HANDLE_INVALID;
 		goto out;
@@ -338,7 +343,7 @@ CK_RV C_Login(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		rv = CKR_USER_TYPE_INVALID;
 		goto out;
 	}
-	session = list_seek(&sessions, &hSession);
+	session = find_by_handle(&sessions, hSession);
 	if (!session) {
 		rv = CKR_SESSION_HANDLE_INVALID;
 		goto out;
@@ -417,7 +422,7 @@ CK_RV C_Logout(CK_SESSION_HANDLE hSession)
 	if (rv != CKR_OK)
 		return rv;
 
-	session = list_seek(&sessions, &hSession);
+	session = find_by_handle(&sessions, hSession);
 	if (!session) {
 		rv = CKR_SESSION_HANDLE_INVALID;
 		goto out;
@@ -458,7 +463,7 @@ CK_RV C_InitPIN(CK_SESSION_HANDLE hSession, CK_CHAR_PTR pPin, CK_ULONG ulPinLen)
 	if (rv != CKR_OK)
 		return rv;
 
-	session = list_seek(&sessions, &hSession);
+	session = find_by_handle(&sessions, hSession);
 	if (!session) {
 		rv = CKR_SESSION_HANDLE_INVALID;
 		goto out;
@@ -502,7 +507,7 @@ CK_RV C_SetPIN(CK_SESSION_HANDLE hSession,
 	if (rv != CKR_OK)
 		return rv;
 
-	session = list_seek(&sessions, &hSession);
+	session = find_by_handle(&sessions, hSession);
 	if (!session) {
 		rv = CKR_SESSION_HANDLE_INVALID;
 		goto out;
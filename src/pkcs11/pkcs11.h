@@ -370,6 +370,7 @@ typedef unsigned long ck_key_type_t;
 #define CKK_GOSTR3410		(0x30UL)
 #define CKK_GOSTR3411		(0x31UL)
 #define CKK_GOST28147		(0x32UL)
+#define CKK_CHACHA20		(0x33UL)
 #define CKK_EC_EDWARDS		(0x40UL)
 #define CKK_EC_MONTGOMERY	(0x41UL)
 #define CKK_VENDOR_DEFINED	(1UL << 31)
@@ -811,6 +812,7 @@ typedef unsigned long ck_mechanism_type_t;
 #define CKM_AES_CFB128			(0x2107UL)
 #define CKM_AES_KEY_WRAP		(0x2109UL)
 #define CKM_AES_KEY_WRAP_PAD		(0x210AUL)
+#define CKM_CHACHA20_POLY1305		(0x4021UL)
 #define CKM_XEDDSA			(0x4029UL)
 
 
@@ -933,6 +935,29 @@ typedef struct CK_GCM_PARAMS {
 	unsigned long ulTagBits;
 } CK_GCM_PARAMS;
 
+typedef unsigned long CK_GENERATOR_FUNCTION;
+
+#define CKG_NO_GENERATE			(0x0UL)
+#define CKG_GENERATE			(0x1UL)
+#define CKG_GENERATE_COUNTER		(0x2UL)
+#define CKG_GENERATE_RANDOM		(0x3UL)
+#define CKG_GENERATE_COUNTER_XOR	(0x4UL)
+
+typedef struct CK_GCM_MESSAGE_PARAMS {
+	unsigned char *pIv;
+	unsigned long ulIvLen;
+	unsigned long ulIvFixedBits;
+	CK_GENERATOR_FUNCTION ivGenerator;
+	unsigned char *pTag;
+	unsigned long ulTagBits;
+} CK_GCM_MESSAGE_PARAMS;
+
+typedef struct CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS {
+	unsigned char *pNonce;
+	unsigned long ulNonceLen;
+	unsigned char *pTag;
+} CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS;
+
 /* EDDSA */
 typedef struct CK_EDDSA_PARAMS {
 	unsigned char phFlag;
@@ -1609,6 +1634,7 @@ struct ck_c_initialize_args
 #define CKR_DEVICE_ERROR			(0x30UL)
 #define CKR_DEVICE_MEMORY			(0x31UL)
 #define CKR_DEVICE_REMOVED			(0x32UL)
+#define CKR_AEAD_DECRYPT_FAILED			(0x35UL)
 #define CKR_ENCRYPTED_DATA_INVALID		(0x40UL)
 #define CKR_ENCRYPTED_DATA_LEN_RANGE		(0x41UL)
 #define CKR_FUNCTION_CANCELED			(0x50UL)
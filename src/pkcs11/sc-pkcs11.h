@@ -74,8 +74,16 @@ struct sc_pkcs11_config {
 	unsigned int create_puk_slot;
 	unsigned int create_slots_flags;
 	unsigned char ignore_pin_length;
+	unsigned int detect_threads;
+	/* seconds the PIN status is reused, including the login state: a
+	 * logout by another application shows in C_GetSessionInfo() only
+	 * after this time (default 5) */
+	unsigned int pin_status_ttl;
 };
 
+/* Upper bound for the detect_threads option */
+#define SC_PKCS11_MAX_DETECT_THREADS	32
+
 /*
  * PKCS#11 Object abstraction layer
  */
@@ -138,6 +146,12 @@ struct sc_pkcs11_object {
 #define SC_PKCS11_OBJECT_HIDDEN	0x0002
 #define SC_PKCS11_OBJECT_RECURS	0x8000
 
+/* Encoded attribute values of one object, see attr-cache.c */
+struct sc_pkcs11_attr_cache {
+	struct sc_pkcs11_attr_cache_entry *entries;
+	unsigned int count;
+};
+
 
 /*
  * PKCS#11 smart card Framework abstraction
@@ -218,7 +232,7 @@ struct sc_pkcs11_slot {
 	struct sc_pkcs11_card *p11card;	/* The card associated with this slot */
 	unsigned int events;		/* Card events SC_EVENT_CARD_{INSERTED,REMOVED} */
 	void *fw_data;			/* Framework specific data */  /* TODO: get know how it used */
-	list_t objects;			/* Objects in this slot */
+	ptrarray_t objects;		/* Objects in this slot */
 	unsigned int nsessions;		/* Number of sessions using this slot */
 	sc_timestamp_t slot_state_expires;
 
@@ -265,6 +279,9 @@ enum {
 	SC_PKCS11_OPERATION_DERIVE,
 	SC_PKCS11_OPERATION_WRAP,
 	SC_PKCS11_OPERATION_UNWRAP,
+	SC_PKCS11_OPERATION_MESSAGE_SIGN,
+	SC_PKCS11_OPERATION_MESSAGE_ENCRYPT,
+	SC_PKCS11_OPERATION_MESSAGE_DECRYPT,
 	SC_PKCS11_OPERATION_MAX
 };
 
@@ -333,6 +350,16 @@ struct sc_pkcs11_mechanism_type {
 					struct sc_pkcs11_object *,
 					CK_BYTE_PTR, CK_ULONG,
 					struct sc_pkcs11_object *);
+	/* Message-based encryption/decryption */
+	CK_RV		  (*message_init)(sc_pkcs11_operation_t *,
+					struct sc_pkcs11_object *, CK_FLAGS);
+	CK_RV		  (*message_begin)(sc_pkcs11_operation_t *,
+					CK_VOID_PTR, CK_ULONG,
+					CK_BYTE_PTR, CK_ULONG);
+	CK_RV		  (*message_next)(sc_pkcs11_operation_t *,
+					CK_VOID_PTR, CK_ULONG,
+					CK_BYTE_PTR, CK_ULONG,
+					CK_BYTE_PTR, CK_ULONG_PTR, CK_FLAGS);
 
 	/* mechanism specific data */
 	const void *  mech_data;
@@ -384,9 +411,8 @@ typedef struct sc_pkcs11_session sc_pkcs11_session_t;
 /* Module variables */
 extern struct sc_context *context;
 extern struct sc_pkcs11_config sc_pkcs11_conf;
-extern list_t sessions;
-extern list_t virtual_slots;
-extern list_t cards;
+extern ptrarray_t sessions;
+extern ptrarray_t virtual_slots;
 
 /* Framework definitions */
 extern struct sc_pkcs11_framework_ops framework_pkcs15;
@@ -397,6 +423,14 @@ CK_RV sc_to_cryptoki_error(int rc, const char *ctx);
 void sc_pkcs11_print_attrs(int level, const char *file, unsigned int line, const char *function,
 		const char *info, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount);
 void sc_pkcs11_card_free(struct sc_pkcs11_card *p11card);
+void *find_by_handle(ptrarray_t *array, CK_ULONG handle);
+
+/* OpenSC vendor interface */
+CK_RV C_OpenSC_GetAttributeValues(CK_SESSION_HANDLE, CK_OBJECT_HANDLE_PTR, CK_ULONG,
+		CK_ATTRIBUTE_PTR, CK_ULONG, CK_RV *);
+CK_RV C_OpenSC_FindObjectsWithAttributes(CK_SESSION_HANDLE, CK_ATTRIBUTE_PTR, CK_ULONG,
+		CK_OBJECT_HANDLE_PTR, CK_ULONG_PTR, CK_ATTRIBUTE_PTR, CK_ULONG, CK_RV *);
+
 #define dump_template(level, info, pTemplate, ulCount) \
 		sc_pkcs11_print_attrs(level, FILENAME, __LINE__, __FUNCTION__, \
 				info, pTemplate, ulCount)
@@ -452,6 +486,12 @@ CK_RV attr_find_and_allocate_ptr(CK_ATTRIBUTE_PTR, CK_ULONG, CK_ULONG, void **,
 CK_RV attr_find_var(CK_ATTRIBUTE_PTR, CK_ULONG, CK_ULONG, void *, size_t *);
 CK_RV attr_extract(CK_ATTRIBUTE_PTR, void *, size_t *);
 
+/* Cache of encoded attribute values (attr-cache.c) */
+CK_RV sc_pkcs11_attr_cache_get(struct sc_pkcs11_attr_cache *, struct sc_pkcs11_session *,
+		void *, CK_ATTRIBUTE_PTR,
+		CK_RV (*)(struct sc_pkcs11_session *, void *, CK_ATTRIBUTE_PTR));
+void sc_pkcs11_attr_cache_clear(struct sc_pkcs11_attr_cache *);
+
 /* Generic Mechanism functions */
 CK_RV sc_pkcs11_register_mechanism(struct sc_pkcs11_card *,
 				sc_pkcs11_mechanism_type_t *, sc_pkcs11_mechanism_type_t **);
@@ -467,6 +507,26 @@ CK_RV sc_pkcs11_sign_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
 CK_RV sc_pkcs11_sign_update(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG);
 CK_RV sc_pkcs11_sign_final(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG_PTR);
 CK_RV sc_pkcs11_sign_size(struct sc_pkcs11_session *, CK_ULONG_PTR);
+CK_RV sc_pkcs11_message_sign_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
+				struct sc_pkcs11_object *, CK_KEY_TYPE);
+CK_RV sc_pkcs11_message_sign_begin(struct sc_pkcs11_session *);
+CK_RV sc_pkcs11_message_sign_update(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG);
+CK_RV sc_pkcs11_message_sign_end(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_message_sign(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG,
+				CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_message_sign_size(struct sc_pkcs11_session *, CK_ULONG_PTR);
+CK_RV sc_pkcs11_message_sign_final(struct sc_pkcs11_session *);
+CK_RV sc_pkcs11_message_crypt_init(struct sc_pkcs11_session *, CK_FLAGS, CK_MECHANISM_PTR,
+				struct sc_pkcs11_object *, CK_KEY_TYPE);
+CK_RV sc_pkcs11_message_crypt_begin(struct sc_pkcs11_session *, CK_FLAGS,
+				CK_VOID_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG);
+CK_RV sc_pkcs11_message_crypt_next(struct sc_pkcs11_session *, CK_FLAGS,
+				CK_VOID_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG,
+				CK_BYTE_PTR, CK_ULONG_PTR, CK_FLAGS);
+CK_RV sc_pkcs11_message_crypt(struct sc_pkcs11_session *, CK_FLAGS,
+				CK_VOID_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG,
+				CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_message_crypt_final(struct sc_pkcs11_session *, CK_FLAGS);
 #ifdef ENABLE_OPENSSL
 CK_RV sc_pkcs11_verif_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
 				struct sc_pkcs11_object *, CK_KEY_TYPE);
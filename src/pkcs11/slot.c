@@ -24,6 +24,11 @@
 
 #include <string.h>
 #include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
 
 #include "sc-pkcs11.h"
 
@@ -33,13 +38,13 @@ void _debug_virtual_slots(sc_pkcs11_slot_t *p)
 	int i, vs_size;
 	sc_pkcs11_slot_t * slot;
 
-	vs_size = list_size(&virtual_slots);
+	vs_size = ptrarray_size(&virtual_slots);
 	_sc_debug(context, 10,
 			"VSS size:%d", vs_size);
 	_sc_debug(context, 10,
 			"VSS  [i] id   flags LU events nsessions slot_info.flags reader p11card description");
 	for (i = 0; i < vs_size; i++) {
-		slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+		slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, i);
 		if (slot) {
 			_sc_debug(context, 10,
 				"VSS %s[%d] 0x%2.2lx 0x%4.4x %d  %d  %d %4.4lx  %p %p %.64s",
@@ -75,8 +80,8 @@ static struct sc_pkcs11_slot * reader_reclaim_slot(sc_reader_t *reader)
 	strcpy_bp(manufacturerID, reader->vendor, 32);
 
 	/* Locate a slot related to the reader */
-	for (i = 0; i<list_size(&virtual_slots); i++) {
-		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+	for (i = 0; i<ptrarray_size(&virtual_slots); i++) {
+		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, i);
 		if (slot->reader == NULL
 				&& 0 == memcmp(slot->slot_info.slotDescription, slotDescription, 64)
 				&& 0 == memcmp(slot->slot_info.manufacturerID, manufacturerID, 32)
@@ -106,7 +111,7 @@ void init_slot_info(CK_SLOT_INFO_PTR pInfo, sc_reader_t *reader)
 	pInfo->firmwareVersion.minor = 0;
 }
 
-/* simclist helpers to locate interesting objects by ID */
+/* helpers to locate interesting objects by ID */
 static int object_list_seeker(const void *el, const void *key)
 {
 	const struct sc_pkcs11_object *object = (struct sc_pkcs11_object *)el;
@@ -126,18 +131,21 @@ CK_RV create_slot(sc_reader_t *reader)
 	/* create a new slot if no empty slot is available */
 	if (!slot) {
 		sc_log(context, "Creating new slot");
-		if (list_size(&virtual_slots) >= sc_pkcs11_conf.max_virtual_slots)
+		if (ptrarray_size(&virtual_slots) >= sc_pkcs11_conf.max_virtual_slots)
 			return CKR_FUNCTION_FAILED;
 
 		slot = (struct sc_pkcs11_slot *)calloc(1, sizeof(struct sc_pkcs11_slot));
 		if (!slot)
 			return CKR_HOST_MEMORY;
 
-		list_append(&virtual_slots, slot);
-		if (0 != list_init(&slot->objects)) {
+		if (ptrarray_append(&virtual_slots, slot) < 0) {
+			free(slot);
+			return CKR_HOST_MEMORY;
+		}
+		if (0 != ptrarray_init(&slot->objects)) {
 			return CKR_HOST_MEMORY;
 		}
-		list_attributes_seeker(&slot->objects, object_list_seeker);
+		ptrarray_attributes_seeker(&slot->objects, object_list_seeker);
 
 		if (0 != list_init(&slot->logins)) {
 			return CKR_HOST_MEMORY;
@@ -147,7 +155,7 @@ CK_RV create_slot(sc_reader_t *reader)
 
 		/* reuse the old list of logins/objects since they should be empty */
 		list_t logins = slot->logins;
-		list_t objects = slot->objects;
+		ptrarray_t objects = slot->objects;
 
 		memset(slot, 0, sizeof *slot);
 
@@ -156,7 +164,7 @@ CK_RV create_slot(sc_reader_t *reader)
 	}
 
 	slot->login_user = -1;
-	slot->id = (CK_SLOT_ID) list_locate(&virtual_slots, slot);
+	slot->id = (CK_SLOT_ID) ptrarray_locate(&virtual_slots, slot);
 	init_slot_info(&slot->slot_info, reader);
 	slot->reader = reader;
 
@@ -191,8 +199,8 @@ CK_RV card_removed(sc_reader_t * reader)
 	sc_log(context, "%s: card removed", reader->name);
 
 
-	for (i=0; i < list_size(&virtual_slots); i++) {
-		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+	for (i=0; i < ptrarray_size(&virtual_slots); i++) {
+		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, i);
 		if (slot->reader == reader) {
 			/* Save the "card" object */
 			if (slot->p11card)
@@ -207,14 +215,35 @@ CK_RV card_removed(sc_reader_t * reader)
 }
 
 
-CK_RV card_detect(sc_reader_t *reader)
-{
-	struct sc_pkcs11_card *p11card = NULL;
-	int free_p11card = 0;
-	int rc;
+/* State of a card detection. The detection is split into three stages so
+ * that the expensive middle one (connecting and binding the card) can run
+ * for several readers concurrently:
+ *  - card_detect_prepare() checks the card presence and finds or allocates
+ *    the p11card; it updates the virtual slots and must run serialized,
+ *  - card_detect_bind() connects the card and binds the framework to all
+ *    applications; it touches only the card in its own reader,
+ *  - card_detect_finish() creates the tokens in the virtual slots and must
+ *    run serialized again. */
+struct card_detect_job {
+	sc_reader_t *reader;
+	struct sc_pkcs11_card *p11card;
+	int free_p11card;
+	int need_bind;
+	int connected;
+	int bound;
+	/* cards of the same driver for the parallel bind */
+	int bind_first;
+	unsigned int bind_next;
+	struct sc_app_info *app_generic;
 	CK_RV rv;
+	CK_RV app_rv[SC_MAX_CARD_APPS];
+};
+
+static CK_RV card_detect_prepare(struct card_detect_job *job)
+{
+	sc_reader_t *reader = job->reader;
 	unsigned int i;
-	int j;
+	int rc;
 
 	sc_log(context, "%s: Detecting smart card", reader->name);
 	/* Check if someone inserted a card */
@@ -243,48 +272,56 @@ again:
 	}
 
 	/* Locate a slot related to the reader */
-	for (i=0; i<list_size(&virtual_slots); i++) {
-		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+	for (i=0; i<ptrarray_size(&virtual_slots); i++) {
+		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, i);
 		if (slot->reader == reader) {
-			p11card = slot->p11card;
+			job->p11card = slot->p11card;
 			break;
 		}
 	}
 
 	/* Detect the card if it's not known already */
-	if (p11card == NULL) {
+	if (job->p11card == NULL) {
 		sc_log(context, "%s: First seen the card ", reader->name);
-		p11card = (struct sc_pkcs11_card *)calloc(1, sizeof(struct sc_pkcs11_card));
-		if (!p11card)
+		job->p11card = (struct sc_pkcs11_card *)calloc(1, sizeof(struct sc_pkcs11_card));
+		if (!job->p11card)
 			return CKR_HOST_MEMORY;
-		free_p11card = 1;
-		p11card->reader = reader;
+		job->free_p11card = 1;
+		job->p11card->reader = reader;
 	}
+	job->need_bind = job->p11card->card == NULL || job->p11card->framework == NULL;
+
+	return CKR_OK;
+}
+
+static CK_RV card_detect_connect(struct card_detect_job *job)
+{
+	struct sc_pkcs11_card *p11card = job->p11card;
+	sc_reader_t *reader = job->reader;
+	int rc;
 
 	if (p11card->card == NULL) {
 		sc_log(context, "%s: Connecting ... ", reader->name);
 		rc = sc_connect_card(reader, &p11card->card);
 		if (rc != SC_SUCCESS) {
 			sc_log(context, "%s: SC connect card error %i", reader->name, rc);
-			rv = sc_to_cryptoki_error(rc, NULL);
-			goto fail;
-		}
-
-		/* escape commands are only guaranteed to be working with a card
-		 * inserted. That's why by now, after sc_connect_card() the reader's
-		 * metadata may have changed. We re-initialize the metadata for every
-		 * slot of this reader here. */
-		if (reader->flags & SC_READER_ENABLE_ESCAPE) {
-			for (i = 0; i<list_size(&virtual_slots); i++) {
-				sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
-				if (slot->reader == reader)
-					init_slot_info(&slot->slot_info, reader);
-			}
+			return sc_to_cryptoki_error(rc, NULL);
 		}
-
+		job->connected = 1;
 		sc_log(context, "%s: Connected SC card %p", reader->name, p11card->card);
 	}
 
+	return CKR_OK;
+}
+
+static CK_RV card_detect_bind(struct card_detect_job *job)
+{
+	struct sc_pkcs11_card *p11card = job->p11card;
+	sc_reader_t *reader = job->reader;
+	unsigned int i;
+	int j;
+	CK_RV rv;
+
 	/* Detect the framework */
 	if (p11card->framework == NULL) {
 		struct sc_app_info *app_generic = sc_pkcs15_get_application_by_type(p11card->card, "generic");
@@ -296,15 +333,15 @@ again:
 			if (frameworks[i]->bind != NULL)
 				break;
 		/*TODO: only first framework is used: pkcs15init framework is not reachable here */
-		if (frameworks[i] == NULL) {
-			rv = CKR_GENERAL_ERROR;
-			goto fail;
-		}
+		if (frameworks[i] == NULL)
+			return CKR_GENERAL_ERROR;
 
 		p11card->framework = frameworks[i];
+		job->app_generic = app_generic;
+		job->bound = 1;
 
 		/* Initialize framework */
-		sc_log(context, "%s: Detected framework %d. Creating tokens.", reader->name, i);
+		sc_log(context, "%s: Detected framework %d. Binding tokens.", reader->name, i);
 		/* Bind 'generic' application or (emulated?) card without applications */
 		if (app_generic || !p11card->card->app_count)   {
 			scconf_block *conf_block = NULL;
@@ -320,7 +357,7 @@ again:
 				"pkcs11_enable_InitToken", 0);
 
 			sc_log(context, "%s: Try to bind 'generic' token.", reader->name);
-			rv = frameworks[i]->bind(p11card, app_generic);
+			rv = p11card->framework->bind(p11card, app_generic);
 			if (rv == CKR_TOKEN_NOT_RECOGNIZED && enable_InitToken)   {
 				sc_log(context, "%s: 'InitToken' enabled -- accept non-binded card", reader->name);
 				rv = CKR_OK;
@@ -329,23 +366,12 @@ again:
 				sc_log(context,
 				       "%s: cannot bind 'generic' token: rv 0x%lX",
 				       reader->name, rv);
-				goto fail;
-			}
-
-			sc_log(context, "%s: Creating 'generic' token.", reader->name);
-			rv = frameworks[i]->create_tokens(p11card, app_generic);
-			if (rv != CKR_OK)   {
-				sc_log(context,
-				       "%s: create 'generic' token error 0x%lX",
-				       reader->name, rv);
-				goto fail;
+				return rv;
 			}
-			/* p11card is now bound to some slot */
-			free_p11card = 0;
 		}
 
 		/* Now bind the rest of applications that are not 'generic' */
-		for (j = 0; j < p11card->card->app_count; j++)   {
+		for (j = 0; j < p11card->card->app_count && j < SC_MAX_CARD_APPS; j++)   {
 			struct sc_app_info *app_info = p11card->card->app[j];
 			char *app_name = app_info ? app_info->label : "<anonymous>";
 
@@ -353,46 +379,247 @@ again:
 				continue;
 
 			sc_log(context, "%s: Binding %s token.", reader->name, app_name);
-			rv = frameworks[i]->bind(p11card, app_info);
-			if (rv != CKR_OK)   {
+			job->app_rv[j] = p11card->framework->bind(p11card, app_info);
+			if (job->app_rv[j] != CKR_OK)
 				sc_log(context, "%s: bind %s token error Ox%lX",
-				       reader->name, app_name, rv);
-				continue;
-			}
+				       reader->name, app_name, job->app_rv[j]);
+		}
+	}
 
-			sc_log(context, "%s: Creating %s token.", reader->name, app_name);
-			rv = frameworks[i]->create_tokens(p11card, app_info);
-			if (rv != CKR_OK)   {
-				sc_log(context,
-				       "%s: create %s token error 0x%lX",
-				       reader->name, app_name, rv);
-				goto fail;
-			}
-			/* p11card is now bound to some slot */
-			free_p11card = 0;
+	return CKR_OK;
+}
+
+static CK_RV card_detect_finish(struct card_detect_job *job)
+{
+	struct sc_pkcs11_card *p11card = job->p11card;
+	sc_reader_t *reader = job->reader;
+	unsigned int i;
+	int j;
+	CK_RV rv = job->rv;
+
+	/* escape commands are only guaranteed to be working with a card
+	 * inserted. That's why by now, after sc_connect_card() the reader's
+	 * metadata may have changed. We re-initialize the metadata for every
+	 * slot of this reader here, also if the card could not be bound. */
+	if (job->connected && (reader->flags & SC_READER_ENABLE_ESCAPE)) {
+		for (i = 0; i<ptrarray_size(&virtual_slots); i++) {
+			sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, i);
+			if (slot->reader == reader)
+				init_slot_info(&slot->slot_info, reader);
 		}
 	}
 
+	if (rv != CKR_OK)
+		goto done;
+
+	if (!job->bound)
+		goto done;
+
+	if (job->app_generic || !p11card->card->app_count)   {
+		sc_log(context, "%s: Creating 'generic' token.", reader->name);
+		rv = p11card->framework->create_tokens(p11card, job->app_generic);
+		if (rv != CKR_OK)   {
+			sc_log(context,
+			       "%s: create 'generic' token error 0x%lX",
+			       reader->name, rv);
+			goto done;
+		}
+		/* p11card is now bound to some slot */
+		job->free_p11card = 0;
+	}
+
+	for (j = 0; j < p11card->card->app_count && j < SC_MAX_CARD_APPS; j++)   {
+		struct sc_app_info *app_info = p11card->card->app[j];
+		char *app_name = app_info ? app_info->label : "<anonymous>";
+
+		if ((job->app_generic && job->app_generic == app_info) || job->app_rv[j] != CKR_OK)
+			continue;
+
+		sc_log(context, "%s: Creating %s token.", reader->name, app_name);
+		rv = p11card->framework->create_tokens(p11card, app_info);
+		if (rv != CKR_OK)   {
+			sc_log(context,
+			       "%s: create %s token error 0x%lX",
+			       reader->name, app_name, rv);
+			goto done;
+		}
+		/* p11card is now bound to some slot */
+		job->free_p11card = 0;
+	}
+
 	sc_log(context, "%s: Detection ended", reader->name);
-	rv = CKR_OK;
 
-fail:
-	if (free_p11card) {
+done:
+	if (job->free_p11card) {
 		sc_pkcs11_card_free(p11card);
 	}
 
 	return rv;
 }
 
+CK_RV card_detect(sc_reader_t *reader)
+{
+	struct card_detect_job job;
+
+	memset(&job, 0, sizeof job);
+	job.reader = reader;
+
+	job.rv = card_detect_prepare(&job);
+	if (job.rv == CKR_OK && job.need_bind)
+		job.rv = card_detect_connect(&job);
+	if (job.rv == CKR_OK && job.need_bind)
+		job.rv = card_detect_bind(&job);
+	return card_detect_finish(&job);
+}
+
+#if defined(PKCS11_THREAD_LOCKING) && (defined(HAVE_PTHREAD) || defined(_WIN32))
+#define CARD_DETECT_PARALLEL
+
+#define CARD_DETECT_BIND_PENDING(job) ((job)->rv == CKR_OK && (job)->need_bind)
+
+struct card_detect_pool {
+	struct card_detect_job *jobs;
+	unsigned int njobs;
+	unsigned int next;
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+#ifdef _WIN32
+static DWORD WINAPI card_detect_worker(LPVOID arg)
+#else
+static void *card_detect_worker(void *arg)
+#endif
+{
+	struct card_detect_pool *pool = arg;
+
+	while (1) {
+		unsigned int i, j;
+
+#ifdef _WIN32
+		EnterCriticalSection(&pool->lock);
+		i = pool->next++;
+		LeaveCriticalSection(&pool->lock);
+#else
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+#endif
+		if (i >= pool->njobs)
+			break;
+		/* the first card of a driver takes all cards of this driver */
+		if (!pool->jobs[i].bind_first)
+			continue;
+		for (j = i; j < pool->njobs; j = pool->jobs[j].bind_next)
+			pool->jobs[j].rv = card_detect_bind(&pool->jobs[j]);
+	}
+
+	return 0;
+}
+
+/* Runs the bind stage of the jobs on at most nthreads threads. The calling
+ * thread takes part in the work, so it never blocks without progress.
+ * The card drivers and their PKCS#15 emulators were not written for
+ * concurrent use, so the cards of one driver are bound one after the
+ * other by the same thread, and only different drivers run concurrently. */
+static void card_detect_bind_parallel(struct card_detect_job *jobs, unsigned int njobs,
+		unsigned int nthreads)
+{
+	struct card_detect_pool pool;
+#ifdef _WIN32
+	HANDLE threads[SC_PKCS11_MAX_DETECT_THREADS];
+#else
+	pthread_t threads[SC_PKCS11_MAX_DETECT_THREADS];
+#endif
+	unsigned int i, j, started = 0;
+
+	/* chain the cards to bind by driver, before any worker runs */
+	for (i = 0; i < njobs; i++) {
+		jobs[i].bind_first = 0;
+		jobs[i].bind_next = njobs;
+	}
+	for (i = 0; i < njobs; i++) {
+		unsigned int last = i;
+
+		if (!CARD_DETECT_BIND_PENDING(&jobs[i]))
+			continue;
+		for (j = 0; j < i; j++)
+			if (CARD_DETECT_BIND_PENDING(&jobs[j])
+					&& jobs[j].p11card->card->driver == jobs[i].p11card->card->driver)
+				break;
+		if (j < i)
+			continue;
+		jobs[i].bind_first = 1;
+		for (j = i + 1; j < njobs; j++) {
+			if (CARD_DETECT_BIND_PENDING(&jobs[j])
+					&& jobs[j].p11card->card->driver == jobs[i].p11card->card->driver) {
+				jobs[last].bind_next = j;
+				last = j;
+			}
+		}
+	}
+
+	pool.jobs = jobs;
+	pool.njobs = njobs;
+	pool.next = 0;
+#ifdef _WIN32
+	InitializeCriticalSection(&pool.lock);
+#else
+	pthread_mutex_init(&pool.lock, NULL);
+#endif
+
+	if (nthreads > SC_PKCS11_MAX_DETECT_THREADS)
+		nthreads = SC_PKCS11_MAX_DETECT_THREADS;
+	for (i = 1; i < nthreads; i++) {
+#ifdef _WIN32
+		threads[started] = CreateThread(NULL, 0, card_detect_worker, &pool, 0, NULL);
+		if (threads[started] == NULL)
+			break;
+#else
+		if (pthread_create(&threads[started], NULL, card_detect_worker, &pool) != 0)
+			break;
+#endif
+		started++;
+	}
+	sc_log(context, "Binding cards using %u threads", started + 1);
+
+	card_detect_worker(&pool);
+
+	for (i = 0; i < started; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], NULL);
+#endif
+	}
+#ifdef _WIN32
+	DeleteCriticalSection(&pool.lock);
+#else
+	pthread_mutex_destroy(&pool.lock);
+#endif
+}
+#endif
+
 
 CK_RV
 card_detect_all(void)
 {
-	unsigned int i, j;
+	unsigned int i, j, nreaders, njobs = 0, nbind = 0;
+	struct card_detect_job *jobs;
+	CK_RV rv = CKR_OK;
 
 	sc_log(context, "Detect all cards");
+	nreaders = sc_ctx_get_reader_count(context);
+	jobs = calloc(nreaders ? nreaders : 1, sizeof *jobs);
+	if (jobs == NULL)
+		return CKR_HOST_MEMORY;
+
 	/* Detect cards in all initialized readers */
-	for (i=0; i< sc_ctx_get_reader_count(context); i++) {
+	for (i=0; i< nreaders && rv == CKR_OK; i++) {
 		sc_reader_t *reader = sc_ctx_get_reader(context, i);
 
 		if (reader->flags & SC_READER_REMOVED) {
@@ -403,8 +630,8 @@ card_detect_all(void)
 			 * https://bugzilla.mozilla.org/show_bug.cgi?id=1613632 */
 
 			/* Instead, remove the relation between reader and slot */
-			for (j = 0; j<list_size(&virtual_slots); j++) {
-				sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, j);
+			for (j = 0; j<ptrarray_size(&virtual_slots); j++) {
+				sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, j);
 				if (slot->reader == reader) {
 					slot->reader = NULL;
 				}
@@ -412,23 +639,53 @@ card_detect_all(void)
 		} else {
 			/* Locate a slot related to the reader */
 			int found = 0;
-			for (j = 0; j<list_size(&virtual_slots); j++) {
-				sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, j);
+			for (j = 0; j<ptrarray_size(&virtual_slots); j++) {
+				sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, j);
 				if (slot->reader == reader) {
 					found = 1;
 					break;
 				}
 			}
 			if (!found) {
-				for (j = 0; j < sc_pkcs11_conf.slots_per_card; j++) {
-					CK_RV rv = create_slot(reader);
-					if (rv != CKR_OK)
-						return rv;
-				}
+				for (j = 0; j < sc_pkcs11_conf.slots_per_card && rv == CKR_OK; j++)
+					rv = create_slot(reader);
+				if (rv != CKR_OK)
+					break;
 			}
-			card_detect(reader);
+			jobs[njobs].reader = reader;
+			jobs[njobs].rv = card_detect_prepare(&jobs[njobs]);
+			if (jobs[njobs].rv == CKR_OK && jobs[njobs].need_bind)
+				nbind++;
+			njobs++;
 		}
 	}
+
+	/* Connect the new cards in the order of the readers, so that the
+	 * drivers are matched and initialized one card at a time. */
+	for (i = 0; i < njobs; i++)
+		if (jobs[i].rv == CKR_OK && jobs[i].need_bind)
+			jobs[i].rv = card_detect_connect(&jobs[i]);
+
+	/* Bind the new cards, concurrently if enabled. The tokens are
+	 * created in the order of the readers afterwards, so that the slot
+	 * numbering does not depend on the timing of the cards. */
+#ifdef CARD_DETECT_PARALLEL
+	if (nbind > 1 && sc_pkcs11_conf.detect_threads > 1) {
+		card_detect_bind_parallel(jobs, njobs,
+				nbind < sc_pkcs11_conf.detect_threads ? nbind : sc_pkcs11_conf.detect_threads);
+	} else
+#endif
+	{
+		for (i = 0; i < njobs; i++)
+			if (jobs[i].rv == CKR_OK && jobs[i].need_bind)
+				jobs[i].rv = card_detect_bind(&jobs[i]);
+	}
+	for (i = 0; i < njobs; i++)
+		card_detect_finish(&jobs[i]);
+	free(jobs);
+
+	if (rv != CKR_OK)
+		return rv;
 	sc_log(context, "All cards detected");
 	return CKR_OK;
 }
@@ -440,12 +697,12 @@ CK_RV slot_allocate(struct sc_pkcs11_slot ** slot, struct sc_pkcs11_card * p11ca
 	struct sc_pkcs11_slot *tmp_slot = NULL;
 
 	/* Locate a free slot for this reader */
-	for (i=0; i< list_size(&virtual_slots); i++) {
-		tmp_slot = (struct sc_pkcs11_slot *)list_get_at(&virtual_slots, i);
+	for (i=0; i< ptrarray_size(&virtual_slots); i++) {
+		tmp_slot = (struct sc_pkcs11_slot *)ptrarray_get_at(&virtual_slots, i);
 		if (tmp_slot->reader == p11card->reader && tmp_slot->p11card == NULL)
 			break;
 	}
-	if (!tmp_slot || (i == list_size(&virtual_slots)))
+	if (!tmp_slot || (i == ptrarray_size(&virtual_slots)))
 		return CKR_FUNCTION_FAILED;
 	sc_log(context, "Allocated slot 0x%lx for card in reader %s", tmp_slot->id, p11card->reader->name);
 	tmp_slot->p11card = p11card;
@@ -459,7 +716,12 @@ CK_RV slot_get_slot(CK_SLOT_ID id, struct sc_pkcs11_slot ** slot)
 	if (context == NULL)
 		return CKR_CRYPTOKI_NOT_INITIALIZED;
 
-	*slot = list_seek(&virtual_slots, &id);	/* FIXME: check for null? */
+	/* Slots are only ever appended, so the ID is normally the index */
+	*slot = NULL;
+	if (id < ptrarray_size(&virtual_slots))
+		*slot = ptrarray_get_at(&virtual_slots, (unsigned int) id);
+	if (!*slot || (*slot)->id != id)
+		*slot = ptrarray_seek(&virtual_slots, &id);
 	if (!*slot)
 		return CKR_SLOT_ID_INVALID;
 	return CKR_OK;
@@ -508,7 +770,7 @@ CK_RV slot_token_removed(CK_SLOT_ID id)
 	/* Terminate active sessions */
 	sc_pkcs11_close_all_sessions(id);
 
-	while ((object = list_fetch(&slot->objects))) {
+	while ((object = ptrarray_pop(&slot->objects))) {
 		if (object->ops->release)
 			object->ops->release(object);
 	}
@@ -543,8 +805,8 @@ CK_RV slot_find_changed(CK_SLOT_ID_PTR idp, int mask)
 	LOG_FUNC_CALLED(context);
 
 	card_detect_all();
-	for (i=0; i<list_size(&virtual_slots); i++) {
-		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+	for (i=0; i<ptrarray_size(&virtual_slots); i++) {
+		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, i);
 		sc_log(context, "slot 0x%lx token: %lu events: 0x%02X",
 		       slot->id, (slot->slot_info.flags & CKF_TOKEN_PRESENT),
 		       slot->events);
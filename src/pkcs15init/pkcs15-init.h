@@ -303,6 +303,8 @@ extern void	sc_pkcs15init_set_callbacks(struct sc_pkcs15init_callbacks *);
 extern int	sc_pkcs15init_bind(struct sc_card *, const char *, const char *,
 				struct sc_app_info *app_info, struct sc_profile **);
 extern void	sc_pkcs15init_unbind(struct sc_profile *);
+/* Frees the parsed profile files no bound profile uses any more */
+extern void	sc_pkcs15init_cleanup(void);
 extern void	sc_pkcs15init_set_p15card(struct sc_profile *,
 				struct sc_pkcs15_card *);
 extern int	sc_pkcs15init_set_lifecycle(struct sc_card *, int);
@@ -401,6 +403,8 @@ extern int	sc_pkcs15init_delete_by_path(struct sc_profile *,
 				struct sc_pkcs15_card *, const struct sc_path *);
 extern int	sc_pkcs15init_update_any_df(struct sc_pkcs15_card *, struct sc_profile *,
 			struct sc_pkcs15_df *, int);
+extern int	sc_pkcs15init_begin_batch(struct sc_profile *);
+extern int	sc_pkcs15init_commit_batch(struct sc_pkcs15_card *, struct sc_profile *);
 extern int	sc_pkcs15init_select_intrinsic_id(struct sc_pkcs15_card *, struct sc_profile *,
 			int, struct sc_pkcs15_id *, void *);
 
@@ -75,6 +75,8 @@
 
 /* Default ID for new key/pin */
 #define DEFAULT_ID			0x45
+/* Changed DF ranges closer than this are written with one UPDATE BINARY */
+#define SC_PKCS15INIT_DIFF_GAP		16
 #define DEFAULT_PIN_FLAGS		(SC_PKCS15_CO_FLAG_PRIVATE|SC_PKCS15_CO_FLAG_MODIFIABLE)
 #define DEFAULT_PRKEY_FLAGS		(SC_PKCS15_CO_FLAG_PRIVATE|SC_PKCS15_CO_FLAG_MODIFIABLE)
 #define DEFAULT_PUBKEY_FLAGS		(SC_PKCS15_CO_FLAG_MODIFIABLE)
@@ -106,6 +108,9 @@ static int	sc_pkcs15init_update_lastupdate(struct sc_pkcs15_card *,
 			struct sc_profile *profile);
 static int	sc_pkcs15init_update_odf(struct sc_pkcs15_card *,
 			struct sc_profile *profile);
+static int	sc_pkcs15init_update_df_file(struct sc_profile *,
+			struct sc_pkcs15_card *, struct sc_file *,
+			unsigned char *, size_t);
 static int	sc_pkcs15init_map_usage(unsigned long, int);
 static int	do_select_parent(struct sc_profile *, struct sc_pkcs15_card *,
 			struct sc_file *, struct sc_file **);
@@ -437,6 +442,11 @@ sc_pkcs15init_unbind(struct sc_profile *profile)
 
 	LOG_FUNC_CALLED(ctx);
 	sc_log(ctx, "Pksc15init Unbind: %i:%p:%i", profile->dirty, profile->p15_data, profile->pkcs15.do_last_update);
+	if (profile->batch.active && profile->p15_data != NULL) {
+		r = sc_pkcs15init_commit_batch(profile->p15_data, profile);
+		if (r < 0)
+			sc_log(ctx, "Failed to write the batched DFs: %s", sc_strerror(r));
+	}
 	if (profile->dirty != 0 && profile->p15_data != NULL && profile->pkcs15.do_last_update) {
 		r = sc_pkcs15init_update_lastupdate(profile->p15_data, profile);
 		if (r < 0)
@@ -3223,32 +3233,30 @@ sc_pkcs15init_update_odf(struct sc_pkcs15_card *p15card, struct sc_profile *prof
 }
 
 /*
- * Update any PKCS15 DF file (except ODF and DIR)
+ * Encode and write one xDF. Sets *update_odf if the ODF
+ * has to be written as well.
  */
-int
-sc_pkcs15init_update_any_df(struct sc_pkcs15_card *p15card,
+static int
+sc_pkcs15init_write_df(struct sc_pkcs15_card *p15card,
 		struct sc_profile *profile,
 		struct sc_pkcs15_df *df,
-		int is_new)
+		int *update_odf)
 {
 	struct sc_context	*ctx = p15card->card->ctx;
 	struct sc_card	*card = p15card->card;
 	struct sc_file	*file = NULL;
 	unsigned char	*buf = NULL;
 	size_t		bufsize;
-	int		update_odf = is_new, r = 0;
+	int		r = 0;
 
 	LOG_FUNC_CALLED(ctx);
-	if (!df)
-		LOG_TEST_RET(ctx, SC_ERROR_INVALID_ARGUMENTS, "DF missing");
-
 	r = sc_profile_get_file_by_path(profile, &df->path, &file);
 	if (r < 0 || file == NULL)
 		sc_select_file(card, &df->path, &file);
 
 	r = sc_pkcs15_encode_df(card->ctx, p15card, df, &buf, &bufsize);
 	if (r >= 0) {
-		r = sc_pkcs15init_update_file(profile, p15card, file, buf, bufsize);
+		r = sc_pkcs15init_update_df_file(profile, p15card, file, buf, bufsize);
 
 		/* For better performance and robustness, we want
 		 * to note which portion of the file actually
@@ -3262,12 +3270,48 @@ sc_pkcs15init_update_any_df(struct sc_pkcs15_card *p15card,
 		if (profile->pkcs15.encode_df_length) {
 			df->path.count = bufsize;
 			df->path.index = 0;
-			update_odf = 1;
+			*update_odf = 1;
 		}
 		free(buf);
 	}
 	sc_file_free(file);
 
+	LOG_TEST_RET(ctx, r, "Failed to encode or update xDF");
+	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+}
+
+/*
+ * Update any PKCS15 DF file (except ODF and DIR)
+ */
+int
+sc_pkcs15init_update_any_df(struct sc_pkcs15_card *p15card,
+		struct sc_profile *profile,
+		struct sc_pkcs15_df *df,
+		int is_new)
+{
+	struct sc_context	*ctx = p15card->card->ctx;
+	int		update_odf = is_new, r = 0;
+	unsigned int	i;
+
+	LOG_FUNC_CALLED(ctx);
+	if (!df)
+		LOG_TEST_RET(ctx, SC_ERROR_INVALID_ARGUMENTS, "DF missing");
+
+	if (profile->batch.active) {
+		for (i = 0; i < profile->batch.count; i++)
+			if (profile->batch.df[i] == df)
+				break;
+		if (i == profile->batch.count && i < SC_PKCS15INIT_MAX_BATCH_DFS)
+			profile->batch.df[profile->batch.count++] = df;
+		if (i < profile->batch.count) {
+			sc_log(ctx, "Batch: deferring update of DF type %i", df->type);
+			profile->batch.update_odf |= is_new;
+			LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+		}
+		/* too many DFs, write this one now */
+	}
+
+	r = sc_pkcs15init_write_df(p15card, profile, df, &update_odf);
 	LOG_TEST_RET(ctx, r, "Failed to encode or update xDF");
 
 	/* Now update the ODF if we have to */
@@ -3278,6 +3322,59 @@ sc_pkcs15init_update_any_df(struct sc_pkcs15_card *p15card,
 	LOG_FUNC_RETURN(ctx, r > 0 ? SC_SUCCESS : r);
 }
 
+/*
+ * Start a batch of object updates. Until sc_pkcs15init_commit_batch()
+ * the xDFs changed by adding, updating or deleting objects are only
+ * changed in memory; each of them is written to the card once at commit,
+ * followed by the ODF if needed.
+ */
+int
+sc_pkcs15init_begin_batch(struct sc_profile *profile)
+{
+	if (profile == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	if (profile->batch.active)
+		return SC_ERROR_NOT_ALLOWED;
+	memset(&profile->batch, 0, sizeof(profile->batch));
+	profile->batch.active = 1;
+	return SC_SUCCESS;
+}
+
+/*
+ * Write the xDFs and the ODF changed since sc_pkcs15init_begin_batch().
+ * All of them are tried; the first error is returned.
+ */
+int
+sc_pkcs15init_commit_batch(struct sc_pkcs15_card *p15card, struct sc_profile *profile)
+{
+	struct sc_context *ctx;
+	int update_odf, r, rv = SC_SUCCESS;
+	unsigned int i;
+
+	if (p15card == NULL || profile == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	ctx = p15card->card->ctx;
+	LOG_FUNC_CALLED(ctx);
+	if (!profile->batch.active)
+		LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+
+	profile->batch.active = 0;
+	update_odf = profile->batch.update_odf;
+	sc_log(ctx, "Batch: writing %u DF(s)", profile->batch.count);
+	for (i = 0; i < profile->batch.count; i++) {
+		r = sc_pkcs15init_write_df(p15card, profile, profile->batch.df[i], &update_odf);
+		if (r < 0 && rv == SC_SUCCESS)
+			rv = r;
+	}
+	if (update_odf) {
+		r = sc_pkcs15init_update_odf(p15card, profile);
+		if (r < 0 && rv == SC_SUCCESS)
+			rv = r;
+	}
+	memset(&profile->batch, 0, sizeof(profile->batch));
+	LOG_FUNC_RETURN(ctx, rv);
+}
+
 /*
  * Add an object to one of the pkcs15 directory files.
  */
@@ -3451,6 +3548,7 @@ sc_pkcs15init_change_attrib(struct sc_pkcs15_card *p15card, struct sc_profile *p
 		default:
 			LOG_TEST_RET(ctx, SC_ERROR_NOT_SUPPORTED, "Cannot change ID attribute");
 		}
+		sc_pkcs15_reindex_objects(p15card);
 		break;
 	case P15_ATTR_TYPE_VALUE:
 		switch(df_type) {
@@ -4183,6 +4281,108 @@ sc_pkcs15init_update_file(struct sc_profile *profile,
 	LOG_FUNC_RETURN(ctx, r);
 }
 
+/*
+ * Find the next range from *offs on where the old and new contents differ.
+ * Changes separated by fewer than SC_PKCS15INIT_DIFF_GAP unchanged bytes
+ * are joined, another APDU costs more than writing them again. Moves *offs
+ * to the start of the range and returns its end, or returns 0 if nothing
+ * changed after *offs.
+ */
+static size_t
+sc_pkcs15init_next_change(const unsigned char *old, const unsigned char *new,
+		size_t size, size_t *offs)
+{
+	size_t	start = *offs, end, gap;
+
+	while (start < size && old[start] == new[start])
+		start++;
+	if (start == size)
+		return 0;
+	for (end = start + 1; end < size; end++) {
+		if (old[end] != new[end])
+			continue;
+		for (gap = end; gap < size && gap - end < SC_PKCS15INIT_DIFF_GAP; gap++)
+			if (old[gap] != new[gap])
+				break;
+		if (gap == size || gap - end == SC_PKCS15INIT_DIFF_GAP)
+			break;
+		end = gap;
+	}
+	*offs = start;
+	return end;
+}
+
+/*
+ * Write a directory file like sc_pkcs15init_update_file(), but compare
+ * the new content with the one on the card and send UPDATE BINARY only
+ * for the byte ranges that changed. Changing one object then rewrites
+ * a few bytes of the DF instead of all of it. Falls back to writing the
+ * whole file if it does not exist yet, is not a transparent EF, cannot
+ * be read or is too small for the new content.
+ */
+static int
+sc_pkcs15init_update_df_file(struct sc_profile *profile,
+		struct sc_pkcs15_card *p15card, struct sc_file *file,
+		unsigned char *data, size_t datalen)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	struct sc_card	*card = p15card->card;
+	struct sc_file	*selected_file = NULL;
+	unsigned char	*old = NULL, *new = NULL;
+	size_t		size, offs, end, written = 0;
+	int		r;
+
+	LOG_FUNC_CALLED(ctx);
+	if (!file)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
+
+	r = sc_select_file(card, &file->path, &selected_file);
+	if (r < 0 || selected_file->size < datalen || selected_file->size > MAX_FILE_SIZE
+			|| selected_file->size == 0
+			|| (selected_file->ef_structure != SC_FILE_EF_TRANSPARENT
+				&& selected_file->ef_structure != 0))
+		goto full;
+	size = selected_file->size;
+
+	old = malloc(size);
+	/* the rest of the file is zeroed, as sc_pkcs15init_update_file() does */
+	new = calloc(1, size);
+	if (old == NULL || new == NULL) {
+		r = SC_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+	memcpy(new, data, datalen);
+
+	r = sc_read_binary(card, 0, old, size, 0);
+	if (r != (int)size) {
+		sc_log(ctx, "Cannot read %s to compare, writing it whole", sc_print_path(&file->path));
+		goto full;
+	}
+
+	r = sc_pkcs15init_authenticate(profile, p15card, selected_file, SC_AC_OP_UPDATE);
+	if (r < 0)
+		goto out;
+
+	for (offs = 0; (end = sc_pkcs15init_next_change(old, new, size, &offs)) != 0; offs = end) {
+		r = sc_update_binary(card, (unsigned int)offs, new + offs, end - offs, 0);
+		if (r < 0)
+			goto out;
+		written += end - offs;
+	}
+	sc_log(ctx, "%s: %"SC_FORMAT_LEN_SIZE_T"u of %"SC_FORMAT_LEN_SIZE_T"u bytes changed",
+			sc_print_path(&file->path), written, size);
+	r = SC_SUCCESS;
+	goto out;
+
+full:
+	r = sc_pkcs15init_update_file(profile, p15card, file, data, (unsigned int)datalen);
+out:
+	sc_file_free(selected_file);
+	free(old);
+	free(new);
+	LOG_FUNC_RETURN(ctx, r);
+}
+
 /*
  * Fix up a file's ACLs by replacing all occurrences of a symbolic
  * PIN name with the real reference.
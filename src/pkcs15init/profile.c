@@ -36,6 +36,10 @@
 #endif
 #include <assert.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #ifdef _WIN32
 #include <windows.h>
@@ -262,6 +266,20 @@ static void		set_pin_defaults(struct sc_profile *,
 static int		new_macro(sc_profile_t *, const char *, scconf_list *);
 static sc_macro_t *	find_macro(sc_profile_t *, const char *);
 
+/* Bucket of a file (case insensitive) or macro name */
+static unsigned int
+profile_hash(const char *name, int nocase)
+{
+	unsigned int hash = 5381;
+
+	while (*name) {
+		unsigned char c = (unsigned char) *name++;
+
+		hash = hash * 33 + (nocase ? tolower(c) : c);
+	}
+	return hash % SC_PROFILE_HASH_SIZE;
+}
+
 static sc_file_t *
 init_file(unsigned int type)
 {
@@ -318,11 +336,172 @@ sc_profile_new(void)
 	return pro;
 }
 
+/*
+ * Parsed profile files, shared by the profiles of the process, so that
+ * binding another card of the same type (every C_InitToken() of the
+ * PKCS#11 module) does not parse the files again. The file is still read
+ * each time and an entry is only used while its contents are unchanged.
+ * The macros of a profile point into the tree, so a profile holds a
+ * reference to it. An entry whose file changed is freed when its last
+ * profile is freed, all others by sc_pkcs15init_cleanup().
+ */
+struct profile_conf {
+	struct profile_conf *	next;
+	char *			path;
+	char *			data;	/* contents the tree was parsed from */
+	size_t			len;
+	unsigned int		refs;
+	int			stale;
+	scconf_context *	conf;
+};
+
+static struct profile_conf *profile_confs = NULL;
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t profile_confs_lock = PTHREAD_MUTEX_INITIALIZER;
+#define PROFILE_CONFS_LOCK()	pthread_mutex_lock(&profile_confs_lock)
+#define PROFILE_CONFS_UNLOCK()	pthread_mutex_unlock(&profile_confs_lock)
+#elif defined(_WIN32)
+static SRWLOCK profile_confs_lock = SRWLOCK_INIT;
+#define PROFILE_CONFS_LOCK()	AcquireSRWLockExclusive(&profile_confs_lock)
+#define PROFILE_CONFS_UNLOCK()	ReleaseSRWLockExclusive(&profile_confs_lock)
+#else
+#define PROFILE_CONFS_LOCK()
+#define PROFILE_CONFS_UNLOCK()
+#endif
+
+/* Reads the whole file, NUL terminated */
+static int
+profile_conf_read(const char *path, char **data, size_t *len)
+{
+	struct stat st;
+	FILE *fp;
+	char *buf;
+	size_t n;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return -1;
+	if (fstat(fileno(fp), &st) != 0 || st.st_size < 0
+			|| (buf = malloc((size_t)st.st_size + 1)) == NULL) {
+		fclose(fp);
+		return -1;
+	}
+	n = fread(buf, 1, (size_t)st.st_size, fp);
+	fclose(fp);
+	buf[n] = '\0';
+	*data = buf;
+	*len = n;
+	return 0;
+}
+
+/* Frees the stale entries no profile uses any more. Called with the lock held */
+static void
+profile_confs_prune(void)
+{
+	struct profile_conf **pp = &profile_confs, *pc;
+
+	while ((pc = *pp) != NULL) {
+		if (!pc->stale || pc->refs) {
+			pp = &pc->next;
+			continue;
+		}
+		*pp = pc->next;
+		scconf_free(pc->conf);
+		free(pc->data);
+		free(pc->path);
+		free(pc);
+	}
+}
+
+/* Returns a referenced entry, or 0/-1 like scconf_parse() */
+static int
+profile_conf_get(struct sc_context *ctx, const char *path, struct profile_conf **out)
+{
+	struct profile_conf *pc, *found = NULL;
+	scconf_context *conf;
+	char *data;
+	size_t len;
+	int res;
+
+	if (profile_conf_read(path, &data, &len) < 0)
+		return -1;
+
+	PROFILE_CONFS_LOCK();
+	for (pc = profile_confs; pc; pc = pc->next) {
+		if (pc->stale || strcmp(pc->path, path))
+			continue;
+		if (pc->len == len && !memcmp(pc->data, data, len))
+			found = pc;
+		else
+			/* the file was changed since */
+			pc->stale = 1;
+	}
+	profile_confs_prune();
+	if (found) {
+		sc_log(ctx, "profile %s already parsed", path);
+		found->refs++;
+		*out = found;
+		free(data);
+		res = 1;
+		goto out;
+	}
+
+	conf = scconf_new(path);
+	res = scconf_parse_string(conf, data);
+	if (res <= 0) {
+		sc_log(ctx, "profile %s: %s", path, conf->errmsg);
+		scconf_free(conf);
+		free(data);
+		res = 0;
+		goto out;
+	}
+	pc = calloc(1, sizeof(struct profile_conf));
+	if (pc == NULL || (pc->path = strdup(path)) == NULL) {
+		free(pc);
+		scconf_free(conf);
+		free(data);
+		res = -1;
+		goto out;
+	}
+	pc->data = data;
+	pc->len = len;
+	pc->refs = 1;
+	pc->conf = conf;
+	pc->next = profile_confs;
+	profile_confs = pc;
+	*out = pc;
+
+out:
+	PROFILE_CONFS_UNLOCK();
+	return res;
+}
+
+static void
+profile_conf_release(struct profile_conf *pc)
+{
+	PROFILE_CONFS_LOCK();
+	pc->refs--;
+	profile_confs_prune();
+	PROFILE_CONFS_UNLOCK();
+}
+
+void
+sc_pkcs15init_cleanup(void)
+{
+	struct profile_conf *pc;
+
+	PROFILE_CONFS_LOCK();
+	for (pc = profile_confs; pc; pc = pc->next)
+		pc->stale = 1;
+	profile_confs_prune();
+	PROFILE_CONFS_UNLOCK();
+}
+
 int
 sc_profile_load(struct sc_profile *profile, const char *filename)
 {
 	struct sc_context *ctx = profile->card->ctx;
-	scconf_context	*conf;
+	struct profile_conf *pc;
 	const char *profile_dir = NULL;
 	char path[PATH_MAX];
 	int res = 0, i;
@@ -361,23 +540,21 @@ sc_profile_load(struct sc_profile *profile, const char *filename)
 
 	sc_log(ctx, "Trying profile file %s", path);
 
-	conf = scconf_new(path);
-	res = scconf_parse(conf);
+	if (profile->conf_count >= SC_PROFILE_MAX_CONFS)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_TOO_MANY_OBJECTS);
 
-	sc_log(ctx, "profile %s loaded ok", path);
+	res = profile_conf_get(ctx, path, &pc);
 
-	if (res < 0) {
-		scconf_free(conf);
+	if (res < 0)
 		LOG_FUNC_RETURN(ctx, SC_ERROR_FILE_NOT_FOUND);
-	}
 
-	if (res == 0) {
-		scconf_free(conf);
+	if (res == 0)
 		LOG_FUNC_RETURN(ctx, SC_ERROR_SYNTAX_ERROR);
-	}
 
-	res = process_conf(profile, conf);
-	scconf_free(conf);
+	sc_log(ctx, "profile %s loaded ok", path);
+	profile->confs[profile->conf_count++] = pc;
+
+	res = process_conf(profile, pc->conf);
 	LOG_FUNC_RETURN(ctx, res);
 }
 
@@ -489,6 +666,8 @@ sc_profile_free(struct sc_profile *profile)
 
 	if (profile->p15_spec)
 		sc_pkcs15_card_free(profile->p15_spec);
+	for (unsigned int i = 0; i < profile->conf_count; i++)
+		profile_conf_release(profile->confs[i]);
 	free(profile);
 }
 
@@ -1162,11 +1341,18 @@ process_tmpl(struct state *cur, struct block *info,
  */
 static void append_file(sc_profile_t *profile, struct file_info *nfile)
 {
-	struct file_info	**list, *fi;
+	struct file_info	**list;
+
+	if (profile->ef_last)
+		profile->ef_last->next = nfile;
+	else
+		profile->ef_list = nfile;
+	profile->ef_last = nfile;
 
-	list = &profile->ef_list;
-	while ((fi = *list) != NULL)
-		list = &fi->next;
+	/* keep the bucket in list order, too */
+	list = &profile->ef_hash[profile_hash(nfile->ident, 1)];
+	while (*list != NULL)
+		list = &(*list)->hash_next;
 	*list = nfile;
 }
 
@@ -1185,6 +1371,10 @@ add_file(sc_profile_t *profile, const char *name,
 		return NULL;
 	info->instance = info;
 	info->ident = strdup(name);
+	if (info->ident == NULL) {
+		free(info);
+		return NULL;
+	}
 
 	info->parent = parent;
 	info->file = file;
@@ -1859,8 +2049,14 @@ new_macro(sc_profile_t *profile, const char *name, scconf_list *value)
 		if (mac == NULL)
 			return SC_ERROR_OUT_OF_MEMORY;
 		mac->name = strdup(name);
+		if (mac->name == NULL) {
+			free(mac);
+			return SC_ERROR_OUT_OF_MEMORY;
+		}
 		mac->next = profile->macro_list;
 		profile->macro_list = mac;
+		mac->hash_next = profile->macro_hash[profile_hash(name, 0)];
+		profile->macro_hash[profile_hash(name, 0)] = mac;
 	}
 
 	mac->value = value;
@@ -1872,7 +2068,7 @@ find_macro(sc_profile_t *profile, const char *name)
 {
 	sc_macro_t	*mac;
 
-	for (mac = profile->macro_list; mac; mac = mac->next) {
+	for (mac = profile->macro_hash[profile_hash(name, 0)]; mac; mac = mac->hash_next) {
 		if (!strcmp(mac->name, name))
 			return mac;
 	}
@@ -2189,7 +2385,7 @@ sc_profile_find_file(struct sc_profile *pro,
 
 	value = path ? path->value : (const u8*) "";
 	len = path ? path->len : 0;
-	for (fi = pro->ef_list; fi; fi = fi->next) {
+	for (fi = pro->ef_hash[profile_hash(name, 1)]; fi; fi = fi->hash_next) {
 		sc_path_t *fpath = &fi->file->path;
 
 		if (!strcasecmp(fi->ident, name) && fpath->len >= len && !memcmp(fpath->value, value, len))
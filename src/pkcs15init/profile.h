@@ -43,6 +43,7 @@ struct auth_info {
 struct file_info {
 	char *			ident;
 	struct file_info *	next;
+	struct file_info *	hash_next;	/* same bucket of sc_profile.ef_hash */
 	struct sc_file *	file;
 	unsigned int		dont_free;
 	struct file_info *	parent;
@@ -75,6 +76,7 @@ struct pin_info {
 typedef struct sc_macro {
 	char *			name;
 	struct sc_macro *	next;
+	struct sc_macro *	hash_next;	/* same bucket of sc_profile.macro_hash */
 	scconf_list *		value;
 } sc_macro_t;
 
@@ -93,6 +95,10 @@ typedef struct sc_template {
 } sc_template_t;
 
 #define SC_PKCS15INIT_MAX_OPTIONS 16
+#define SC_PKCS15INIT_MAX_BATCH_DFS	16
+#define SC_PROFILE_HASH_SIZE	64
+#define SC_PROFILE_MAX_CONFS	4
+struct profile_conf;
 struct sc_profile {
 	char *			name;
 	char *			options[SC_PKCS15INIT_MAX_OPTIONS];
@@ -105,6 +111,7 @@ struct sc_profile {
 	struct file_info *	mf_info;
 	struct file_info *	df_info;
 	struct file_info *	ef_list;
+	struct file_info *	ef_last;
 	struct sc_file *	df[SC_PKCS15_DF_TYPE_COUNT];
 
 	struct pin_info *	pin_list;
@@ -112,6 +119,10 @@ struct sc_profile {
 	sc_template_t *		template_list;
 	sc_macro_t *		macro_list;
 
+	/* ef_list and macro_list hashed by name */
+	struct file_info *	ef_hash[SC_PROFILE_HASH_SIZE];
+	sc_macro_t *		macro_hash[SC_PROFILE_HASH_SIZE];
+
 	unsigned int		pin_domains;
 	unsigned int		pin_maxlen;
 	unsigned int		pin_minlen;
@@ -135,11 +146,24 @@ struct sc_profile {
 	 * has been changed) */
 	int			dirty;
 
+	/* Between sc_pkcs15init_begin_batch() and sc_pkcs15init_commit_batch()
+	 * the changed DFs are only recorded here and written at commit */
+	struct {
+		int		active;
+		int		update_odf;
+		unsigned int	count;
+		struct sc_pkcs15_df *df[SC_PKCS15INIT_MAX_BATCH_DFS];
+	} batch;
+
 	/* PKCS15 object ID style */
 	unsigned int id_style;
 
 	/* Minidriver support style */
 	unsigned int md_style;
+
+	/* the parsed files, the macros point into them */
+	struct profile_conf *	confs[SC_PROFILE_MAX_CONFS];
+	unsigned int		conf_count;
 };
 
 struct sc_profile *sc_profile_new(void);
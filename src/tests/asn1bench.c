@@ -0,0 +1,188 @@
+/*
+ * asn1bench.c: Measure how many PKCS#15 directory file entries are
+ * decoded per second
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libopensc/opensc.h"
+#include "libopensc/pkcs15.h"
+#include "bench.h"
+
+#define NUM_ENTRIES	100
+#define ROUNDS		200
+
+struct df_bench {
+	const char *name;
+	int (*encode)(struct sc_context *, const struct sc_pkcs15_object *, u8 **, size_t *);
+	int (*decode)(struct sc_pkcs15_card *, struct sc_pkcs15_object *, const u8 **, size_t *);
+	unsigned int type;
+	void *data;
+	u8 *df;
+	size_t df_len;
+};
+
+/* Encode NUM_ENTRIES copies of the object into one directory file */
+static int build_df(struct sc_context *ctx, struct df_bench *b)
+{
+	struct sc_pkcs15_object obj;
+	u8 *entry = NULL;
+	size_t entry_len = 0, i;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = b->type;
+	obj.data = b->data;
+	obj.flags = SC_PKCS15_CO_FLAG_PRIVATE;
+	strcpy(obj.label, "Benchmark object");
+	sc_pkcs15_format_id("01", &obj.auth_id);
+	if (b->encode(ctx, &obj, &entry, &entry_len) != SC_SUCCESS)
+		return -1;
+
+	b->df_len = entry_len * NUM_ENTRIES;
+	b->df = malloc(b->df_len);
+	if (b->df == NULL) {
+		free(entry);
+		return -1;
+	}
+	for (i = 0; i < NUM_ENTRIES; i++)
+		memcpy(b->df + i * entry_len, entry, entry_len);
+	free(entry);
+	return 0;
+}
+
+static int decode_df(struct sc_pkcs15_card *p15card, struct df_bench *b)
+{
+	const u8 *p = b->df;
+	size_t left = b->df_len;
+	int count = 0;
+
+	while (left > 0) {
+		struct sc_pkcs15_object *obj = calloc(1, sizeof(struct sc_pkcs15_object));
+
+		if (obj == NULL || b->decode(p15card, obj, &p, &left) != SC_SUCCESS) {
+			free(obj);
+			break;
+		}
+		sc_pkcs15_free_object(obj);
+		count++;
+	}
+	return count;
+}
+
+int main(void)
+{
+	struct sc_context *ctx = NULL;
+	struct sc_card card;
+	struct sc_pkcs15_card *p15card;
+	struct sc_pkcs15_prkey_info prkey;
+	struct sc_pkcs15_pubkey_info pubkey;
+	struct sc_pkcs15_cert_info cert;
+	struct sc_pkcs15_auth_info pin;
+	struct df_bench bench[] = {
+		{ "PrKDF", sc_pkcs15_encode_prkdf_entry, sc_pkcs15_decode_prkdf_entry,
+			SC_PKCS15_TYPE_PRKEY_RSA, &prkey, NULL, 0 },
+		{ "PuKDF", sc_pkcs15_encode_pukdf_entry, sc_pkcs15_decode_pukdf_entry,
+			SC_PKCS15_TYPE_PUBKEY_RSA, &pubkey, NULL, 0 },
+		{ "CDF", sc_pkcs15_encode_cdf_entry, sc_pkcs15_decode_cdf_entry,
+			SC_PKCS15_TYPE_CERT_X509, &cert, NULL, 0 },
+		{ "AODF", sc_pkcs15_encode_aodf_entry, sc_pkcs15_decode_aodf_entry,
+			SC_PKCS15_TYPE_AUTH_PIN, &pin, NULL, 0 },
+	};
+	size_t i, n = sizeof(bench) / sizeof(bench[0]);
+	int rv = 1;
+
+	memset(&prkey, 0, sizeof(prkey));
+	sc_pkcs15_format_id("45d3c2b1a09f8e7d6c5b4a39281706f5e4d3c2b1", &prkey.id);
+	prkey.usage = SC_PKCS15_PRKEY_USAGE_SIGN | SC_PKCS15_PRKEY_USAGE_NONREPUDIATION;
+	prkey.access_flags = SC_PKCS15_PRKEY_ACCESS_SENSITIVE | SC_PKCS15_PRKEY_ACCESS_LOCAL;
+	prkey.native = 1;
+	prkey.key_reference = 2;
+	prkey.modulus_length = 2048;
+	sc_format_path("3F0050154B01", &prkey.path);
+
+	memset(&pubkey, 0, sizeof(pubkey));
+	pubkey.id = prkey.id;
+	pubkey.usage = SC_PKCS15_PRKEY_USAGE_VERIFY;
+	pubkey.modulus_length = 2048;
+	sc_format_path("3F0050155501", &pubkey.path);
+
+	memset(&cert, 0, sizeof(cert));
+	cert.id = prkey.id;
+	sc_format_path("3F0050154301", &cert.path);
+
+	memset(&pin, 0, sizeof(pin));
+	sc_pkcs15_format_id("01", &pin.auth_id);
+	pin.auth_type = SC_PKCS15_PIN_AUTH_TYPE_PIN;
+	pin.attrs.pin.flags = SC_PKCS15_PIN_FLAG_INITIALIZED | SC_PKCS15_PIN_FLAG_NEEDS_PADDING;
+	pin.attrs.pin.type = SC_PKCS15_PIN_TYPE_ASCII_NUMERIC;
+	pin.attrs.pin.min_length = 4;
+	pin.attrs.pin.stored_length = 8;
+	pin.attrs.pin.max_length = 8;
+	pin.attrs.pin.reference = 1;
+	pin.attrs.pin.pad_char = 0xFF;
+	pin.tries_left = -1;
+	sc_format_path("3F005015", &pin.path);
+
+	if (sc_establish_context(&ctx, "asn1bench") != SC_SUCCESS)
+		return 1;
+	memset(&card, 0, sizeof(card));
+	card.ctx = ctx;
+	p15card = sc_pkcs15_card_new();
+	if (p15card == NULL)
+		goto err;
+	p15card->card = &card;
+	/* entry paths are made absolute to the application DF */
+	p15card->file_app = sc_file_new();
+	if (p15card->file_app == NULL)
+		goto err;
+	sc_format_path("3F005015", &p15card->file_app->path);
+
+	printf("%d entries per DF, %d rounds\n", NUM_ENTRIES, ROUNDS);
+	printf("%-8s %10s %12s\n", "", "ms", "entries/s");
+	for (i = 0; i < n; i++) {
+		double start, ms;
+		int r, count = 0;
+
+		if (build_df(ctx, &bench[i]) != 0) {
+			fprintf(stderr, "Failed to encode %s entry\n", bench[i].name);
+			goto err;
+		}
+		start = bench_now_ms();
+		for (r = 0; r < ROUNDS; r++)
+			count += decode_df(p15card, &bench[i]);
+		ms = bench_now_ms() - start;
+		if (count != NUM_ENTRIES * ROUNDS) {
+			fprintf(stderr, "Failed to decode %s entries\n", bench[i].name);
+			goto err;
+		}
+		printf("%-8s %10.2f %12.0f\n", bench[i].name, ms, count / ms * 1000.0);
+	}
+	rv = 0;
+err:
+	for (i = 0; i < n; i++)
+		free(bench[i].df);
+	if (p15card) {
+		p15card->card = NULL;
+		sc_pkcs15_card_free(p15card);
+	}
+	sc_release_context(ctx);
+	return rv;
+}
@@ -0,0 +1,15 @@
+#ifndef _SC_BENCH_H
+#define _SC_BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Monotonic time in milliseconds for the benchmarks, 0 if no clock */
+double bench_now_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * fuzz_asn1_cursor.c: Fuzz target for the zero-copy TLV cursor
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include "libopensc/internal.h"
+#include "libopensc/asn1.h"
+
+#define MAX_DEPTH 16
+
+/* every span must stay inside the input */
+static void check_span(const u8 *start, const u8 *end, const u8 *p, size_t len)
+{
+    if (p < start || p > end || len > (size_t)(end - p))
+        abort();
+}
+
+/* the cursor must agree with sc_asn1_find_tag() */
+static void check_find(const struct sc_asn1_cursor *cur, unsigned int tag)
+{
+    struct sc_asn1_tlv tlv;
+    const u8 *p;
+    size_t len;
+    int r;
+
+    r = sc_asn1_cursor_find(cur, tag, &tlv);
+    p = sc_asn1_find_tag(NULL, cur->p, cur->left, tag, &len);
+    if ((r == 1) != (p != NULL))
+        abort();
+    if (r == 1 && (p != tlv.value || len != tlv.len))
+        abort();
+}
+
+static void walk(const u8 *start, const u8 *end, struct sc_asn1_cursor *cur, int depth)
+{
+    struct sc_asn1_cursor child;
+    struct sc_asn1_tlv tlv;
+    int r;
+
+    if (depth > MAX_DEPTH)
+        return;
+
+    while (1) {
+        const u8 *p = cur->p;
+        size_t left = cur->left;
+
+        r = sc_asn1_cursor_next(cur, &tlv);
+        if (r <= 0 && r != SC_ERROR_ASN1_END_OF_CONTENTS)
+            break;
+        check_span(start, end, tlv.raw, tlv.raw_len);
+        check_span(start, end, tlv.value, tlv.len);
+        if (tlv.raw != p || tlv.raw_len > left || tlv.value + tlv.len != tlv.raw + tlv.raw_len)
+            abort();
+        if (r == 1 && (cur->p != p + tlv.raw_len || cur->left != left - tlv.raw_len))
+            abort();
+        if (r == 1) {
+            struct sc_asn1_cursor at = { p, left };
+            check_find(&at, tlv.tag);
+        }
+
+        sc_asn1_cursor_enter(&child, &tlv);
+        walk(start, end, &child, depth + 1);
+        if (r != 1)
+            break;
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct sc_asn1_cursor cur;
+    unsigned int tag;
+
+    sc_asn1_cursor_init(&cur, data, size);
+    walk(data, data + size, &cur, 0);
+
+    /* look up a tag taken from the input as well */
+    if (size >= 2) {
+        tag = (data[0] << 8) | data[1];
+        sc_asn1_cursor_init(&cur, data + 2, size - 2);
+        check_find(&cur, tag);
+        check_find(&cur, data[0]);
+    }
+    return 0;
+}
@@ -59,11 +59,12 @@ static int fuzz_card_connect(const uint8_t *data, size_t size, sc_pkcs11_slot_t
 	int rv = CKR_OK, free_p11card = 0;
 
 	/* Erase possible virtual slots*/
-	list_clear(&virtual_slots);
+	while (ptrarray_pop(&virtual_slots) != NULL)
+		;
 
 	/* Erase possible readers from context */
-	while (list_size(&context->readers)) {
-		sc_reader_t *rdr = (sc_reader_t *) list_get_at(&context->readers, 0);
+	while (ptrarray_size(&context->readers)) {
+		sc_reader_t *rdr = (sc_reader_t *) ptrarray_get_at(&context->readers, 0);
 		_sc_delete_reader(context, rdr);
 	}
 	if (context->reader_driver->ops->finish != NULL)
@@ -80,8 +81,8 @@ static int fuzz_card_connect(const uint8_t *data, size_t size, sc_pkcs11_slot_t
 	}
 
 	/* Locate a slot related to the reader */
-	for (size_t i = 0; i < list_size(&virtual_slots); i++) {
-		slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+	for (unsigned int i = 0; i < ptrarray_size(&virtual_slots); i++) {
+		slot = (sc_pkcs11_slot_t *) ptrarray_get_at(&virtual_slots, i);
 		if (slot->reader == reader) {
 			p11card = slot->p11card;
 			break;
@@ -180,7 +180,7 @@ void fuzz_add_reader(struct sc_context *ctx, const uint8_t *Data, size_t Size)
     reader->name = strdup(name);
 
     reader->ctx = ctx;
-    list_append(&ctx->readers, reader);
+    ptrarray_append(&ctx->readers, reader);
 }
 
 int fuzz_connect_card(sc_context_t *ctx, sc_card_t **card, sc_reader_t **reader_out,
@@ -189,8 +189,8 @@ int fuzz_connect_card(sc_context_t *ctx, sc_card_t **card, sc_reader_t **reader_
     struct sc_reader *reader = NULL;
 
     /* Erase possible readers from ctx */
-    while (list_size(&ctx->readers)) {
-        sc_reader_t *rdr = (sc_reader_t *) list_get_at(&ctx->readers, 0);
+    while (ptrarray_size(&ctx->readers)) {
+        sc_reader_t *rdr = (sc_reader_t *) ptrarray_get_at(&ctx->readers, 0);
         _sc_delete_reader(ctx, rdr);
     }
     if (ctx->reader_driver->ops->finish != NULL)
@@ -0,0 +1,209 @@
+/*
+ * listbench.c: Compare simclist and ptrarray on the access patterns of
+ * the PKCS#11 module (slot and object tables)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common/simclist.h"
+#include "common/ptrarray.h"
+#include "bench.h"
+
+#define NUM_SLOTS	256
+#define NUM_OBJECTS	2000
+#define ROUNDS		20
+
+struct slot {
+	unsigned long id;
+	void *reader;
+	void *p11card;
+};
+
+struct object {
+	unsigned long handle;
+	unsigned long class;
+};
+
+static volatile unsigned long sink;
+
+static int slot_seeker(const void *el, const void *key)
+{
+	return ((const struct slot *)el)->id == *(const unsigned long *)key;
+}
+
+static int object_seeker(const void *el, const void *key)
+{
+	return ((const struct object *)el)->handle == *(const unsigned long *)key;
+}
+
+/* Accessors, so that the same loops run on both containers */
+struct ops {
+	const char *name;
+	unsigned int (*size)(void *c);
+	void *(*get_at)(void *c, unsigned int i);
+	void *(*slot_by_id)(void *c, unsigned long id);
+	void *(*object_by_handle)(void *c, unsigned long handle);
+};
+
+static unsigned int l_size(void *c) { return list_size(c); }
+static void *l_get_at(void *c, unsigned int i) { return list_get_at(c, i); }
+static void *l_slot_by_id(void *c, unsigned long id) { return list_seek(c, &id); }
+static void *l_object_by_handle(void *c, unsigned long handle) { return list_seek(c, &handle); }
+
+static unsigned int a_size(void *c) { return ptrarray_size(c); }
+static void *a_get_at(void *c, unsigned int i) { return ptrarray_get_at(c, i); }
+static void *a_slot_by_id(void *c, unsigned long id)
+{
+	/* mirrors slot_get_slot(): the ID is the index */
+	struct slot *s = ptrarray_get_at(c, (unsigned int)id);
+
+	if (s == NULL || s->id != id)
+		s = ptrarray_seek(c, &id);
+	return s;
+}
+
+static void *a_object_by_handle(void *c, unsigned long handle)
+{
+	/* mirrors get_object_from_session(): the handle is the address */
+	int pos = ptrarray_locate(c, (void *)(size_t)handle);
+	struct object *obj = ptrarray_get_at(c, (unsigned int)pos);
+
+	if (pos < 0 || obj->handle != handle)
+		obj = ptrarray_seek(c, &handle);
+	return obj;
+}
+
+static const struct ops list_ops = { "simclist", l_size, l_get_at, l_slot_by_id, l_object_by_handle };
+static const struct ops array_ops = { "ptrarray", a_size, a_get_at, a_slot_by_id, a_object_by_handle };
+
+/* card_detect_all(): for every reader scan all slots */
+static double bench_detect(const struct ops *o, void *slots)
+{
+	double start = bench_now_ms();
+	unsigned int r, i, j;
+
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < NUM_SLOTS; i++)
+			for (j = 0; j < o->size(slots); j++) {
+				struct slot *s = o->get_at(slots, j);
+				if (s->reader == NULL && s->p11card == NULL)
+					sink++;
+			}
+	return bench_now_ms() - start;
+}
+
+/* C_GetSlotInfo()/C_GetTokenInfo() on every slot */
+static double bench_slot_lookup(const struct ops *o, void *slots)
+{
+	double start = bench_now_ms();
+	unsigned int r;
+	unsigned long id;
+
+	for (r = 0; r < ROUNDS * 10; r++)
+		for (id = 0; id < NUM_SLOTS; id++)
+			sink += ((struct slot *)o->slot_by_id(slots, id))->id;
+	return bench_now_ms() - start;
+}
+
+/* C_FindObjectsInit(): scan all objects of a slot */
+static double bench_find_objects(const struct ops *o, void *objects)
+{
+	double start = bench_now_ms();
+	unsigned int r, i;
+
+	for (r = 0; r < ROUNDS * 10; r++)
+		for (i = 0; i < o->size(objects); i++) {
+			struct object *obj = o->get_at(objects, i);
+			if (obj->class == 3)
+				sink++;
+		}
+	return bench_now_ms() - start;
+}
+
+/* C_GetAttributeValue(): look up every object by handle */
+static double bench_object_lookup(const struct ops *o, void *objects, struct object *obj)
+{
+	double start = bench_now_ms();
+	unsigned int r, i;
+
+	for (r = 0; r < ROUNDS / 10; r++)
+		for (i = 0; i < NUM_OBJECTS; i++)
+			sink += ((struct object *)o->object_by_handle(objects, obj[i].handle))->class;
+	return bench_now_ms() - start;
+}
+
+int main(void)
+{
+	static struct slot slot[NUM_SLOTS];
+	struct object *obj;
+	list_t lslots, lobjects;
+	ptrarray_t aslots, aobjects;
+	const struct ops *ops[2] = { &list_ops, &array_ops };
+	void *slots[2] = { &lslots, &aslots };
+	void *objects[2] = { &lobjects, &aobjects };
+	double t[2][4];
+	unsigned int i;
+
+	obj = calloc(NUM_OBJECTS, sizeof(*obj));
+	if (obj == NULL)
+		return 1;
+
+	list_init(&lslots);
+	list_attributes_seeker(&lslots, slot_seeker);
+	list_init(&lobjects);
+	list_attributes_seeker(&lobjects, object_seeker);
+	ptrarray_init(&aslots);
+	ptrarray_attributes_seeker(&aslots, slot_seeker);
+	ptrarray_init(&aobjects);
+	ptrarray_attributes_seeker(&aobjects, object_seeker);
+
+	for (i = 0; i < NUM_SLOTS; i++) {
+		slot[i].id = i;
+		list_append(&lslots, &slot[i]);
+		ptrarray_append(&aslots, &slot[i]);
+	}
+	for (i = 0; i < NUM_OBJECTS; i++) {
+		obj[i].handle = (unsigned long)(size_t)&obj[i];
+		obj[i].class = i % 4;
+		list_append(&lobjects, &obj[i]);
+		ptrarray_append(&aobjects, &obj[i]);
+	}
+
+	for (i = 0; i < 2; i++) {
+		t[i][0] = bench_detect(ops[i], slots[i]);
+		t[i][1] = bench_slot_lookup(ops[i], slots[i]);
+		t[i][2] = bench_find_objects(ops[i], objects[i]);
+		t[i][3] = bench_object_lookup(ops[i], objects[i], obj);
+	}
+
+	printf("%d slots, %d objects, times in ms\n", NUM_SLOTS, NUM_OBJECTS);
+	printf("%-24s %10s %10s %8s\n", "", list_ops.name, array_ops.name, "speedup");
+	printf("%-24s %10.2f %10.2f %7.1fx\n", "slot scan (detect)", t[0][0], t[1][0], t[0][0] / t[1][0]);
+	printf("%-24s %10.2f %10.2f %7.1fx\n", "slot lookup by ID", t[0][1], t[1][1], t[0][1] / t[1][1]);
+	printf("%-24s %10.2f %10.2f %7.1fx\n", "object scan (find)", t[0][2], t[1][2], t[0][2] / t[1][2]);
+	printf("%-24s %10.2f %10.2f %7.1fx\n", "object lookup by handle", t[0][3], t[1][3], t[0][3] / t[1][3]);
+
+	list_destroy(&lslots);
+	list_destroy(&lobjects);
+	ptrarray_destroy(&aslots);
+	ptrarray_destroy(&aobjects);
+	free(obj);
+	return 0;
+}
@@ -0,0 +1,491 @@
+/*
+ * microbench.c: Time hot libopensc helpers and compare the results
+ * against a stored baseline
+ *
+ * Usage: microbench [--samples <n>] [--filter <name>] [--output <file>]
+ *                   [--compare <baseline> [--threshold <percent>]]
+ *
+ * Every benchmark is calibrated so one sample takes at least
+ * MIN_SAMPLE_MS, run WARMUP_SAMPLES times without measuring, and then
+ * sampled. Samples outside the Tukey fences (1.5 times the interquartile
+ * range) are dropped before the median is taken.
+ *
+ * The output has one tab separated line per benchmark:
+ *   name  median_ns  mean_ns  min_ns  samples
+ * With --compare, a previously saved output is read and the baseline
+ * median, the change in percent and "ok", "regression" or "new" are
+ * appended. The exit code is 1 if a benchmark got slower than the
+ * threshold (default 10 percent).
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/compat_strlcpy.h"
+#include "libopensc/opensc.h"
+#include "libopensc/asn1.h"
+#include "libopensc/internal.h"
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+/* sc_decompress_alloc() is not exported */
+#include "libopensc/compression.c"
+#endif
+#ifdef ENABLE_OPENSSL
+#include "sm/sm-common.h"
+#endif
+#include "bench.h"
+
+#define MIN_SAMPLE_MS	5.0
+#define WARMUP_SAMPLES	3
+#define DEFAULT_SAMPLES	15
+#define MAX_SAMPLES	1000
+#define DEFAULT_THRESHOLD 10.0
+
+struct bench {
+	const char *name;
+	int (*run)(unsigned long n);
+};
+
+struct result {
+	char name[64];
+	double median, mean, min;
+	int samples;
+};
+
+static sc_context_t *ctx = NULL;
+static u8 data[4096];
+static char hex[2 * 256 + 1];
+static u8 base64[2048];
+static u8 der[256];
+static size_t der_len;
+static u8 apdu_bytes[SC_MAX_APDU_BUFFER_SIZE];
+static size_t apdu_bytes_len;
+#ifdef ENABLE_ZLIB
+static u8 compressed[4096];
+static size_t compressed_len;
+#endif
+
+static const struct sc_asn1_entry c_asn1_bench[] = {
+	{ "bench", SC_ASN1_STRUCT, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, NULL, NULL },
+	{ NULL, 0, 0, 0, NULL, NULL }
+};
+
+static const struct sc_asn1_entry c_asn1_bench_attr[] = {
+	{ "id",		SC_ASN1_OCTET_STRING, SC_ASN1_TAG_OCTET_STRING, 0, NULL, NULL },
+	{ "reference",	SC_ASN1_INTEGER, SC_ASN1_TAG_INTEGER, 0, NULL, NULL },
+	{ "algorithm",	SC_ASN1_OBJECT, SC_ASN1_TAG_OBJECT, 0, NULL, NULL },
+	{ "label",	SC_ASN1_UTF8STRING, SC_ASN1_TAG_UTF8STRING, 0, NULL, NULL },
+	{ "usage",	SC_ASN1_BIT_FIELD, SC_ASN1_TAG_BIT_STRING, 0, NULL, NULL },
+	{ NULL, 0, 0, 0, NULL, NULL }
+};
+
+struct bench_attr {
+	u8 id[20];
+	size_t id_len;
+	int reference;
+	struct sc_object_id algorithm;
+	u8 label[64];
+	size_t label_len;
+	unsigned int usage;
+	size_t usage_len;
+};
+
+static void format_bench_attr(struct sc_asn1_entry *asn1, struct sc_asn1_entry *asn1_attr,
+		struct bench_attr *attr, int set)
+{
+	sc_copy_asn1_entry(c_asn1_bench, asn1);
+	sc_copy_asn1_entry(c_asn1_bench_attr, asn1_attr);
+	sc_format_asn1_entry(asn1, asn1_attr, NULL, set);
+	sc_format_asn1_entry(asn1_attr + 0, attr->id, &attr->id_len, set);
+	sc_format_asn1_entry(asn1_attr + 1, &attr->reference, NULL, set);
+	sc_format_asn1_entry(asn1_attr + 2, &attr->algorithm, NULL, set);
+	sc_format_asn1_entry(asn1_attr + 3, attr->label, &attr->label_len, set);
+	sc_format_asn1_entry(asn1_attr + 4, &attr->usage, &attr->usage_len, set);
+}
+
+static int bench_asn1_encode(unsigned long n)
+{
+	struct sc_asn1_entry asn1[2], asn1_attr[6];
+	struct bench_attr attr;
+	u8 *buf = NULL;
+	size_t len;
+
+	memset(&attr, 0, sizeof(attr));
+	memcpy(attr.id, data, sizeof(attr.id));
+	attr.id_len = sizeof(attr.id);
+	attr.reference = 0x82;
+	sc_format_oid(&attr.algorithm, "1.2.840.113549.1.1.11");
+	strcpy((char *) attr.label, "Benchmark signature key");
+	attr.label_len = strlen((char *) attr.label);
+	attr.usage = 0x2C;
+	attr.usage_len = sizeof(attr.usage);
+	while (n--) {
+		format_bench_attr(asn1, asn1_attr, &attr, 1);
+		if (sc_asn1_encode(ctx, asn1, &buf, &len) != SC_SUCCESS || len > sizeof(der))
+			return -1;
+		memcpy(der, buf, len);
+		der_len = len;
+		free(buf);
+	}
+	return 0;
+}
+
+static int bench_asn1_decode(unsigned long n)
+{
+	struct sc_asn1_entry asn1[2], asn1_attr[6];
+	struct bench_attr attr;
+
+	while (n--) {
+		memset(&attr, 0, sizeof(attr));
+		attr.id_len = sizeof(attr.id);
+		attr.label_len = sizeof(attr.label);
+		attr.usage_len = sizeof(attr.usage);
+		format_bench_attr(asn1, asn1_attr, &attr, 0);
+		if (sc_asn1_decode(ctx, asn1, der, der_len, NULL, NULL) != SC_SUCCESS)
+			return -1;
+	}
+	return 0;
+}
+
+static int bench_bin_to_hex(unsigned long n)
+{
+	while (n--)
+		if (sc_bin_to_hex(data, 256, hex, sizeof(hex), 0) != SC_SUCCESS)
+			return -1;
+	return 0;
+}
+
+static int bench_hex_to_bin(unsigned long n)
+{
+	u8 out[256];
+	size_t len;
+
+	while (n--) {
+		len = sizeof(out);
+		if (sc_hex_to_bin(hex, out, &len) != SC_SUCCESS)
+			return -1;
+	}
+	return 0;
+}
+
+static int bench_base64_encode(unsigned long n)
+{
+	while (n--)
+		if (sc_base64_encode(data, 1024, base64, sizeof(base64), 64) < 0)
+			return -1;
+	return 0;
+}
+
+static int bench_base64_decode(unsigned long n)
+{
+	u8 out[1024];
+
+	while (n--)
+		if (sc_base64_decode((const char *) base64, out, sizeof(out)) < 0)
+			return -1;
+	return 0;
+}
+
+static int bench_pkcs1_encode(unsigned long n)
+{
+	u8 out[256];
+	size_t len;
+
+	while (n--) {
+		len = sizeof(out);
+		if (sc_pkcs1_encode(ctx, SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_SHA256,
+				data, 32, out, &len, 2048, NULL) != SC_SUCCESS)
+			return -1;
+	}
+	return 0;
+}
+
+static int bench_apdu2bytes(unsigned long n)
+{
+	sc_apdu_t apdu;
+
+	sc_format_apdu_ex(&apdu, 0x00, 0xD6, 0x00, 0x00, data, 255, NULL, 0);
+	apdu.cse = SC_APDU_CASE_3_SHORT;
+	while (n--) {
+		if (sc_apdu2bytes(ctx, &apdu, SC_PROTO_T1, apdu_bytes, sizeof(apdu_bytes)) != SC_SUCCESS)
+			return -1;
+	}
+	apdu_bytes_len = 5 + 255;
+	return 0;
+}
+
+static int bench_bytes2apdu(unsigned long n)
+{
+	sc_apdu_t apdu;
+
+	while (n--)
+		if (sc_bytes2apdu(ctx, apdu_bytes, apdu_bytes_len, &apdu) != SC_SUCCESS)
+			return -1;
+	return 0;
+}
+
+#ifdef ENABLE_ZLIB
+static int bench_decompress_alloc(unsigned long n)
+{
+	u8 *out = NULL;
+	size_t len;
+
+	while (n--) {
+		if (sc_decompress_alloc(&out, &len, compressed, compressed_len, COMPRESSION_ZLIB) != SC_SUCCESS)
+			return -1;
+		free(out);
+		out = NULL;
+	}
+	return 0;
+}
+#endif
+
+#ifdef ENABLE_OPENSSL
+static u8 sm_key[16] = {
+	0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+	0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10 };
+
+static int bench_sm_encrypt_des_cbc3(unsigned long n)
+{
+	unsigned char *out = NULL;
+	size_t len;
+
+	while (n--) {
+		if (sm_encrypt_des_cbc3(ctx, sm_key, data, 256, &out, &len, 0) != SC_SUCCESS)
+			return -1;
+		free(out);
+		out = NULL;
+	}
+	return 0;
+}
+
+static int bench_sm_mac_des3(unsigned long n)
+{
+	sm_des_cblock mac, iv;
+
+	memset(iv, 0, sizeof(iv));
+	while (n--)
+		DES_cbc_cksum_3des(ctx, data, &mac, 256, sm_key, &iv);
+	return 0;
+}
+#endif
+
+/* the order matters: decoders use the output of the encoder before them */
+static const struct bench benches[] = {
+	{ "asn1_encode", bench_asn1_encode },
+	{ "asn1_decode", bench_asn1_decode },
+	{ "bin_to_hex_256", bench_bin_to_hex },
+	{ "hex_to_bin_256", bench_hex_to_bin },
+	{ "base64_encode_1k", bench_base64_encode },
+	{ "base64_decode_1k", bench_base64_decode },
+	{ "pkcs1_encode_sha256", bench_pkcs1_encode },
+	{ "apdu2bytes_255", bench_apdu2bytes },
+	{ "bytes2apdu_255", bench_bytes2apdu },
+#ifdef ENABLE_ZLIB
+	{ "decompress_alloc_4k", bench_decompress_alloc },
+#endif
+#ifdef ENABLE_OPENSSL
+	{ "sm_encrypt_des_cbc3_256", bench_sm_encrypt_des_cbc3 },
+	{ "sm_mac_des3_256", bench_sm_mac_des3 },
+#endif
+	{ NULL, NULL }
+};
+
+static int setup(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (u8) (i * 7 + i / 64);
+	if (bench_asn1_encode(1) != 0 || bench_bin_to_hex(1) != 0
+			|| bench_base64_encode(1) != 0 || bench_apdu2bytes(1) != 0)
+		return -1;
+#ifdef ENABLE_ZLIB
+	{
+		uLongf len = sizeof(compressed);
+
+		if (compress(compressed, &len, data, sizeof(data)) != Z_OK)
+			return -1;
+		compressed_len = len;
+	}
+#endif
+	return 0;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run_bench(const struct bench *b, int samples, struct result *res)
+{
+	double ns[MAX_SAMPLES], q1, q3, lo, hi, start, ms, sum = 0;
+	unsigned long n = 1;
+	int i, kept = 0;
+
+	/* calibrate the number of iterations per sample */
+	for (;;) {
+		start = bench_now_ms();
+		if (b->run(n) != 0)
+			return -1;
+		ms = bench_now_ms() - start;
+		if (ms >= MIN_SAMPLE_MS || n >= 1UL << 30)
+			break;
+		n *= ms > 0.1 ? (unsigned long) (MIN_SAMPLE_MS / ms) + 1 : 10;
+	}
+
+	for (i = 0; i < WARMUP_SAMPLES; i++)
+		if (b->run(n) != 0)
+			return -1;
+
+	for (i = 0; i < samples; i++) {
+		start = bench_now_ms();
+		if (b->run(n) != 0)
+			return -1;
+		ns[i] = (bench_now_ms() - start) * 1000000.0 / n;
+	}
+
+	/* Tukey fences */
+	qsort(ns, samples, sizeof(double), compare_double);
+	q1 = ns[samples / 4];
+	q3 = ns[(samples * 3) / 4];
+	lo = q1 - 1.5 * (q3 - q1);
+	hi = q3 + 1.5 * (q3 - q1);
+	for (i = 0; i < samples; i++)
+		if (ns[i] >= lo && ns[i] <= hi)
+			ns[kept++] = ns[i];
+	for (i = 0; i < kept; i++)
+		sum += ns[i];
+
+	strlcpy(res->name, b->name, sizeof(res->name));
+	res->median = kept % 2 ? ns[kept / 2] : (ns[kept / 2 - 1] + ns[kept / 2]) / 2;
+	res->mean = sum / kept;
+	res->min = ns[0];
+	res->samples = kept;
+	return 0;
+}
+
+static int load_baseline(const char *file, struct result *base, int max)
+{
+	char line[256];
+	FILE *f;
+	int n = 0;
+
+	f = fopen(file, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Failed to open %s\n", file);
+		return -1;
+	}
+	while (n < max && fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%63s %lf %lf %lf %d", base[n].name, &base[n].median,
+				&base[n].mean, &base[n].min, &base[n].samples) == 5)
+			n++;
+	}
+	fclose(f);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	struct result base[64], res;
+	const char *filter = NULL, *output = NULL, *compare = NULL;
+	double threshold = DEFAULT_THRESHOLD;
+	int samples = DEFAULT_SAMPLES, nbase = 0, regressions = 0, i, j;
+	FILE *out = NULL;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+			samples = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			filter = argv[++i];
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+			compare = argv[++i];
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+			threshold = atof(argv[++i]);
+		else {
+			fprintf(stderr, "Usage: %s [--samples <n>] [--filter <name>] [--output <file>]\n"
+					"\t[--compare <baseline> [--threshold <percent>]]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (samples < 4 || samples > MAX_SAMPLES) {
+		fprintf(stderr, "The number of samples must be between 4 and %d\n", MAX_SAMPLES);
+		return 2;
+	}
+	if (compare && (nbase = load_baseline(compare, base, 64)) < 0)
+		return 2;
+	if (output && (out = fopen(output, "w")) == NULL) {
+		fprintf(stderr, "Failed to open %s\n", output);
+		return 2;
+	}
+
+	if (sc_establish_context(&ctx, "microbench") != SC_SUCCESS)
+		return 2;
+	if (setup() != 0) {
+		fprintf(stderr, "Failed to prepare the benchmark input\n");
+		sc_release_context(ctx);
+		return 2;
+	}
+
+	printf("# name\tmedian_ns\tmean_ns\tmin_ns\tsamples%s\n",
+			compare ? "\tbaseline_ns\tchange_pct\tstatus" : "");
+	if (out)
+		fprintf(out, "# name\tmedian_ns\tmean_ns\tmin_ns\tsamples\n");
+	for (i = 0; benches[i].name; i++) {
+		if (filter && strstr(benches[i].name, filter) == NULL)
+			continue;
+		if (run_bench(&benches[i], samples, &res) != 0) {
+			fprintf(stderr, "%s failed\n", benches[i].name);
+			regressions++;
+			continue;
+		}
+		printf("%s\t%.1f\t%.1f\t%.1f\t%d", res.name, res.median, res.mean, res.min, res.samples);
+		if (out)
+			fprintf(out, "%s\t%.1f\t%.1f\t%.1f\t%d\n", res.name, res.median, res.mean, res.min, res.samples);
+		if (compare) {
+			for (j = 0; j < nbase; j++)
+				if (strcmp(base[j].name, res.name) == 0)
+					break;
+			if (j == nbase || base[j].median <= 0) {
+				printf("\t-\t-\tnew");
+			} else {
+				double change = (res.median - base[j].median) * 100.0 / base[j].median;
+
+				printf("\t%.1f\t%+.1f\t%s", base[j].median, change,
+						change > threshold ? "regression" : "ok");
+				if (change > threshold)
+					regressions++;
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	if (out)
+		fclose(out);
+	sc_release_context(ctx);
+	return regressions ? 1 : 0;
+}
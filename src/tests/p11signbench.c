@@ -0,0 +1,185 @@
+/*
+ * p11signbench.c: Compare the signatures per second of C_SignInit/C_Sign
+ * and of the PKCS#11 3.0 message-based signing functions
+ *
+ * Usage: p11signbench <module> [<pin> [<count>]]
+ *
+ * The first private key with CKA_SIGN on the first token is used with
+ * CKM_SHA256_RSA_PKCS or CKM_ECDSA_SHA256.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pkcs11/pkcs11.h"
+#include "common/libpkcs11.h"
+#include "bench.h"
+
+#define DEFAULT_COUNT	100
+
+static CK_FUNCTION_LIST_3_0_PTR p11 = NULL;
+
+static int find_key(CK_SESSION_HANDLE session, CK_OBJECT_HANDLE *key, CK_MECHANISM *mech)
+{
+	CK_OBJECT_CLASS class = CKO_PRIVATE_KEY;
+	CK_BBOOL sign = CK_TRUE;
+	CK_ATTRIBUTE tmpl[] = {
+		{ CKA_CLASS, &class, sizeof(class) },
+		{ CKA_SIGN, &sign, sizeof(sign) },
+	};
+	CK_KEY_TYPE key_type;
+	CK_ATTRIBUTE key_type_attr = { CKA_KEY_TYPE, &key_type, sizeof(key_type) };
+	CK_ULONG count = 0;
+	CK_RV rv;
+
+	rv = p11->C_FindObjectsInit(session, tmpl, 2);
+	if (rv == CKR_OK) {
+		rv = p11->C_FindObjects(session, key, 1, &count);
+		p11->C_FindObjectsFinal(session);
+	}
+	if (rv != CKR_OK || count == 0) {
+		fprintf(stderr, "No signature key found\n");
+		return -1;
+	}
+	if (p11->C_GetAttributeValue(session, *key, &key_type_attr, 1) != CKR_OK)
+		return -1;
+	switch (key_type) {
+	case CKK_RSA:
+		mech->mechanism = CKM_SHA256_RSA_PKCS;
+		break;
+	case CKK_EC:
+		mech->mechanism = CKM_ECDSA_SHA256;
+		break;
+	default:
+		fprintf(stderr, "Unsupported key type 0x%lx\n", key_type);
+		return -1;
+	}
+	return 0;
+}
+
+static CK_RV bench_sign(CK_SESSION_HANDLE session, CK_OBJECT_HANDLE key,
+		CK_MECHANISM *mech, CK_BYTE *data, CK_ULONG data_len, int count)
+{
+	CK_BYTE sig[1024];
+	CK_ULONG sig_len;
+	CK_RV rv = CKR_OK;
+	int i;
+
+	for (i = 0; i < count && rv == CKR_OK; i++) {
+		sig_len = sizeof(sig);
+		rv = p11->C_SignInit(session, mech, key);
+		if (rv == CKR_OK)
+			rv = p11->C_Sign(session, data, data_len, sig, &sig_len);
+	}
+	return rv;
+}
+
+static CK_RV bench_sign_message(CK_SESSION_HANDLE session, CK_OBJECT_HANDLE key,
+		CK_MECHANISM *mech, CK_BYTE *data, CK_ULONG data_len, int count)
+{
+	CK_BYTE sig[1024];
+	CK_ULONG sig_len;
+	CK_RV rv;
+	int i;
+
+	rv = p11->C_MessageSignInit(session, mech, key);
+	for (i = 0; i < count && rv == CKR_OK; i++) {
+		sig_len = sizeof(sig);
+		rv = p11->C_SignMessage(session, NULL, 0, data, data_len, sig, &sig_len);
+	}
+	p11->C_MessageSignFinal(session);
+	return rv;
+}
+
+int main(int argc, char *argv[])
+{
+	CK_FUNCTION_LIST_PTR p11_v2 = NULL;
+	CK_SLOT_ID slot;
+	CK_ULONG slot_count = 1;
+	CK_SESSION_HANDLE session;
+	CK_OBJECT_HANDLE key;
+	CK_MECHANISM mech = { 0, NULL, 0 };
+	CK_BYTE data[64];
+	void *module;
+	int count = DEFAULT_COUNT, r;
+	CK_RV rv;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <module> [<pin> [<count>]]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 3)
+		count = atoi(argv[3]);
+
+	module = C_LoadModule(argv[1], &p11_v2);
+	if (module == NULL) {
+		fprintf(stderr, "Failed to load %s\n", argv[1]);
+		return 1;
+	}
+	p11 = (CK_FUNCTION_LIST_3_0_PTR) p11_v2;
+	if (p11->version.major < 3) {
+		fprintf(stderr, "Module does not provide the PKCS#11 3.0 interface\n");
+		C_UnloadModule(module);
+		return 1;
+	}
+
+	rv = p11->C_Initialize(NULL);
+	if (rv == CKR_OK)
+		rv = p11->C_GetSlotList(CK_TRUE, &slot, &slot_count);
+	if (rv == CKR_OK && slot_count == 0)
+		rv = CKR_TOKEN_NOT_PRESENT;
+	if (rv == CKR_OK)
+		rv = p11->C_OpenSession(slot, CKF_SERIAL_SESSION, NULL, NULL, &session);
+	if (rv == CKR_OK && argc > 2)
+		rv = p11->C_Login(session, CKU_USER, (CK_UTF8CHAR *) argv[2], strlen(argv[2]));
+	if (rv != CKR_OK) {
+		fprintf(stderr, "Failed to open a session: 0x%lx\n", rv);
+		goto out;
+	}
+	if (find_key(session, &key, &mech) != 0) {
+		rv = CKR_KEY_HANDLE_INVALID;
+		goto out;
+	}
+	memset(data, 0x5A, sizeof(data));
+
+	printf("%d signatures with mechanism 0x%lx\n", count, mech.mechanism);
+	printf("%-20s %10s %12s\n", "", "ms", "signatures/s");
+	for (r = 0; r < 2; r++) {
+		const char *name = r == 0 ? "C_Sign" : "C_SignMessage";
+		double start, ms;
+
+		start = bench_now_ms();
+		if (r == 0)
+			rv = bench_sign(session, key, &mech, data, sizeof(data), count);
+		else
+			rv = bench_sign_message(session, key, &mech, data, sizeof(data), count);
+		ms = bench_now_ms() - start;
+		if (rv != CKR_OK) {
+			fprintf(stderr, "%s failed: 0x%lx\n", name, rv);
+			goto out;
+		}
+		printf("%-20s %10.2f %12.1f\n", name, ms, count / ms * 1000.0);
+	}
+
+out:
+	p11->C_Finalize(NULL);
+	C_UnloadModule(module);
+	return rv == CKR_OK ? 0 : 1;
+}
@@ -34,6 +34,8 @@
 #include "p11test_case_interface.h"
 #include "p11test_case_wrap.h"
 #include "p11test_case_secret.h"
+#include "p11test_case_aead.h"
+#include "p11test_case_bulk.h"
 
 #define DEFAULT_P11LIB	"../../pkcs11/.libs/opensc-pkcs11.so"
 
@@ -101,6 +103,14 @@ int main(int argc, char** argv) {
 		/* Verify that key wrapping and unwrapping works */
 		cmocka_unit_test_setup_teardown(wrap_tests,
 			user_login_setup, after_test_cleanup),
+
+		/* Verify message-based AEAD encryption with known answers */
+		cmocka_unit_test_setup_teardown(aead_tests,
+			user_login_setup, after_test_cleanup),
+
+		/* Bulk attribute functions return what C_GetAttributeValue does */
+		cmocka_unit_test_setup_teardown(bulk_attributes_test,
+			user_login_setup, after_test_cleanup),
 	};
 
 	/* Make sure it is initialized to sensible values */
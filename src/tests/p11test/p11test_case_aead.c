@@ -0,0 +1,384 @@
+/*
+ * p11test_case_aead.c: Check the message-based AEAD encryption
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "p11test_case_aead.h"
+#include <dlfcn.h>
+
+extern void *pkcs11_so;
+
+struct aead_vector {
+	const char *name;
+	CK_MECHANISM_TYPE mech;
+	CK_KEY_TYPE key_type;
+	const char *key;
+	const char *iv;
+	const char *aad;
+	const char *plain;
+	const char *cipher;
+	const char *tag;
+};
+
+/* "Ladies and Gentlemen of the class of '99: If I could offer you only one
+ * tip for the future, sunscreen would be it." */
+#define RFC8439_PLAINTEXT \
+	"4c616469657320616e642047656e746c656d656e206f662074686520636c6173" \
+	"73206f66202739393a204966204920636f756c64206f6666657220796f75206f" \
+	"6e6c79206f6e652074697020666f7220746865206675747572652c2073756e73" \
+	"637265656e20776f756c642062652069742e"
+
+static const struct aead_vector aead_vectors[] = {
+	/* GCM specification, test case 4 */
+	{ "AES-128-GCM", CKM_AES_GCM, CKK_AES,
+		"feffe9928665731c6d6a8f9467308308",
+		"cafebabefacedbaddecaf888",
+		"feedfacedeadbeeffeedfacedeadbeefabaddad2",
+		"d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+		"1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+		"42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+		"21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+		"5bc94fbc3221a5db94fae95ae7121a47" },
+	/* GCM specification, test case 16 */
+	{ "AES-256-GCM", CKM_AES_GCM, CKK_AES,
+		"feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+		"cafebabefacedbaddecaf888",
+		"feedfacedeadbeeffeedfacedeadbeefabaddad2",
+		"d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+		"1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+		"522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+		"8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+		"76fc6ece0f4e1768cddf8853bb2d551b" },
+	/* RFC 8439, section 2.8.2 */
+	{ "ChaCha20-Poly1305", CKM_CHACHA20_POLY1305, CKK_CHACHA20,
+		"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f",
+		"070000004041424344454647",
+		"50515253c0c1c2c3c4c5c6c7",
+		RFC8439_PLAINTEXT,
+		"d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+		"3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+		"92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+		"3ff4def08e4b7a9de576d26586cec64b6116",
+		"1ae10b594f09e26a7e902ecbd0600691" },
+};
+
+static CK_ULONG
+hex_to_bin(const char *hex, CK_BYTE *out)
+{
+	CK_ULONG len = strlen(hex) / 2, i;
+	unsigned int byte;
+
+	for (i = 0; i < len; i++) {
+		sscanf(hex + 2 * i, "%2x", &byte);
+		out[i] = (CK_BYTE) byte;
+	}
+	return len;
+}
+
+/* Fill the per-message parameters of the mechanism */
+static CK_ULONG
+aead_params(CK_MECHANISM_TYPE mech, CK_BYTE *iv, CK_ULONG iv_len, CK_BYTE *tag,
+	CK_GCM_MESSAGE_PARAMS *gcm, CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS *chacha, void **params)
+{
+	if (mech == CKM_AES_GCM) {
+		gcm->pIv = iv;
+		gcm->ulIvLen = iv_len;
+		gcm->ulIvFixedBits = 0;
+		gcm->ivGenerator = CKG_NO_GENERATE;
+		gcm->pTag = tag;
+		gcm->ulTagBits = 128;
+		*params = gcm;
+		return sizeof(*gcm);
+	}
+	chacha->pNonce = iv;
+	chacha->ulNonceLen = iv_len;
+	chacha->pTag = tag;
+	*params = chacha;
+	return sizeof(*chacha);
+}
+
+static int
+aead_mechanism_supported(token_info_t *info, CK_FUNCTION_LIST_3_0_PTR fp, const struct aead_vector *v)
+{
+	CK_MECHANISM_INFO mech_info;
+	CK_RV rv;
+
+	rv = fp->C_GetMechanismInfo(info->slot_id, v->mech, &mech_info);
+	if (rv != CKR_OK || !(mech_info.flags & CKF_MESSAGE_ENCRYPT)
+			|| !(mech_info.flags & CKF_MESSAGE_DECRYPT)) {
+		debug_print(" [SKIP %s ] Mechanism not supported", v->name);
+		return 0;
+	}
+	return 1;
+}
+
+/* Encrypt and decrypt one known answer vector with the given key
+ *
+ * Returns
+ *  * 1 if all the results match,
+ *  * 0 if the module does not hold the key value.
+ *  Mismatches terminate the execution.
+ */
+static int
+test_aead_key(token_info_t *info, CK_FUNCTION_LIST_3_0_PTR fp, const struct aead_vector *v,
+	CK_OBJECT_HANDLE handle)
+{
+	CK_BYTE iv[12], aad[32], plain[128], cipher[128], tag[16];
+	CK_BYTE out[128], out_tag[16];
+	CK_MECHANISM mech = { v->mech, NULL_PTR, 0 };
+	CK_GCM_MESSAGE_PARAMS gcm;
+	CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS chacha;
+	CK_ULONG iv_len, aad_len, plain_len, out_len, part_len, params_len;
+	void *params = NULL;
+	CK_RV rv;
+
+	iv_len = hex_to_bin(v->iv, iv);
+	aad_len = hex_to_bin(v->aad, aad);
+	plain_len = hex_to_bin(v->plain, plain);
+	hex_to_bin(v->cipher, cipher);
+	hex_to_bin(v->tag, tag);
+
+	rv = fp->C_MessageEncryptInit(info->session_handle, &mech, handle);
+	if (rv == CKR_KEY_FUNCTION_NOT_PERMITTED) {
+		/* the key value is not available to the module */
+		debug_print(" [SKIP %s ] C_MessageEncryptInit: rv = 0x%.8lX", v->name, rv);
+		return 0;
+	}
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "%s: C_MessageEncryptInit: rv = 0x%.8lX", v->name, rv);
+
+	/* single part */
+	params_len = aead_params(v->mech, iv, iv_len, out_tag, &gcm, &chacha, &params);
+	out_len = sizeof(out);
+	rv = fp->C_EncryptMessage(info->session_handle, params, params_len,
+		aad, aad_len, plain, plain_len, out, &out_len);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "%s: C_EncryptMessage: rv = 0x%.8lX", v->name, rv);
+	assert_int_equal(out_len, plain_len);
+	assert_memory_equal(out, cipher, plain_len);
+	assert_memory_equal(out_tag, tag, sizeof(tag));
+
+	/* the same message in two parts with the same key schedule */
+	memset(out, 0, sizeof(out));
+	memset(out_tag, 0, sizeof(out_tag));
+	rv = fp->C_EncryptMessageBegin(info->session_handle, params, params_len, aad, aad_len);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "%s: C_EncryptMessageBegin: rv = 0x%.8lX", v->name, rv);
+	part_len = sizeof(out);
+	rv = fp->C_EncryptMessageNext(info->session_handle, params, params_len,
+		plain, 17, out, &part_len, 0);
+	if (rv != CKR_OK || part_len != 17)
+		P11TEST_FAIL(info, "%s: C_EncryptMessageNext: rv = 0x%.8lX", v->name, rv);
+	part_len = sizeof(out) - 17;
+	rv = fp->C_EncryptMessageNext(info->session_handle, params, params_len,
+		plain + 17, plain_len - 17, out + 17, &part_len, CKF_END_OF_MESSAGE);
+	if (rv != CKR_OK || part_len != plain_len - 17)
+		P11TEST_FAIL(info, "%s: C_EncryptMessageNext: rv = 0x%.8lX", v->name, rv);
+	assert_memory_equal(out, cipher, plain_len);
+	assert_memory_equal(out_tag, tag, sizeof(tag));
+
+	rv = fp->C_MessageEncryptFinal(info->session_handle);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "%s: C_MessageEncryptFinal: rv = 0x%.8lX", v->name, rv);
+
+	/* decryption with the right and with a modified tag */
+	rv = fp->C_MessageDecryptInit(info->session_handle, &mech, handle);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "%s: C_MessageDecryptInit: rv = 0x%.8lX", v->name, rv);
+	memcpy(out_tag, tag, sizeof(tag));
+	out_len = sizeof(out);
+	rv = fp->C_DecryptMessage(info->session_handle, params, params_len,
+		aad, aad_len, cipher, plain_len, out, &out_len);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "%s: C_DecryptMessage: rv = 0x%.8lX", v->name, rv);
+	assert_int_equal(out_len, plain_len);
+	assert_memory_equal(out, plain, plain_len);
+
+	out_tag[0] ^= 0x01;
+	out_len = sizeof(out);
+	rv = fp->C_DecryptMessage(info->session_handle, params, params_len,
+		aad, aad_len, cipher, plain_len, out, &out_len);
+	if (rv != CKR_AEAD_DECRYPT_FAILED)
+		P11TEST_FAIL(info, "%s: C_DecryptMessage with a wrong tag: rv = 0x%.8lX", v->name, rv);
+
+	rv = fp->C_MessageDecryptFinal(info->session_handle);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "%s: C_MessageDecryptFinal: rv = 0x%.8lX", v->name, rv);
+
+	return 1;
+}
+
+/* Run one known answer vector with a session key created from the value */
+static int
+test_aead_vector(token_info_t *info, CK_FUNCTION_LIST_3_0_PTR fp, const struct aead_vector *v)
+{
+	CK_OBJECT_CLASS key_class = CKO_SECRET_KEY;
+	CK_KEY_TYPE key_type = v->key_type;
+	CK_BBOOL true_value = CK_TRUE;
+	CK_BBOOL false_value = CK_FALSE;
+	CK_BYTE key[32];
+	CK_ATTRIBUTE template[] = {
+		{ CKA_CLASS, &key_class, sizeof(key_class) },
+		{ CKA_KEY_TYPE, &key_type, sizeof(key_type) },
+		{ CKA_TOKEN, &false_value, sizeof(false_value) },
+		{ CKA_ENCRYPT, &true_value, sizeof(true_value) },
+		{ CKA_DECRYPT, &true_value, sizeof(true_value) },
+		{ CKA_VALUE, key, 0 },
+	};
+	CK_OBJECT_HANDLE handle = CK_INVALID_HANDLE;
+	CK_RV rv;
+	int r;
+
+	if (!aead_mechanism_supported(info, fp, v))
+		return 0;
+
+	template[5].ulValueLen = hex_to_bin(v->key, key);
+	rv = fp->C_CreateObject(info->session_handle, template,
+		sizeof(template) / sizeof(CK_ATTRIBUTE), &handle);
+	if (rv != CKR_OK) {
+		debug_print(" [SKIP %s ] C_CreateObject: rv = 0x%.8lX", v->name, rv);
+		return 0;
+	}
+
+	r = test_aead_key(info, fp, v, handle);
+	fp->C_DestroyObject(info->session_handle, handle);
+	return r;
+}
+
+/* Find an AES key on the token that can encrypt and unwrap */
+static CK_OBJECT_HANDLE
+find_aes_unwrap_key(token_info_t *info, CK_FUNCTION_LIST_3_0_PTR fp)
+{
+	CK_OBJECT_CLASS key_class = CKO_SECRET_KEY;
+	CK_KEY_TYPE key_type = CKK_AES;
+	CK_BBOOL true_value = CK_TRUE;
+	CK_ATTRIBUTE filter[] = {
+		{ CKA_CLASS, &key_class, sizeof(key_class) },
+		{ CKA_KEY_TYPE, &key_type, sizeof(key_type) },
+		{ CKA_TOKEN, &true_value, sizeof(true_value) },
+		{ CKA_ENCRYPT, &true_value, sizeof(true_value) },
+		{ CKA_UNWRAP, &true_value, sizeof(true_value) },
+	};
+	CK_OBJECT_HANDLE handle = CK_INVALID_HANDLE;
+	CK_ULONG count = 0;
+	CK_RV rv;
+
+	rv = fp->C_FindObjectsInit(info->session_handle, filter, sizeof(filter) / sizeof(CK_ATTRIBUTE));
+	if (rv != CKR_OK)
+		return CK_INVALID_HANDLE;
+	rv = fp->C_FindObjects(info->session_handle, &handle, 1, &count);
+	fp->C_FindObjectsFinal(info->session_handle);
+	if (rv != CKR_OK || count == 0)
+		return CK_INVALID_HANDLE;
+	return handle;
+}
+
+/* Run one known answer vector with a session key that the token unwrapped
+ * with an AES key. The module has to hold the unwrapped value, since the
+ * token does not implement AEAD.
+ */
+static int
+test_aead_unwrapped(token_info_t *info, CK_FUNCTION_LIST_3_0_PTR fp, const struct aead_vector *v,
+	CK_OBJECT_HANDLE unwrap_key)
+{
+	CK_OBJECT_CLASS key_class = CKO_SECRET_KEY;
+	CK_KEY_TYPE key_type = v->key_type;
+	CK_BBOOL true_value = CK_TRUE;
+	CK_BBOOL false_value = CK_FALSE;
+	CK_BYTE key[32], wrapped[32];
+	CK_ULONG key_len, wrapped_len = sizeof(wrapped);
+	CK_ATTRIBUTE template[] = {
+		{ CKA_CLASS, &key_class, sizeof(key_class) },
+		{ CKA_KEY_TYPE, &key_type, sizeof(key_type) },
+		{ CKA_TOKEN, &false_value, sizeof(false_value) },
+		{ CKA_ENCRYPT, &true_value, sizeof(true_value) },
+		{ CKA_DECRYPT, &true_value, sizeof(true_value) },
+		{ CKA_VALUE_LEN, &key_len, sizeof(key_len) },
+	};
+	CK_MECHANISM mech = { CKM_AES_ECB, NULL_PTR, 0 };
+	CK_OBJECT_HANDLE handle = CK_INVALID_HANDLE;
+	CK_RV rv;
+	int r;
+
+	if (unwrap_key == CK_INVALID_HANDLE || !aead_mechanism_supported(info, fp, v))
+		return 0;
+
+	/* The key values are multiples of the AES block size, no padding needed */
+	key_len = hex_to_bin(v->key, key);
+	rv = fp->C_EncryptInit(info->session_handle, &mech, unwrap_key);
+	if (rv == CKR_OK)
+		rv = fp->C_Encrypt(info->session_handle, key, key_len, wrapped, &wrapped_len);
+	if (rv != CKR_OK) {
+		debug_print(" [SKIP %s ] C_Encrypt: rv = 0x%.8lX", v->name, rv);
+		return 0;
+	}
+
+	rv = fp->C_UnwrapKey(info->session_handle, &mech, unwrap_key, wrapped, wrapped_len,
+		template, sizeof(template) / sizeof(CK_ATTRIBUTE), &handle);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "%s: C_UnwrapKey: rv = 0x%.8lX", v->name, rv);
+
+	r = test_aead_key(info, fp, v, handle);
+	fp->C_DestroyObject(info->session_handle, handle);
+	if (r == 0)
+		P11TEST_FAIL(info, "%s: the unwrapped session key cannot be used", v->name);
+	return r;
+}
+
+void aead_tests(void **state)
+{
+	token_info_t *info = (token_info_t *) *state;
+	CK_RV (*C_GetInterface)(CK_UTF8CHAR_PTR, CK_VERSION_PTR, CK_INTERFACE_PTR_PTR, CK_FLAGS) = NULL;
+	CK_INTERFACE_PTR interface;
+	CK_VERSION version = { 3, 0 };
+	CK_FUNCTION_LIST_3_0_PTR fp;
+	CK_OBJECT_HANDLE unwrap_key;
+	size_t i;
+	int tested = 0;
+	CK_RV rv;
+
+	P11TEST_START(info);
+
+	/* The message-based functions are available only in PKCS #11 3.0 */
+	C_GetInterface = (CK_RV (*)(CK_UTF8CHAR_PTR, CK_VERSION_PTR, CK_INTERFACE_PTR_PTR, CK_FLAGS))
+		dlsym(pkcs11_so, "C_GetInterface");
+	if (C_GetInterface == NULL)
+		P11TEST_SKIP(info);
+	rv = C_GetInterface((unsigned char *)"PKCS 11", &version, &interface, 0);
+	if (rv != CKR_OK)
+		P11TEST_SKIP(info);
+	fp = interface->pFunctionList;
+
+	unwrap_key = find_aes_unwrap_key(info, fp);
+
+	P11TEST_DATA_ROW(info, 3,
+		's', "MECHANISM",
+		's', "KNOWN ANSWER",
+		's', "UNWRAPPED KEY");
+	for (i = 0; i < sizeof(aead_vectors) / sizeof(aead_vectors[0]); i++) {
+		int r = test_aead_vector(info, fp, &aead_vectors[i]);
+		int u = test_aead_unwrapped(info, fp, &aead_vectors[i], unwrap_key);
+
+		P11TEST_DATA_ROW(info, 3,
+			's', aead_vectors[i].name,
+			's', r == 1 ? "YES" : "",
+			's', u == 1 ? "YES" : "");
+		tested += r + u;
+	}
+
+	if (tested == 0)
+		P11TEST_SKIP(info);
+	P11TEST_PASS(info);
+}
@@ -0,0 +1,167 @@
+/*
+ * p11test_case_bulk.c: Check the OpenSC bulk attribute functions
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "p11test_case_bulk.h"
+#include "pkcs11/pkcs11-opensc.h"
+#include <dlfcn.h>
+
+extern void *pkcs11_so;
+
+#define BULK_ATTRS	5
+#define BULK_BUF_LEN	256
+
+/* Buffers for the attributes of one object */
+struct bulk_values {
+	CK_OBJECT_CLASS class;
+	CK_BBOOL private;
+	CK_BYTE id[BULK_BUF_LEN];
+	CK_BYTE label[BULK_BUF_LEN];
+};
+
+/* CKA_VALUE only asks for the length: it is sensitive for private keys,
+ * which checks that the error precedence is the same as well */
+static void
+bulk_template(CK_ATTRIBUTE_PTR template, struct bulk_values *values)
+{
+	CK_ATTRIBUTE t[BULK_ATTRS] = {
+		{ CKA_CLASS, &values->class, sizeof(values->class) },
+		{ CKA_PRIVATE, &values->private, sizeof(values->private) },
+		{ CKA_ID, values->id, sizeof(values->id) },
+		{ CKA_LABEL, values->label, sizeof(values->label) },
+		{ CKA_VALUE, NULL_PTR, 0 },
+	};
+
+	memset(values, 0, sizeof(*values));
+	memcpy(template, t, sizeof(t));
+}
+
+static void
+bulk_compare(token_info_t *info, CK_OBJECT_HANDLE handle,
+	CK_ATTRIBUTE_PTR bulk, CK_RV bulk_rv)
+{
+	CK_FUNCTION_LIST_PTR fp = info->function_pointer;
+	CK_ATTRIBUTE single[BULK_ATTRS];
+	struct bulk_values values;
+	CK_RV rv;
+	int i;
+
+	bulk_template(single, &values);
+	rv = fp->C_GetAttributeValue(info->session_handle, handle, single, BULK_ATTRS);
+	if (rv != bulk_rv)
+		P11TEST_FAIL(info, "Object %lu: bulk rv 0x%.8lX, C_GetAttributeValue rv 0x%.8lX",
+			handle, bulk_rv, rv);
+	for (i = 0; i < BULK_ATTRS; i++) {
+		if (bulk[i].ulValueLen != single[i].ulValueLen)
+			P11TEST_FAIL(info, "Object %lu: attribute 0x%lX length %ld, expected %ld",
+				handle, single[i].type, (long)bulk[i].ulValueLen, (long)single[i].ulValueLen);
+		if (single[i].pValue != NULL_PTR && single[i].ulValueLen != (CK_ULONG)-1)
+			assert_memory_equal(bulk[i].pValue, single[i].pValue, single[i].ulValueLen);
+	}
+}
+
+void bulk_attributes_test(void **state)
+{
+	token_info_t *info = (token_info_t *) *state;
+	CK_RV (*C_GetInterface)(CK_UTF8CHAR_PTR, CK_VERSION_PTR, CK_INTERFACE_PTR_PTR, CK_FLAGS) = NULL;
+	CK_OPENSC_FUNCTION_LIST_PTR opensc;
+	CK_INTERFACE_PTR interface;
+	CK_OBJECT_HANDLE_PTR handles = NULL;
+	CK_ATTRIBUTE_PTR templates = NULL;
+	struct bulk_values *values = NULL;
+	CK_RV *results = NULL;
+	CK_ULONG count = 0, i;
+	CK_RV rv;
+
+	P11TEST_START(info);
+
+	C_GetInterface = (CK_RV (*)(CK_UTF8CHAR_PTR, CK_VERSION_PTR, CK_INTERFACE_PTR_PTR, CK_FLAGS))
+		dlsym(pkcs11_so, "C_GetInterface");
+	if (C_GetInterface == NULL)
+		P11TEST_SKIP(info);
+	rv = C_GetInterface((unsigned char *)OPENSC_INTERFACE_NAME, NULL, &interface, 0);
+	if (rv != CKR_OK)
+		P11TEST_SKIP(info);
+	opensc = interface->pFunctionList;
+	if (opensc->version.major == 1 && opensc->version.minor < 1)
+		P11TEST_SKIP(info);
+
+	/* count all the objects first */
+	rv = opensc->C_OpenSC_FindObjectsWithAttributes(info->session_handle,
+		NULL_PTR, 0, NULL_PTR, &count, NULL_PTR, 0, NULL_PTR);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "C_OpenSC_FindObjectsWithAttributes: rv = 0x%.8lX", rv);
+	if (count == 0)
+		P11TEST_SKIP(info);
+
+	handles = calloc(count, sizeof(CK_OBJECT_HANDLE));
+	templates = calloc(count * BULK_ATTRS, sizeof(CK_ATTRIBUTE));
+	values = calloc(count, sizeof(struct bulk_values));
+	results = calloc(count, sizeof(CK_RV));
+	assert_non_null(handles);
+	assert_non_null(templates);
+	assert_non_null(values);
+	assert_non_null(results);
+
+	/* one less than needed */
+	if (count > 1) {
+		CK_ULONG small = count - 1;
+
+		for (i = 0; i < small; i++)
+			bulk_template(templates + i * BULK_ATTRS, &values[i]);
+		rv = opensc->C_OpenSC_FindObjectsWithAttributes(info->session_handle,
+			NULL_PTR, 0, handles, &small, templates, BULK_ATTRS, results);
+		if (rv != CKR_BUFFER_TOO_SMALL || small != count)
+			P11TEST_FAIL(info, "C_OpenSC_FindObjectsWithAttributes: rv = 0x%.8lX, %lu objects",
+				rv, small);
+	}
+
+	P11TEST_DATA_ROW(info, 2,
+		's', "FUNCTION",
+		's', "OBJECTS");
+
+	/* find and get the attributes in one call */
+	for (i = 0; i < count; i++)
+		bulk_template(templates + i * BULK_ATTRS, &values[i]);
+	rv = opensc->C_OpenSC_FindObjectsWithAttributes(info->session_handle,
+		NULL_PTR, 0, handles, &count, templates, BULK_ATTRS, results);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "C_OpenSC_FindObjectsWithAttributes: rv = 0x%.8lX", rv);
+	for (i = 0; i < count; i++)
+		bulk_compare(info, handles[i], templates + i * BULK_ATTRS, results[i]);
+	P11TEST_DATA_ROW(info, 2,
+		's', "C_OpenSC_FindObjectsWithAttributes",
+		'd', (int)count);
+
+	/* the same for the handles found */
+	for (i = 0; i < count; i++)
+		bulk_template(templates + i * BULK_ATTRS, &values[i]);
+	rv = opensc->C_OpenSC_GetAttributeValues(info->session_handle,
+		handles, count, templates, BULK_ATTRS, results);
+	if (rv != CKR_OK)
+		P11TEST_FAIL(info, "C_OpenSC_GetAttributeValues: rv = 0x%.8lX", rv);
+	for (i = 0; i < count; i++)
+		bulk_compare(info, handles[i], templates + i * BULK_ATTRS, results[i]);
+	P11TEST_DATA_ROW(info, 2,
+		's', "C_OpenSC_GetAttributeValues",
+		'd', (int)count);
+
+	free(handles);
+	free(templates);
+	free(values);
+	free(results);
+	P11TEST_PASS(info);
+}
@@ -20,6 +20,7 @@
  */
 
 #include "p11test_case_interface.h"
+#include "pkcs11/pkcs11-opensc.h"
 #include <dlfcn.h>
 
 extern void *pkcs11_so;
@@ -55,8 +56,8 @@ void interface_test(void **state)
 	/* Get the count of interfaces */
 	rv = C_GetInterfaceList(NULL, &count);
 	assert_int_equal(rv, CKR_OK);
-	/* XXX assuming two interfaces, PKCS#11 3.0 and 2.20 */
-	assert_int_equal(count, 2);
+	/* XXX assuming three interfaces, PKCS#11 3.0, 2.20 and the OpenSC vendor one */
+	assert_int_equal(count, 3);
 
 	interfaces = malloc(count * sizeof(CK_INTERFACE));
 	assert_non_null(interfaces);
@@ -80,6 +81,9 @@ void interface_test(void **state)
 	assert_int_equal(((CK_VERSION *)interfaces[1].pFunctionList)->major, 2);
 	assert_int_equal(((CK_VERSION *)interfaces[1].pFunctionList)->minor, 20);
 	assert_int_equal(interfaces[1].flags, 0);
+	assert_string_equal(interfaces[2].pInterfaceName, OPENSC_INTERFACE_NAME);
+	assert_int_equal(((CK_VERSION *)interfaces[2].pFunctionList)->major, 1);
+	assert_int_equal(interfaces[2].flags, 0);
 
 	/* GetInterface with NULL name should give us default PKCS 11 one */
 	rv = C_GetInterface(NULL, NULL, &interface, 0);
@@ -115,6 +119,29 @@ void interface_test(void **state)
 	/* The function list should be the same here too */
 	assert_ptr_equal(interfaces[1].pFunctionList, interface->pFunctionList);
 
+	/* GetInterface for the vendor interface */
+	rv = C_GetInterface((unsigned char *)OPENSC_INTERFACE_NAME, NULL, &interface, 0);
+	assert_int_equal(rv, CKR_OK);
+	assert_ptr_equal(interfaces[2].pFunctionList, interface->pFunctionList);
+	{
+		CK_OPENSC_FUNCTION_LIST_PTR opensc = interface->pFunctionList;
+		CK_OPENSC_APDU_STATS stats;
+
+		rv = opensc->C_OpenSC_GetStats(CK_OPENSC_ALL_SLOTS, &stats);
+		assert_int_equal(rv, CKR_OK);
+		rv = opensc->C_OpenSC_ResetStats(CK_OPENSC_ALL_SLOTS);
+		assert_int_equal(rv, CKR_OK);
+		rv = opensc->C_OpenSC_GetStats(CK_OPENSC_ALL_SLOTS, NULL);
+		assert_int_equal(rv, CKR_ARGUMENTS_BAD);
+
+		/* bulk attribute retrieval, since 1.1 */
+		assert_true(opensc->version.major > 1 || opensc->version.minor >= 1);
+		rv = opensc->C_OpenSC_GetAttributeValues(0, NULL, 0, NULL, 0, NULL);
+		assert_int_equal(rv, CKR_ARGUMENTS_BAD);
+		rv = opensc->C_OpenSC_FindObjectsWithAttributes(0, NULL, 0, NULL, NULL, NULL, 0, NULL);
+		assert_int_equal(rv, CKR_ARGUMENTS_BAD);
+	}
+
 	/* GetInterface with unknown interface  */
 	rv = C_GetInterface((unsigned char *)"PKCS 11 other", NULL, &interface, 0);
 	assert_int_equal(rv, CKR_ARGUMENTS_BAD);
@@ -0,0 +1,260 @@
+/*
+ * apdu-chain.c: Unit tests for chained commands and GET RESPONSE
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "libopensc/opensc.h"
+#include "libopensc/cards.h"
+
+#define DATA_LEN	600
+#define RESP_LEN	0x30
+#define MAX_APDUS	16
+
+static u8 data[DATA_LEN];
+static u8 resp_data[RESP_LEN];
+
+/* what the fake card received */
+static struct {
+	u8 cla, ins;
+	size_t datalen;
+} received[MAX_APDUS];
+static int n_received;
+static int transmit_calls, sequence_calls;
+static int fail_at;		/* answer the n-th APDU with 6A80 */
+static size_t resp_sent;
+
+static int
+fake_card(sc_apdu_t *apdu)
+{
+	size_t len;
+
+	if (n_received == MAX_APDUS)
+		return SC_ERROR_INTERNAL;
+	received[n_received].cla = apdu->cla;
+	received[n_received].ins = apdu->ins;
+	received[n_received].datalen = apdu->datalen;
+	n_received++;
+
+	apdu->resplen = 0;
+	if (fail_at == n_received) {
+		apdu->sw1 = 0x6A;
+		apdu->sw2 = 0x80;
+	}
+	else if (apdu->ins == 0xC0) {
+		/* GET RESPONSE */
+		len = RESP_LEN - resp_sent;
+		if (len > apdu->le)
+			len = apdu->le;
+		memcpy(apdu->resp, resp_data + resp_sent, len);
+		apdu->resplen = len;
+		resp_sent += len;
+		apdu->sw1 = resp_sent < RESP_LEN ? 0x61 : 0x90;
+		apdu->sw2 = resp_sent < RESP_LEN ? (u8)(RESP_LEN - resp_sent) : 0x00;
+	}
+	else if ((apdu->cla & 0x10) == 0 && apdu->le) {
+		/* the last chunk has its response waiting */
+		apdu->sw1 = 0x61;
+		apdu->sw2 = RESP_LEN;
+	}
+	else {
+		apdu->sw1 = 0x90;
+		apdu->sw2 = 0x00;
+	}
+	return SC_SUCCESS;
+}
+
+static int
+fake_transmit(struct sc_reader *reader, sc_apdu_t *apdu)
+{
+	transmit_calls++;
+	return fake_card(apdu);
+}
+
+static int
+fake_transmit_sequence(struct sc_reader *reader, sc_apdu_t *apdus, size_t count)
+{
+	size_t i;
+	int r;
+
+	sequence_calls++;
+	for (i = 0; i < count; ) {
+		r = fake_card(&apdus[i]);
+		if (r < 0)
+			return r;
+		i++;
+		if (apdus[i - 1].sw1 != 0x90 || apdus[i - 1].sw2 != 0x00)
+			break;
+	}
+	return (int)i;
+}
+
+static int setup(void **state)
+{
+	static struct sc_card_operations ops;
+	static struct sc_reader_operations reader_ops;
+	static struct sc_reader reader;
+	static struct sc_card card;
+	struct sc_context *ctx = NULL;
+	size_t i;
+
+	for (i = 0; i < DATA_LEN; i++)
+		data[i] = (u8)(i * 3 + 1);
+	for (i = 0; i < RESP_LEN; i++)
+		resp_data[i] = (u8)(i ^ 0x5A);
+
+	assert_int_equal(sc_establish_context(&ctx, "apdu-chain"), 0);
+	ops = *sc_get_iso7816_driver()->ops;
+	reader_ops.transmit = fake_transmit;
+	reader_ops.transmit_sequence = fake_transmit_sequence;
+	reader.ops = &reader_ops;
+	reader.active_protocol = SC_PROTO_T1;
+	card.ctx = ctx;
+	card.ops = &ops;
+	card.reader = &reader;
+	card.type = SC_CARD_TYPE_UNKNOWN;
+	card.max_send_size = 255;
+	card.max_recv_size = 256;
+	*state = &card;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct sc_card *card = (struct sc_card *) *state;
+
+	sc_release_context(card->ctx);
+	return 0;
+}
+
+static void
+reset(struct sc_card *card, int sequence)
+{
+	n_received = transmit_calls = sequence_calls = 0;
+	fail_at = 0;
+	resp_sent = 0;
+	((struct sc_reader_operations *) card->reader->ops)->transmit_sequence =
+		sequence ? fake_transmit_sequence : NULL;
+}
+
+static void
+chained_apdu(struct sc_card *card, sc_apdu_t *apdu, u8 *resp, size_t resplen)
+{
+	sc_format_apdu(card, apdu, SC_APDU_CASE_4_SHORT, 0x2A, 0x80, 0x86);
+	apdu->flags |= SC_APDU_FLAGS_CHAINING;
+	apdu->data = data;
+	apdu->datalen = apdu->lc = DATA_LEN;
+	apdu->resp = resp;
+	apdu->resplen = resplen;
+	apdu->le = 256;
+}
+
+static void check_chunks(void)
+{
+	assert_int_equal(received[0].cla, 0x10);
+	assert_int_equal(received[0].datalen, 255);
+	assert_int_equal(received[1].cla, 0x10);
+	assert_int_equal(received[1].datalen, 255);
+	assert_int_equal(received[2].cla, 0x00);
+	assert_int_equal(received[2].datalen, DATA_LEN - 2 * 255);
+	assert_int_equal(received[3].ins, 0xC0);
+}
+
+static void torture_chain_sequence(void **state)
+{
+	struct sc_card *card = (struct sc_card *) *state;
+	u8 resp[256];
+	sc_apdu_t apdu;
+	int r;
+
+	reset(card, 1);
+	chained_apdu(card, &apdu, resp, sizeof(resp));
+	r = sc_transmit_apdu(card, &apdu);
+	assert_int_equal(r, SC_SUCCESS);
+	/* three chunks in one call, then GET RESPONSE */
+	assert_int_equal(sequence_calls, 1);
+	assert_int_equal(transmit_calls, 1);
+	assert_int_equal(n_received, 4);
+	check_chunks();
+	assert_int_equal(apdu.sw1, 0x90);
+	assert_int_equal(apdu.sw2, 0x00);
+	assert_int_equal(apdu.resplen, RESP_LEN);
+	assert_memory_equal(resp, resp_data, RESP_LEN);
+}
+
+static void torture_chain_single(void **state)
+{
+	struct sc_card *card = (struct sc_card *) *state;
+	u8 resp[256];
+	sc_apdu_t apdu;
+	int r;
+
+	reset(card, 0);
+	chained_apdu(card, &apdu, resp, sizeof(resp));
+	r = sc_transmit_apdu(card, &apdu);
+	assert_int_equal(r, SC_SUCCESS);
+	assert_int_equal(sequence_calls, 0);
+	assert_int_equal(transmit_calls, 4);
+	check_chunks();
+	assert_int_equal(apdu.resplen, RESP_LEN);
+	assert_memory_equal(resp, resp_data, RESP_LEN);
+}
+
+static void torture_chain_error(void **state)
+{
+	struct sc_card *card = (struct sc_card *) *state;
+	u8 resp[256];
+	sc_apdu_t apdu;
+	int r;
+
+	reset(card, 1);
+	fail_at = 2;
+	chained_apdu(card, &apdu, resp, sizeof(resp));
+	r = sc_transmit_apdu(card, &apdu);
+	assert_int_equal(r, SC_ERROR_INCORRECT_PARAMETERS);
+	/* the last chunk is not sent */
+	assert_int_equal(n_received, 2);
+	assert_int_equal(sequence_calls, 1);
+}
+
+static void torture_get_response_short_buffer(void **state)
+{
+	struct sc_card *card = (struct sc_card *) *state;
+	u8 resp[RESP_LEN];
+	sc_apdu_t apdu;
+	int r;
+
+	/* only part of the response fits the caller's buffer */
+	reset(card, 1);
+	chained_apdu(card, &apdu, resp, 0x10);
+	r = sc_transmit_apdu(card, &apdu);
+	assert_int_equal(r, SC_SUCCESS);
+	assert_int_equal(apdu.resplen, 0x10);
+	assert_memory_equal(resp, resp_data, 0x10);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test(torture_chain_sequence),
+		cmocka_unit_test(torture_chain_single),
+		cmocka_unit_test(torture_chain_error),
+		cmocka_unit_test(torture_get_response_short_buffer),
+	};
+
+	rc = cmocka_run_group_tests(tests, setup, teardown);
+	return rc;
+}
@@ -594,6 +594,71 @@ static void torture_asn1_encode_simple(void **state)
 	assert_int_equal(rv, SC_SUCCESS);
 }
 
+static void torture_asn1_cursor_walk(void **state)
+{
+	/* 6E { 4F 01 AA, 5F52 02 BB CC, 73 { C0 00 } } 00 */
+	const u8 data[] = {0x6E, 0x0C, 0x4F, 0x01, 0xAA, 0x5F, 0x52, 0x02, 0xBB, 0xCC,
+		0x73, 0x02, 0xC0, 0x00, 0x00, 0x00};
+	struct sc_asn1_cursor cur, child;
+	struct sc_asn1_tlv tlv, inner;
+	int rv;
+
+	sc_asn1_cursor_init(&cur, data, sizeof(data));
+	rv = sc_asn1_cursor_next(&cur, &tlv);
+	assert_int_equal(rv, 1);
+	assert_int_equal(tlv.tag, 0x6E);
+	assert_ptr_equal(tlv.raw, data);
+	assert_ptr_equal(tlv.value, data + 2);
+	assert_int_equal(tlv.len, 0x0C);
+	assert_int_equal(tlv.raw_len, 0x0E);
+
+	sc_asn1_cursor_enter(&child, &tlv);
+	rv = sc_asn1_cursor_find(&child, 0x5F52, &inner);
+	assert_int_equal(rv, 1);
+	assert_ptr_equal(inner.value, data + 8);
+	assert_int_equal(inner.len, 2);
+	/* find does not move the cursor */
+	rv = sc_asn1_cursor_next(&child, &inner);
+	assert_int_equal(rv, 1);
+	assert_int_equal(inner.tag, 0x4F);
+	rv = sc_asn1_cursor_find(&child, 0x99, &inner);
+	assert_int_equal(rv, 0);
+	assert_null(inner.value);
+
+	/* the padding ends the data */
+	rv = sc_asn1_cursor_next(&cur, &tlv);
+	assert_int_equal(rv, 0);
+	assert_int_equal(cur.left, 2);
+}
+
+static void torture_asn1_cursor_truncated(void **state)
+{
+	/* the value is one byte short */
+	const u8 data[] = {0x53, 0x04, 0x70, 0x02, 0x01};
+	/* the length is cut off */
+	const u8 broken[] = {0x53, 0x82, 0x01};
+	struct sc_asn1_cursor cur;
+	struct sc_asn1_tlv tlv;
+	int rv;
+
+	sc_asn1_cursor_init(&cur, data, sizeof(data));
+	rv = sc_asn1_cursor_next(&cur, &tlv);
+	assert_int_equal(rv, SC_ERROR_ASN1_END_OF_CONTENTS);
+	assert_int_equal(tlv.tag, 0x53);
+	assert_int_equal(tlv.len, 3);
+	assert_ptr_equal(cur.p, data);
+	rv = sc_asn1_cursor_find(&cur, 0x53, &tlv);
+	assert_int_equal(rv, SC_ERROR_ASN1_END_OF_CONTENTS);
+
+	sc_asn1_cursor_init(&cur, broken, sizeof(broken));
+	rv = sc_asn1_cursor_next(&cur, &tlv);
+	assert_int_equal(rv, SC_ERROR_INVALID_ASN1_OBJECT);
+
+	sc_asn1_cursor_init(&cur, NULL, 10);
+	rv = sc_asn1_cursor_next(&cur, &tlv);
+	assert_int_equal(rv, 0);
+}
+
 int main(void)
 {
 	int rc;
@@ -664,6 +729,9 @@ int main(void)
 		/* encode() */
 		cmocka_unit_test_setup_teardown(torture_asn1_encode_simple,
 			setup_sc_context, teardown_sc_context),
+		/* cursor */
+		cmocka_unit_test(torture_asn1_cursor_walk),
+		cmocka_unit_test(torture_asn1_cursor_truncated),
 	};
 
 	rc = cmocka_run_group_tests(tests, NULL, NULL);
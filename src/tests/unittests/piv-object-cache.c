@@ -0,0 +1,158 @@
+/*
+ * piv-object-cache.c: Unit tests for the records of the PIV object cache
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "libopensc/log.c"
+#include "libopensc/sc.c"
+#include "libopensc/asn1.c"
+#include "libopensc/simpletlv.c"
+#include "libopensc/compression.c"
+#include "libopensc/card-piv.c"
+
+static const u8 chuid_tag[3] = { 0x5F, 0xC1, 0x02 };
+static const u8 cert_tag[3] = { 0x5F, 0xC1, 0x05 };
+static const u8 absent_tag[3] = { 0x5F, 0xC1, 0x0A };
+
+static void torture_piv_cache_round_trip(void **state)
+{
+	u8 cert[300], tag[3], *data = NULL;
+	size_t len = 0, i;
+	FILE *f;
+
+	for (i = 0; i < sizeof(cert); i++)
+		cert[i] = (u8) i;
+	f = tmpfile();
+	assert_non_null(f);
+	assert_int_equal(piv_object_cache_write_record(f, chuid_tag, (const u8 *) "\x30\x19", 2), SC_SUCCESS);
+	assert_int_equal(piv_object_cache_write_record(f, cert_tag, cert, sizeof(cert)), SC_SUCCESS);
+	/* an object that is not on the card */
+	assert_int_equal(piv_object_cache_write_record(f, absent_tag, NULL, 0), SC_SUCCESS);
+	rewind(f);
+
+	assert_int_equal(piv_object_cache_read_record(f, tag, &data, &len), SC_SUCCESS);
+	assert_memory_equal(tag, chuid_tag, 3);
+	assert_int_equal(len, 2);
+	assert_memory_equal(data, "\x30\x19", 2);
+	free(data);
+
+	assert_int_equal(piv_object_cache_read_record(f, tag, &data, &len), SC_SUCCESS);
+	assert_memory_equal(tag, cert_tag, 3);
+	assert_int_equal(len, sizeof(cert));
+	assert_memory_equal(data, cert, sizeof(cert));
+	free(data);
+
+	assert_int_equal(piv_object_cache_read_record(f, tag, &data, &len), SC_SUCCESS);
+	assert_memory_equal(tag, absent_tag, 3);
+	assert_int_equal(len, 0);
+	assert_null(data);
+
+	/* end of file */
+	assert_int_equal(piv_object_cache_read_record(f, tag, &data, &len), SC_ERROR_FILE_NOT_FOUND);
+	assert_null(data);
+	fclose(f);
+}
+
+static void torture_piv_cache_truncated(void **state)
+{
+	u8 tag[3], *data = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	/* the header is cut short */
+	f = tmpfile();
+	assert_non_null(f);
+	assert_int_equal(fwrite("\x5F\xC1\x05\x00", 1, 4, f), 4);
+	rewind(f);
+	assert_int_equal(piv_object_cache_read_record(f, tag, &data, &len), SC_ERROR_FILE_NOT_FOUND);
+	assert_null(data);
+	fclose(f);
+
+	/* the data is cut short */
+	f = tmpfile();
+	assert_non_null(f);
+	assert_int_equal(piv_object_cache_write_record(f, cert_tag, (const u8 *) "0123456789", 10), SC_SUCCESS);
+	rewind(f);
+	assert_int_equal(ftruncate(fileno(f), 7 + 4), 0);
+	assert_int_equal(piv_object_cache_read_record(f, tag, &data, &len), SC_ERROR_INVALID_DATA);
+	assert_null(data);
+	fclose(f);
+}
+
+static void torture_piv_cache_oversized(void **state)
+{
+	u8 tag[3], *data = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	/* longer than any object can be */
+	f = tmpfile();
+	assert_non_null(f);
+	assert_int_equal(fwrite("\x5F\xC1\x05\x00\x01\x00\x00" "data", 1, 11, f), 11);
+	rewind(f);
+	assert_int_equal(piv_object_cache_read_record(f, tag, &data, &len), SC_ERROR_INVALID_DATA);
+	assert_null(data);
+	fclose(f);
+
+	/* a length with the top byte set */
+	f = tmpfile();
+	assert_non_null(f);
+	assert_int_equal(fwrite("\x5F\xC1\x05\xFF\xFF\xFF\xFF", 1, 7, f), 7);
+	rewind(f);
+	assert_int_equal(piv_object_cache_read_record(f, tag, &data, &len), SC_ERROR_INVALID_DATA);
+	assert_null(data);
+	fclose(f);
+}
+
+static void torture_piv_cache_tmp_names(void **state)
+{
+	char dir[] = "/tmp/piv-cache-XXXXXX", filename[PATH_MAX];
+	char tmpname1[PATH_MAX], tmpname2[PATH_MAX];
+	FILE *f1, *f2;
+
+	assert_non_null(mkdtemp(dir));
+	snprintf(filename, sizeof(filename), "%s/piv-0102", dir);
+
+	/* two writers at the same time get different files */
+	f1 = piv_object_cache_open_tmp(filename, tmpname1, sizeof(tmpname1));
+	f2 = piv_object_cache_open_tmp(filename, tmpname2, sizeof(tmpname2));
+	assert_non_null(f1);
+	assert_non_null(f2);
+	assert_string_not_equal(tmpname1, tmpname2);
+	assert_int_equal(strncmp(tmpname1, filename, strlen(filename)), 0);
+	fclose(f1);
+	fclose(f2);
+	remove(tmpname1);
+	remove(tmpname2);
+
+	/* the name does not fit */
+	assert_null(piv_object_cache_open_tmp(filename, tmpname1, strlen(filename) + 2));
+	rmdir(dir);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test(torture_piv_cache_round_trip),
+		cmocka_unit_test(torture_piv_cache_truncated),
+		cmocka_unit_test(torture_piv_cache_oversized),
+		cmocka_unit_test(torture_piv_cache_tmp_names),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+	return rc;
+}
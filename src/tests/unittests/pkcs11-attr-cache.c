@@ -0,0 +1,197 @@
+/*
+ * pkcs11-attr-cache.c: Unit tests for the cache of encoded attribute values
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "pkcs11/attr-cache.c"
+
+/* Stands in for the object the values are encoded from */
+struct fake_object {
+	unsigned char value[8];
+	CK_ULONG len;
+	int calls;
+};
+
+static CK_RV
+fake_get_attribute(struct sc_pkcs11_session *session, void *object, CK_ATTRIBUTE_PTR attr)
+{
+	struct fake_object *obj = object;
+
+	obj->calls++;
+	if (attr->type == CKA_LABEL)
+		return CKR_ATTRIBUTE_TYPE_INVALID;
+	if (attr->pValue == NULL_PTR) {
+		attr->ulValueLen = obj->len;
+		return CKR_OK;
+	}
+	if (attr->ulValueLen < obj->len) {
+		attr->ulValueLen = obj->len;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+	attr->ulValueLen = obj->len;
+	/* like CKA_MODULUS_BITS of an EC key without a public key */
+	if (attr->type == CKA_MODULUS_BITS)
+		return CKR_OK;
+	memcpy(attr->pValue, obj->value, obj->len);
+	/* tell the attribute types apart */
+	((unsigned char *) attr->pValue)[0] = (unsigned char) attr->type;
+	return CKR_OK;
+}
+
+static CK_RV
+get(struct sc_pkcs11_attr_cache *cache, struct fake_object *obj,
+		CK_ATTRIBUTE_TYPE type, unsigned char *buf, CK_ULONG *len)
+{
+	CK_ATTRIBUTE attr = { type, buf, *len };
+	CK_RV rv;
+
+	rv = sc_pkcs11_attr_cache_get(cache, NULL, obj, &attr, fake_get_attribute);
+	*len = attr.ulValueLen;
+	return rv;
+}
+
+static void torture_attr_cache_hit(void **state)
+{
+	struct sc_pkcs11_attr_cache cache = { NULL, 0 };
+	struct fake_object obj = { { 0, 1, 2, 3 }, 4, 0 };
+	unsigned char buf[8];
+	CK_ULONG len = sizeof(buf);
+	int calls;
+
+	assert_int_equal(get(&cache, &obj, CKA_MODULUS, buf, &len), CKR_OK);
+	assert_int_equal(len, 4);
+	assert_int_equal(buf[0], (unsigned char) CKA_MODULUS);
+	assert_int_equal(buf[3], 3);
+	assert_int_equal(cache.count, 1);
+	calls = obj.calls;
+
+	/* served from the cache, even when the object changed */
+	obj.value[3] = 9;
+	memset(buf, 0, sizeof(buf));
+	len = sizeof(buf);
+	assert_int_equal(get(&cache, &obj, CKA_MODULUS, buf, &len), CKR_OK);
+	assert_int_equal(len, 4);
+	assert_int_equal(buf[0], (unsigned char) CKA_MODULUS);
+	assert_int_equal(buf[3], 3);
+	assert_int_equal(obj.calls, calls);
+
+	/* length only and a buffer that is too small */
+	len = 0;
+	assert_int_equal(get(&cache, &obj, CKA_MODULUS, NULL, &len), CKR_OK);
+	assert_int_equal(len, 4);
+	len = 2;
+	assert_int_equal(get(&cache, &obj, CKA_MODULUS, buf, &len), CKR_BUFFER_TOO_SMALL);
+	assert_int_equal(len, 4);
+	assert_int_equal(obj.calls, calls);
+
+	sc_pkcs11_attr_cache_clear(&cache);
+}
+
+static void torture_attr_cache_miss(void **state)
+{
+	struct sc_pkcs11_attr_cache cache = { NULL, 0 };
+	struct fake_object obj = { { 0, 1, 2, 3 }, 4, 0 };
+	unsigned char buf[8];
+	CK_ULONG len = sizeof(buf);
+	int calls;
+
+	assert_int_equal(get(&cache, &obj, CKA_MODULUS, buf, &len), CKR_OK);
+	calls = obj.calls;
+
+	/* another type is looked up and cached separately */
+	len = sizeof(buf);
+	assert_int_equal(get(&cache, &obj, CKA_EC_POINT, buf, &len), CKR_OK);
+	assert_int_equal(buf[0], (unsigned char) CKA_EC_POINT);
+	assert_true(obj.calls > calls);
+	assert_int_equal(cache.count, 2);
+
+	/* failures are passed on and not cached */
+	calls = obj.calls;
+	len = sizeof(buf);
+	assert_int_equal(get(&cache, &obj, CKA_LABEL, buf, &len), CKR_ATTRIBUTE_TYPE_INVALID);
+	assert_int_equal(get(&cache, &obj, CKA_LABEL, buf, &len), CKR_ATTRIBUTE_TYPE_INVALID);
+	assert_int_equal(obj.calls, calls + 2);
+	assert_int_equal(cache.count, 2);
+
+	/* a value that is first asked for with a small buffer is still cached */
+	len = 1;
+	assert_int_equal(get(&cache, &obj, CKA_VALUE, buf, &len), CKR_BUFFER_TOO_SMALL);
+	assert_int_equal(len, 4);
+	assert_int_equal(cache.count, 3);
+
+	sc_pkcs11_attr_cache_clear(&cache);
+}
+
+static void torture_attr_cache_unwritten(void **state)
+{
+	struct sc_pkcs11_attr_cache cache = { NULL, 0 };
+	struct fake_object obj = { { 0, 1, 2, 3 }, 4, 0 };
+	unsigned char buf[8];
+	CK_ULONG len = sizeof(buf);
+
+	/* a value the getter did not write is cached cleared */
+	memset(buf, 0xAA, sizeof(buf));
+	assert_int_equal(get(&cache, &obj, CKA_MODULUS_BITS, buf, &len), CKR_OK);
+	assert_int_equal(len, 4);
+	assert_int_equal(cache.count, 1);
+	assert_memory_equal(buf, "\0\0\0\0", 4);
+
+	sc_pkcs11_attr_cache_clear(&cache);
+}
+
+static void torture_attr_cache_invalidation(void **state)
+{
+	struct sc_pkcs11_attr_cache cache = { NULL, 0 };
+	struct fake_object obj = { { 0, 1, 2, 3 }, 4, 0 };
+	unsigned char buf[8];
+	CK_ULONG len = sizeof(buf);
+	int calls;
+
+	assert_int_equal(get(&cache, &obj, CKA_MODULUS, buf, &len), CKR_OK);
+	assert_int_equal(buf[3], 3);
+
+	/* the owner replaces the data and clears the cache */
+	obj.value[3] = 9;
+	obj.len = 6;
+	sc_pkcs11_attr_cache_clear(&cache);
+	assert_null(cache.entries);
+	assert_int_equal(cache.count, 0);
+
+	calls = obj.calls;
+	len = sizeof(buf);
+	assert_int_equal(get(&cache, &obj, CKA_MODULUS, buf, &len), CKR_OK);
+	assert_int_equal(len, 6);
+	assert_int_equal(buf[3], 9);
+	assert_true(obj.calls > calls);
+
+	sc_pkcs11_attr_cache_clear(&cache);
+	/* clearing twice is harmless */
+	sc_pkcs11_attr_cache_clear(&cache);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test(torture_attr_cache_hit),
+		cmocka_unit_test(torture_attr_cache_miss),
+		cmocka_unit_test(torture_attr_cache_unwritten),
+		cmocka_unit_test(torture_attr_cache_invalidation),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+	return rc;
+}
@@ -0,0 +1,229 @@
+/*
+ * pkcs15-cache.c: Unit tests for validating cached files against a file list
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "torture.h"
+#include "libopensc/opensc.h"
+#include "libopensc/pkcs15.h"
+
+static const struct sc_aid aid = { { 0xE8, 0x2B, 0x06, 0x01 }, 4 };
+static char cache_home[PATH_MAX];
+static struct sc_card card;
+static struct sc_card_operations ops;
+static struct sc_pkcs15_card *p15card;
+/* the size of the files CExx on the card, 0 if the file does not exist */
+static size_t card_sizes[256];
+static int selects;
+
+static int
+fake_select_file(struct sc_card *card, const struct sc_path *path, struct sc_file **file_out)
+{
+	struct sc_file *file;
+
+	selects++;
+	if (path->len != 2 || path->value[0] != 0xCE || card_sizes[path->value[1]] == 0)
+		return SC_ERROR_FILE_NOT_FOUND;
+	if (file_out == NULL)
+		return SC_SUCCESS;
+	file = sc_file_new();
+	if (file == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	file->size = card_sizes[path->value[1]];
+	*file_out = file;
+	return SC_SUCCESS;
+}
+
+static void
+remove_dir(const char *name)
+{
+	char fname[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	dir = opendir(name);
+	if (dir == NULL)
+		return;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		snprintf(fname, sizeof(fname), "%s/%s", name, entry->d_name);
+		if (unlink(fname) != 0)
+			remove_dir(fname);
+	}
+	closedir(dir);
+	rmdir(name);
+}
+
+static int setup(void **state)
+{
+	struct sc_context *ctx = NULL;
+
+	strcpy(cache_home, "/tmp/opensc-cache-XXXXXX");
+	if (mkdtemp(cache_home) == NULL)
+		return -1;
+	setenv("OPENSC_CONF", "/nonexistent", 1);
+	setenv("XDG_CACHE_HOME", cache_home, 1);
+	if (sc_establish_context(&ctx, "pkcs15-cache") != SC_SUCCESS)
+		return -1;
+	card.ctx = ctx;
+	ops.select_file = fake_select_file;
+	card.ops = &ops;
+	memset(card_sizes, 0, sizeof(card_sizes));
+	p15card = sc_pkcs15_card_new();
+	if (p15card == NULL)
+		return -1;
+	p15card->card = &card;
+	p15card->tokeninfo->serial_number = strdup("0123456789");
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct sc_context *ctx = card.ctx;
+
+	sc_pkcs15_card_free(p15card);
+	sc_release_context(ctx);
+	remove_dir(cache_home);
+	return 0;
+}
+
+static void
+fid_path(struct sc_path *path, u8 fid_hi, u8 fid_lo)
+{
+	u8 fid[2] = { fid_hi, fid_lo };
+
+	memset(path, 0, sizeof(*path));
+	sc_path_set(path, SC_PATH_TYPE_FILE_ID, fid, 2, 0, -1);
+	path->aid = aid;
+}
+
+static void
+cache(u8 fid, const char *content)
+{
+	struct sc_path path;
+
+	fid_path(&path, 0xCE, fid);
+	assert_int_equal(sc_pkcs15_cache_file(p15card, &path,
+			(const u8 *) content, strlen(content)), 0);
+	card_sizes[fid] = strlen(content);
+}
+
+/* returns the first byte of the cached file, or 0 if it is not cached */
+static int
+cached(u8 fid)
+{
+	struct sc_path path;
+	u8 *buf = NULL;
+	size_t len = 0;
+	int r;
+
+	fid_path(&path, 0xCE, fid);
+	if (sc_pkcs15_read_cached_file(p15card, &path, &buf, &len) != SC_SUCCESS)
+		return 0;
+	r = len > 0 ? buf[0] : 0;
+	free(buf);
+	return r;
+}
+
+static void torture_file_list_unchanged(void **state)
+{
+	const u8 list[] = { 0xCE, 0x01, 0xCE, 0x02 };
+
+	/* nothing is cached yet */
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, list, sizeof(list)), 0);
+	cache(0x01, "a");
+	cache(0x02, "b");
+
+	selects = 0;
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, list, sizeof(list)), 1);
+	assert_int_equal(cached(0x01), 'a');
+	assert_int_equal(cached(0x02), 'b');
+	/* one SELECT per cached file */
+	assert_int_equal(selects, 2);
+
+	/* a file rewritten in place with another size is dropped */
+	card_sizes[0x02] = 10;
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, list, sizeof(list)), 0);
+	assert_int_equal(cached(0x01), 'a');
+	assert_int_equal(cached(0x02), 0);
+
+	/* only the cached files are selected */
+	selects = 0;
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, list, sizeof(list)), 1);
+	assert_int_equal(selects, 1);
+}
+
+static void torture_file_list_diff(void **state)
+{
+	const u8 old_list[] = { 0xCE, 0x01, 0xCE, 0x02, 0xCE, 0x03 };
+	const u8 new_list[] = { 0xCE, 0x02, 0xCE, 0x03, 0xCE, 0x04 };
+
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, old_list, sizeof(old_list)), 0);
+	cache(0x01, "a");
+	cache(0x02, "b");
+	cache(0x03, "c");
+	/* left over from a file that was deleted before */
+	cache(0x04, "d");
+	card_sizes[0x01] = 0;
+	/* rewritten with another size while also in the old list */
+	card_sizes[0x03] = 5;
+
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, new_list, sizeof(new_list)), 0);
+	/* removed and added files are dropped, the others stay */
+	assert_int_equal(cached(0x01), 0);
+	assert_int_equal(cached(0x02), 'b');
+	assert_int_equal(cached(0x03), 0);
+	assert_int_equal(cached(0x04), 0);
+
+	/* the new list was stored */
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, new_list, sizeof(new_list)), 1);
+
+	/* all files removed */
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, NULL, 0), 0);
+	assert_int_equal(cached(0x02), 0);
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, NULL, 0), 1);
+}
+
+static void torture_file_list_invalid(void **state)
+{
+	const u8 list[] = { 0xCE, 0x01, 0xCE };
+	struct sc_aid no_aid;
+
+	memset(&no_aid, 0, sizeof(no_aid));
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &aid, list, sizeof(list)),
+			SC_ERROR_INVALID_ARGUMENTS);
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, &no_aid, list, 2),
+			SC_ERROR_INVALID_ARGUMENTS);
+	assert_int_equal(sc_pkcs15_cache_validate_file_list(p15card, NULL, list, 2),
+			SC_ERROR_INVALID_ARGUMENTS);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(torture_file_list_unchanged, setup, teardown),
+		cmocka_unit_test_setup_teardown(torture_file_list_diff, setup, teardown),
+		cmocka_unit_test_setup_teardown(torture_file_list_invalid, setup, teardown),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+	return rc;
+}
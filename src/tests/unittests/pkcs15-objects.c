@@ -0,0 +1,182 @@
+/*
+ * pkcs15-objects.c: Unit tests for the PKCS#15 object list and lookups
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "libopensc/pkcs15.h"
+
+static struct sc_pkcs15_object *
+new_object(struct sc_pkcs15_card *p15card, unsigned int type, u8 id)
+{
+	struct sc_pkcs15_object *obj = calloc(1, sizeof(struct sc_pkcs15_object));
+	struct sc_pkcs15_id *obj_id = NULL;
+
+	assert_non_null(obj);
+	obj->type = type;
+	switch (type & SC_PKCS15_TYPE_CLASS_MASK) {
+	case SC_PKCS15_TYPE_CERT:
+		obj->data = calloc(1, sizeof(struct sc_pkcs15_cert_info));
+		obj_id = &((struct sc_pkcs15_cert_info *) obj->data)->id;
+		break;
+	case SC_PKCS15_TYPE_PRKEY:
+		obj->data = calloc(1, sizeof(struct sc_pkcs15_prkey_info));
+		obj_id = &((struct sc_pkcs15_prkey_info *) obj->data)->id;
+		break;
+	case SC_PKCS15_TYPE_AUTH:
+		obj->data = calloc(1, sizeof(struct sc_pkcs15_auth_info));
+		obj_id = &((struct sc_pkcs15_auth_info *) obj->data)->auth_id;
+		break;
+	}
+	assert_non_null(obj->data);
+	obj_id->value[0] = id;
+	obj_id->len = 1;
+	assert_int_equal(sc_pkcs15_add_object(p15card, obj), 0);
+	return obj;
+}
+
+static void
+set_id(struct sc_pkcs15_id *id, u8 value)
+{
+	id->value[0] = value;
+	id->len = 1;
+}
+
+static void torture_pkcs15_objects_order(void **state)
+{
+	struct sc_pkcs15_card *p15card = sc_pkcs15_card_new();
+	struct sc_pkcs15_object *objs[8], *found[8];
+	int r;
+
+	assert_non_null(p15card);
+	objs[0] = new_object(p15card, SC_PKCS15_TYPE_CERT_X509, 1);
+	objs[1] = new_object(p15card, SC_PKCS15_TYPE_PRKEY_RSA, 1);
+	objs[2] = new_object(p15card, SC_PKCS15_TYPE_CERT_X509, 2);
+	objs[3] = new_object(p15card, SC_PKCS15_TYPE_AUTH_PIN, 1);
+	objs[4] = new_object(p15card, SC_PKCS15_TYPE_CERT_X509, 1);
+
+	/* the list itself is unchanged */
+	assert_ptr_equal(p15card->obj_list, objs[0]);
+	assert_ptr_equal(objs[4]->prev, objs[3]);
+	assert_null(objs[4]->next);
+
+	r = sc_pkcs15_get_objects(p15card, SC_PKCS15_TYPE_CERT, found, 8);
+	assert_int_equal(r, 3);
+	assert_ptr_equal(found[0], objs[0]);
+	assert_ptr_equal(found[1], objs[2]);
+	assert_ptr_equal(found[2], objs[4]);
+
+	r = sc_pkcs15_get_objects(p15card, SC_PKCS15_TYPE_PRKEY_EC, found, 8);
+	assert_int_equal(r, 0);
+
+	/* several classes at once: list order */
+	{
+		struct sc_pkcs15_search_key sk;
+
+		memset(&sk, 0, sizeof(sk));
+		sk.class_mask = SC_PKCS15_SEARCH_CLASS_CERT | SC_PKCS15_SEARCH_CLASS_PRKEY;
+		r = sc_pkcs15_search_objects(p15card, &sk, found, 8);
+		assert_int_equal(r, 4);
+		assert_ptr_equal(found[0], objs[0]);
+		assert_ptr_equal(found[1], objs[1]);
+		assert_ptr_equal(found[3], objs[4]);
+	}
+
+	sc_pkcs15_card_free(p15card);
+}
+
+static void torture_pkcs15_objects_find_by_id(void **state)
+{
+	struct sc_pkcs15_card *p15card = sc_pkcs15_card_new();
+	struct sc_pkcs15_object *objs[4], *found = NULL;
+	struct sc_pkcs15_id id;
+
+	assert_non_null(p15card);
+	objs[0] = new_object(p15card, SC_PKCS15_TYPE_CERT_X509, 1);
+	objs[1] = new_object(p15card, SC_PKCS15_TYPE_PRKEY_RSA, 1);
+	objs[2] = new_object(p15card, SC_PKCS15_TYPE_CERT_X509, 1);
+	objs[3] = new_object(p15card, SC_PKCS15_TYPE_AUTH_PIN, 2);
+
+	set_id(&id, 1);
+	assert_int_equal(sc_pkcs15_find_cert_by_id(p15card, &id, &found), 0);
+	assert_ptr_equal(found, objs[0]);
+	assert_int_equal(sc_pkcs15_find_prkey_by_id(p15card, &id, &found), 0);
+	assert_ptr_equal(found, objs[1]);
+	assert_int_equal(sc_pkcs15_find_pin_by_auth_id(p15card, &id, &found), SC_ERROR_OBJECT_NOT_FOUND);
+	set_id(&id, 2);
+	assert_int_equal(sc_pkcs15_find_pin_by_auth_id(p15card, &id, &found), 0);
+	assert_ptr_equal(found, objs[3]);
+	assert_int_equal(sc_pkcs15_find_cert_by_id(p15card, &id, &found), SC_ERROR_OBJECT_NOT_FOUND);
+
+	/* objects added after the first lookup are found */
+	objs[0] = new_object(p15card, SC_PKCS15_TYPE_CERT_X509, 2);
+	assert_int_equal(sc_pkcs15_find_cert_by_id(p15card, &id, &found), 0);
+	assert_ptr_equal(found, objs[0]);
+
+	/* removed objects are not */
+	sc_pkcs15_remove_object(p15card, objs[0]);
+	sc_pkcs15_free_object(objs[0]);
+	assert_int_equal(sc_pkcs15_find_cert_by_id(p15card, &id, &found), SC_ERROR_OBJECT_NOT_FOUND);
+
+	/* a changed ID */
+	set_id(&((struct sc_pkcs15_cert_info *) objs[2]->data)->id, 2);
+	sc_pkcs15_reindex_objects(p15card);
+	assert_int_equal(sc_pkcs15_find_cert_by_id(p15card, &id, &found), 0);
+	assert_ptr_equal(found, objs[2]);
+
+	sc_pkcs15_card_free(p15card);
+}
+
+static void torture_pkcs15_objects_many(void **state)
+{
+	struct sc_pkcs15_card *p15card = sc_pkcs15_card_new();
+	struct sc_pkcs15_object *objs[600], *found = NULL;
+	struct sc_pkcs15_id id;
+	unsigned int i;
+
+	assert_non_null(p15card);
+	for (i = 0; i < 600; i++)
+		objs[i] = new_object(p15card, i % 2 ? SC_PKCS15_TYPE_CERT_X509 : SC_PKCS15_TYPE_PRKEY_RSA, (u8)(i / 2));
+
+	/* remove the tail, then append again */
+	sc_pkcs15_remove_object(p15card, objs[599]);
+	sc_pkcs15_free_object(objs[599]);
+	objs[599] = new_object(p15card, SC_PKCS15_TYPE_CERT_X509, 0);
+	assert_ptr_equal(objs[599]->prev, objs[598]);
+
+	for (i = 0; i < 256; i++) {
+		set_id(&id, (u8)i);
+		assert_int_equal(sc_pkcs15_find_cert_by_id(p15card, &id, &found), 0);
+		assert_ptr_equal(found, objs[2 * i + 1]);
+		assert_int_equal(sc_pkcs15_find_prkey_by_id(p15card, &id, &found), 0);
+		assert_ptr_equal(found, objs[2 * i]);
+	}
+	assert_int_equal(sc_pkcs15_get_objects(p15card, SC_PKCS15_TYPE_CERT, NULL, 0), 300);
+
+	sc_pkcs15_card_free(p15card);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test(torture_pkcs15_objects_order),
+		cmocka_unit_test(torture_pkcs15_objects_find_by_id),
+		cmocka_unit_test(torture_pkcs15_objects_many),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+	return rc;
+}
@@ -0,0 +1,253 @@
+/*
+ * pkcs15-read-stream.c: Unit tests for the chunked PKCS#15 file reads
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "libopensc/opensc.h"
+#include "libopensc/pkcs15.h"
+
+#define FILE_LEN	700
+#define MAX_RECV	100
+
+static u8 file_content[FILE_LEN];
+static int read_calls;
+
+struct stream_result {
+	u8 data[FILE_LEN];
+	size_t len;
+	size_t max_chunk;
+	int chunks;
+	int fail_after;
+};
+
+static int
+fake_select_file(struct sc_card *card, const struct sc_path *path, struct sc_file **file_out)
+{
+	struct sc_file *file;
+
+	if (file_out == NULL)
+		return SC_SUCCESS;
+	file = sc_file_new();
+	if (file == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	file->type = SC_FILE_TYPE_WORKING_EF;
+	file->ef_structure = SC_FILE_EF_TRANSPARENT;
+	file->size = FILE_LEN;
+	file->path = *path;
+	*file_out = file;
+	return SC_SUCCESS;
+}
+
+static int
+fake_read_binary(struct sc_card *card, unsigned int idx, u8 *buf, size_t count, unsigned long flags)
+{
+	read_calls++;
+	if (count > MAX_RECV || idx >= FILE_LEN)
+		return SC_ERROR_INCORRECT_PARAMETERS;
+	if (count > FILE_LEN - idx)
+		count = FILE_LEN - idx;
+	memcpy(buf, file_content + idx, count);
+	return (int)count;
+}
+
+static int
+collect(void *arg, const u8 *data, size_t len)
+{
+	struct stream_result *res = (struct stream_result *) arg;
+
+	if (res->fail_after && res->chunks == res->fail_after)
+		return SC_ERROR_CARD_CMD_FAILED;
+	assert_true(res->len + len <= sizeof(res->data));
+	memcpy(res->data + res->len, data, len);
+	res->len += len;
+	if (len > res->max_chunk)
+		res->max_chunk = len;
+	res->chunks++;
+	return 0;
+}
+
+static int setup(void **state)
+{
+	static struct sc_card_operations ops;
+	static struct sc_reader_operations reader_ops;
+	static struct sc_reader reader;
+	static struct sc_card card;
+	struct sc_context *ctx = NULL;
+	struct sc_pkcs15_card *p15card;
+	size_t i;
+
+	for (i = 0; i < FILE_LEN; i++)
+		file_content[i] = (u8)(i * 7 + 3);
+
+	assert_int_equal(sc_establish_context(&ctx, "pkcs15-read-stream"), 0);
+	ops.select_file = fake_select_file;
+	ops.read_binary = fake_read_binary;
+	reader.ops = &reader_ops;
+	card.ctx = ctx;
+	card.ops = &ops;
+	card.reader = &reader;
+	card.max_recv_size = MAX_RECV;
+
+	p15card = sc_pkcs15_card_new();
+	assert_non_null(p15card);
+	p15card->card = &card;
+	*state = p15card;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct sc_pkcs15_card *p15card = (struct sc_pkcs15_card *) *state;
+	struct sc_context *ctx = p15card->card->ctx;
+
+	p15card->card = NULL;
+	sc_pkcs15_card_free(p15card);
+	sc_release_context(ctx);
+	return 0;
+}
+
+static void torture_read_stream_whole_file(void **state)
+{
+	struct sc_pkcs15_card *p15card = (struct sc_pkcs15_card *) *state;
+	struct stream_result res;
+	struct sc_path path;
+	int r;
+
+	memset(&res, 0, sizeof(res));
+	sc_format_path("3F0050154401", &path);
+	read_calls = 0;
+	r = sc_pkcs15_read_file_stream(p15card, &path, 0, collect, &res);
+	assert_int_equal(r, FILE_LEN);
+	assert_int_equal(res.len, FILE_LEN);
+	assert_memory_equal(res.data, file_content, FILE_LEN);
+	/* one chunk per response APDU */
+	assert_int_equal(res.max_chunk, MAX_RECV);
+	assert_int_equal(res.chunks, (FILE_LEN + MAX_RECV - 1) / MAX_RECV);
+	assert_int_equal(read_calls, res.chunks);
+}
+
+static void torture_read_stream_range(void **state)
+{
+	struct sc_pkcs15_card *p15card = (struct sc_pkcs15_card *) *state;
+	struct stream_result res;
+	struct sc_path path;
+	int r;
+
+	memset(&res, 0, sizeof(res));
+	sc_format_path("3F0050154401", &path);
+	path.index = 50;
+	path.count = 250;
+	r = sc_pkcs15_read_file_stream(p15card, &path, 0, collect, &res);
+	assert_int_equal(r, 250);
+	assert_memory_equal(res.data, file_content + 50, 250);
+
+	/* out of the file */
+	path.index = 600;
+	path.count = 200;
+	r = sc_pkcs15_read_file_stream(p15card, &path, 0, collect, &res);
+	assert_int_equal(r, SC_ERROR_INVALID_ASN1_OBJECT);
+}
+
+static void torture_read_stream_stop(void **state)
+{
+	struct sc_pkcs15_card *p15card = (struct sc_pkcs15_card *) *state;
+	struct stream_result res;
+	struct sc_path path;
+	int r;
+
+	memset(&res, 0, sizeof(res));
+	res.fail_after = 2;
+	sc_format_path("3F0050154401", &path);
+	read_calls = 0;
+	r = sc_pkcs15_read_file_stream(p15card, &path, 0, collect, &res);
+	assert_int_equal(r, SC_ERROR_CARD_CMD_FAILED);
+	assert_int_equal(res.len, 2 * MAX_RECV);
+	assert_int_equal(read_calls, 3);
+	/* the card is unlocked again */
+	assert_int_equal(p15card->card->lock_count, 0);
+}
+
+static void torture_read_stream_file_len(void **state)
+{
+	struct sc_pkcs15_card *p15card = (struct sc_pkcs15_card *) *state;
+	struct sc_path path;
+	size_t len = 0;
+	int r;
+
+	sc_format_path("3F0050154401", &path);
+	read_calls = 0;
+	r = sc_pkcs15_get_file_len(p15card, &path, 0, &len);
+	assert_int_equal(r, SC_SUCCESS);
+	assert_int_equal(len, FILE_LEN);
+	/* the file is not read */
+	assert_int_equal(read_calls, 0);
+
+	path.index = 50;
+	path.count = 250;
+	r = sc_pkcs15_get_file_len(p15card, &path, 0, &len);
+	assert_int_equal(r, SC_SUCCESS);
+	assert_int_equal(len, 250);
+
+	path.index = 600;
+	path.count = 200;
+	r = sc_pkcs15_get_file_len(p15card, &path, 0, &len);
+	assert_int_equal(r, SC_ERROR_INVALID_ASN1_OBJECT);
+	assert_int_equal(p15card->card->lock_count, 0);
+}
+
+static void torture_read_stream_data_object(void **state)
+{
+	struct sc_pkcs15_card *p15card = (struct sc_pkcs15_card *) *state;
+	struct sc_pkcs15_data_info info;
+	struct stream_result res;
+	u8 value[] = { 0x01, 0x02, 0x03 };
+	int r;
+
+	memset(&info, 0, sizeof(info));
+	memset(&res, 0, sizeof(res));
+	sc_format_path("3F0050154401", &info.path);
+	r = sc_pkcs15_read_data_object_stream(p15card, &info, 0, collect, &res);
+	assert_int_equal(r, FILE_LEN);
+	assert_memory_equal(res.data, file_content, FILE_LEN);
+	/* the value is not kept */
+	assert_null(info.data.value);
+
+	/* a known value does not touch the card */
+	memset(&res, 0, sizeof(res));
+	info.data.value = value;
+	info.data.len = sizeof(value);
+	read_calls = 0;
+	r = sc_pkcs15_read_data_object_stream(p15card, &info, 0, collect, &res);
+	assert_int_equal(r, sizeof(value));
+	assert_int_equal(res.chunks, 1);
+	assert_memory_equal(res.data, value, sizeof(value));
+	assert_int_equal(read_calls, 0);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test(torture_read_stream_whole_file),
+		cmocka_unit_test(torture_read_stream_range),
+		cmocka_unit_test(torture_read_stream_stop),
+		cmocka_unit_test(torture_read_stream_file_len),
+		cmocka_unit_test(torture_read_stream_data_object),
+	};
+
+	rc = cmocka_run_group_tests(tests, setup, teardown);
+	return rc;
+}
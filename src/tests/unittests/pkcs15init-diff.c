@@ -0,0 +1,189 @@
+/*
+ * pkcs15init-diff.c: Unit tests for finding the changed ranges of a DF
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "pkcs15init/pkcs15-lib.c"
+
+#define DF_SIZE		128
+#define MAX_RANGES	8
+
+struct range {
+	size_t start, end;
+};
+
+/* Collects the ranges sc_pkcs15init_update_df_file() would write */
+static size_t
+diff(const unsigned char *old, const unsigned char *new, size_t size, struct range *ranges)
+{
+	size_t offs, end, n = 0;
+
+	for (offs = 0; (end = sc_pkcs15init_next_change(old, new, size, &offs)) != 0; offs = end) {
+		assert_true(n < MAX_RANGES);
+		assert_true(offs < end);
+		assert_true(end <= size);
+		ranges[n].start = offs;
+		ranges[n].end = end;
+		n++;
+	}
+	return n;
+}
+
+/* Applies the ranges to the old content, which must give the new one */
+static void
+check_apply(const unsigned char *old, const unsigned char *new, size_t size,
+		const struct range *ranges, size_t n)
+{
+	unsigned char card[DF_SIZE];
+	size_t i;
+
+	memcpy(card, old, size);
+	for (i = 0; i < n; i++)
+		memcpy(card + ranges[i].start, new + ranges[i].start, ranges[i].end - ranges[i].start);
+	assert_memory_equal(card, new, size);
+}
+
+static void
+init(unsigned char *old, unsigned char *new)
+{
+	size_t i;
+
+	for (i = 0; i < DF_SIZE; i++)
+		old[i] = new[i] = (unsigned char) (i * 7 + 1);
+}
+
+static void torture_diff_unchanged(void **state)
+{
+	unsigned char old[DF_SIZE], new[DF_SIZE];
+	struct range ranges[MAX_RANGES];
+
+	init(old, new);
+	assert_int_equal(diff(old, new, DF_SIZE, ranges), 0);
+}
+
+static void torture_diff_single(void **state)
+{
+	unsigned char old[DF_SIZE], new[DF_SIZE];
+	struct range ranges[MAX_RANGES];
+
+	init(old, new);
+	new[0] ^= 0xFF;
+	new[DF_SIZE - 1] ^= 0xFF;
+	assert_int_equal(diff(old, new, DF_SIZE, ranges), 2);
+	assert_int_equal(ranges[0].start, 0);
+	assert_int_equal(ranges[0].end, 1);
+	assert_int_equal(ranges[1].start, DF_SIZE - 1);
+	assert_int_equal(ranges[1].end, DF_SIZE);
+	check_apply(old, new, DF_SIZE, ranges, 2);
+}
+
+static void torture_diff_adjacent(void **state)
+{
+	unsigned char old[DF_SIZE], new[DF_SIZE];
+	struct range ranges[MAX_RANGES];
+
+	/* changed bytes next to each other are one range */
+	init(old, new);
+	memset(new + 10, 0xAA, 5);
+	assert_int_equal(diff(old, new, DF_SIZE, ranges), 1);
+	assert_int_equal(ranges[0].start, 10);
+	assert_int_equal(ranges[0].end, 15);
+	check_apply(old, new, DF_SIZE, ranges, 1);
+
+	/* fewer than SC_PKCS15INIT_DIFF_GAP unchanged bytes between them */
+	init(old, new);
+	new[10] ^= 0xFF;
+	new[10 + SC_PKCS15INIT_DIFF_GAP] ^= 0xFF;
+	assert_int_equal(diff(old, new, DF_SIZE, ranges), 1);
+	assert_int_equal(ranges[0].start, 10);
+	assert_int_equal(ranges[0].end, 11 + SC_PKCS15INIT_DIFF_GAP);
+	check_apply(old, new, DF_SIZE, ranges, 1);
+
+	/* exactly SC_PKCS15INIT_DIFF_GAP unchanged bytes keep them apart */
+	init(old, new);
+	new[10] ^= 0xFF;
+	new[11 + SC_PKCS15INIT_DIFF_GAP] ^= 0xFF;
+	assert_int_equal(diff(old, new, DF_SIZE, ranges), 2);
+	assert_int_equal(ranges[0].end, 11);
+	assert_int_equal(ranges[1].start, 11 + SC_PKCS15INIT_DIFF_GAP);
+	check_apply(old, new, DF_SIZE, ranges, 2);
+}
+
+static void torture_diff_overlapping(void **state)
+{
+	unsigned char old[DF_SIZE], new[DF_SIZE];
+	struct range ranges[MAX_RANGES];
+	size_t i;
+
+	/* a chain of close changes is joined into one range */
+	init(old, new);
+	for (i = 4; i < 4 + 5 * (SC_PKCS15INIT_DIFF_GAP - 1); i += SC_PKCS15INIT_DIFF_GAP - 1)
+		new[i] ^= 0xFF;
+	assert_int_equal(diff(old, new, DF_SIZE, ranges), 1);
+	assert_int_equal(ranges[0].start, 4);
+	assert_int_equal(ranges[0].end, 4 + 4 * (SC_PKCS15INIT_DIFF_GAP - 1) + 1);
+	check_apply(old, new, DF_SIZE, ranges, 1);
+
+	/* an entry moved by one byte changes everything after it */
+	init(old, new);
+	memmove(new + 21, old + 20, DF_SIZE - 21);
+	new[20] = 0x30;
+	i = diff(old, new, DF_SIZE, ranges);
+	assert_int_equal(i, 1);
+	assert_int_equal(ranges[0].start, 20);
+	assert_int_equal(ranges[0].end, DF_SIZE);
+	check_apply(old, new, DF_SIZE, ranges, i);
+}
+
+static void torture_diff_shrinking(void **state)
+{
+	unsigned char old[DF_SIZE], new[DF_SIZE];
+	struct range ranges[MAX_RANGES];
+
+	/* a removed entry at the end: the rest is zeroed */
+	init(old, new);
+	memset(old + 100, 0, DF_SIZE - 100);
+	memset(new + 60, 0, DF_SIZE - 60);
+	assert_int_equal(diff(old, new, DF_SIZE, ranges), 1);
+	assert_int_equal(ranges[0].start, 60);
+	/* the bytes that are already zero are not written */
+	assert_int_equal(ranges[0].end, 100);
+	check_apply(old, new, DF_SIZE, ranges, 1);
+
+	/* an entry removed from the middle moves the rest to the front */
+	init(old, new);
+	memmove(new + 30, old + 50, DF_SIZE - 50);
+	memset(new + DF_SIZE - 20, 0, 20);
+	assert_int_equal(diff(old, new, DF_SIZE, ranges), 1);
+	assert_int_equal(ranges[0].start, 30);
+	assert_int_equal(ranges[0].end, DF_SIZE);
+	check_apply(old, new, DF_SIZE, ranges, 1);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test(torture_diff_unchanged),
+		cmocka_unit_test(torture_diff_single),
+		cmocka_unit_test(torture_diff_adjacent),
+		cmocka_unit_test(torture_diff_overlapping),
+		cmocka_unit_test(torture_diff_shrinking),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+	return rc;
+}
@@ -0,0 +1,130 @@
+/*
+ * ptrarray.c: Unit tests for the pointer array container
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "common/ptrarray.h"
+
+struct element {
+	unsigned long id;
+};
+
+static int element_seeker(const void *el, const void *key)
+{
+	const struct element *e = el;
+
+	if (el == NULL || key == NULL)
+		return 0;
+	return e->id == *(const unsigned long *)key;
+}
+
+static void torture_ptrarray_empty(void **state)
+{
+	ptrarray_t a;
+	unsigned long id = 1;
+
+	assert_int_equal(ptrarray_init(&a), 0);
+	assert_int_equal(ptrarray_size(&a), 0);
+	assert_null(ptrarray_get_at(&a, 0));
+	assert_null(ptrarray_seek(&a, &id));
+	assert_null(ptrarray_pop(&a));
+	assert_int_equal(ptrarray_delete_at(&a, 0), -1);
+	ptrarray_destroy(&a);
+}
+
+static void torture_ptrarray_append_get(void **state)
+{
+	struct element el[100];
+	ptrarray_t a;
+	unsigned int i;
+
+	assert_int_equal(ptrarray_init(&a), 0);
+	for (i = 0; i < 100; i++) {
+		el[i].id = i;
+		assert_int_equal(ptrarray_append(&a, &el[i]), 1);
+	}
+	assert_int_equal(ptrarray_size(&a), 100);
+	for (i = 0; i < 100; i++) {
+		assert_ptr_equal(ptrarray_get_at(&a, i), &el[i]);
+		assert_int_equal(ptrarray_locate(&a, &el[i]), i);
+	}
+	assert_null(ptrarray_get_at(&a, 100));
+	ptrarray_destroy(&a);
+}
+
+static void torture_ptrarray_seek(void **state)
+{
+	struct element el[10];
+	ptrarray_t a;
+	unsigned long id;
+	unsigned int i;
+
+	assert_int_equal(ptrarray_init(&a), 0);
+	for (i = 0; i < 10; i++) {
+		el[i].id = 100 + i;
+		ptrarray_append(&a, &el[i]);
+	}
+
+	/* no seeker set */
+	id = 105;
+	assert_null(ptrarray_seek(&a, &id));
+
+	ptrarray_attributes_seeker(&a, element_seeker);
+	assert_ptr_equal(ptrarray_seek(&a, &id), &el[5]);
+	id = 5;
+	assert_null(ptrarray_seek(&a, &id));
+	ptrarray_destroy(&a);
+}
+
+static void torture_ptrarray_delete(void **state)
+{
+	struct element el[5];
+	ptrarray_t a;
+	unsigned int i;
+
+	assert_int_equal(ptrarray_init(&a), 0);
+	for (i = 0; i < 5; i++)
+		ptrarray_append(&a, &el[i]);
+
+	/* order of the remaining elements is kept */
+	assert_int_equal(ptrarray_delete(&a, &el[1]), 0);
+	assert_int_equal(ptrarray_size(&a), 4);
+	assert_ptr_equal(ptrarray_get_at(&a, 0), &el[0]);
+	assert_ptr_equal(ptrarray_get_at(&a, 1), &el[2]);
+	assert_ptr_equal(ptrarray_get_at(&a, 3), &el[4]);
+	assert_int_equal(ptrarray_delete(&a, &el[1]), -1);
+
+	assert_int_equal(ptrarray_delete_at(&a, 3), 0);
+	assert_int_equal(ptrarray_delete_at(&a, 3), -1);
+	assert_ptr_equal(ptrarray_pop(&a), &el[3]);
+	assert_int_equal(ptrarray_size(&a), 2);
+	assert_int_equal(ptrarray_locate(&a, &el[3]), -1);
+	ptrarray_destroy(&a);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test(torture_ptrarray_empty),
+		cmocka_unit_test(torture_ptrarray_append_get),
+		cmocka_unit_test(torture_ptrarray_seek),
+		cmocka_unit_test(torture_ptrarray_delete),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+	return rc;
+}
@@ -0,0 +1,251 @@
+/*
+ * shared-state.c: Unit tests for the card state shared between processes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "libopensc/shared-state.c"
+
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+#include <sys/wait.h>
+#endif
+
+static int invalidated;
+
+/* card.c is not linked in, count the calls instead */
+void sc_invalidate_cache(struct sc_card *card)
+{
+	memset(&card->cache, 0, sizeof(card->cache));
+	invalidated++;
+}
+
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+
+static int
+fake_lock(struct sc_reader *reader)
+{
+	return SC_SUCCESS;
+}
+
+static struct sc_reader_operations reader_ops;
+static struct sc_reader reader;
+static struct sc_card card1, card2;
+static char reader_name[64];
+
+static int setup(void **state)
+{
+	struct sc_context *ctx = NULL;
+
+	assert_int_equal(sc_establish_context(&ctx, "shared-state"), 0);
+	ctx->flags |= SC_CTX_FLAG_SHARED_CARD_STATE;
+	snprintf(reader_name, sizeof(reader_name), "shared-state test reader %ld", (long)getpid());
+	reader_ops.lock = fake_lock;
+	reader.ops = &reader_ops;
+	reader.name = reader_name;
+	card1.ctx = card2.ctx = ctx;
+	card1.reader = card2.reader = &reader;
+	*state = ctx;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	sc_card_shared_state_detach(&card1);
+	sc_card_shared_state_detach(&card2);
+	sc_release_context((struct sc_context *) *state);
+	return 0;
+}
+
+static int segment_exists(const char *name)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+
+	if (fd < 0)
+		return 0;
+	close(fd);
+	return 1;
+}
+
+static void torture_shared_state_generation(void **state)
+{
+	char name[64];
+
+	assert_int_equal(sc_card_shared_state_attach(&card1), SC_SUCCESS);
+	assert_int_equal(sc_card_shared_state_attach(&card2), SC_SUCCESS);
+	assert_non_null(card1.shared_state);
+	assert_non_null(card2.shared_state);
+	/* both processes use the same segment name */
+	assert_string_equal(card1.shared_state->name, card2.shared_state->name);
+	strcpy(name, card1.shared_state->name);
+
+	/* a new segment: the card state is unknown */
+	invalidated = 0;
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 0);
+	assert_int_equal(invalidated, 1);
+	/* nothing was sent */
+	sc_card_shared_state_release(&card1);
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 1);
+	sc_card_shared_state_release(&card1);
+
+	/* the other card has not seen this generation yet */
+	assert_int_equal(sc_card_shared_state_acquire(&card2, 0), 0);
+	card2.cache.valid = 1;
+	sc_format_path("3F005015", &card2.cache.current_path);
+	card2.shared_state->changed = 1;
+	sc_card_shared_state_release(&card2);
+	assert_int_equal(sc_card_shared_state_acquire(&card2, 0), 1);
+	sc_card_shared_state_release(&card2);
+
+	/* card1 notices the change and takes over the current path */
+	invalidated = 0;
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 0);
+	assert_int_equal(invalidated, 1);
+	assert_int_equal(card1.cache.current_path.len, 4);
+	sc_card_shared_state_release(&card1);
+	/* a reset is always a change */
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 1), 0);
+	sc_card_shared_state_release(&card1);
+
+	/* the last one removes the segment */
+	sc_card_shared_state_detach(&card1);
+	assert_true(segment_exists(name));
+	sc_card_shared_state_detach(&card2);
+	assert_false(segment_exists(name));
+}
+
+static void torture_shared_state_dead_segment(void **state)
+{
+	struct sc_shared_segment *segment;
+
+	assert_int_equal(sc_card_shared_state_attach(&card1), SC_SUCCESS);
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 0);
+	sc_card_shared_state_release(&card1);
+
+	/* as if the last other process removed it while card1 mapped it */
+	segment = card1.shared_state->segment;
+	segment->dead = 1;
+	shm_unlink(card1.shared_state->name);
+
+	/* a new process changes the card through a new segment */
+	assert_int_equal(sc_card_shared_state_attach(&card2), SC_SUCCESS);
+	assert_int_equal(sc_card_shared_state_acquire(&card2, 0), 0);
+	card2.shared_state->changed = 1;
+	sc_card_shared_state_release(&card2);
+
+	/* card1 must not trust its old segment */
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 0);
+	sc_card_shared_state_release(&card1);
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 1);
+	/* both share the new segment now */
+	card1.shared_state->changed = 1;
+	sc_card_shared_state_release(&card1);
+	assert_int_equal(sc_card_shared_state_acquire(&card2, 0), 0);
+	sc_card_shared_state_release(&card2);
+}
+
+static void torture_shared_state_crashed_process(void **state)
+{
+	struct sc_shared_segment *segment;
+	char name[64];
+	pid_t pid;
+	int i;
+
+	assert_int_equal(sc_card_shared_state_attach(&card1), SC_SUCCESS);
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 0);
+	sc_card_shared_state_release(&card1);
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 1);
+	strcpy(name, card1.shared_state->name);
+	segment = card1.shared_state->segment;
+
+	/* a process that died while it sent APDUs */
+	pid = fork();
+	assert_true(pid >= 0);
+	if (pid == 0)
+		_exit(0);
+	assert_int_equal(waitpid(pid, NULL, 0), pid);
+	for (i = 0; i < SC_SHARED_STATE_USERS; i++)
+		if (segment->users[i] == 0) {
+			segment->users[i] = pid;
+			break;
+		}
+	segment->dirty = 1;
+	sc_card_shared_state_release(&card1);
+
+	invalidated = 0;
+	assert_int_equal(sc_card_shared_state_acquire(&card1, 0), 0);
+	assert_int_equal(invalidated, 1);
+	assert_int_equal(segment->dirty, 0);
+	sc_card_shared_state_release(&card1);
+
+	/* its entry does not keep the segment alive */
+	sc_card_shared_state_detach(&card1);
+	assert_false(segment_exists(name));
+}
+
+static void torture_shared_state_foreign_segment(void **state)
+{
+	char name[64], prefix[32];
+	int fd;
+
+	shared_segment_name(reader.name, name, sizeof(name));
+	/* the user is part of the name */
+	snprintf(prefix, sizeof(prefix), "/opensc-%lu-", (unsigned long)geteuid());
+	assert_int_equal(strncmp(name, prefix, strlen(prefix)), 0);
+
+	/* writable by others: anyone could forge the generation */
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	assert_true(fd >= 0);
+	assert_int_equal(fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH), 0);
+	assert_int_not_equal(sc_card_shared_state_attach(&card1), SC_SUCCESS);
+	assert_null(card1.shared_state);
+
+	/* pre-created by another user */
+	assert_int_equal(fchmod(fd, S_IRUSR | S_IWUSR), 0);
+	if (geteuid() == 0) {
+		assert_int_equal(fchown(fd, 65534, 65534), 0);
+		assert_int_not_equal(sc_card_shared_state_attach(&card1), SC_SUCCESS);
+		assert_null(card1.shared_state);
+	}
+	close(fd);
+	shm_unlink(name);
+
+	/* our own segment is used */
+	assert_int_equal(sc_card_shared_state_attach(&card1), SC_SUCCESS);
+	assert_non_null(card1.shared_state);
+}
+
+int main(void)
+{
+	int rc;
+	struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(torture_shared_state_generation, setup, teardown),
+		cmocka_unit_test_setup_teardown(torture_shared_state_dead_segment, setup, teardown),
+		cmocka_unit_test_setup_teardown(torture_shared_state_crashed_process, setup, teardown),
+		cmocka_unit_test_setup_teardown(torture_shared_state_foreign_segment, setup, teardown),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+	return rc;
+}
+
+#else
+
+int main(void)
+{
+	/* shared memory is not supported on this platform */
+	return 77;
+}
+
+#endif
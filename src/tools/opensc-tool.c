@@ -46,13 +46,15 @@ static int	opt_wait = 0;
 static char **	opt_apdus;
 static char	*opt_reader;
 static int	opt_apdu_count = 0;
+static int	opt_stats = 0;
 static int	verbose = 0;
 
 enum {
 	OPT_SERIAL = 0x100,
 	OPT_LIST_ALG,
 	OPT_VERSION,
-	OPT_RESET
+	OPT_RESET,
+	OPT_STATS
 };
 
 static const struct option options[] = {
@@ -72,6 +74,7 @@ static const struct option options[] = {
 	{ "card-driver",	1, NULL,		'c' },
 	{ "list-algorithms",    0, NULL,	OPT_LIST_ALG },
 	{ "wait",		0, NULL,		'w' },
+	{ "stats",		0, NULL,	OPT_STATS   },
 	{ "verbose",		0, NULL,		'v' },
 	{ NULL, 0, NULL, 0 }
 };
@@ -93,6 +96,7 @@ static const char *option_help[] = {
 	"Forces a card driver (use '?' for list)",
 	"Lists algorithms supported by card",
 	"Wait for a card to be inserted",
+	"Prints APDU statistics of the performed operations",
 	"Verbose operation, may be used several times",
 };
 
@@ -677,6 +681,45 @@ static int card_reset(const char *reset_type)
 	return 0;
 }
 
+static void print_stats(void)
+{
+	sc_apdu_stats_t stats;
+	unsigned int i;
+
+	if (sc_ctx_get_stats(ctx, NULL, &stats) != SC_SUCCESS)
+		return;
+
+	printf("APDU statistics:\n");
+	printf("  APDUs:          %llu (%llu failed)\n", stats.apdus, stats.errors);
+	printf("  Bytes sent:     %llu\n", stats.bytes_sent);
+	printf("  Bytes received: %llu\n", stats.bytes_received);
+	printf("  GET RESPONSE:   %llu\n", stats.get_responses);
+	printf("  SELECT:         %llu\n", stats.selects);
+	printf("  Retries:        %llu\n", stats.retries);
+	printf("  Total time:     %llu us\n", stats.time_us);
+	if (stats.apdus == 0)
+		return;
+
+	printf("  Latency:\n");
+	for (i = 0; i < SC_STATS_LATENCY_BUCKETS; i++) {
+		if (stats.latency[i] == 0)
+			continue;
+		if (i < SC_STATS_LATENCY_BUCKETS - 1)
+			printf("    < %8llu us: %llu\n",
+				(unsigned long long)SC_STATS_LATENCY_BASE_US << i, stats.latency[i]);
+		else
+			printf("    >= %7llu us: %llu\n",
+				(unsigned long long)SC_STATS_LATENCY_BASE_US << (i - 1), stats.latency[i]);
+	}
+	printf("  Instructions:\n");
+	for (i = 0; i < 256; i++) {
+		if (stats.ins[i].count == 0)
+			continue;
+		printf("    INS %02X: %llu APDUs, %llu us avg\n", i, stats.ins[i].count,
+			stats.ins[i].time_us / stats.ins[i].count);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	int err = 0, r, c, long_optind = 0;
@@ -793,6 +836,9 @@ int main(int argc, char *argv[])
 			opt_reset_type = optarg;
 			action_count++;
 			break;
+		case OPT_STATS:
+			opt_stats = 1;
+			break;
 		}
 	}
 	if (action_count == 0)
@@ -921,6 +967,8 @@ int main(int argc, char *argv[])
 		action_count--;
 	}
 end:
+	if (opt_stats && ctx)
+		print_stats();
 	sc_disconnect_card(card);
 	sc_release_context(ctx);
 	return err;
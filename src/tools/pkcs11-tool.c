@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <time.h>
 
 #ifndef _WIN32
 #include <sys/types.h>
@@ -66,6 +67,7 @@
 #include "pkcs11/pkcs11.h"
 #include "pkcs11/pkcs11-opensc.h"
 #include "libopensc/asn1.h"
+#include "libopensc/internal.h"
 #include "libopensc/log.h"
 #include "common/compat_strlcat.h"
 #include "common/compat_strlcpy.h"
@@ -96,6 +98,8 @@ extern CK_FUNCTION_LIST_3_0 pkcs11_function_list_3_0;
 #define MAX_TEST_THREADS 10
 #endif
 
+#define BENCH_MAX_ERRORS 16
+
 #define NEED_SESSION_RO	0x01
 #define NEED_SESSION_RW	0x02
 
@@ -204,7 +208,26 @@ enum {
 	OPT_OBJECT_INDEX,
 	OPT_ALLOW_SW,
 	OPT_LIST_INTERFACES,
-	OPT_IV
+	OPT_IV,
+	OPT_BENCHMARK,
+	OPT_BENCHMARK_ITERATIONS,
+	OPT_BENCHMARK_DURATION,
+	OPT_BENCHMARK_THREADS,
+	OPT_BENCHMARK_SLOTS,
+	OPT_BENCHMARK_JSON
+};
+
+enum {
+	BENCH_SIGN,
+	BENCH_VERIFY,
+	BENCH_DECRYPT,
+	BENCH_DIGEST,
+	BENCH_FIND,
+	BENCH_GETATTR
+};
+
+static const char *bench_op_names[] = {
+	"sign", "verify", "decrypt", "digest", "find", "getattr", NULL
 };
 
 static const struct option options[] = {
@@ -291,6 +314,12 @@ static const struct option options[] = {
 	{ "generate-random",	1, NULL,		OPT_GENERATE_RANDOM },
 	{ "allow-sw",		0, NULL,		OPT_ALLOW_SW },
 	{ "iv",			1, NULL,		OPT_IV },
+	{ "benchmark",		1, NULL,		OPT_BENCHMARK },
+	{ "benchmark-iterations", 1, NULL,		OPT_BENCHMARK_ITERATIONS },
+	{ "benchmark-duration",	1, NULL,		OPT_BENCHMARK_DURATION },
+	{ "benchmark-threads",	1, NULL,		OPT_BENCHMARK_THREADS },
+	{ "benchmark-slots",	1, NULL,		OPT_BENCHMARK_SLOTS },
+	{ "benchmark-json",	0, NULL,		OPT_BENCHMARK_JSON },
 
 	{ NULL, 0, NULL, 0 }
 };
@@ -379,6 +408,12 @@ static const char *option_help[] = {
 	"Generate given amount of random data",
 	"Allow using software mechanisms (without CKF_HW)",
 	"Initialization vector",
+	"Measure the throughput and latency of <arg>: sign, verify, decrypt, digest, find or getattr",
+	"Number of operations per benchmark thread (default 100)",
+	"Run each benchmark thread for <arg> seconds instead of a number of operations",
+	"Number of benchmark threads (default 1, more than one implies --use-locking)",
+	"Number of slots with a token the benchmark threads are spread over (default 1)",
+	"Print the benchmark results as JSON",
 };
 
 static const char *	app_name = "pkcs11-tool"; /* for utils.c */
@@ -438,6 +473,12 @@ static int		opt_salt_len_given = 0; /* 0 - not given, 1 - given with input param
 static int		opt_always_auth = 0;
 static CK_FLAGS		opt_allow_sw = CKF_HW;
 static const char *	opt_iv = NULL;
+static int		opt_benchmark = -1;
+static unsigned long	opt_benchmark_iterations = 0;
+static unsigned long	opt_benchmark_duration = 0;
+static unsigned long	opt_benchmark_threads = 1;
+static unsigned long	opt_benchmark_slots = 1;
+static int		opt_benchmark_json = 0;
 
 static void *module = NULL;
 static CK_FUNCTION_LIST_3_0_PTR p11 = NULL;
@@ -610,6 +651,7 @@ static void *		test_threads_run(void * pttd);
 #endif
 #endif /* defined(_WIN32) || defined(HAVE_PTHREAD) */
 static void		generate_random(CK_SESSION_HANDLE session);
+static int		benchmark(CK_SLOT_ID slot, CK_SESSION_HANDLE session);
 static CK_RV		find_object_with_attributes(CK_SESSION_HANDLE session, CK_OBJECT_HANDLE *out,
 				CK_ATTRIBUTE *attrs, CK_ULONG attrsLen, CK_ULONG obj_index);
 static CK_ULONG		get_private_key_length(CK_SESSION_HANDLE sess, CK_OBJECT_HANDLE prkey);
@@ -745,6 +787,7 @@ int main(int argc, char * argv[])
 	int do_unlock_pin = 0;
 	int action_count = 0;
 	int do_generate_random = 0;
+	int do_benchmark = 0;
 	char *s = NULL;
 	CK_RV rv;
 
@@ -1139,6 +1182,31 @@ int main(int argc, char * argv[])
 		case OPT_IV:
 			opt_iv = optarg;
 			break;
+		case OPT_BENCHMARK:
+			for (opt_benchmark = 0; bench_op_names[opt_benchmark]; opt_benchmark++)
+				if (strcmp(optarg, bench_op_names[opt_benchmark]) == 0)
+					break;
+			if (bench_op_names[opt_benchmark] == NULL)
+				util_fatal("Unknown benchmark operation '%s'", optarg);
+			need_session |= NEED_SESSION_RO;
+			do_benchmark = 1;
+			action_count++;
+			break;
+		case OPT_BENCHMARK_ITERATIONS:
+			opt_benchmark_iterations = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_BENCHMARK_DURATION:
+			opt_benchmark_duration = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_BENCHMARK_THREADS:
+			opt_benchmark_threads = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_BENCHMARK_SLOTS:
+			opt_benchmark_slots = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_BENCHMARK_JSON:
+			opt_benchmark_json = 1;
+			break;
 		default:
 			util_print_usage_and_die(app_name, options, option_help, NULL);
 		}
@@ -1178,6 +1246,9 @@ int main(int argc, char * argv[])
 #if defined(_WIN32) || defined(HAVE_PTHREAD)
 	if (do_test_threads)
 		test_threads();
+	/* the benchmark threads share the module */
+	if (do_benchmark && opt_benchmark_threads > 1)
+		c_initialize_args_ptr = &c_initialize_args_OS;
 #endif
 
 	rv = p11->C_Initialize(c_initialize_args_ptr);
@@ -1269,7 +1340,8 @@ int main(int argc, char * argv[])
 	if (do_list_mechs)
 		list_mechs(opt_slot);
 
-	if (do_sign || do_decrypt || do_encrypt || do_unwrap || do_wrap) {
+	if (do_sign || do_decrypt || do_encrypt || do_unwrap || do_wrap
+			|| (do_benchmark && opt_benchmark != BENCH_DIGEST)) {
 		CK_TOKEN_INFO info;
 
 		get_token_info(opt_slot, &info);
@@ -1498,6 +1570,9 @@ int main(int argc, char * argv[])
 		generate_random(session);
 	}
 
+	if (do_benchmark)
+		err = benchmark(opt_slot, session);
+
 end:
 	if (session != CK_INVALID_HANDLE) {
 		rv = p11->C_CloseSession(session);
@@ -1708,6 +1783,14 @@ static void list_mechs(CK_SLOT_ID slot)
 				printf(", decrypt");
 				info.flags &= ~CKF_DECRYPT;
 			}
+			if (info.flags & CKF_MESSAGE_ENCRYPT) {
+				printf(", message_encrypt");
+				info.flags &= ~CKF_MESSAGE_ENCRYPT;
+			}
+			if (info.flags & CKF_MESSAGE_DECRYPT) {
+				printf(", message_decrypt");
+				info.flags &= ~CKF_MESSAGE_DECRYPT;
+			}
 			if (info.flags & CKF_DIGEST) {
 				printf(", digest");
 				info.flags &= ~CKF_DIGEST;
@@ -8760,3 +8843,477 @@ static void test_threads()
 	}
 }
 #endif /* defined(_WIN32) || defined(HAVE_PTHREAD) */
+
+/*
+ * --benchmark: run one operation in a loop on one or more slots and
+ * threads, and report the throughput, the latency distribution and the
+ * CKR codes of the failed calls.
+ */
+struct bench_slot {
+	CK_SLOT_ID slot;
+	CK_SESSION_HANDLE session;	/* keeps the token logged in */
+	int own_session;
+	CK_MECHANISM_TYPE mech;
+	CK_OBJECT_HANDLE object;
+	CK_BYTE input[1024];
+	CK_ULONG input_len;
+	CK_BYTE data[1024];		/* signature or ciphertext */
+	CK_ULONG data_len;
+	unsigned long ops;
+};
+
+struct bench_error {
+	CK_RV rv;
+	unsigned long count;
+};
+
+struct bench_thread {
+	struct bench_slot *bs;
+	double *latency;		/* microseconds */
+	size_t count, size;
+	unsigned long attempts;
+	struct bench_error errors[BENCH_MAX_ERRORS];
+	unsigned long other_errors;	/* codes that did not fit in errors */
+	CK_RV rv;
+#ifdef _WIN32
+	HANDLE handle;
+#elif defined(HAVE_PTHREAD)
+	pthread_t handle;
+#endif
+};
+
+static unsigned long long bench_deadline = 0;	/* sc_timestamp_us() */
+
+static CK_RV bench_run_op(struct bench_slot *bs, CK_SESSION_HANDLE session)
+{
+	CK_MECHANISM mech = { bs->mech, NULL, 0 };
+	CK_BYTE out[1024];
+	CK_ULONG out_len = sizeof(out);
+	CK_RV rv = CKR_OK;
+
+	switch (opt_benchmark) {
+	case BENCH_SIGN:
+		rv = p11->C_SignInit(session, &mech, bs->object);
+		if (rv == CKR_OK)
+			rv = p11->C_Sign(session, bs->input, bs->input_len, out, &out_len);
+		break;
+	case BENCH_VERIFY:
+		rv = p11->C_VerifyInit(session, &mech, bs->object);
+		if (rv == CKR_OK)
+			rv = p11->C_Verify(session, bs->input, bs->input_len, bs->data, bs->data_len);
+		break;
+	case BENCH_DECRYPT:
+		rv = p11->C_DecryptInit(session, &mech, bs->object);
+		if (rv == CKR_OK)
+			rv = p11->C_Decrypt(session, bs->data, bs->data_len, out, &out_len);
+		break;
+	case BENCH_DIGEST:
+		rv = p11->C_DigestInit(session, &mech);
+		if (rv == CKR_OK)
+			rv = p11->C_Digest(session, bs->input, bs->input_len, out, &out_len);
+		break;
+	case BENCH_FIND: {
+		CK_ATTRIBUTE attr = { CKA_CLASS, &opt_object_class, sizeof(opt_object_class) };
+		CK_OBJECT_HANDLE handles[32];
+		CK_ULONG count;
+		CK_RV rv_final;
+
+		rv = p11->C_FindObjectsInit(session, &attr, opt_object_class_str ? 1 : 0);
+		if (rv != CKR_OK)
+			break;
+		do {
+			rv = p11->C_FindObjects(session, handles, 32, &count);
+		} while (rv == CKR_OK && count > 0);
+		rv_final = p11->C_FindObjectsFinal(session);
+		if (rv == CKR_OK)
+			rv = rv_final;
+		break;
+	}
+	case BENCH_GETATTR: {
+		CK_OBJECT_CLASS cls;
+		CK_BBOOL token, private;
+		CK_ATTRIBUTE attrs[] = {
+			{ CKA_CLASS, &cls, sizeof(cls) },
+			{ CKA_TOKEN, &token, sizeof(token) },
+			{ CKA_PRIVATE, &private, sizeof(private) },
+			{ CKA_LABEL, out, sizeof(out) },
+		};
+
+		rv = p11->C_GetAttributeValue(session, bs->object, attrs, 4);
+		break;
+	}
+	}
+	return rv;
+}
+
+static void bench_count_error(struct bench_thread *bt, CK_RV rv)
+{
+	int i;
+
+	for (i = 0; i < BENCH_MAX_ERRORS; i++) {
+		if (bt->errors[i].count == 0)
+			bt->errors[i].rv = rv;
+		if (bt->errors[i].rv == rv) {
+			bt->errors[i].count++;
+			return;
+		}
+	}
+	bt->other_errors++;
+}
+
+static void bench_worker(struct bench_thread *bt)
+{
+	CK_SESSION_HANDLE session;
+	unsigned long long start, end;
+	CK_RV rv;
+
+	bt->rv = p11->C_OpenSession(bt->bs->slot, CKF_SERIAL_SESSION, NULL, NULL, &session);
+	if (bt->rv != CKR_OK)
+		return;
+
+	while (opt_benchmark_duration ? sc_timestamp_us() < bench_deadline
+			: bt->attempts < opt_benchmark_iterations) {
+		bt->attempts++;
+		start = sc_timestamp_us();
+		rv = bench_run_op(bt->bs, session);
+		end = sc_timestamp_us();
+		if (rv != CKR_OK) {
+			bench_count_error(bt, rv);
+			continue;
+		}
+		if (bt->count == bt->size) {
+			size_t size = bt->size ? bt->size * 2 : 1024;
+			double *latency = realloc(bt->latency, size * sizeof(double));
+
+			if (latency == NULL) {
+				bt->rv = CKR_HOST_MEMORY;
+				break;
+			}
+			bt->latency = latency;
+			bt->size = size;
+		}
+		bt->latency[bt->count++] = (double) (end - start);
+	}
+	p11->C_CloseSession(session);
+}
+
+#if defined(_WIN32) || defined(HAVE_PTHREAD)
+#ifdef _WIN32
+static DWORD WINAPI bench_thread_run(_In_ LPVOID arg)
+#else
+static void *bench_thread_run(void *arg)
+#endif
+{
+	bench_worker((struct bench_thread *) arg);
+#ifdef _WIN32
+	return 0;
+#else
+	return NULL;
+#endif
+}
+#endif /* defined(_WIN32) || defined(HAVE_PTHREAD) */
+
+static void bench_setup_slot(struct bench_slot *bs)
+{
+	CK_OBJECT_HANDLE privkey = CK_INVALID_HANDLE;
+	CK_MECHANISM mech;
+	CK_KEY_TYPE key_type = CKK_RSA;
+	CK_RV rv;
+
+	if (opt_benchmark == BENCH_SIGN || opt_benchmark == BENCH_VERIFY
+			|| opt_benchmark == BENCH_DECRYPT || opt_benchmark == BENCH_GETATTR) {
+		if (!find_object(bs->session, CKO_PRIVATE_KEY, &privkey,
+				opt_object_id_len ? opt_object_id : NULL, opt_object_id_len,
+				opt_object_index))
+			util_fatal("Private key not found in slot 0x%lx", bs->slot);
+		key_type = getKEY_TYPE(bs->session, privkey);
+		bs->object = privkey;
+	}
+
+	if (opt_mechanism_used)
+		bs->mech = opt_mechanism;
+	else if (opt_benchmark == BENCH_DIGEST)
+		bs->mech = CKM_SHA256;
+	else if (opt_benchmark == BENCH_DECRYPT)
+		bs->mech = CKM_RSA_PKCS;
+	else if (key_type == CKK_RSA)
+		bs->mech = CKM_SHA256_RSA_PKCS;
+	else if (key_type == CKK_EC)
+		bs->mech = CKM_ECDSA_SHA256;
+	else if (opt_benchmark != BENCH_FIND && opt_benchmark != BENCH_GETATTR)
+		util_fatal("Specify the mechanism for key type 0x%lx with --mechanism", key_type);
+
+	bs->input_len = opt_benchmark == BENCH_DIGEST ? sizeof(bs->input) : 32;
+	pseudo_randomize(bs->input, bs->input_len);
+
+	if (opt_benchmark == BENCH_VERIFY) {
+		CK_BYTE *id;
+		CK_ULONG id_len = 0;
+
+		mech.mechanism = bs->mech;
+		mech.pParameter = NULL;
+		mech.ulParameterLen = 0;
+		bs->data_len = sizeof(bs->data);
+		rv = p11->C_SignInit(bs->session, &mech, privkey);
+		if (rv == CKR_OK)
+			rv = p11->C_Sign(bs->session, bs->input, bs->input_len, bs->data, &bs->data_len);
+		if (rv != CKR_OK)
+			p11_fatal("C_Sign", rv);
+
+		id = getID(bs->session, privkey, &id_len);
+		if (id == NULL || !find_object(bs->session, CKO_PUBLIC_KEY, &bs->object, id, id_len, 0))
+			util_fatal("Public key not found in slot 0x%lx", bs->slot);
+		free(id);
+	}
+
+	if (opt_benchmark == BENCH_DECRYPT) {
+#ifdef ENABLE_OPENSSL
+		EVP_PKEY *pkey;
+		EVP_PKEY_CTX *ctx = NULL;
+		size_t len = sizeof(bs->data);
+		int pad;
+
+		if (bs->mech == CKM_RSA_PKCS) {
+			pad = RSA_PKCS1_PADDING;
+		} else if (bs->mech == CKM_RSA_X_509) {
+			pad = RSA_NO_PADDING;
+			bs->input_len = (get_private_key_length(bs->session, privkey) + 7) / 8;
+			if (bs->input_len > sizeof(bs->input))
+				util_fatal("Key is too large");
+			pseudo_randomize(bs->input, bs->input_len);
+			bs->input[0] = 0;
+		} else {
+			util_fatal("Only RSA-PKCS and RSA-X-509 decryption can be benchmarked");
+		}
+
+		pkey = get_public_key(bs->session, privkey);
+		if (pkey == NULL)
+			util_fatal("Public key not found in slot 0x%lx", bs->slot);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		ctx = EVP_PKEY_CTX_new_from_pkey(osslctx, pkey, NULL);
+#else
+		ctx = EVP_PKEY_CTX_new(pkey, NULL);
+#endif
+		if (ctx == NULL || EVP_PKEY_encrypt_init(ctx) <= 0
+				|| EVP_PKEY_CTX_set_rsa_padding(ctx, pad) <= 0
+				|| EVP_PKEY_encrypt(ctx, bs->data, &len, bs->input, bs->input_len) <= 0)
+			util_fatal("Failed to encrypt the benchmark input");
+		bs->data_len = len;
+		EVP_PKEY_CTX_free(ctx);
+		EVP_PKEY_free(pkey);
+#else
+		util_fatal("Decryption benchmark requires OpenSSL support");
+#endif
+	}
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* nearest-rank percentile of the sorted latencies, in milliseconds */
+static double bench_percentile(const double *latency, size_t count, int p)
+{
+	size_t rank;
+
+	if (count == 0)
+		return 0;
+	rank = (count * p + 99) / 100;
+	return latency[rank ? rank - 1 : 0] / 1000.0;
+}
+
+static void bench_json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static int benchmark(CK_SLOT_ID slot, CK_SESSION_HANDLE session)
+{
+	struct bench_slot *slots;
+	struct bench_thread *threads;
+	struct bench_error errors[BENCH_MAX_ERRORS];
+	unsigned long nslots = 0, i, j, k, failed = 0, other_errors = 0;
+	unsigned long long start;
+	size_t total = 0;
+	double *latency, elapsed;
+	const char *mech_name = NULL;
+
+	if (opt_benchmark_threads == 0 || opt_benchmark_slots == 0)
+		util_fatal("The number of benchmark threads and slots must be positive");
+#if !defined(_WIN32) && !defined(HAVE_PTHREAD)
+	if (opt_benchmark_threads > 1)
+		util_fatal("Threads are not supported in this build");
+#endif
+	if (!opt_benchmark_duration && !opt_benchmark_iterations)
+		opt_benchmark_iterations = 100;
+	if (sc_timestamp_us() == 0)
+		util_fatal("No monotonic clock to time the benchmark");
+
+	slots = calloc(opt_benchmark_slots, sizeof(struct bench_slot));
+	threads = calloc(opt_benchmark_threads, sizeof(struct bench_thread));
+	if (slots == NULL || threads == NULL)
+		util_fatal("Not enough memory");
+
+	/* the selected slot first, then the other slots with a token */
+	slots[nslots].slot = slot;
+	slots[nslots++].session = session;
+	for (i = 0; i < p11_num_slots && nslots < opt_benchmark_slots; i++) {
+		struct bench_slot *bs = &slots[nslots];
+		CK_SLOT_INFO info;
+		CK_RV rv;
+
+		if (p11_slots[i] == slot
+				|| p11->C_GetSlotInfo(p11_slots[i], &info) != CKR_OK
+				|| !(info.flags & CKF_TOKEN_PRESENT))
+			continue;
+		bs->slot = p11_slots[i];
+		rv = p11->C_OpenSession(bs->slot, CKF_SERIAL_SESSION, NULL, NULL, &bs->session);
+		if (rv != CKR_OK)
+			p11_fatal("C_OpenSession", rv);
+		bs->own_session = 1;
+		if (opt_pin) {
+			rv = p11->C_Login(bs->session, CKU_USER, (CK_UTF8CHAR *) opt_pin, strlen(opt_pin));
+			if (rv != CKR_OK && rv != CKR_USER_ALREADY_LOGGED_IN)
+				p11_fatal("C_Login", rv);
+		}
+		nslots++;
+	}
+	if (nslots < opt_benchmark_slots)
+		fprintf(stderr, "Only %lu slot(s) with a token found\n", nslots);
+
+	for (i = 0; i < nslots; i++)
+		bench_setup_slot(&slots[i]);
+	if (opt_benchmark != BENCH_FIND && opt_benchmark != BENCH_GETATTR)
+		mech_name = p11_mechanism_to_name(slots[0].mech);
+
+	/* threads are spread round-robin over the slots */
+	for (i = 0; i < opt_benchmark_threads; i++)
+		threads[i].bs = &slots[i % nslots];
+
+	start = sc_timestamp_us();
+	bench_deadline = start + opt_benchmark_duration * 1000000ULL;
+	if (opt_benchmark_threads == 1) {
+		bench_worker(&threads[0]);
+	}
+#if defined(_WIN32) || defined(HAVE_PTHREAD)
+	else {
+		for (i = 0; i < opt_benchmark_threads; i++) {
+#ifdef _WIN32
+			threads[i].handle = CreateThread(NULL, 0, bench_thread_run, &threads[i], 0, NULL);
+			if (threads[i].handle == NULL)
+				util_fatal("Failed to start benchmark thread %lu", i);
+#else
+			if (pthread_create(&threads[i].handle, NULL, bench_thread_run, &threads[i]) != 0)
+				util_fatal("Failed to start benchmark thread %lu", i);
+#endif
+		}
+		for (i = 0; i < opt_benchmark_threads; i++) {
+#ifdef _WIN32
+			WaitForSingleObject(threads[i].handle, INFINITE);
+			CloseHandle(threads[i].handle);
+#else
+			pthread_join(threads[i].handle, NULL);
+#endif
+		}
+	}
+#endif
+	elapsed = (sc_timestamp_us() - start) / 1000000.0;
+
+	/* merge the per thread results */
+	memset(errors, 0, sizeof(errors));
+	for (i = 0; i < opt_benchmark_threads; i++) {
+		if (threads[i].rv != CKR_OK)
+			fprintf(stderr, "Benchmark thread %lu failed: %s\n", i, CKR2Str(threads[i].rv));
+		threads[i].bs->ops += threads[i].count;
+		total += threads[i].count;
+		for (j = 0; j < BENCH_MAX_ERRORS && threads[i].errors[j].count; j++) {
+			failed += threads[i].errors[j].count;
+			for (k = 0; k < BENCH_MAX_ERRORS; k++)
+				if (errors[k].count == 0 || errors[k].rv == threads[i].errors[j].rv)
+					break;
+			if (k == BENCH_MAX_ERRORS) {
+				other_errors += threads[i].errors[j].count;
+				continue;
+			}
+			errors[k].rv = threads[i].errors[j].rv;
+			errors[k].count += threads[i].errors[j].count;
+		}
+		failed += threads[i].other_errors;
+		other_errors += threads[i].other_errors;
+	}
+	latency = malloc((total ? total : 1) * sizeof(double));
+	if (latency == NULL)
+		util_fatal("Not enough memory");
+	for (i = 0, total = 0; i < opt_benchmark_threads; i++) {
+		if (threads[i].count)
+			memcpy(latency + total, threads[i].latency, threads[i].count * sizeof(double));
+		total += threads[i].count;
+		free(threads[i].latency);
+	}
+	qsort(latency, total, sizeof(double), bench_compare);
+
+	if (opt_benchmark_json) {
+		printf("{\n  \"module\": ");
+		bench_json_string(opt_module);
+		printf(",\n  \"operation\": \"%s\",\n  \"mechanism\": ", bench_op_names[opt_benchmark]);
+		if (mech_name)
+			bench_json_string(mech_name);
+		else
+			printf("null");
+		printf(",\n  \"threads\": %lu,\n  \"slots\": %lu,\n", opt_benchmark_threads, nslots);
+		printf("  \"elapsed_s\": %.3f,\n  \"ops\": %lu,\n  \"errors\": %lu,\n  \"ops_per_sec\": %.1f,\n",
+				elapsed, (unsigned long) total, failed, elapsed > 0 ? total / elapsed : 0);
+		printf("  \"latency_ms\": { \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+				bench_percentile(latency, total, 50), bench_percentile(latency, total, 95),
+				bench_percentile(latency, total, 99), bench_percentile(latency, total, 100));
+		printf("  \"ckr_errors\": {");
+		for (k = 0; k < BENCH_MAX_ERRORS && errors[k].count; k++)
+			printf("%s \"%s\": %lu", k ? "," : "", CKR2Str(errors[k].rv), errors[k].count);
+		if (other_errors)
+			printf("%s \"other\": %lu", k ? "," : "", other_errors);
+		printf(" },\n  \"per_slot\": [");
+		for (i = 0; i < nslots; i++)
+			printf("%s\n    { \"slot\": %lu, \"ops\": %lu, \"ops_per_sec\": %.1f }", i ? "," : "",
+					slots[i].slot, slots[i].ops, elapsed > 0 ? slots[i].ops / elapsed : 0);
+		printf("\n  ]\n}\n");
+	} else {
+		printf("Benchmark %s", bench_op_names[opt_benchmark]);
+		if (mech_name)
+			printf(" (%s)", mech_name);
+		printf(", %lu thread(s), %lu slot(s)\n", opt_benchmark_threads, nslots);
+		printf("  operations:   %lu in %.3f s, %.1f ops/s\n",
+				(unsigned long) total, elapsed, elapsed > 0 ? total / elapsed : 0);
+		printf("  latency (ms): p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+				bench_percentile(latency, total, 50), bench_percentile(latency, total, 95),
+				bench_percentile(latency, total, 99), bench_percentile(latency, total, 100));
+		for (i = 0; i < nslots; i++)
+			printf("  slot 0x%lx:    %lu operations, %.1f ops/s\n",
+					slots[i].slot, slots[i].ops, elapsed > 0 ? slots[i].ops / elapsed : 0);
+		if (failed)
+			printf("  errors:       %lu\n", failed);
+		for (k = 0; k < BENCH_MAX_ERRORS && errors[k].count; k++)
+			printf("    %s: %lu\n", CKR2Str(errors[k].rv), errors[k].count);
+		if (other_errors)
+			printf("    other: %lu\n", other_errors);
+	}
+
+	for (i = 0; i < nslots; i++)
+		if (slots[i].own_session)
+			p11->C_CloseSession(slots[i].session);
+	free(latency);
+	free(threads);
+	free(slots);
+	return failed || total == 0;
+}
@@ -38,6 +38,13 @@
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 #include <openssl/opensslv.h>
 #include "libopensc/sc-ossl-compat.h"
 #include <openssl/conf.h>
@@ -118,6 +125,7 @@ static int	do_read_public_key(const char *, const char *, EVP_PKEY **);
 static int	do_read_certificate(const char *, const char *, X509 **);
 static char *	cert_common_name(X509 *x509);
 static void	parse_commandline(int argc, char **argv);
+static int	run_batch(const char *app);
 static void	ossl_print_errors(void);
 static int	verify_pin(struct sc_pkcs15_card *, char *);
 
@@ -147,6 +155,7 @@ enum {
 	OPT_MD_CONTAINER_GUID,
 	OPT_VERSION,
 	OPT_USER_CONSENT,
+	OPT_BATCH,
 
 	OPT_PIN1      = 0x10000,	/* don't touch these values */
 	OPT_PUK1      = 0x10001,
@@ -216,6 +225,7 @@ const struct option	options[] = {
 	{ "card-profile",	required_argument, NULL,	'c' },
 	{ "md-container-guid",	required_argument, NULL,	OPT_MD_CONTAINER_GUID},
 	{ "wait",		no_argument, NULL,		'w' },
+	{ "batch",		required_argument, NULL,	OPT_BATCH },
 	{ "help",		no_argument, NULL,		'h' },
 	{ "verbose",		no_argument, NULL,		'v' },
 
@@ -281,6 +291,7 @@ static const char *		option_help[] = {
 	"Specify the card profile to use",
 	"For a new key specify GUID for a MD container",
 	"Wait for card insertion",
+	"Initialize the tokens listed in file <arg>, on all their readers at once",
 	"Display this message",
 	"Verbose operation, may be used several times",
 
@@ -385,6 +396,7 @@ static char *			opt_application_name = NULL;
 static char *			opt_bind_to_aid = NULL;
 static char *			opt_puk_authid = NULL;
 static char *			opt_md_container_guid = NULL;
+static char *			opt_batch = NULL;
 static unsigned int		opt_x509_usage = 0;
 static unsigned int		opt_delete_flags = 0;
 static unsigned int		opt_type = 0;
@@ -451,6 +463,7 @@ main(int argc, char **argv)
 	struct sc_profile	*profile = NULL;
 	unsigned int		n;
 	int					r = 0;
+	int			batch = 0;
 	struct sc_pkcs15_card *tmp_p15_data = NULL;
 
 #ifdef RANDOM_POOL
@@ -462,6 +475,13 @@ main(int argc, char **argv)
 
 	if (optind != argc)
 		util_print_usage_and_die(app_name, options, option_help, NULL);
+	if (opt_batch) {
+		/* returns -1 in the process of one token, with its options set */
+		r = run_batch(argv[0]);
+		if (r >= 0)
+			return r;
+		r = 0;
+	}
 	if (opt_actions == 0) {
 		fprintf(stderr, "No action specified.\n");
 		util_print_usage_and_die(app_name, options, option_help, NULL);
@@ -542,6 +562,26 @@ main(int argc, char **argv)
 			}
 		}
 
+		/* The object actions only change the DFs in memory,
+		 * each changed DF is written once when they are done.
+		 * A PIN or a generated key cannot be taken back, so they
+		 * are only created after the pending DFs are written, and
+		 * their own DF updates are written at once. */
+		if (action >= ACTION_DELETE_OBJECTS && action <= ACTION_STORE_DATA
+				&& action != ACTION_STORE_PIN && action != ACTION_GENERATE_KEY) {
+			if (!batch && g_p15card != NULL)
+				batch = sc_pkcs15init_begin_batch(profile) == SC_SUCCESS;
+		}
+		else if (batch) {
+			batch = 0;
+			r = sc_pkcs15init_commit_batch(g_p15card, profile);
+			if (r < 0) {
+				fprintf(stderr, "Failed to update PKCS#15 directory files: %s\n",
+					sc_strerror(r));
+				break;
+			}
+		}
+
 		if (verbose && action != ACTION_ASSERT_PRISTINE)
 			printf("About to %s.\n", action_names[action]);
 
@@ -615,6 +655,17 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (batch) {
+		int rc = sc_pkcs15init_commit_batch(g_p15card, profile);
+
+		if (rc < 0) {
+			fprintf(stderr, "Failed to update PKCS#15 directory files: %s\n",
+				sc_strerror(rc));
+			if (r >= 0)
+				r = rc;
+		}
+	}
+
 	for (n = 0; n < sizeof(pins)/sizeof(pins[0]); n++) {
 		free(pins[n]);
 	}
@@ -2876,6 +2927,9 @@ handle_option(const struct option *opt)
 		if (optarg != NULL)
 			opt_user_consent = atoi(optarg);
 		break;
+	case OPT_BATCH:
+		opt_batch = optarg;
+		break;
 	default:
 		util_print_usage_and_die(app_name, options, option_help, NULL);
 	}
@@ -2906,6 +2960,267 @@ handle_option(const struct option *opt)
 	}
 }
 
+/*
+ * Batch mode: initialize many tokens at the same time.
+ *
+ * Every line of the manifest names a reader (as for --reader) followed by
+ * the options for the token in that reader, for example
+ *
+ *   0   -C --label "Token 1" --pin 1234 --puk 12345678 --so-pin 87654321
+ *
+ * Options given on the command line besides --batch apply to all lines.
+ * Every line is run by a forked process, which parses the options of its
+ * line on top of those and then carries on like a normal run. Slow
+ * operations like on-card key generation thus overlap across readers, and
+ * the PINs of the manifest never appear on a command line. The output of
+ * the processes is shown prefixed with the reader, followed by a summary.
+ */
+#define MAX_BATCH_TOKENS	64
+#define MAX_BATCH_ARGS		64
+
+#ifndef _WIN32
+struct batch_token {
+	int		line;
+	int		argc;
+	char *		argv[MAX_BATCH_ARGS];
+	pid_t		pid;
+	int		fd;
+	int		status;
+	char		out[512];
+	size_t		out_len;
+};
+
+/* Split a manifest line into words; double quotes group words */
+static int
+batch_split_line(char *line, char **args, int max)
+{
+	char *p = line, *q;
+	int n = 0;
+
+	while (1) {
+		while (isspace((unsigned char) *p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			break;
+		if (n == max)
+			return -1;
+		args[n++] = q = p;
+		while (*p && !isspace((unsigned char) *p)) {
+			if (*p != '"') {
+				*q++ = *p++;
+				continue;
+			}
+			for (p++; *p && *p != '"'; )
+				*q++ = *p++;
+			if (*p++ != '"')
+				return -1;
+		}
+		if (*p)
+			p++;
+		*q = '\0';
+	}
+	return n;
+}
+
+static void
+batch_flush_output(struct batch_token *tok)
+{
+	if (tok->out_len)
+		printf("[%s] %.*s\n", tok->argv[0], (int) tok->out_len, tok->out);
+	tok->out_len = 0;
+}
+
+static void
+batch_add_output(struct batch_token *tok, const char *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (data[i] == '\n') {
+			batch_flush_output(tok);
+			continue;
+		}
+		if (tok->out_len == sizeof(tok->out))
+			batch_flush_output(tok);
+		tok->out[tok->out_len++] = data[i];
+	}
+	fflush(stdout);
+}
+
+/* Fork the process for one token. Returns 0 in the child, which has the
+ * options of the token set, 1 in the parent and -1 on error. */
+static int
+batch_start(struct batch_token *tok, const char *app)
+{
+	char *token_argv[MAX_BATCH_ARGS + 3];
+	int fds[2], n = 0, i;
+
+	if (pipe(fds) != 0)
+		return -1;
+	fflush(stdout);
+	fflush(stderr);
+	tok->pid = fork();
+	if (tok->pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (tok->pid == 0) {
+		/* PINs must come from the manifest, there is nobody to ask */
+		int null_fd = open("/dev/null", O_RDONLY);
+
+		if (null_fd >= 0) {
+			dup2(null_fd, STDIN_FILENO);
+			close(null_fd);
+		}
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		setvbuf(stdout, NULL, _IOLBF, 0);
+
+		token_argv[n++] = (char *) app;
+		token_argv[n++] = "--reader";
+		for (i = 0; i < tok->argc; i++)
+			token_argv[n++] = tok->argv[i];
+		token_argv[n] = NULL;
+		opt_batch = NULL;
+		optind = 0;
+		parse_commandline(n, token_argv);
+		if (optind != n)
+			util_print_usage_and_die(app_name, options, option_help, NULL);
+		return 0;
+	}
+	close(fds[1]);
+	tok->fd = fds[0];
+	printf("[%s] started (manifest line %d)\n", tok->argv[0], tok->line);
+	return 1;
+}
+
+static int
+run_batch(const char *app)
+{
+	struct batch_token *tokens;
+	char line[4096], *args[MAX_BATCH_ARGS];
+	int count = 0, running = 0, failed = 0, line_no = 0, n, i;
+	FILE *fp;
+
+	if (opt_reader)
+		util_fatal("--reader cannot be used with --batch, the manifest names the readers");
+
+	tokens = calloc(MAX_BATCH_TOKENS, sizeof(struct batch_token));
+	if (tokens == NULL)
+		util_fatal("Out of memory");
+	fp = fopen(opt_batch, "r");
+	if (fp == NULL)
+		util_fatal("Cannot open manifest %s: %s", opt_batch, strerror(errno));
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line_no++;
+		if (strchr(line, '\n') == NULL && !feof(fp))
+			util_fatal("%s:%d: line too long", opt_batch, line_no);
+		n = batch_split_line(line, args, MAX_BATCH_ARGS);
+		if (n < 0)
+			util_fatal("%s:%d: too many arguments or unbalanced quotes", opt_batch, line_no);
+		if (n == 0)
+			continue;
+		if (count == MAX_BATCH_TOKENS)
+			util_fatal("%s: more than %d tokens", opt_batch, MAX_BATCH_TOKENS);
+		tokens[count].line = line_no;
+		tokens[count].argc = n;
+		tokens[count].fd = -1;
+		for (i = 0; i < n; i++)
+			if ((tokens[count].argv[i] = strdup(args[i])) == NULL)
+				util_fatal("Out of memory");
+		count++;
+	}
+	fclose(fp);
+
+	for (i = 0; i < count; i++) {
+		int r = batch_start(&tokens[i], app);
+
+		if (r == 0) {
+			/* the process of this token */
+			for (n = 0; n < i; n++)
+				if (tokens[n].fd >= 0)
+					close(tokens[n].fd);
+			return -1;
+		}
+		if (r < 0) {
+			printf("[%s] cannot start: %s\n", tokens[i].argv[0], strerror(errno));
+			tokens[i].status = -1;
+			continue;
+		}
+		running++;
+	}
+
+	while (running > 0) {
+		fd_set set;
+		int max_fd = -1;
+
+		FD_ZERO(&set);
+		for (i = 0; i < count; i++) {
+			if (tokens[i].fd < 0)
+				continue;
+			FD_SET(tokens[i].fd, &set);
+			if (tokens[i].fd > max_fd)
+				max_fd = tokens[i].fd;
+		}
+		if (select(max_fd + 1, &set, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			util_fatal("select() failed: %s", strerror(errno));
+		}
+		for (i = 0; i < count; i++) {
+			struct batch_token *tok = &tokens[i];
+			char buf[1024];
+			ssize_t len;
+
+			if (tok->fd < 0 || !FD_ISSET(tok->fd, &set))
+				continue;
+			len = read(tok->fd, buf, sizeof(buf));
+			if (len > 0) {
+				batch_add_output(tok, buf, len);
+				continue;
+			}
+			if (len < 0 && errno == EINTR)
+				continue;
+
+			batch_flush_output(tok);
+			close(tok->fd);
+			tok->fd = -1;
+			running--;
+			if (waitpid(tok->pid, &tok->status, 0) < 0)
+				tok->status = -1;
+			if (tok->status == 0)
+				printf("[%s] done\n", tok->argv[0]);
+			else
+				printf("[%s] FAILED\n", tok->argv[0]);
+			fflush(stdout);
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		if (tokens[i].status != 0)
+			failed++;
+	printf("\n%d of %d tokens initialized\n", count - failed, count);
+	for (i = 0; i < count; i++)
+		if (tokens[i].status != 0)
+			printf("  failed: %s (%s line %d)\n", tokens[i].argv[0], opt_batch, tokens[i].line);
+	for (i = 0; i < count; i++)
+		for (n = 0; n < tokens[i].argc; n++)
+			free(tokens[i].argv[n]);
+	free(tokens);
+	return failed ? 1 : 0;
+}
+#else
+static int
+run_batch(const char *app)
+{
+	util_fatal("--batch is not supported on this platform");
+	return 1;
+}
+#endif
+
 /*
  * Parse the command line.
  */